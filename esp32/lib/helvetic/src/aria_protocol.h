@@ -0,0 +1,302 @@
+#pragma once
+
+// Zero-copy codec for the Aria version 3 upload request (see protocol.md).
+// Works on a borrowed byte span, never allocates and has no Arduino
+// dependency so it builds for the ESP32 and for native Linux targets.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crc16.h"
+
+namespace aria
+{
+
+// aria_upload_request_body3 layout
+constexpr uint32_t PROTOCOL_VERSION = 3;
+constexpr size_t REQUEST_HEADER_SIZE = 30;     // protocol, battery, MAC, auth code
+constexpr size_t MEASUREMENT_HEADER_SIZE = 16; // firmware, unknown2, timestamp, count
+constexpr size_t REQUEST_PREAMBLE_SIZE = REQUEST_HEADER_SIZE + MEASUREMENT_HEADER_SIZE;
+constexpr size_t MEASUREMENT_SIZE = 32;
+constexpr size_t CRC_SIZE = 2;
+constexpr size_t MAC_SIZE = 6;
+constexpr size_t AUTH_CODE_SIZE = 16;
+
+// Newest measurement plus up to 16 cached ones
+constexpr uint32_t MAX_MEASUREMENTS = 17;
+constexpr size_t MAX_REQUEST_SIZE = REQUEST_PREAMBLE_SIZE + MAX_MEASUREMENTS * MEASUREMENT_SIZE + CRC_SIZE;
+
+// aria_upload_response_envelope3 layout, without a firmware update message
+constexpr size_t RESPONSE_HEADER_SIZE = 11;  // timestamp, units, status, unknown, user count
+constexpr size_t USER_RECORD_SIZE = 77;      // aria_user up to and including its timestamp
+constexpr size_t RESPONSE_TRAILER_SIZE = 12; // user unknown1, update_available, unknown3
+constexpr size_t RESPONSE_FOOTER_SIZE = 4;   // CRC and message size after the body
+
+constexpr size_t responseBodySize(uint32_t users)
+{
+    return RESPONSE_HEADER_SIZE + users * USER_RECORD_SIZE + RESPONSE_TRAILER_SIZE;
+}
+
+// The uint16 after the CRC, 0x19 + n * 0x4d: body plus CRC length
+constexpr uint16_t responseMessageSize(uint32_t users)
+{
+    return static_cast<uint16_t>(responseBodySize(users) + CRC_SIZE);
+}
+
+constexpr size_t responseSize(uint32_t users)
+{
+    return responseBodySize(users) + RESPONSE_FOOTER_SIZE;
+}
+
+template <typename T>
+inline T readLE(const uint8_t *src)
+{
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+        value |= static_cast<T>(src[i]) << (i * 8);
+    }
+    return value;
+}
+
+template <typename T>
+inline void writeLE(uint8_t *dest, T value)
+{
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+        dest[i] = (value >> (i * 8)) & 0xFF;
+    }
+}
+
+struct Measurement
+{
+    uint32_t id2;
+    uint32_t impedance;
+    uint32_t weight_g;
+    uint32_t timestamp;
+    uint32_t user_id; // 0 for guests
+    uint32_t fat1;    // 0.001%
+    uint32_t covariance;
+    uint32_t fat2;
+
+    static Measurement decode(const uint8_t *src)
+    {
+        return Measurement{
+            readLE<uint32_t>(src),
+            readLE<uint32_t>(src + 4),
+            readLE<uint32_t>(src + 8),
+            readLE<uint32_t>(src + 12),
+            readLE<uint32_t>(src + 16),
+            readLE<uint32_t>(src + 20),
+            readLE<uint32_t>(src + 24),
+            readLE<uint32_t>(src + 28)};
+    }
+};
+
+struct UploadHeader
+{
+    uint32_t protocolVersion;
+    uint32_t batteryPercent;
+    const uint8_t *mac;      // MAC_SIZE bytes, points into the request
+    const uint8_t *authCode; // AUTH_CODE_SIZE bytes, points into the request
+    uint32_t firmwareVersion;
+    uint32_t unknown2;
+    uint32_t timestamp; // scale clock at upload time
+    uint32_t measurementCount;
+
+    static UploadHeader decode(const uint8_t *src)
+    {
+        return UploadHeader{
+            readLE<uint32_t>(src),
+            readLE<uint32_t>(src + 4),
+            src + 8,
+            src + 14,
+            readLE<uint32_t>(src + 30),
+            readLE<uint32_t>(src + 34),
+            readLE<uint32_t>(src + 38),
+            readLE<uint32_t>(src + 42)};
+    }
+};
+
+enum class ParseStatus : uint8_t
+{
+    Ok,
+    Truncated,           // fewer bytes than the header says
+    BadProtocol,         // protocol_version != 3
+    TooManyMeasurements, // more than MAX_MEASUREMENTS
+    BadCrc               // envelope CRC does not match the body
+};
+
+inline const char *parseStatusName(ParseStatus status)
+{
+    switch (status)
+    {
+    case ParseStatus::Ok:
+        return "ok";
+    case ParseStatus::Truncated:
+        return "truncated";
+    case ParseStatus::BadProtocol:
+        return "bad protocol";
+    case ParseStatus::TooManyMeasurements:
+        return "too many measurements";
+    case ParseStatus::BadCrc:
+        return "bad crc";
+    }
+    return "unknown";
+}
+
+// Decodes records on dereference, so walking the list costs nothing
+// for measurements the caller skips.
+class MeasurementIterator
+{
+public:
+    explicit MeasurementIterator(const uint8_t *pos) : mPos(pos) {}
+    Measurement operator*() const { return Measurement::decode(mPos); }
+    const uint8_t *raw() const { return mPos; }
+    MeasurementIterator &operator++()
+    {
+        mPos += MEASUREMENT_SIZE;
+        return *this;
+    }
+    bool operator!=(const MeasurementIterator &other) const { return mPos != other.mPos; }
+    bool operator==(const MeasurementIterator &other) const { return mPos == other.mPos; }
+
+private:
+    const uint8_t *mPos;
+};
+
+class MeasurementRange
+{
+public:
+    MeasurementRange(const uint8_t *first, size_t count) : mFirst(first), mCount(count) {}
+    MeasurementIterator begin() const { return MeasurementIterator(mFirst); }
+    MeasurementIterator end() const { return MeasurementIterator(mFirst + mCount * MEASUREMENT_SIZE); }
+    size_t size() const { return mCount; }
+    bool empty() const { return mCount == 0; }
+    Measurement operator[](size_t index) const { return Measurement::decode(mFirst + index * MEASUREMENT_SIZE); }
+
+private:
+    const uint8_t *mFirst;
+    size_t mCount;
+};
+
+// View over an aria_upload_request_envelope3. The buffer must outlive the view.
+class UploadRequest
+{
+public:
+    ParseStatus parse(const uint8_t *data, size_t length)
+    {
+        mData = data;
+        mBodyLength = 0;
+        mCrc = 0;
+
+        if (length < REQUEST_PREAMBLE_SIZE)
+        {
+            return ParseStatus::Truncated;
+        }
+        mHeader = UploadHeader::decode(data);
+        if (mHeader.protocolVersion != PROTOCOL_VERSION)
+        {
+            return ParseStatus::BadProtocol;
+        }
+        // Checked before the multiplication below so a hostile count cannot wrap it
+        if (mHeader.measurementCount > MAX_MEASUREMENTS)
+        {
+            return ParseStatus::TooManyMeasurements;
+        }
+
+        size_t bodyLength = REQUEST_PREAMBLE_SIZE + mHeader.measurementCount * MEASUREMENT_SIZE;
+        if (length < bodyLength + CRC_SIZE)
+        {
+            return ParseStatus::Truncated;
+        }
+        mCrc = readLE<uint16_t>(data + bodyLength);
+        if (Crc16Xmodem::compute(data, bodyLength) != mCrc)
+        {
+            return ParseStatus::BadCrc;
+        }
+        // Only a checked envelope exposes its measurements
+        mBodyLength = bodyLength;
+        return ParseStatus::Ok;
+    }
+
+    const UploadHeader &header() const { return mHeader; }
+    MeasurementRange measurements() const
+    {
+        return MeasurementRange(mData + REQUEST_PREAMBLE_SIZE, mBodyLength ? mHeader.measurementCount : 0);
+    }
+    const uint8_t *body() const { return mData; }
+    size_t bodyLength() const { return mBodyLength; }
+    uint16_t crc() const { return mCrc; }
+
+private:
+    const uint8_t *mData = nullptr;
+    size_t mBodyLength = 0;
+    uint16_t mCrc = 0;
+    UploadHeader mHeader = {};
+};
+
+// Collects an upload that arrives in arbitrary chunks into a caller-owned
+// buffer and exposes each measurement as soon as its 32 bytes are in.
+// The envelope CRC can only be checked by finish(), once everything arrived.
+class UploadStreamParser
+{
+public:
+    UploadStreamParser(uint8_t *buffer, size_t capacity) : mBuffer(buffer), mCapacity(capacity) {}
+
+    void reset()
+    {
+        mLength = 0;
+        mOverflow = false;
+    }
+
+    void feed(const uint8_t *data, size_t length)
+    {
+        size_t room = mCapacity - mLength;
+        if (length > room)
+        {
+            // Bytes past the largest valid envelope are never needed
+            mOverflow = true;
+            length = room;
+        }
+        for (size_t i = 0; i < length; i++)
+        {
+            mBuffer[mLength + i] = data[i];
+        }
+        mLength += length;
+    }
+
+    bool headerComplete() const { return mLength >= REQUEST_PREAMBLE_SIZE; }
+    UploadHeader header() const { return UploadHeader::decode(mBuffer); }
+
+    // Number of measurement records received in full so far
+    size_t completeMeasurements() const
+    {
+        if (!headerComplete())
+        {
+            return 0;
+        }
+        size_t count = (mLength - REQUEST_PREAMBLE_SIZE) / MEASUREMENT_SIZE;
+        uint32_t declared = header().measurementCount;
+        return count < declared ? count : declared;
+    }
+
+    Measurement measurement(size_t index) const
+    {
+        return Measurement::decode(mBuffer + REQUEST_PREAMBLE_SIZE + index * MEASUREMENT_SIZE);
+    }
+
+    ParseStatus finish(UploadRequest &request) const { return request.parse(mBuffer, mLength); }
+
+    const uint8_t *data() const { return mBuffer; }
+    size_t size() const { return mLength; }
+    bool overflowed() const { return mOverflow; }
+
+private:
+    uint8_t *mBuffer;
+    size_t mCapacity;
+    size_t mLength = 0;
+    bool mOverflow = false;
+};
+
+} // namespace aria
@@ -0,0 +1,398 @@
+#pragma once
+
+// Upload response envelope for a household of users (see protocol.md).
+//
+// The user table is configured once at boot and compiled into an arena
+// holding the complete response body: header, one aria_user record per
+// user at a fixed offset and the trailer. Answering an upload copies the
+// arena and patches the few fields that change between requests (clock,
+// weight tolerance windows, ages, timestamps) before the CRC is taken, so
+// the cost per request does not depend on how the users were configured.
+//
+// ResponseCache goes one step further and keeps the last response sent to
+// each scale. While nothing in the table changed, only the clock and the
+// user timestamps are rewritten and the CRC is corrected from those bytes
+// alone, without reading the rest of the body.
+//
+// A response may offer a firmware update: update_available is then 1 and
+// the image URL, NUL terminated, follows it (update_msg in protocol.md).
+// Such responses are rare and always built in full.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aria_protocol.h"
+#include "civil_time.h"
+
+namespace aria
+{
+
+constexpr size_t MAX_USERS = 8;
+constexpr size_t USER_NAME_SIZE = 20;
+constexpr uint32_t DEFAULT_TOLERANCE_G = 4000;
+
+constexpr size_t MAX_UPDATE_URL_SIZE = 96; // with the NUL
+constexpr size_t MAX_RESPONSE_SIZE = responseSize(MAX_USERS) + MAX_UPDATE_URL_SIZE;
+
+// update_available_type
+constexpr uint32_t UPDATE_AVAILABLE = 0x01;
+constexpr uint32_t UPDATE_NONE = 0x03;
+
+enum Gender : uint8_t
+{
+    GENDER_FEMALE = 0x00,
+    GENDER_MALE = 0x02,
+    GENDER_UNKNOWN = 0x34
+};
+
+struct UserProfile
+{
+    uint32_t id;
+    char name[USER_NAME_SIZE + 1];
+    uint16_t birthYear; // 0 when only `age` is known
+    uint8_t birthMonth;
+    uint8_t birthDay;
+    uint32_t age; // years, used when there is no birth date
+    uint32_t heightMm;
+    uint8_t gender;
+    uint32_t toleranceG; // the scale matches this user within last weight +/- tolerance
+};
+
+// Parses "id,name,birthdate,height_mm,gender[,tolerance_g]". The birth date
+// is YYYY-MM-DD or a plain age in years, gender m, f or anything else for
+// unknown.
+inline bool parseUserProfile(const char *text, UserProfile &profile)
+{
+    profile = UserProfile{};
+    profile.toleranceG = DEFAULT_TOLERANCE_G;
+
+    char *end;
+    profile.id = strtoul(text, &end, 0);
+    if (end == text || *end != ',' || profile.id == 0)
+    {
+        return false; // user id 0 means guest to the scale
+    }
+
+    const char *name = end + 1;
+    const char *comma = strchr(name, ',');
+    if (!comma)
+    {
+        return false;
+    }
+    size_t nameLength = static_cast<size_t>(comma - name);
+    if (nameLength > USER_NAME_SIZE)
+    {
+        nameLength = USER_NAME_SIZE;
+    }
+    memcpy(profile.name, name, nameLength);
+
+    const char *date = comma + 1;
+    uint32_t first = strtoul(date, &end, 10);
+    if (end == date)
+    {
+        return false;
+    }
+    if (*end == '-')
+    {
+        profile.birthYear = first;
+        profile.birthMonth = strtoul(end + 1, &end, 10);
+        if (*end != '-')
+        {
+            return false;
+        }
+        profile.birthDay = strtoul(end + 1, &end, 10);
+        if (profile.birthMonth < 1 || profile.birthMonth > 12 || profile.birthDay < 1 || profile.birthDay > 31)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        profile.age = first;
+    }
+    if (*end != ',')
+    {
+        return false;
+    }
+
+    const char *height = end + 1;
+    profile.heightMm = strtoul(height, &end, 10);
+    if (end == height || *end != ',')
+    {
+        return false;
+    }
+
+    char gender = end[1];
+    profile.gender = (gender == 'f' || gender == 'F')   ? GENDER_FEMALE
+                     : (gender == 'm' || gender == 'M') ? GENDER_MALE
+                                                        : GENDER_UNKNOWN;
+    const char *tolerance = strchr(end + 1, ',');
+    if (tolerance)
+    {
+        profile.toleranceG = strtoul(tolerance + 1, nullptr, 10);
+    }
+    return true;
+}
+
+class UserTable
+{
+public:
+    // Configuration, before compile()
+    bool add(const UserProfile &profile)
+    {
+        if (mCount == MAX_USERS || find(profile.id) >= 0)
+        {
+            return false;
+        }
+        mUsers[mCount] = profile;
+        mLastWeightG[mCount] = 0;
+        mCount++;
+        return true;
+    }
+
+    // Serializes everything that does not change between requests
+    void compile()
+    {
+        mBodySize = responseBodySize(mCount);
+        memset(mArena, 0, sizeof(mArena));
+        mArena[4] = 0x00; // units (KG, 0x02) (lbs, 0x00)
+        mArena[5] = 0x32; // status (configured)
+        mArena[6] = 0x01; // unknown
+        writeLE(mArena + 7, static_cast<uint32_t>(mCount));
+        for (size_t i = 0; i < mCount; i++)
+        {
+            const UserProfile &user = mUsers[i];
+            uint8_t *record = mArena + userOffset(i);
+            writeLE(record, user.id);
+            // 16 bytes padding, then the name zero padded to 20 bytes
+            memcpy(record + 20, user.name, strlen(user.name));
+            writeLE(record + 48, user.age);
+            record[52] = user.gender;
+            writeLE(record + 53, user.heightMm);
+            // Previous weight, body fat, covariance and other weight stay 0
+        }
+        uint8_t *trailer = mArena + userOffset(mCount);
+        writeLE(trailer, static_cast<uint32_t>(0)); // unknown
+        writeLE(trailer + 4, UPDATE_NONE);
+        writeLE(trailer + 8, static_cast<uint32_t>(0)); // unknown
+        mAgesForDay = UINT32_MAX;
+
+        // The user timestamps always change together, so one factor covers all
+        mClockShift = Crc16Shifter(Crc16Xmodem::shiftFactor(mBodySize - 4));
+        uint16_t userTimeFactor = 0;
+        for (size_t i = 0; i < mCount; i++)
+        {
+            userTimeFactor ^= Crc16Xmodem::shiftFactor(mBodySize - userOffset(i) - USER_TIMESTAMP_OFFSET - 4);
+        }
+        mUserTimeShift = Crc16Shifter(userTimeFactor);
+        mGeneration++;
+    }
+
+    // Changes whenever a response built now would differ in more than the
+    // clock and the user timestamps
+    uint32_t generation() const { return mGeneration; }
+
+    size_t size() const { return mCount; }
+    const UserProfile &user(size_t index) const { return mUsers[index]; }
+
+    int find(uint32_t id) const
+    {
+        for (size_t i = 0; i < mCount; i++)
+        {
+            if (mUsers[i].id == id)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    // Centres the user's tolerance window on the next responses
+    void setLastWeight(size_t index, uint32_t weightG)
+    {
+        if (mLastWeightG[index] != weightG)
+        {
+            mLastWeightG[index] = weightG;
+            mGeneration++;
+        }
+    }
+    uint32_t lastWeight(size_t index) const { return mLastWeightG[index]; }
+
+    // Writes the complete envelope, CRC and message size included, and
+    // returns its length. `out` needs responseSize(size()) bytes, and
+    // MAX_UPDATE_URL_SIZE more with an update URL. A URL that does not fit
+    // is left out.
+    size_t build(uint8_t *out, uint32_t now, uint32_t scaleTime, const char *updateUrl = nullptr)
+    {
+        refresh(now);
+        memcpy(out, mArena, mBodySize);
+        writeLE(out, now);
+        for (size_t i = 0; i < mCount; i++)
+        {
+            uint8_t *record = out + userOffset(i);
+            uint32_t weight = mLastWeightG[i];
+            if (weight)
+            {
+                // Unknown weights keep a 0..0 window, like the reference server
+                uint32_t tolerance = mUsers[i].toleranceG;
+                writeLE(record + 40, weight > tolerance ? weight - tolerance : 0);
+                writeLE(record + 44, weight + tolerance);
+            }
+            writeLE(record + USER_TIMESTAMP_OFFSET, scaleTime - 1000);
+        }
+        size_t bodySize = mBodySize;
+        size_t urlSize = updateUrl ? strlen(updateUrl) + 1 : 0;
+        if (urlSize && urlSize <= MAX_UPDATE_URL_SIZE)
+        {
+            uint8_t *trailer = out + userOffset(mCount);
+            writeLE(trailer + 4, UPDATE_AVAILABLE);
+            memcpy(trailer + 8, updateUrl, urlSize);
+            writeLE(trailer + 8 + urlSize, static_cast<uint32_t>(0));
+            bodySize += urlSize;
+        }
+        uint16_t crc = Crc16Xmodem::compute(out, bodySize);
+        writeLE(out + bodySize, crc);
+        writeLE(out + bodySize + CRC_SIZE, static_cast<uint16_t>(bodySize + CRC_SIZE));
+        return bodySize + RESPONSE_FOOTER_SIZE;
+    }
+
+    // Moves a response built by this table in the current generation to a
+    // new clock and scale time. Only the changed fields are rewritten and
+    // read for the CRC, so the cost does not grow with the number of users.
+    void patch(uint8_t *response, uint32_t now, uint32_t scaleTime) const
+    {
+        uint16_t crc = readLE<uint16_t>(response + mBodySize);
+        uint8_t value[4];
+        writeLE(value, now);
+        crc = mClockShift.patch(crc, response, value, 4);
+        memcpy(response, value, 4);
+        if (mCount)
+        {
+            writeLE(value, scaleTime - 1000);
+            uint8_t *first = response + userOffset(0) + USER_TIMESTAMP_OFFSET;
+            crc = mUserTimeShift.patch(crc, first, value, 4);
+            for (size_t i = 0; i < mCount; i++)
+            {
+                memcpy(response + userOffset(i) + USER_TIMESTAMP_OFFSET, value, 4);
+            }
+        }
+        writeLE(response + mBodySize, crc);
+    }
+
+    // Ages only change at midnight, so they are patched into the arena once a day
+    void refresh(uint32_t now)
+    {
+        uint32_t day = now / 86400;
+        if (day == mAgesForDay)
+        {
+            return;
+        }
+        mAgesForDay = day;
+        uint32_t year, month, dayOfMonth;
+        civil::civilFromDays(day, year, month, dayOfMonth);
+        for (size_t i = 0; i < mCount; i++)
+        {
+            const UserProfile &user = mUsers[i];
+            if (user.birthYear == 0)
+            {
+                continue;
+            }
+            uint32_t age = year > user.birthYear ? year - user.birthYear : 0;
+            if (age && (month < user.birthMonth || (month == user.birthMonth && dayOfMonth < user.birthDay)))
+            {
+                age--;
+            }
+            uint8_t *field = mArena + userOffset(i) + 48;
+            if (readLE<uint32_t>(field) != age)
+            {
+                writeLE(field, age);
+                mGeneration++;
+            }
+        }
+    }
+
+private:
+    static constexpr size_t USER_TIMESTAMP_OFFSET = 73;
+
+    static constexpr size_t userOffset(size_t index) { return RESPONSE_HEADER_SIZE + index * USER_RECORD_SIZE; }
+
+    UserProfile mUsers[MAX_USERS] = {};
+    uint32_t mLastWeightG[MAX_USERS] = {};
+    size_t mCount = 0;
+    uint8_t mArena[responseBodySize(MAX_USERS)] = {};
+    size_t mBodySize = responseBodySize(0);
+    uint32_t mAgesForDay = UINT32_MAX;
+    uint32_t mGeneration = 0;
+    Crc16Shifter mClockShift;
+    Crc16Shifter mUserTimeShift;
+};
+
+// Last response per scale MAC, least recently used slot replaced
+class ResponseCache
+{
+public:
+    static constexpr size_t SLOTS = 4;
+
+    explicit ResponseCache(UserTable &users) : mUsers(users) {}
+
+    // Response for the scale with this MAC. Points into the cache and stays
+    // valid until the next call. `hit` tells whether it was only patched.
+    const uint8_t *get(const uint8_t *mac, uint32_t now, uint32_t scaleTime, size_t &length, bool &hit,
+                       const char *updateUrl = nullptr)
+    {
+        mUsers.refresh(now);
+        Entry *entry = nullptr;
+        Entry *oldest = &mEntries[0];
+        for (Entry &candidate : mEntries)
+        {
+            if (candidate.length && memcmp(candidate.mac, mac, MAC_SIZE) == 0)
+            {
+                entry = &candidate;
+                break;
+            }
+            if (candidate.lastUse < oldest->lastUse)
+            {
+                oldest = &candidate;
+            }
+        }
+
+        hit = entry && entry->generation == mUsers.generation() && !entry->update && !updateUrl;
+        if (hit)
+        {
+            mUsers.patch(entry->bytes, now, scaleTime);
+        }
+        else
+        {
+            if (!entry)
+            {
+                entry = oldest;
+                memcpy(entry->mac, mac, MAC_SIZE);
+            }
+            entry->length = mUsers.build(entry->bytes, now, scaleTime, updateUrl);
+            entry->generation = mUsers.generation();
+            entry->update = updateUrl != nullptr; // patch() does not know the longer body
+        }
+        entry->lastUse = ++mUseClock;
+        length = entry->length;
+        return entry->bytes;
+    }
+
+private:
+    struct Entry
+    {
+        uint8_t mac[MAC_SIZE];
+        uint32_t generation;
+        uint32_t lastUse;
+        size_t length; // 0 while unused
+        bool update;
+        uint8_t bytes[MAX_RESPONSE_SIZE];
+    };
+
+    UserTable &mUsers;
+    Entry mEntries[SLOTS] = {};
+    uint32_t mUseClock = 0;
+};
+
+} // namespace aria
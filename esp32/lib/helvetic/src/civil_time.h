@@ -0,0 +1,61 @@
+#pragma once
+
+// Conversions between Unix time and UTC calendar dates without time.h, so
+// the result does not depend on the C library's time zone state
+// (H. Hinnant's days_from_civil / civil_from_days, proleptic Gregorian).
+
+#include <stdint.h>
+
+namespace civil
+{
+
+struct DateTime
+{
+    uint16_t year;
+    uint8_t month; // 1-12
+    uint8_t day;   // 1-31
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+};
+
+// Days since 1970-01-01, valid from 1970 on
+inline uint32_t daysFromCivil(uint32_t year, uint32_t month, uint32_t day)
+{
+    year -= month <= 2 ? 1 : 0;
+    uint32_t era = year / 400;
+    uint32_t yoe = year - era * 400;
+    uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+inline void civilFromDays(uint32_t days, uint32_t &year, uint32_t &month, uint32_t &day)
+{
+    uint32_t z = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    day = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = yoe + era * 400 + (month <= 2 ? 1 : 0);
+}
+
+inline uint32_t toUnix(const DateTime &dt)
+{
+    return daysFromCivil(dt.year, dt.month, dt.day) * 86400 + dt.hour * 3600 + dt.minute * 60 + dt.second;
+}
+
+inline DateTime fromUnix(uint32_t timestamp)
+{
+    uint32_t year, month, day;
+    civilFromDays(timestamp / 86400, year, month, day);
+    uint32_t seconds = timestamp % 86400;
+    return DateTime{static_cast<uint16_t>(year), static_cast<uint8_t>(month), static_cast<uint8_t>(day),
+                    static_cast<uint8_t>(seconds / 3600), static_cast<uint8_t>(seconds / 60 % 60),
+                    static_cast<uint8_t>(seconds % 60)};
+}
+
+} // namespace civil
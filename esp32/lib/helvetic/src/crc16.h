@@ -0,0 +1,207 @@
+#pragma once
+
+// CRC16-XMODEM (poly 0x1021, init 0, no reflection, no final xor) as used by
+// the Aria upload request and response envelopes.
+//
+// Lookup tables are generated at compile time. Bulk data is processed eight
+// bytes per step (slice-by-8). Because XMODEM has a zero init and no final
+// xor the CRC is linear, so CRCs of adjacent blocks can be combined and a
+// patched field can be re-checksummed from the old CRC without rescanning.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace crc16_detail
+{
+
+constexpr uint16_t POLY = 0x1021;
+constexpr int SLICES = 8;
+
+struct Tables
+{
+    // table[k][b] = CRC of byte b followed by k zero bytes
+    uint16_t table[SLICES][256];
+    // shift[k] = x^(8 * 2^k) mod P, used to append 2^k zero bytes
+    uint16_t shift[32];
+
+    constexpr Tables() : table(), shift()
+    {
+        for (int b = 0; b < 256; b++)
+        {
+            uint16_t crc = static_cast<uint16_t>(b << 8);
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ POLY) : static_cast<uint16_t>(crc << 1);
+            }
+            table[0][b] = crc;
+        }
+        for (int k = 1; k < SLICES; k++)
+        {
+            for (int b = 0; b < 256; b++)
+            {
+                uint16_t prev = table[k - 1][b];
+                table[k][b] = static_cast<uint16_t>((prev << 8) ^ table[0][prev >> 8]);
+            }
+        }
+        shift[0] = 0x0100; // x^8
+        for (int k = 1; k < 32; k++)
+        {
+            shift[k] = multiply(shift[k - 1], shift[k - 1]);
+        }
+    }
+
+    // a(x) * b(x) mod P(x) over GF(2)
+    static constexpr uint16_t multiply(uint16_t a, uint16_t b)
+    {
+        uint16_t result = 0;
+        for (int bit = 15; bit >= 0; bit--)
+        {
+            result = (result & 0x8000) ? static_cast<uint16_t>((result << 1) ^ POLY) : static_cast<uint16_t>(result << 1);
+            if (b & (1u << bit))
+            {
+                result ^= a;
+            }
+        }
+        return result;
+    }
+};
+
+inline constexpr Tables TABLES{};
+
+} // namespace crc16_detail
+
+class Crc16Xmodem
+{
+public:
+    explicit constexpr Crc16Xmodem(uint16_t crc = 0) : mCrc(crc) {}
+
+    Crc16Xmodem &update(const uint8_t *data, size_t length)
+    {
+        mCrc = compute(data, length, mCrc);
+        return *this;
+    }
+
+    Crc16Xmodem &update(uint8_t byte)
+    {
+        mCrc = step(mCrc, byte);
+        return *this;
+    }
+
+    uint16_t finalize() const { return mCrc; }
+    void reset(uint16_t crc = 0) { mCrc = crc; }
+
+    static uint16_t compute(const uint8_t *data, size_t length, uint16_t crc = 0)
+    {
+        const auto &t = crc16_detail::TABLES.table;
+        // The 16-bit state is fully absorbed by the first two bytes of a slice
+        while (length >= 8)
+        {
+            crc = t[7][data[0] ^ (crc >> 8)] ^ t[6][data[1] ^ (crc & 0xFF)] ^
+                  t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^ t[2][data[5]] ^
+                  t[1][data[6]] ^ t[0][data[7]];
+            data += 8;
+            length -= 8;
+        }
+        if (length >= 4)
+        {
+            crc = t[3][data[0] ^ (crc >> 8)] ^ t[2][data[1] ^ (crc & 0xFF)] ^
+                  t[1][data[2]] ^ t[0][data[3]];
+            data += 4;
+            length -= 4;
+        }
+        while (length--)
+        {
+            crc = step(crc, *data++);
+        }
+        return crc;
+    }
+
+    // CRC after appending `zeroBytes` zero bytes to the message, in O(log n)
+    static uint16_t shift(uint16_t crc, size_t zeroBytes)
+    {
+        for (int k = 0; zeroBytes && k < 32; k++, zeroBytes >>= 1)
+        {
+            if (zeroBytes & 1)
+            {
+                crc = crc16_detail::Tables::multiply(crc, crc16_detail::TABLES.shift[k]);
+            }
+        }
+        return crc;
+    }
+
+    // CRC of A||B from crc(A), crc(B) and the length of B
+    static uint16_t combine(uint16_t crcA, uint16_t crcB, size_t lengthB)
+    {
+        return shift(crcA, lengthB) ^ crcB;
+    }
+
+    // New CRC of a message after `length` bytes changed from oldBytes to
+    // newBytes, with `trailing` bytes of the message following the field.
+    static uint16_t patch(uint16_t crc, const uint8_t *oldBytes, const uint8_t *newBytes, size_t length, size_t trailing)
+    {
+        uint16_t delta = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            delta = step(delta, oldBytes[i] ^ newBytes[i]);
+        }
+        return crc ^ shift(delta, trailing);
+    }
+
+    // x^(8 * trailing) mod P, so that patch() is crc ^ delta * shiftFactor(trailing).
+    // Fields that always change by the same bytes can share one factor, the
+    // xor of their own.
+    static uint16_t shiftFactor(size_t trailing)
+    {
+        return shift(1, trailing);
+    }
+
+private:
+    static uint16_t step(uint16_t crc, uint8_t byte)
+    {
+        return static_cast<uint16_t>(crc << 8) ^ crc16_detail::TABLES.table[0][(crc >> 8) ^ byte];
+    }
+
+    uint16_t mCrc;
+};
+
+// patch() for a field position that is patched over and over: the
+// multiplication by its shiftFactor() goes through four nibble tables
+// built once, instead of one polynomial multiplication per set bit of
+// the trailing length.
+class Crc16Shifter
+{
+public:
+    explicit Crc16Shifter(uint16_t factor = 0)
+    {
+        for (int nibble = 0; nibble < 4; nibble++)
+        {
+            for (int value = 0; value < 16; value++)
+            {
+                mTable[nibble][value] = crc16_detail::Tables::multiply(static_cast<uint16_t>(value << (nibble * 4)), factor);
+            }
+        }
+    }
+
+    uint16_t patch(uint16_t crc, const uint8_t *oldBytes, const uint8_t *newBytes, size_t length) const
+    {
+        uint16_t delta = 0;
+        while (length)
+        {
+            uint8_t changed[8];
+            size_t n = length < sizeof(changed) ? length : sizeof(changed);
+            for (size_t i = 0; i < n; i++)
+            {
+                changed[i] = oldBytes[i] ^ newBytes[i];
+            }
+            delta = Crc16Xmodem::compute(changed, n, delta);
+            oldBytes += n;
+            newBytes += n;
+            length -= n;
+        }
+        return crc ^ mTable[0][delta & 0xF] ^ mTable[1][(delta >> 4) & 0xF] ^
+               mTable[2][(delta >> 8) & 0xF] ^ mTable[3][delta >> 12];
+    }
+
+private:
+    uint16_t mTable[4][16];
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+// Fixed-size set of 64-bit keys that remembers the most recent CAPACITY
+// insertions.
+//
+// Open addressing with linear probing over 2 * CAPACITY slots, so the load
+// factor never exceeds one half and a lookup touches a couple of adjacent
+// slots. A ring of keys in insertion order decides what to forget: when
+// full, the oldest key is removed with backward-shift deletion, which
+// leaves no tombstones. Key 0 marks an empty slot and is remapped.
+// No allocation, not thread safe.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64-bit mix of up to a few words (splitmix64 finaliser per step)
+inline uint64_t dedupeHash(uint64_t seed, uint64_t value)
+{
+    uint64_t x = seed ^ (value + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2));
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+template <size_t CAPACITY>
+class DedupeSet
+{
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "DedupeSet capacity must be a power of two");
+
+public:
+    static constexpr size_t SLOTS = 2 * CAPACITY;
+
+    static uint64_t hash(uint64_t seed, uint64_t value) { return dedupeHash(seed, value); }
+
+    bool contains(uint64_t key) const
+    {
+        key = normalise(key);
+        for (size_t i = home(key);; i = (i + 1) & (SLOTS - 1))
+        {
+            if (mSlots[i] == key)
+            {
+                return true;
+            }
+            if (mSlots[i] == 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    // Returns false if the key was already present; the set is unchanged then
+    bool insert(uint64_t key)
+    {
+        key = normalise(key);
+        size_t i = home(key);
+        for (; mSlots[i] != 0; i = (i + 1) & (SLOTS - 1))
+        {
+            if (mSlots[i] == key)
+            {
+                return false;
+            }
+        }
+
+        if (mNext >= CAPACITY && erase(mOrder[mNext & (CAPACITY - 1)]))
+        {
+            // Forgot the oldest key; the free slot found above may have moved
+            for (i = home(key); mSlots[i] != 0; i = (i + 1) & (SLOTS - 1))
+            {
+            }
+        }
+        mSlots[i] = key;
+        mOrder[mNext & (CAPACITY - 1)] = key;
+        mNext++;
+        mCount++;
+        return true;
+    }
+
+    bool erase(uint64_t key)
+    {
+        key = normalise(key);
+        size_t i = home(key);
+        for (; mSlots[i] != key; i = (i + 1) & (SLOTS - 1))
+        {
+            if (mSlots[i] == 0)
+            {
+                return false;
+            }
+        }
+
+        // Pull later entries of the cluster back into the gap
+        size_t gap = i;
+        for (size_t j = (i + 1) & (SLOTS - 1); mSlots[j] != 0; j = (j + 1) & (SLOTS - 1))
+        {
+            size_t want = home(mSlots[j]);
+            // Movable if its home is not cyclically within (gap, j]
+            if (((j - want) & (SLOTS - 1)) >= ((j - gap) & (SLOTS - 1)))
+            {
+                mSlots[gap] = mSlots[j];
+                gap = j;
+            }
+        }
+        mSlots[gap] = 0;
+        mCount--;
+        return true;
+    }
+
+    size_t size() const { return mCount; }
+
+    // Insertion order, oldest first; may include keys erased since
+    size_t orderSize() const { return mNext < CAPACITY ? static_cast<size_t>(mNext) : CAPACITY; }
+    uint64_t ordered(size_t index) const
+    {
+        uint32_t first = mNext < CAPACITY ? 0 : mNext;
+        return mOrder[(first + index) & (CAPACITY - 1)];
+    }
+
+private:
+    static uint64_t normalise(uint64_t key) { return key ? key : 1; }
+    static size_t home(uint64_t key) { return static_cast<size_t>(key >> 32 ^ key) & (SLOTS - 1); }
+
+    uint64_t mSlots[SLOTS] = {};
+    uint64_t mOrder[CAPACITY] = {};
+    uint32_t mNext = 0; // insertions ever, mNext % CAPACITY is the oldest
+    size_t mCount = 0;
+};
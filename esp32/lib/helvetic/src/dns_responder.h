@@ -0,0 +1,329 @@
+#pragma once
+
+// Authoritative-only DNS answers for a small compiled table of names.
+//
+// For every table entry a complete response to the canonical A query is
+// built once; a query that matches it byte for byte (the common case, the
+// Aria always asks the same way) is answered by copying the template and
+// patching the transaction id and RD bit. Other spellings and subdomains
+// of wildcard entries take a slower path that echoes the question. Names
+// outside the table are refused or handed back to the caller to forward.
+//
+// No sockets and no allocation, so the same code runs on the ESP32 and on
+// the build host.
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace dns
+{
+
+constexpr size_t HEADER_SIZE = 12;
+constexpr size_t MAX_PACKET = 512; // classic UDP limit, no EDNS
+constexpr size_t MAX_NAME = 253;
+constexpr uint16_t TYPE_A = 1;
+constexpr uint16_t TYPE_ANY = 255;
+constexpr uint16_t CLASS_IN = 1;
+constexpr uint32_t DEFAULT_TTL = 60;
+
+enum Rcode : uint8_t
+{
+    NOERROR = 0,
+    FORMERR = 1,
+    NXDOMAIN = 3,
+    NOTIMP = 4,
+    REFUSED = 5
+};
+
+struct Name
+{
+    const char *name; // lowercase, no trailing dot
+    bool subdomains;  // also answer for *.name
+};
+
+enum class Result : uint8_t
+{
+    Answered,  // A record from the table
+    NoData,    // table name, other record type
+    Refused,   // not in the table
+    Forward,   // not in the table, caller should forward the query
+    Malformed, // FORMERR or NOTIMP sent back
+    Dropped    // not a query, nothing to send
+};
+
+struct Question
+{
+    char name[MAX_NAME + 1]; // lowercase, dotted
+    size_t nameLength;
+    uint16_t type;
+    uint16_t qclass;
+    size_t end; // offset just past the question
+};
+
+inline uint16_t read16(const uint8_t *p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline void write16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+// Decodes the first question; compressed names are not valid there
+inline bool parseQuestion(const uint8_t *packet, size_t length, Question &question)
+{
+    size_t pos = HEADER_SIZE;
+    size_t out = 0;
+    for (;;)
+    {
+        if (pos >= length)
+        {
+            return false;
+        }
+        uint8_t label = packet[pos++];
+        if (label == 0)
+        {
+            break;
+        }
+        if (label > 63 || pos + label > length || out + label + 1 > MAX_NAME)
+        {
+            return false;
+        }
+        if (out)
+        {
+            question.name[out++] = '.';
+        }
+        for (uint8_t i = 0; i < label; i++)
+        {
+            char c = static_cast<char>(packet[pos++]);
+            question.name[out++] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c + 32) : c;
+        }
+    }
+    if (pos + 4 > length)
+    {
+        return false;
+    }
+    question.name[out] = 0;
+    question.nameLength = out;
+    question.type = read16(packet + pos);
+    question.qclass = read16(packet + pos + 2);
+    question.end = pos + 4;
+    return true;
+}
+
+// Writes `name` in wire format, returns the bytes used or 0 if it does not fit
+inline size_t encodeName(const char *name, uint8_t *out, size_t capacity)
+{
+    size_t pos = 0;
+    while (*name)
+    {
+        const char *dot = strchr(name, '.');
+        size_t label = dot ? static_cast<size_t>(dot - name) : strlen(name);
+        if (label == 0 || label > 63 || pos + 1 + label + 1 > capacity)
+        {
+            return 0;
+        }
+        out[pos++] = static_cast<uint8_t>(label);
+        memcpy(out + pos, name, label);
+        pos += label;
+        name += label + (dot ? 1 : 0);
+    }
+    if (pos + 1 > capacity)
+    {
+        return 0;
+    }
+    out[pos++] = 0;
+    return pos;
+}
+
+template <size_t N>
+class Responder
+{
+public:
+    static constexpr size_t TEMPLATE_MAX = 96;
+    static constexpr size_t ANSWER_SIZE = 16; // pointer, type, class, ttl, rdlength, address
+
+    explicit Responder(const Name (&names)[N], uint32_t ttl = DEFAULT_TTL) : mNames(names), mTtl(ttl) {}
+
+    // Rebuilds the templates; call before answering and when the address changes
+    void setAddress(const uint8_t address[4])
+    {
+        memcpy(mAddress, address, 4);
+        for (size_t i = 0; i < N; i++)
+        {
+            uint8_t *t = mTemplates[i];
+            memset(t, 0, HEADER_SIZE);
+            t[2] = 0x85; // QR, AA, RD
+            t[3] = 0x80; // RA
+            write16(t + 4, 1);
+            write16(t + 6, 1);
+            size_t nameLength = encodeName(mNames[i].name, t + HEADER_SIZE, TEMPLATE_MAX - HEADER_SIZE - 4 - ANSWER_SIZE);
+            if (nameLength == 0)
+            {
+                mTemplateLength[i] = 0; // never matches the fast path
+                continue;
+            }
+            size_t pos = HEADER_SIZE + nameLength;
+            write16(t + pos, TYPE_A);
+            write16(t + pos + 2, CLASS_IN);
+            mQuestionEnd[i] = pos + 4;
+            mTemplateLength[i] = mQuestionEnd[i] + writeAnswer(t + mQuestionEnd[i]);
+        }
+    }
+
+    void setForwardUnknown(bool forward) { mForwardUnknown = forward; }
+
+    // Builds the response to `query` in `out` (at least MAX_PACKET bytes).
+    // Returns its length, 0 when nothing should be sent. `match` is the
+    // table index for Answered and NoData, -1 otherwise.
+    size_t respond(const uint8_t *query, size_t length, uint8_t *out, Result &result, int &match)
+    {
+        match = -1;
+        if (length < HEADER_SIZE || (query[2] & 0x80))
+        {
+            // Too short to answer, or a response
+            result = Result::Dropped;
+            return 0;
+        }
+
+        // Fast path: one plain question, identical to a template's
+        if (length <= TEMPLATE_MAX && (query[2] & 0x78) == 0 && read16(query + 4) == 1 &&
+            read16(query + 6) == 0 && read16(query + 8) == 0 && read16(query + 10) == 0)
+        {
+            for (size_t i = 0; i < N; i++)
+            {
+                if (mTemplateLength[i] && length == mQuestionEnd[i] &&
+                    memcmp(query + HEADER_SIZE, mTemplates[i] + HEADER_SIZE, length - HEADER_SIZE) == 0)
+                {
+                    memcpy(out, mTemplates[i], mTemplateLength[i]);
+                    out[0] = query[0];
+                    out[1] = query[1];
+                    out[2] = 0x84 | (query[2] & 0x01);
+                    return hit(i, Result::Answered, result, match, mTemplateLength[i]);
+                }
+            }
+        }
+
+        Question question;
+        if ((query[2] & 0x78) != 0)
+        {
+            // Only standard queries
+            result = Result::Malformed;
+            return header(query, out, NOTIMP, 0);
+        }
+        if (read16(query + 4) != 1 || !parseQuestion(query, length, question))
+        {
+            result = Result::Malformed;
+            return header(query, out, FORMERR, 0);
+        }
+
+        int index = find(question.name, question.nameLength);
+        if (index < 0)
+        {
+            if (mForwardUnknown)
+            {
+                result = Result::Forward;
+                return 0;
+            }
+            mRefused.fetch_add(1, std::memory_order_relaxed);
+            result = Result::Refused;
+            return withQuestion(query, question, out, REFUSED, false);
+        }
+
+        bool isA = question.qclass == CLASS_IN && (question.type == TYPE_A || question.type == TYPE_ANY);
+        size_t size = withQuestion(query, question, out, NOERROR, isA);
+        return hit(index, isA ? Result::Answered : Result::NoData, result, match, size);
+    }
+
+    size_t size() const { return N; }
+    const char *name(size_t index) const { return mNames[index].name; }
+    uint32_t hits(size_t index) const { return mHits[index].load(std::memory_order_relaxed); }
+    uint32_t refused() const { return mRefused.load(std::memory_order_relaxed); }
+
+private:
+    size_t hit(size_t index, Result kind, Result &result, int &match, size_t size)
+    {
+        mHits[index].fetch_add(1, std::memory_order_relaxed);
+        result = kind;
+        match = static_cast<int>(index);
+        return size;
+    }
+
+    int find(const char *name, size_t length) const
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            const char *entry = mNames[i].name;
+            size_t entryLength = strlen(entry);
+            if (length == entryLength && memcmp(name, entry, length) == 0)
+            {
+                return static_cast<int>(i);
+            }
+            if (mNames[i].subdomains && length > entryLength && name[length - entryLength - 1] == '.' &&
+                memcmp(name + length - entryLength, entry, entryLength) == 0)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    size_t writeAnswer(uint8_t *p) const
+    {
+        write16(p, 0xC00C); // name: pointer to the question
+        write16(p + 2, TYPE_A);
+        write16(p + 4, CLASS_IN);
+        p[6] = mTtl >> 24;
+        p[7] = (mTtl >> 16) & 0xFF;
+        p[8] = (mTtl >> 8) & 0xFF;
+        p[9] = mTtl & 0xFF;
+        write16(p + 10, 4);
+        memcpy(p + 12, mAddress, 4);
+        return ANSWER_SIZE;
+    }
+
+    static size_t header(const uint8_t *query, uint8_t *out, Rcode rcode, uint16_t questions)
+    {
+        memset(out, 0, HEADER_SIZE);
+        out[0] = query[0];
+        out[1] = query[1];
+        out[2] = 0x80 | (query[2] & 0x79); // QR, echo opcode and RD
+        out[3] = 0x80 | rcode;
+        write16(out + 4, questions);
+        return HEADER_SIZE;
+    }
+
+    size_t withQuestion(const uint8_t *query, const Question &question, uint8_t *out, Rcode rcode, bool answer) const
+    {
+        header(query, out, rcode, 1);
+        if (rcode == NOERROR)
+        {
+            out[2] |= 0x04; // AA
+        }
+        // The question is echoed as sent, original case included
+        memcpy(out + HEADER_SIZE, query + HEADER_SIZE, question.end - HEADER_SIZE);
+        size_t size = question.end;
+        if (answer)
+        {
+            write16(out + 6, 1);
+            size += writeAnswer(out + size);
+        }
+        return size;
+    }
+
+    const Name (&mNames)[N];
+    uint32_t mTtl;
+    uint8_t mAddress[4] = {};
+    bool mForwardUnknown = false;
+    uint8_t mTemplates[N][TEMPLATE_MAX];
+    size_t mTemplateLength[N] = {};
+    size_t mQuestionEnd[N] = {};
+    std::atomic<uint32_t> mHits[N] = {};
+    std::atomic<uint32_t> mRefused{0};
+};
+
+} // namespace dns
@@ -0,0 +1,159 @@
+#pragma once
+
+// The newest CAPACITY measurements in RAM, one array per field.
+//
+// Records are addressed by sequence number: slot seq % CAPACITY, so there
+// is no head pointer and a push overwrites the oldest record. Queries such
+// as "newest record of a user" or a user's weight trend walk the timestamp
+// and user arrays, 5 bytes per record, and touch the others only for the
+// records they keep. Sequence numbers must be contiguous; a push that skips
+// ahead starts over. No allocation, not thread safe.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packed_record.h"
+
+namespace history
+{
+
+// One user's weight over a time range, grams
+struct Trend
+{
+    uint32_t count;
+    uint32_t firstTimestamp;
+    uint32_t lastTimestamp;
+    uint32_t firstWeight; // at firstTimestamp
+    uint32_t lastWeight;
+    uint32_t minWeight;
+    uint32_t maxWeight;
+    uint64_t sumWeight;
+
+    uint32_t meanWeight() const { return count ? static_cast<uint32_t>(sumWeight / count) : 0; }
+    int32_t change() const { return static_cast<int32_t>(lastWeight - firstWeight); }
+};
+
+template <size_t CAPACITY>
+class Columns
+{
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "Columns capacity must be a power of two");
+
+public:
+    void clear(uint32_t nextSeq)
+    {
+        mNextSeq = nextSeq;
+        mCount = 0;
+    }
+
+    void push(uint32_t seq, const Record &record)
+    {
+        if (seq != mNextSeq)
+        {
+            clear(seq);
+        }
+        size_t i = seq & (CAPACITY - 1);
+        mTimestamp[i] = record.timestamp;
+        mWeight[i] = record.weightGrams;
+        mFat[i] = record.fat;
+        mImpedance[i] = record.impedance;
+        mUser[i] = record.user;
+        mFlags[i] = record.flags;
+        mNextSeq = seq + 1;
+        if (mCount < CAPACITY)
+        {
+            mCount++;
+        }
+    }
+
+    size_t size() const { return mCount; }
+    uint32_t firstSeq() const { return mNextSeq - static_cast<uint32_t>(mCount); }
+    uint32_t nextSeq() const { return mNextSeq; }
+    bool contains(uint32_t seq) const { return seq - firstSeq() < mCount; }
+
+    // Only for contains(seq)
+    Record at(uint32_t seq) const
+    {
+        size_t i = seq & (CAPACITY - 1);
+        return Record{mTimestamp[i], mWeight[i], mFat[i], mImpedance[i], mUser[i], mFlags[i]};
+    }
+
+    // Newest record of each user, newest first; the newest by position,
+    // which is also by time for one scale
+    size_t latestPerUser(Record *out, size_t max) const
+    {
+        uint32_t seen[256 / 32] = {};
+        size_t n = 0;
+        for (uint32_t seq = mNextSeq; seq != firstSeq() && n < max;)
+        {
+            seq--;
+            uint8_t user = mUser[seq & (CAPACITY - 1)];
+            if (seen[user / 32] >> (user % 32) & 1)
+            {
+                continue;
+            }
+            seen[user / 32] |= 1u << (user % 32);
+            out[n++] = at(seq);
+        }
+        return n;
+    }
+
+    bool latest(uint8_t user, Record &record) const
+    {
+        for (uint32_t seq = mNextSeq; seq != firstSeq();)
+        {
+            seq--;
+            if (mUser[seq & (CAPACITY - 1)] == user)
+            {
+                record = at(seq);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Weight of `user` over the cached records taken at or after `since`
+    Trend trend(uint8_t user, uint32_t since) const
+    {
+        Trend trend = {0, UINT32_MAX, 0, 0, 0, UINT32_MAX, 0, 0};
+        for (uint32_t seq = firstSeq(); seq != mNextSeq; seq++)
+        {
+            size_t i = seq & (CAPACITY - 1);
+            if (mUser[i] != user || mTimestamp[i] < since)
+            {
+                continue;
+            }
+            uint32_t weight = mWeight[i];
+            trend.count++;
+            trend.sumWeight += weight;
+            trend.minWeight = weight < trend.minWeight ? weight : trend.minWeight;
+            trend.maxWeight = weight > trend.maxWeight ? weight : trend.maxWeight;
+            if (mTimestamp[i] < trend.firstTimestamp)
+            {
+                trend.firstTimestamp = mTimestamp[i];
+                trend.firstWeight = weight;
+            }
+            if (mTimestamp[i] >= trend.lastTimestamp)
+            {
+                trend.lastTimestamp = mTimestamp[i];
+                trend.lastWeight = weight;
+            }
+        }
+        if (trend.count == 0)
+        {
+            trend = Trend{};
+        }
+        return trend;
+    }
+
+private:
+    uint32_t mTimestamp[CAPACITY];
+    uint32_t mWeight[CAPACITY];
+    uint32_t mFat[CAPACITY];
+    uint16_t mImpedance[CAPACITY];
+    uint8_t mUser[CAPACITY];
+    uint8_t mFlags[CAPACITY];
+    uint32_t mNextSeq = 0;
+    size_t mCount = 0;
+};
+
+} // namespace history
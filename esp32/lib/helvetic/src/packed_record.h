@@ -0,0 +1,133 @@
+#pragma once
+
+// On-flash measurement history format, version 2.
+//
+// A segment file starts with a 16-byte header and holds fixed 16-byte
+// records after it, every field little-endian whatever the compiler:
+//
+//   header: u8 version, u8 record size, u16 reserved, u32 first sequence
+//           number, u32 base timestamp, u16 reserved, u16 CRC
+//   record: u24 seconds since the base timestamp, u8 user,
+//           u24 weight in grams, u8 flags, u16 impedance in ohms,
+//           u24 body fat in 0.001 %, u8 reserved, u16 CRC
+//
+// The units are the Aria's own, so nothing is lost to float rounding. The
+// sequence number of a record is its position after the first one. A
+// record whose timestamp is before the base or more than 194 days after it
+// does not fit and starts a new segment. CRCs are CRC-16/XMODEM seeded with
+// CRC_SEED, so an all-zero record is not valid.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crc16.h"
+
+namespace history
+{
+
+constexpr uint8_t FORMAT_VERSION = 2;
+constexpr size_t HEADER_SIZE = 16;
+constexpr size_t RECORD_SIZE = 16;
+constexpr uint32_t MAX_DELTA = 0xFFFFFF;
+constexpr uint32_t MAX_WEIGHT = 0xFFFFFF;
+constexpr uint32_t MAX_FAT = 0xFFFFFF;
+constexpr uint16_t CRC_SEED = 0x4857; // "HW"
+
+constexpr uint8_t FLAG_STABLE = 0x01;
+
+struct Record
+{
+    uint32_t timestamp;
+    uint32_t weightGrams;
+    uint32_t fat; // 0.001 %
+    uint16_t impedance;
+    uint8_t user;
+    uint8_t flags;
+};
+
+struct SegmentHeader
+{
+    uint32_t firstSeq;
+    uint32_t baseTimestamp;
+};
+
+namespace detail
+{
+inline void put(uint8_t *dest, uint32_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++)
+    {
+        dest[i] = (value >> (i * 8)) & 0xFF;
+    }
+}
+
+inline uint32_t get(const uint8_t *src, size_t bytes)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        value |= static_cast<uint32_t>(src[i]) << (i * 8);
+    }
+    return value;
+}
+} // namespace detail
+
+inline bool fits(const Record &record, uint32_t baseTimestamp)
+{
+    return record.timestamp >= baseTimestamp && record.timestamp - baseTimestamp <= MAX_DELTA;
+}
+
+// Values beyond a field's range are saturated; the caller checks fits()
+inline void encode(const Record &record, uint32_t baseTimestamp, uint8_t *out)
+{
+    detail::put(out, record.timestamp - baseTimestamp, 3);
+    out[3] = record.user;
+    detail::put(out + 4, record.weightGrams < MAX_WEIGHT ? record.weightGrams : MAX_WEIGHT, 3);
+    out[7] = record.flags;
+    detail::put(out + 8, record.impedance, 2);
+    detail::put(out + 10, record.fat < MAX_FAT ? record.fat : MAX_FAT, 3);
+    out[13] = 0;
+    detail::put(out + 14, Crc16Xmodem::compute(out, RECORD_SIZE - 2, CRC_SEED), 2);
+}
+
+// False if the CRC does not match
+inline bool decode(const uint8_t *in, uint32_t baseTimestamp, Record &record)
+{
+    if (Crc16Xmodem::compute(in, RECORD_SIZE - 2, CRC_SEED) != detail::get(in + 14, 2))
+    {
+        return false;
+    }
+    record.timestamp = baseTimestamp + detail::get(in, 3);
+    record.user = in[3];
+    record.weightGrams = detail::get(in + 4, 3);
+    record.flags = in[7];
+    record.impedance = detail::get(in + 8, 2);
+    record.fat = detail::get(in + 10, 3);
+    return true;
+}
+
+inline void encodeHeader(const SegmentHeader &header, uint8_t *out)
+{
+    out[0] = FORMAT_VERSION;
+    out[1] = RECORD_SIZE;
+    detail::put(out + 2, 0, 2);
+    detail::put(out + 4, header.firstSeq, 4);
+    detail::put(out + 8, header.baseTimestamp, 4);
+    detail::put(out + 12, 0, 2);
+    detail::put(out + 14, Crc16Xmodem::compute(out, HEADER_SIZE - 2, CRC_SEED), 2);
+}
+
+// False for another version or record size, or a bad CRC
+inline bool decodeHeader(const uint8_t *in, SegmentHeader &header)
+{
+    if (in[0] != FORMAT_VERSION || in[1] != RECORD_SIZE ||
+        Crc16Xmodem::compute(in, HEADER_SIZE - 2, CRC_SEED) != detail::get(in + 14, 2))
+    {
+        return false;
+    }
+    header.firstSeq = detail::get(in + 4, 4);
+    header.baseTimestamp = detail::get(in + 8, 4);
+    return true;
+}
+
+} // namespace history
@@ -0,0 +1,288 @@
+#pragma once
+
+// Per-user daily and weekly aggregates of weight, body fat and impedance,
+// updated in constant time per measurement.
+//
+// Each user has a ring of DAYS day buckets and WEEKS week buckets (UTC,
+// ISO weeks starting on Monday), addressed by day or week number modulo
+// the ring size; a measurement for a newer period simply resets the bucket
+// it lands in. Besides count, min, max and sum, every bucket keeps the
+// user's exponentially weighted moving average (alpha 1/8) as it stood
+// after the last measurement of the period. The moving average only
+// follows measurements in time order; a late one still counts towards its
+// bucket's other figures. Measurements from before MIN_TIMESTAMP, taken by
+// a scale whose clock was never set, are left out. When USERS users are
+// known, the one measured least recently is dropped. encode() and decode()
+// convert an entry to and from its on-flash form, which does not depend on
+// the compiler's struct layout. No allocation, not thread safe.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "packed_record.h"
+
+namespace history
+{
+
+enum Metric : uint8_t
+{
+    METRIC_WEIGHT, // grams
+    METRIC_FAT,    // 0.001 %
+    METRIC_IMPEDANCE,
+    METRICS
+};
+
+struct Aggregate
+{
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t ewma;
+    uint32_t reserved;
+};
+
+struct Bucket
+{
+    uint16_t day; // first day of the period, days since 1970-01-01; u32 time ends on day 49710
+    uint16_t count;
+    uint32_t reserved;
+    Aggregate metrics[METRICS];
+
+    uint32_t mean(Metric metric) const { return count ? static_cast<uint32_t>(metrics[metric].sum / count) : 0; }
+};
+
+constexpr uint32_t MIN_TIMESTAMP = 1577836800; // 2020-01-01
+
+// Days since 1970-01-01 of the Monday starting the ISO week of `day`, or 0
+// for the first days of 1970, whose Monday is before it
+inline uint32_t weekStart(uint32_t day)
+{
+    uint32_t sinceMonday = (day + 3) % 7; // 1970-01-01 was a Thursday
+    return day >= sinceMonday ? day - sinceMonday : 0;
+}
+
+// Serialized sizes, see RollupTable::encode()
+constexpr size_t AGGREGATE_SIZE = 20;
+constexpr size_t BUCKET_SIZE = 4 + METRICS * AGGREGATE_SIZE;
+
+template <size_t DAYS, size_t WEEKS>
+struct UserRollup
+{
+    uint8_t user;
+    uint8_t used;
+    uint16_t reserved;
+    uint32_t lastTimestamp; // newest measurement, for the moving average and eviction
+    int32_t ewma[METRICS];  // 8 fractional bits
+    Bucket days[DAYS];
+    Bucket weeks[WEEKS];
+};
+
+template <size_t USERS, size_t DAYS, size_t WEEKS>
+class RollupTable
+{
+public:
+    typedef UserRollup<DAYS, WEEKS> Entry;
+    static const size_t SIZE = USERS;
+    static const size_t ENTRY_SIZE = 6 + METRICS * 4 + (DAYS + WEEKS) * BUCKET_SIZE;
+
+    void clear() { memset(mEntries, 0, sizeof(mEntries)); }
+
+    void add(const Record &record)
+    {
+        if (record.timestamp < MIN_TIMESTAMP)
+        {
+            return;
+        }
+        Entry &entry = findOrAdd(record.user);
+        uint32_t values[METRICS] = {record.weightGrams, record.fat, record.impedance};
+
+        bool inOrder = record.timestamp >= entry.lastTimestamp;
+        if (inOrder)
+        {
+            for (size_t m = 0; m < METRICS; m++)
+            {
+                int32_t scaled = static_cast<int32_t>(values[m] << 8);
+                entry.ewma[m] = entry.lastTimestamp == 0 ? scaled : entry.ewma[m] + (scaled - entry.ewma[m]) / 8;
+            }
+            entry.lastTimestamp = record.timestamp;
+        }
+
+        uint32_t day = record.timestamp / 86400;
+        uint32_t week = (day + 3) / 7;
+        addTo(entry.days[day % DAYS], day, values, inOrder ? entry.ewma : nullptr);
+        addTo(entry.weeks[week % WEEKS], weekStart(day), values, inOrder ? entry.ewma : nullptr);
+    }
+
+    const Entry *find(uint8_t user) const
+    {
+        for (size_t i = 0; i < USERS; i++)
+        {
+            if (mEntries[i].used && mEntries[i].user == user)
+            {
+                return &mEntries[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // Non-empty buckets, newest first
+    static size_t sorted(const Bucket *ring, size_t size, Bucket *out)
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            if (ring[i].count == 0)
+            {
+                continue;
+            }
+            size_t pos = n++;
+            while (pos > 0 && out[pos - 1].day < ring[i].day)
+            {
+                out[pos] = out[pos - 1];
+                pos--;
+            }
+            out[pos] = ring[i];
+        }
+        return n;
+    }
+
+    const Entry &entry(size_t i) const { return mEntries[i]; }
+    Entry &entry(size_t i) { return mEntries[i]; }
+
+    // ENTRY_SIZE bytes, every field little-endian: u8 user, u8 used, u32
+    // newest timestamp, i32 moving average per metric, then the day and
+    // week buckets as u16 day, u16 count and per metric u32 min, u32 max,
+    // u64 sum, u32 moving average
+    static void encode(const Entry &entry, uint8_t *out)
+    {
+        out[0] = entry.user;
+        out[1] = entry.used;
+        detail::put(out + 2, entry.lastTimestamp, 4);
+        uint8_t *p = out + 6;
+        for (size_t m = 0; m < METRICS; m++, p += 4)
+        {
+            detail::put(p, static_cast<uint32_t>(entry.ewma[m]), 4);
+        }
+        for (size_t i = 0; i < DAYS; i++, p += BUCKET_SIZE)
+        {
+            encodeBucket(entry.days[i], p);
+        }
+        for (size_t i = 0; i < WEEKS; i++, p += BUCKET_SIZE)
+        {
+            encodeBucket(entry.weeks[i], p);
+        }
+    }
+
+    static void decode(const uint8_t *in, Entry &entry)
+    {
+        memset(&entry, 0, sizeof(entry));
+        entry.user = in[0];
+        entry.used = in[1] ? 1 : 0;
+        entry.lastTimestamp = detail::get(in + 2, 4);
+        const uint8_t *p = in + 6;
+        for (size_t m = 0; m < METRICS; m++, p += 4)
+        {
+            entry.ewma[m] = static_cast<int32_t>(detail::get(p, 4));
+        }
+        for (size_t i = 0; i < DAYS; i++, p += BUCKET_SIZE)
+        {
+            decodeBucket(p, entry.days[i]);
+        }
+        for (size_t i = 0; i < WEEKS; i++, p += BUCKET_SIZE)
+        {
+            decodeBucket(p, entry.weeks[i]);
+        }
+    }
+
+private:
+    Entry &findOrAdd(uint8_t user)
+    {
+        size_t victim = 0;
+        for (size_t i = 0; i < USERS; i++)
+        {
+            Entry &candidate = mEntries[i];
+            if (candidate.used && candidate.user == user)
+            {
+                return candidate;
+            }
+            if (mEntries[victim].used && (!candidate.used || candidate.lastTimestamp < mEntries[victim].lastTimestamp))
+            {
+                victim = i;
+            }
+        }
+        Entry &entry = mEntries[victim];
+        memset(&entry, 0, sizeof(entry));
+        entry.user = user;
+        entry.used = 1;
+        return entry;
+    }
+
+    static void encodeBucket(const Bucket &bucket, uint8_t *out)
+    {
+        detail::put(out, bucket.day, 2);
+        detail::put(out + 2, bucket.count, 2);
+        uint8_t *p = out + 4;
+        for (size_t m = 0; m < METRICS; m++, p += AGGREGATE_SIZE)
+        {
+            const Aggregate &aggregate = bucket.metrics[m];
+            detail::put(p, aggregate.min, 4);
+            detail::put(p + 4, aggregate.max, 4);
+            detail::put(p + 8, static_cast<uint32_t>(aggregate.sum), 4);
+            detail::put(p + 12, static_cast<uint32_t>(aggregate.sum >> 32), 4);
+            detail::put(p + 16, aggregate.ewma, 4);
+        }
+    }
+
+    static void decodeBucket(const uint8_t *in, Bucket &bucket)
+    {
+        bucket.day = static_cast<uint16_t>(detail::get(in, 2));
+        bucket.count = static_cast<uint16_t>(detail::get(in + 2, 2));
+        const uint8_t *p = in + 4;
+        for (size_t m = 0; m < METRICS; m++, p += AGGREGATE_SIZE)
+        {
+            Aggregate &aggregate = bucket.metrics[m];
+            aggregate.min = detail::get(p, 4);
+            aggregate.max = detail::get(p + 4, 4);
+            aggregate.sum = detail::get(p + 8, 4) | static_cast<uint64_t>(detail::get(p + 12, 4)) << 32;
+            aggregate.ewma = detail::get(p + 16, 4);
+        }
+    }
+
+    static void addTo(Bucket &bucket, uint32_t day, const uint32_t *values, const int32_t *ewma)
+    {
+        if (bucket.count && bucket.day > day)
+        {
+            return; // older than the ring reaches
+        }
+        if (!bucket.count || bucket.day != day)
+        {
+            memset(&bucket, 0, sizeof(bucket));
+            bucket.day = static_cast<uint16_t>(day);
+            for (size_t m = 0; m < METRICS; m++)
+            {
+                bucket.metrics[m].min = UINT32_MAX;
+            }
+        }
+        bucket.count++;
+        for (size_t m = 0; m < METRICS; m++)
+        {
+            Aggregate &aggregate = bucket.metrics[m];
+            aggregate.min = values[m] < aggregate.min ? values[m] : aggregate.min;
+            aggregate.max = values[m] > aggregate.max ? values[m] : aggregate.max;
+            aggregate.sum += values[m];
+            if (ewma)
+            {
+                aggregate.ewma = static_cast<uint32_t>((ewma[m] + 128) >> 8);
+            }
+            else if (bucket.count == 1)
+            {
+                aggregate.ewma = values[m]; // a period seen only late starts from its first value
+            }
+        }
+    }
+
+    Entry mEntries[USERS] = {};
+};
+
+} // namespace history
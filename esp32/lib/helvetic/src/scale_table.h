@@ -0,0 +1,141 @@
+#pragma once
+
+// What the gateway knows about each Aria that uploads to it, keyed by MAC.
+//
+// Open addressing with linear probing over 2 * CAPACITY slots, so a lookup
+// hashes the MAC and usually reads one slot. The entries are plain bytes
+// and can be written to flash and read back as they are. When the table is
+// full, the scale seen least recently is forgotten. No allocation, not
+// thread safe.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aria_protocol.h"
+
+namespace aria
+{
+
+struct ScaleState
+{
+    uint8_t mac[MAC_SIZE];
+    uint8_t batteryPercent;
+    uint8_t userMask; // bit i: user table entry i has weighed in on this scale
+    uint8_t authCode[AUTH_CODE_SIZE];
+    uint32_t firmwareVersion;
+    uint32_t firstSeen; // our clock
+    uint32_t lastSeen;
+    int32_t clockSkew; // scale clock minus ours at the last upload, seconds
+    uint32_t uploads;
+    uint32_t measurements;
+};
+
+template <size_t CAPACITY>
+class ScaleTable
+{
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "ScaleTable capacity must be a power of two");
+
+public:
+    static constexpr size_t SLOTS = 2 * CAPACITY;
+
+    ScaleState *find(const uint8_t *mac)
+    {
+        for (size_t i = home(mac); mUsed[i]; i = (i + 1) & (SLOTS - 1))
+        {
+            if (memcmp(mSlots[i].mac, mac, MAC_SIZE) == 0)
+            {
+                return &mSlots[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // Existing entry for the MAC, or a new zeroed one (`added` is set then)
+    ScaleState &findOrAdd(const uint8_t *mac, bool &added)
+    {
+        size_t i = home(mac);
+        for (; mUsed[i]; i = (i + 1) & (SLOTS - 1))
+        {
+            if (memcmp(mSlots[i].mac, mac, MAC_SIZE) == 0)
+            {
+                added = false;
+                return mSlots[i];
+            }
+        }
+
+        if (mCount == CAPACITY)
+        {
+            eraseSlot(leastRecent());
+            for (i = home(mac); mUsed[i]; i = (i + 1) & (SLOTS - 1))
+            {
+            }
+        }
+        mSlots[i] = ScaleState{};
+        memcpy(mSlots[i].mac, mac, MAC_SIZE);
+        mUsed[i] = true;
+        mCount++;
+        added = true;
+        return mSlots[i];
+    }
+
+    // Restores an entry read back from flash
+    void restore(const ScaleState &state)
+    {
+        bool added;
+        ScaleState &entry = findOrAdd(state.mac, added);
+        entry = state;
+    }
+
+    size_t size() const { return mCount; }
+
+    // Iteration over the slots: skip those where used() is false
+    bool used(size_t slot) const { return mUsed[slot]; }
+    const ScaleState &slot(size_t slot) const { return mSlots[slot]; }
+
+private:
+    static size_t home(const uint8_t *mac)
+    {
+        // The low three bytes are the per-device part of the MAC
+        uint32_t x = (uint32_t)mac[3] << 16 | (uint32_t)mac[4] << 8 | mac[5];
+        x ^= (uint32_t)mac[2] << 24;
+        x *= 0x9E3779B1u;
+        return (x >> 16) & (SLOTS - 1);
+    }
+
+    size_t leastRecent() const
+    {
+        size_t oldest = SLOTS;
+        for (size_t i = 0; i < SLOTS; i++)
+        {
+            if (mUsed[i] && (oldest == SLOTS || mSlots[i].lastSeen < mSlots[oldest].lastSeen))
+            {
+                oldest = i;
+            }
+        }
+        return oldest;
+    }
+
+    // Backward-shift deletion, see DedupeSet
+    void eraseSlot(size_t i)
+    {
+        size_t gap = i;
+        for (size_t j = (i + 1) & (SLOTS - 1); mUsed[j]; j = (j + 1) & (SLOTS - 1))
+        {
+            size_t want = home(mSlots[j].mac);
+            if (((j - want) & (SLOTS - 1)) >= ((j - gap) & (SLOTS - 1)))
+            {
+                mSlots[gap] = mSlots[j];
+                gap = j;
+            }
+        }
+        mUsed[gap] = false;
+        mCount--;
+    }
+
+    ScaleState mSlots[SLOTS] = {};
+    bool mUsed[SLOTS] = {};
+    size_t mCount = 0;
+};
+
+} // namespace aria
@@ -0,0 +1,144 @@
+#pragma once
+
+// SHA-256 (FIPS 180-4) over data fed in pieces of any size, for checking
+// firmware images against their published hashes. Portable and small
+// rather than fast: about one block of state, no tables beyond the round
+// constants.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+class Sha256
+{
+public:
+    static constexpr size_t DIGEST_SIZE = 32;
+
+    Sha256() { reset(); }
+
+    void reset()
+    {
+        static const uint32_t INITIAL[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(mState, INITIAL, sizeof(mState));
+        mLength = 0;
+        mFill = 0;
+    }
+
+    void update(const uint8_t *data, size_t length)
+    {
+        mLength += length;
+        while (length > 0)
+        {
+            size_t take = sizeof(mBlock) - mFill < length ? sizeof(mBlock) - mFill : length;
+            memcpy(mBlock + mFill, data, take);
+            mFill += take;
+            data += take;
+            length -= take;
+            if (mFill == sizeof(mBlock))
+            {
+                compress(mBlock);
+                mFill = 0;
+            }
+        }
+    }
+
+    void finish(uint8_t *digest)
+    {
+        uint64_t bits = mLength * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (mFill != 56)
+        {
+            update(&pad, 1);
+        }
+        uint8_t length[8];
+        for (size_t i = 0; i < 8; i++)
+        {
+            length[i] = static_cast<uint8_t>(bits >> (56 - i * 8));
+        }
+        update(length, sizeof(length));
+        for (size_t i = 0; i < 8; i++)
+        {
+            digest[i * 4] = static_cast<uint8_t>(mState[i] >> 24);
+            digest[i * 4 + 1] = static_cast<uint8_t>(mState[i] >> 16);
+            digest[i * 4 + 2] = static_cast<uint8_t>(mState[i] >> 8);
+            digest[i * 4 + 3] = static_cast<uint8_t>(mState[i]);
+        }
+    }
+
+    // 64 lowercase hex digits to bytes; false if malformed
+    static bool parseHex(const char *hex, uint8_t *digest)
+    {
+        for (size_t i = 0; i < DIGEST_SIZE * 2; i++)
+        {
+            char c = hex[i];
+            uint8_t nibble = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : 0xFF;
+            if (nibble == 0xFF)
+            {
+                return false;
+            }
+            digest[i / 2] = static_cast<uint8_t>(i % 2 ? digest[i / 2] | nibble : nibble << 4);
+        }
+        return hex[DIGEST_SIZE * 2] == '\0';
+    }
+
+private:
+    static uint32_t rotr(uint32_t x, unsigned n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const uint8_t *block)
+    {
+        static const uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+        uint32_t w[64];
+        for (size_t i = 0; i < 16; i++)
+        {
+            w[i] = static_cast<uint32_t>(block[i * 4]) << 24 | static_cast<uint32_t>(block[i * 4 + 1]) << 16 |
+                   static_cast<uint32_t>(block[i * 4 + 2]) << 8 | block[i * 4 + 3];
+        }
+        for (size_t i = 16; i < 64; i++)
+        {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = mState[0], b = mState[1], c = mState[2], d = mState[3];
+        uint32_t e = mState[4], f = mState[5], g = mState[6], h = mState[7];
+        for (size_t i = 0; i < 64; i++)
+        {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        mState[0] += a;
+        mState[1] += b;
+        mState[2] += c;
+        mState[3] += d;
+        mState[4] += e;
+        mState[5] += f;
+        mState[6] += g;
+        mState[7] += h;
+    }
+
+    uint32_t mState[8];
+    uint8_t mBlock[64];
+    size_t mFill;
+    uint64_t mLength;
+};
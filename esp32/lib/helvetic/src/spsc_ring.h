@@ -0,0 +1,79 @@
+#pragma once
+
+// Bounded lock-free single-producer/single-consumer ring.
+//
+// push() may only be called from one thread and pop() from one other thread.
+// Indices grow without wrapping the array; the difference head - tail is the
+// queue depth, so all N slots are usable. Only std::atomic is used, so the
+// same code runs on FreeRTOS and on host threads.
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    static constexpr size_t CAPACITY = N;
+
+    // Producer side. Returns false and counts a drop when the ring is full.
+    bool push(const T &item)
+    {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        size_t tail = mTail.load(std::memory_order_acquire);
+        if (head - tail == N)
+        {
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        mItems[head & (N - 1)] = item;
+        mHead.store(head + 1, std::memory_order_release);
+
+        size_t depth = head + 1 - tail;
+        if (depth > mHighWatermark.load(std::memory_order_relaxed))
+        {
+            mHighWatermark.store(depth, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T &item) { return pop(&item, 1) == 1; }
+
+    size_t pop(T *items, size_t max)
+    {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        size_t head = mHead.load(std::memory_order_acquire);
+        size_t count = head - tail;
+        if (count > max)
+        {
+            count = max;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            items[i] = mItems[(tail + i) & (N - 1)];
+        }
+        mTail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Approximate when called concurrently with the other side
+    size_t size() const
+    {
+        return mHead.load(std::memory_order_acquire) - mTail.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+
+    uint32_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+    size_t highWatermark() const { return mHighWatermark.load(std::memory_order_relaxed); }
+
+private:
+    T mItems[N];
+    std::atomic<size_t> mHead{0};
+    std::atomic<size_t> mTail{0};
+    std::atomic<uint32_t> mDropped{0};
+    std::atomic<size_t> mHighWatermark{0};
+};
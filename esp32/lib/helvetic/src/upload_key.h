@@ -0,0 +1,31 @@
+#pragma once
+
+// Dedupe key of an uploaded measurement, shared by the firmware's
+// UploadDedupe and the ingest server so both recognise the same re-sent
+// measurements, and their journals stay interchangeable.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aria_protocol.h"
+#include "dedupe_set.h"
+
+namespace aria
+{
+
+// Hash of (MAC, timestamp, weight, impedance); the Aria re-sends a
+// measurement with all of them unchanged
+inline uint64_t uploadKey(const uint8_t *mac, const Measurement &measurement)
+{
+    uint64_t macBits = 0;
+    for (size_t i = 0; i < MAC_SIZE; i++)
+    {
+        macBits = macBits << 8 | mac[i];
+    }
+    uint64_t h = dedupeHash(0, macBits);
+    h = dedupeHash(h, measurement.timestamp);
+    h = dedupeHash(h, (uint64_t)measurement.weight_g << 32 | measurement.impedance);
+    return h;
+}
+
+} // namespace aria
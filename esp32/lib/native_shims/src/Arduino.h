@@ -0,0 +1,43 @@
+#pragma once
+
+// Native stand-in for the parts of Arduino-ESP32 the firmware uses
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#include "WString.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+using std::max;
+using std::min;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long) {}
+    int available();
+    int read();
+    size_t write(const uint8_t *data, size_t length) { return fwrite(data, 1, length, stdout); }
+    size_t print(const char *str) { return fputs(str, stdout) >= 0 ? strlen(str) : 0; }
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    void flush() { fflush(stdout); }
+};
+
+extern HardwareSerial Serial;
+
+void setup();
+void loop();
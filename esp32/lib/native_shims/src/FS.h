@@ -0,0 +1,86 @@
+#pragma once
+
+// Arduino fs::FS backed by a host directory
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include "WString.h"
+
+namespace fs
+{
+
+enum SeekMode
+{
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+struct FileImpl;
+
+class File
+{
+public:
+    File() {}
+    explicit File(std::shared_ptr<FileImpl> impl) : mImpl(impl) {}
+
+    explicit operator bool() const;
+    size_t write(uint8_t byte) { return write(&byte, 1); }
+    size_t write(const uint8_t *data, size_t length);
+    size_t print(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+    size_t print(const String &str) { return write((const uint8_t *)str.c_str(), str.length()); }
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    int available();
+    int read();
+    int peek();
+    size_t read(uint8_t *data, size_t length);
+    size_t readBytes(char *data, size_t length) { return read((uint8_t *)data, length); }
+    size_t readBytesUntil(char terminator, char *data, size_t length);
+    String readStringUntil(char terminator);
+    void flush();
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close();
+    const char *path() const;
+    const char *name() const;
+    bool isDirectory() const;
+    File openNextFile(const char *mode = "r");
+    void rewindDirectory();
+
+private:
+    std::shared_ptr<FileImpl> mImpl;
+};
+
+class FS
+{
+public:
+    explicit FS(const char *rootEnv, const char *defaultRoot) : mRootEnv(rootEnv), mDefaultRoot(defaultRoot) {}
+
+    File open(const char *path, const char *mode = "r", bool create = false);
+    File open(const String &path, const char *mode = "r", bool create = false) { return open(path.c_str(), mode, create); }
+    bool exists(const char *path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+    bool mkdir(const char *path);
+    bool rmdir(const char *path);
+
+    // Host directory that stands in for the partition
+    std::string hostPath(const char *path);
+
+protected:
+    const char *mRootEnv;
+    const char *mDefaultRoot;
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekSet;
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "WString.h"
+
+class IPAddress
+{
+public:
+    IPAddress() : IPAddress(0, 0, 0, 0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : mOctets{a, b, c, d} {}
+
+    uint8_t operator[](int index) const { return mOctets[index]; }
+    bool fromString(const char *address)
+    {
+        unsigned a, b, c, d;
+        char extra;
+        if (sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &extra) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+        {
+            return false;
+        }
+        mOctets[0] = a;
+        mOctets[1] = b;
+        mOctets[2] = c;
+        mOctets[3] = d;
+        return true;
+    }
+    String toString() const
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", mOctets[0], mOctets[1], mOctets[2], mOctets[3]);
+        return String(buf);
+    }
+
+private:
+    uint8_t mOctets[4];
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "FS.h"
+
+namespace fs
+{
+
+class LittleFSFS : public FS
+{
+public:
+    // HELVETIC_FS_DIR selects the directory, ./native_fs by default
+    LittleFSFS() : FS("HELVETIC_FS_DIR", "native_fs") {}
+    bool begin(bool formatOnFail = false, const char *basePath = "/littlefs", uint8_t maxOpenFiles = 10, const char *partitionLabel = "spiffs");
+    void end() {}
+    bool format();
+    size_t totalBytes();
+    size_t usedBytes();
+};
+
+} // namespace fs
+
+extern fs::LittleFSFS LittleFS;
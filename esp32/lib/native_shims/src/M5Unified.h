@@ -0,0 +1,113 @@
+#pragma once
+
+// M5Unified stand-in: a text-buffer display, a fixed battery and a virtual RTC
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include "WString.h"
+
+static const uint16_t BLACK = 0x0000;
+static const uint16_t WHITE = 0xFFFF;
+static const uint16_t RED = 0xF800;
+static const uint16_t GREEN = 0x07E0;
+static const uint16_t BLUE = 0x001F;
+static const uint16_t YELLOW = 0xFFE0;
+static const uint16_t ORANGE = 0xFDA0;
+
+namespace m5
+{
+
+struct rtc_date_t
+{
+    int16_t year;
+    int8_t month;
+    int8_t date;
+    int8_t weekDay;
+};
+
+struct rtc_time_t
+{
+    int8_t hours;
+    int8_t minutes;
+    int8_t seconds;
+};
+
+struct rtc_datetime_t
+{
+    rtc_date_t date;
+    rtc_time_t time;
+};
+
+// Host clock plus an adjustable offset. HELVETIC_RTC_OFFSET (seconds) sets
+// the initial skew and HELVETIC_RTC_DISABLED=1 simulates a missing RTC.
+class RTC_Class
+{
+public:
+    bool isEnabled() const;
+    rtc_datetime_t getDateTime() const;
+    void setDateTime(const rtc_datetime_t &datetime);
+    void setDateTime(const tm *datetime);
+
+    // Simulation controls, not part of M5Unified
+    time_t now() const;
+    void adjust(int64_t seconds) { mOffset += seconds; }
+    uint32_t readCount() const { return mReads; }
+
+private:
+    void init() const;
+
+    mutable bool mInitialised = false;
+    mutable int64_t mOffset = 0;
+    mutable bool mEnabled = true;
+    mutable uint32_t mReads = 0;
+};
+
+// Keeps the last full frame as text; HELVETIC_DISPLAY=1 echoes it to stdout
+class Display_Class
+{
+public:
+    void setRotation(uint8_t) {}
+    void fillScreen(uint16_t) { mFrame.clear(); }
+    void setCursor(int32_t x, int32_t y);
+    void setTextColor(uint16_t, uint16_t = BLACK) {}
+    void setTextSize(float) {}
+    size_t println(const char *text = "");
+    size_t print(const char *text);
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    int32_t width() const { return 240; }
+    int32_t height() const { return 135; }
+
+    const std::string &lastFrame() const { return mLastFrame; }
+
+private:
+    std::string mFrame;
+    std::string mLastFrame;
+};
+
+class Power_Class
+{
+public:
+    int32_t getBatteryLevel() const;
+};
+
+struct config_t
+{
+    bool serial_begin = true;
+};
+
+class M5Unified
+{
+public:
+    config_t config() const { return config_t(); }
+    void begin(const config_t &) {}
+    void update() {}
+
+    Display_Class Display;
+    Power_Class Power;
+    RTC_Class Rtc;
+};
+
+} // namespace m5
+
+extern m5::M5Unified M5;
@@ -0,0 +1,285 @@
+#pragma once
+
+// Recording NimBLE stand-in. No radio: values, notifications and advertising
+// changes are kept in memory and logged under the NIMBLE_SIM tag.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define BLE_HS_CONN_HANDLE_NONE 0xFFFF
+#define BLE_GAP_LE_PHY_1M_MASK 0x01
+#define BLE_GAP_LE_PHY_2M_MASK 0x02
+#define BLE_GAP_LE_PHY_CODED_MASK 0x04
+#define BLE_HCI_LE_PHY_1M 1
+#define BLE_HCI_LE_PHY_2M 2
+#define BLE_HCI_LE_PHY_CODED 3
+
+class NimBLEServer;
+class NimBLEService;
+class NimBLECharacteristic;
+#if CONFIG_BT_NIMBLE_EXT_ADV
+class NimBLEExtAdvertising;
+typedef NimBLEExtAdvertising NimBLEAdvertisingType;
+#else
+class NimBLEAdvertising;
+typedef NimBLEAdvertising NimBLEAdvertisingType;
+#endif
+
+class NimBLEUUID
+{
+public:
+    NimBLEUUID() {}
+    NimBLEUUID(uint16_t uuid);
+    NimBLEUUID(const char *uuid) : mValue(uuid) {}
+    NimBLEUUID(const std::string &uuid) : mValue(uuid) {}
+    std::string toString() const { return mValue; }
+    bool operator==(const NimBLEUUID &other) const { return mValue == other.mValue; }
+
+private:
+    std::string mValue;
+};
+
+class NimBLEAddress
+{
+public:
+    NimBLEAddress() {}
+    NimBLEAddress(const uint8_t *address, uint8_t type);
+    const uint8_t *getVal() const { return mValue; }
+    uint8_t getType() const { return mType; }
+    std::string toString() const;
+
+private:
+    uint8_t mValue[6] = {};
+    uint8_t mType = 0;
+};
+
+namespace NIMBLE_PROPERTY
+{
+enum : uint16_t
+{
+    BROADCAST = 0x0001,
+    READ = 0x0002,
+    WRITE_NR = 0x0004,
+    WRITE = 0x0008,
+    NOTIFY = 0x0010,
+    INDICATE = 0x0020
+};
+}
+
+class NimBLEConnInfo
+{
+public:
+    uint16_t getConnHandle() const { return mHandle; }
+    uint16_t getMTU() const { return mMtu; }
+    uint16_t getConnInterval() const { return mInterval; }
+    uint16_t getConnLatency() const { return mLatency; }
+    uint16_t getConnTimeout() const { return mTimeout; }
+    NimBLEAddress getAddress() const { return mAddress; }
+    NimBLEAddress getIdAddress() const { return mAddress; }
+    bool isBonded() const { return mBonded; }
+
+    uint16_t mHandle = 0;
+    uint16_t mMtu = 23;
+    uint16_t mInterval = 24; // 30 ms
+    uint16_t mLatency = 0;
+    uint16_t mTimeout = 400;
+    NimBLEAddress mAddress;
+    bool mBonded = false;
+};
+
+class NimBLECharacteristicCallbacks
+{
+public:
+    virtual ~NimBLECharacteristicCallbacks() {}
+    virtual void onRead(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) {}
+    virtual void onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) {}
+    virtual void onStatus(NimBLECharacteristic *pCharacteristic, int code) {}
+    virtual void onSubscribe(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo, uint16_t subValue) {}
+};
+
+class NimBLEServerCallbacks
+{
+public:
+    virtual ~NimBLEServerCallbacks() {}
+    virtual void onConnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo) {}
+    virtual void onDisconnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo, int reason) {}
+    virtual void onMTUChange(uint16_t MTU, NimBLEConnInfo &connInfo) {}
+    virtual void onConnParamsUpdate(NimBLEConnInfo &connInfo) {}
+    virtual void onPhyUpdate(NimBLEConnInfo &connInfo, uint8_t txPhy, uint8_t rxPhy) {}
+};
+
+class NimBLECharacteristic
+{
+public:
+    NimBLECharacteristic(const NimBLEUUID &uuid, uint16_t properties) : mUuid(uuid), mProperties(properties) {}
+
+    void setCallbacks(NimBLECharacteristicCallbacks *callbacks) { mCallbacks = callbacks; }
+    NimBLECharacteristicCallbacks *getCallbacks() const { return mCallbacks; }
+    void setValue(const uint8_t *data, size_t length) { mValue.assign((const char *)data, length); }
+    void setValue(const std::string &value) { mValue = value; }
+    std::string getValue() const { return mValue; }
+    NimBLEUUID getUUID() const { return mUuid; }
+    bool notify(uint16_t connHandle = BLE_HS_CONN_HANDLE_NONE);
+    bool notify(const uint8_t *data, size_t length, uint16_t connHandle = BLE_HS_CONN_HANDLE_NONE);
+
+    // Simulation hooks, not part of NimBLE
+    uint32_t notifyCount() const { return mNotifyCount; }
+    void simulateWrite(const uint8_t *data, size_t length);
+    void simulateRead();
+    void simulateSubscribe(NimBLEConnInfo &connInfo, uint16_t subValue);
+
+private:
+    NimBLEUUID mUuid;
+    uint16_t mProperties;
+    std::string mValue;
+    NimBLECharacteristicCallbacks *mCallbacks = nullptr;
+    uint32_t mNotifyCount = 0;
+};
+
+class NimBLEService
+{
+public:
+    explicit NimBLEService(const NimBLEUUID &uuid) : mUuid(uuid) {}
+    ~NimBLEService();
+    NimBLECharacteristic *createCharacteristic(const NimBLEUUID &uuid, uint16_t properties, uint16_t maxLen = 512);
+    NimBLECharacteristic *getCharacteristic(const NimBLEUUID &uuid);
+    bool start() { return true; }
+    NimBLEUUID getUUID() const { return mUuid; }
+
+private:
+    NimBLEUUID mUuid;
+    std::vector<NimBLECharacteristic *> mCharacteristics;
+};
+
+class NimBLEServer
+{
+public:
+    ~NimBLEServer();
+    NimBLEService *createService(const NimBLEUUID &uuid);
+    NimBLEService *getServiceByUUID(const NimBLEUUID &uuid);
+    void setCallbacks(NimBLEServerCallbacks *callbacks, bool deleteCallbacks = true) { mCallbacks = callbacks; }
+    uint32_t getConnectedCount() const { return mConnected; }
+    NimBLEAdvertisingType *getAdvertising();
+    bool start() { return true; }
+    bool disconnect(uint16_t connHandle, uint8_t reason = 0x13);
+    bool updateConnParams(uint16_t connHandle, uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout);
+    bool setDataLen(uint16_t connHandle, uint16_t txOctets);
+    bool updatePhy(uint16_t connHandle, uint8_t txPhyMask, uint8_t rxPhyMask, uint16_t phyOptions);
+    uint16_t getPeerMTU(uint16_t connHandle) const;
+
+    // Simulation hooks: a central connecting, negotiating and leaving
+    NimBLEConnInfo &simulateConnect(uint16_t mtu = 23, const uint8_t *address = nullptr);
+    void simulateDisconnect(uint16_t connHandle);
+    NimBLEConnInfo *findConnection(uint16_t connHandle);
+
+private:
+    std::vector<NimBLEService *> mServices;
+    std::vector<NimBLEConnInfo> mConnections;
+    NimBLEServerCallbacks *mCallbacks = nullptr;
+    uint32_t mConnected = 0;
+    uint16_t mNextHandle = 1;
+};
+
+#if CONFIG_BT_NIMBLE_EXT_ADV
+// BLE 5 advertising sets, as NimBLE builds them with CONFIG_BT_NIMBLE_EXT_ADV
+class NimBLEExtAdvertisement
+{
+public:
+    NimBLEExtAdvertisement(uint8_t primaryPhy = BLE_HCI_LE_PHY_1M, uint8_t secondaryPhy = BLE_HCI_LE_PHY_1M) {}
+    void setData(const uint8_t *data, size_t length) { mPayload.assign((const char *)data, length); }
+    bool setName(const std::string &name, bool isComplete = true);
+    void setConnectable(bool enable) { mConnectable = enable; }
+    void setScannable(bool enable) { mScannable = enable; }
+    void setLegacyAdvertising(bool enable) { mLegacy = enable; }
+    void setMinInterval(uint32_t interval) {}
+    void setMaxInterval(uint32_t interval) {}
+
+    std::string mPayload;
+    bool mConnectable = false;
+    bool mScannable = false;
+    bool mLegacy = false;
+};
+
+class NimBLEExtAdvertising
+{
+public:
+    bool setInstanceData(uint8_t instance, NimBLEExtAdvertisement &advertisement);
+    bool setScanResponseData(uint8_t instance, NimBLEExtAdvertisement &data);
+    bool start(uint8_t instance, int duration = 0, int maxEvents = 0);
+    bool stop(uint8_t instance);
+    bool isActive(uint8_t instance) const { return instance < MAX_INSTANCES && mActive[instance]; }
+
+    // Simulation state
+    static const uint8_t MAX_INSTANCES = 2;
+    bool setData(uint8_t instance, const std::string &data);
+    const std::string &data(uint8_t instance) const { return mData[instance]; }
+    uint32_t startCount() const { return mStarts; }
+    uint32_t stopCount() const { return mStops; }
+
+private:
+    bool mConfigured[MAX_INSTANCES] = {};
+    bool mActive[MAX_INSTANCES] = {};
+    std::string mData[MAX_INSTANCES];
+    uint32_t mStarts = 0;
+    uint32_t mStops = 0;
+};
+
+// The slice of the NimBLE host API used to update a running set
+struct os_mbuf
+{
+    std::string data;
+};
+os_mbuf *os_msys_get_pkthdr(uint16_t length, uint16_t userHeaderLength);
+int os_mbuf_append(os_mbuf *buffer, const void *data, uint16_t length);
+int os_mbuf_free_chain(os_mbuf *buffer);
+int ble_gap_ext_adv_set_data(uint8_t instance, os_mbuf *data);
+#else
+class NimBLEAdvertising
+{
+public:
+    bool addServiceUUID(const NimBLEUUID &uuid);
+    bool setServiceData(const NimBLEUUID &uuid, const std::string &data);
+    bool enableScanResponse(bool enable) { return true; }
+    bool setMinInterval(uint16_t interval) { return true; }
+    bool setMaxInterval(uint16_t interval) { return true; }
+    bool setName(const std::string &name) { return true; }
+    bool start(uint32_t duration = 0);
+    bool stop();
+    bool refreshAdvertisingData();
+    bool isAdvertising() const { return mAdvertising; }
+
+    // Simulation counters
+    uint32_t startCount() const { return mStarts; }
+    uint32_t stopCount() const { return mStops; }
+    uint32_t refreshCount() const { return mRefreshes; }
+    const std::string &serviceData() const { return mServiceData; }
+
+private:
+    bool mAdvertising = false;
+    uint32_t mStarts = 0;
+    uint32_t mStops = 0;
+    uint32_t mRefreshes = 0;
+    std::string mServiceData;
+};
+#endif
+
+class NimBLEDevice
+{
+public:
+    static bool init(const std::string &deviceName);
+    static bool deinit(bool clearAll = false) { return true; }
+    static NimBLEServer *createServer();
+    static NimBLEServer *getServer() { return sServer; }
+    static NimBLEAdvertisingType *getAdvertising();
+    static bool setMTU(uint16_t mtu);
+    static uint16_t getMTU() { return sMtu; }
+    static bool setPower(int8_t dbm) { return true; }
+    static bool setDefaultPhy(uint8_t txPhyMask, uint8_t rxPhyMask) { return true; }
+
+private:
+    static NimBLEServer *sServer;
+    static NimBLEAdvertisingType *sAdvertising;
+    static uint16_t sMtu;
+};
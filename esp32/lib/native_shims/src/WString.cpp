@@ -0,0 +1,73 @@
+#include "WString.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <strings.h>
+
+bool String::equalsIgnoreCase(const String &other) const
+{
+    return mStr.length() == other.mStr.length() && strcasecmp(mStr.c_str(), other.mStr.c_str()) == 0;
+}
+
+int String::indexOf(char c, size_t from) const
+{
+    size_t pos = mStr.find(c, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::indexOf(const String &str, size_t from) const
+{
+    size_t pos = mStr.find(str.mStr, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+}
+
+String String::substring(size_t from, size_t to) const
+{
+    if (from > to)
+    {
+        size_t tmp = from;
+        from = to;
+        to = tmp;
+    }
+    if (from >= mStr.length())
+    {
+        return String();
+    }
+    return String(mStr.substr(from, to - from));
+}
+
+void String::trim()
+{
+    size_t begin = 0;
+    size_t end = mStr.length();
+    while (begin < end && isspace((unsigned char)mStr[begin]))
+    {
+        begin++;
+    }
+    while (end > begin && isspace((unsigned char)mStr[end - 1]))
+    {
+        end--;
+    }
+    mStr = mStr.substr(begin, end - begin);
+}
+
+void String::toLowerCase()
+{
+    for (char &c : mStr)
+    {
+        c = tolower((unsigned char)c);
+    }
+}
+
+void String::replace(const String &from, const String &to)
+{
+    if (from.mStr.empty())
+    {
+        return;
+    }
+    size_t pos = 0;
+    while ((pos = mStr.find(from.mStr, pos)) != std::string::npos)
+    {
+        mStr.replace(pos, from.mStr.length(), to.mStr);
+        pos += to.mStr.length();
+    }
+}
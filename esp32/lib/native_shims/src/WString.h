@@ -0,0 +1,72 @@
+#pragma once
+
+// Minimal Arduino String on top of std::string
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+class String
+{
+public:
+    String() {}
+    String(const char *str) : mStr(str ? str : "") {}
+    String(const char *str, size_t length) : mStr(str, length) {}
+    String(const std::string &str) : mStr(str) {}
+    explicit String(char c) : mStr(1, c) {}
+    explicit String(int value) : mStr(std::to_string(value)) {}
+    explicit String(unsigned int value) : mStr(std::to_string(value)) {}
+    explicit String(long value) : mStr(std::to_string(value)) {}
+    explicit String(unsigned long value) : mStr(std::to_string(value)) {}
+
+    const char *c_str() const { return mStr.c_str(); }
+    size_t length() const { return mStr.length(); }
+    bool isEmpty() const { return mStr.empty(); }
+    char operator[](size_t index) const { return index < mStr.length() ? mStr[index] : 0; }
+    char &operator[](size_t index) { return mStr[index]; }
+
+    String &operator+=(const String &other)
+    {
+        mStr += other.mStr;
+        return *this;
+    }
+    String &operator+=(const char *other)
+    {
+        mStr += other ? other : "";
+        return *this;
+    }
+    String &operator+=(char c)
+    {
+        mStr += c;
+        return *this;
+    }
+    friend String operator+(const String &a, const String &b) { return String(a.mStr + b.mStr); }
+    friend String operator+(const String &a, const char *b) { return String(a.mStr + (b ? b : "")); }
+    friend String operator+(const char *a, const String &b) { return String((a ? a : "") + b.mStr); }
+    bool operator==(const String &other) const { return mStr == other.mStr; }
+    bool operator==(const char *other) const { return other && mStr == other; }
+    bool operator!=(const String &other) const { return mStr != other.mStr; }
+
+    bool equals(const String &other) const { return mStr == other.mStr; }
+    bool equalsIgnoreCase(const String &other) const;
+    bool startsWith(const String &prefix) const { return mStr.compare(0, prefix.mStr.length(), prefix.mStr) == 0; }
+    bool endsWith(const String &suffix) const
+    {
+        return mStr.length() >= suffix.mStr.length() &&
+               mStr.compare(mStr.length() - suffix.mStr.length(), suffix.mStr.length(), suffix.mStr) == 0;
+    }
+    int indexOf(char c, size_t from = 0) const;
+    int indexOf(const String &str, size_t from = 0) const;
+    String substring(size_t from) const { return from < mStr.length() ? String(mStr.substr(from)) : String(); }
+    String substring(size_t from, size_t to) const;
+    void trim();
+    void toLowerCase();
+    long toInt() const { return strtol(mStr.c_str(), nullptr, 10); }
+    void replace(const String &from, const String &to);
+
+    const std::string &str() const { return mStr; }
+
+private:
+    std::string mStr;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+// Single-threaded HTTP/1.1 server on POSIX sockets with the arduino-esp32
+// 3.x WebServer interface. One connection is served per handleClient() and
+// closed afterwards. HELVETIC_HTTP_PORT overrides the port passed in.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "WString.h"
+#include "WiFiClient.h"
+
+#define HTTP_RAW_BUFLEN 1436
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define CONTENT_LENGTH_NOT_SET ((size_t)-2)
+
+enum HTTPMethod
+{
+    HTTP_ANY,
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_PATCH,
+    HTTP_DELETE,
+    HTTP_OPTIONS
+};
+
+enum HTTPRawStatus
+{
+    RAW_START,
+    RAW_WRITE,
+    RAW_END,
+    RAW_ABORTED
+};
+
+struct HTTPRaw
+{
+    HTTPRawStatus status;
+    size_t totalSize;
+    size_t currentSize;
+    uint8_t buf[HTTP_RAW_BUFLEN];
+    void *data;
+};
+
+class WebServer
+{
+public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    explicit WebServer(int port = 80) : mPort(port) {}
+    ~WebServer();
+
+    void begin();
+    void close();
+    void handleClient();
+
+    void on(const String &uri, THandlerFunction fn) { on(uri, HTTP_ANY, fn); }
+    void on(const String &uri, HTTPMethod method, THandlerFunction fn) { on(uri, method, fn, nullptr); }
+    void on(const String &uri, HTTPMethod method, THandlerFunction fn, THandlerFunction ufn);
+    void onNotFound(THandlerFunction fn) { mNotFound = fn; }
+
+    String uri() const { return mUri; }
+    HTTPMethod method() const { return mMethod; }
+    int args() const { return (int)mArgs.size(); }
+    String arg(int index) const { return index < args() ? mArgs[index].second : String(); }
+    String argName(int index) const { return index < args() ? mArgs[index].first : String(); }
+    String arg(const String &name) const;
+    bool hasArg(const String &name) const;
+    String header(const String &name) const;
+    bool hasHeader(const String &name) const;
+    // Every request header is kept, so there is nothing to select
+    void collectHeaders(const char *headerKeys[], size_t headerKeysCount) {}
+    HTTPRaw &raw() { return *mRaw; }
+    WiFiClient &client() { return mClient; }
+
+    void setContentLength(size_t length) { mContentLength = length; }
+    void sendHeader(const String &name, const String &value, bool first = false);
+    void send(int code, const char *contentType = nullptr, const String &content = String(""));
+    void send(int code, const String &contentType, const String &content) { send(code, contentType.c_str(), content); }
+    void send_P(int code, const char *contentType, const char *content, size_t contentLength);
+    void sendContent(const String &content) { sendContent(content.c_str(), content.length()); }
+    void sendContent(const char *content, size_t length);
+
+private:
+    struct Handler
+    {
+        String uri;
+        HTTPMethod method;
+        THandlerFunction fn;
+        THandlerFunction ufn;
+    };
+
+    bool readRequest();
+    bool readBody(const Handler *handler, const String &contentType);
+    size_t readSome(uint8_t *buf, size_t length);
+    void sendHeaders(int code, const char *contentType, size_t contentLength);
+    void parseArgs(const std::string &query);
+    const Handler *findHandler() const;
+
+    int mPort;
+    int mListenFd = -1;
+    WiFiClient mClient;
+    std::vector<Handler> mHandlers;
+    THandlerFunction mNotFound;
+
+    // Current request
+    String mUri;
+    HTTPMethod mMethod = HTTP_GET;
+    std::vector<std::pair<String, String>> mArgs;
+    std::vector<std::pair<String, String>> mRequestHeaders;
+    std::string mPending; // body bytes read along with the headers
+    size_t mRequestLength = 0;
+    std::unique_ptr<HTTPRaw> mRaw;
+
+    // Current response
+    std::string mResponseHeaders;
+    size_t mContentLength = CONTENT_LENGTH_NOT_SET;
+    bool mChunked = false;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+// The host's network stands in for the soft AP; nothing is configured
+
+#include <stdint.h>
+#include <functional>
+#include "IPAddress.h"
+#include "WiFiClient.h"
+
+typedef enum
+{
+    WIFI_OFF,
+    WIFI_STA,
+    WIFI_AP,
+    WIFI_AP_STA
+} wifi_mode_t;
+
+typedef enum
+{
+    ARDUINO_EVENT_WIFI_AP_STACONNECTED,
+    ARDUINO_EVENT_WIFI_AP_STADISCONNECTED
+} arduino_event_id_t;
+typedef arduino_event_id_t WiFiEvent_t;
+
+typedef union
+{
+    struct
+    {
+        uint8_t mac[6];
+    } wifi_ap_staconnected;
+    struct
+    {
+        uint8_t mac[6];
+    } wifi_ap_stadisconnected;
+} WiFiEventInfo_t;
+
+typedef void (*WiFiEventSysCb)(WiFiEvent_t event, WiFiEventInfo_t info);
+
+class WiFiClass
+{
+public:
+    bool mode(wifi_mode_t) { return true; }
+    bool softAP(const char *ssid, const char *password = nullptr);
+    IPAddress softAPIP() { return IPAddress(127, 0, 0, 1); }
+    int onEvent(WiFiEventSysCb) { return 0; }
+};
+
+extern WiFiClass WiFi;
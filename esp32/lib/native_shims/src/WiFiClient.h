@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Connected TCP socket handed out by WebServer::client()
+class WiFiClient
+{
+public:
+    WiFiClient() {}
+    explicit WiFiClient(int fd) : mFd(fd) {}
+
+    size_t write(const uint8_t *data, size_t length);
+    size_t write(uint8_t byte) { return write(&byte, 1); }
+    int read(uint8_t *data, size_t length);
+    bool connected() const { return mFd >= 0; }
+    int fd() const { return mFd; }
+    void stop();
+    explicit operator bool() const { return connected(); }
+
+private:
+    int mFd = -1;
+};
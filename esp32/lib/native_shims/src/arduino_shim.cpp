@@ -0,0 +1,74 @@
+#include "Arduino.h"
+#include <chrono>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <thread>
+#include <unistd.h>
+
+HardwareSerial Serial;
+
+unsigned long millis()
+{
+    return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)esp_timer_get_time();
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield()
+{
+    std::this_thread::yield();
+}
+
+// Serial input comes from stdin without blocking the loop
+int HardwareSerial::available()
+{
+    static bool nonBlocking = false;
+    if (!nonBlocking)
+    {
+        fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+        nonBlocking = true;
+    }
+    int c = getchar();
+    if (c == EOF)
+    {
+        clearerr(stdin);
+        return 0;
+    }
+    ungetc(c, stdin);
+    return 1;
+}
+
+int HardwareSerial::read()
+{
+    return available() ? getchar() : -1;
+}
+
+int HardwareSerial::printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int written = vprintf(format, args);
+    va_end(args);
+    return written;
+}
+
+// Arduino's main: setup() once, then loop() forever
+int main()
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    setup();
+    for (;;)
+    {
+        loop();
+        // The device spins freely; on a shared host give the CPU back
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
@@ -0,0 +1,93 @@
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <malloc.h>
+#include <map>
+#include <mutex>
+#include <stdarg.h>
+#include <string>
+
+// Function-local statics, global constructors already log before main()
+static std::chrono::steady_clock::time_point bootTime()
+{
+    static const auto boot = std::chrono::steady_clock::now();
+    return boot;
+}
+
+static std::map<std::string, esp_log_level_t> &levels()
+{
+    static std::map<std::string, esp_log_level_t> map;
+    return map;
+}
+
+static std::mutex logMutex;
+static esp_log_level_t defaultLogLevel = ESP_LOG_INFO;
+
+int64_t esp_timer_get_time()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bootTime()).count();
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    std::lock_guard<std::mutex> lock(logMutex);
+    if (tag[0] == '*' && tag[1] == 0)
+    {
+        defaultLogLevel = level;
+        levels().clear();
+        return;
+    }
+    levels()[tag] = level;
+}
+
+bool esp_log_enabled(const char *tag, esp_log_level_t level)
+{
+    std::lock_guard<std::mutex> lock(logMutex);
+    auto it = levels().find(tag);
+    return level <= (it == levels().end() ? defaultLogLevel : it->second);
+}
+
+void esp_log_write(esp_log_level_t, const char *, const char *format, ...)
+{
+    std::lock_guard<std::mutex> lock(logMutex);
+    printf("(%lld) ", (long long)(esp_timer_get_time() / 1000));
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    putchar('\n');
+    fflush(stdout);
+}
+
+static const size_t SIMULATED_HEAP = 320 * 1024;
+static std::atomic<size_t> minimumFree{SIMULATED_HEAP};
+
+size_t heap_caps_get_free_size(uint32_t)
+{
+    size_t used = std::min(mallinfo2().uordblks, SIMULATED_HEAP);
+    size_t free = SIMULATED_HEAP - used;
+    size_t minimum = minimumFree.load();
+    while (free < minimum && !minimumFree.compare_exchange_weak(minimum, free))
+    {
+    }
+    return free;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    heap_caps_get_free_size(caps);
+    return minimumFree.load();
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return heap_caps_get_free_size(caps);
+}
+
+size_t heap_caps_get_total_size(uint32_t)
+{
+    return SIMULATED_HEAP;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// FreeRTOS primitives used by the firmware, mapped onto std::thread
+
+#include <stdint.h>
+#include <mutex>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+// Critical sections become a plain mutex
+struct portMUX_TYPE
+{
+    std::recursive_mutex mutex;
+};
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define taskENTER_CRITICAL(mux) (mux)->mutex.lock()
+#define taskEXIT_CRITICAL(mux) (mux)->mutex.unlock()
+#define portENTER_CRITICAL(mux) taskENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL(mux) taskEXIT_CRITICAL(mux)
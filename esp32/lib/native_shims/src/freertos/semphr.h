@@ -0,0 +1,20 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef std::recursive_mutex *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new std::recursive_mutex(); }
+inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() { return new std::recursive_mutex(); }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t)
+{
+    sem->lock();
+    return pdTRUE;
+}
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    sem->unlock();
+    return pdTRUE;
+}
+#define xSemaphoreTakeRecursive xSemaphoreTake
+#define xSemaphoreGiveRecursive xSemaphoreGive
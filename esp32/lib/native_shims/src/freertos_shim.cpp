@@ -0,0 +1,94 @@
+#include "freertos/task.h"
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+struct NativeTask
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t notifications = 0;
+};
+
+static thread_local NativeTask *currentTask = nullptr;
+static const auto bootTime = std::chrono::steady_clock::now();
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *, uint32_t, void *arg,
+                                   UBaseType_t, TaskHandle_t *handle, BaseType_t)
+{
+    // Tasks live for the whole process, like the firmware's
+    NativeTask *task = new NativeTask();
+    if (handle)
+    {
+        *handle = task;
+    }
+    std::thread([fn, arg, task]()
+                {
+                    currentTask = task;
+                    fn(arg); })
+        .detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(fn, name, stackDepth, arg, priority, handle, 0);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+void vTaskDelete(TaskHandle_t)
+{
+    // Only ever used by a task on itself right before returning
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return (TickType_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return currentTask;
+}
+
+BaseType_t xPortGetCoreID()
+{
+    return currentTask ? 0 : 1;
+}
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->notifications++;
+    }
+    task->cv.notify_one();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait)
+{
+    NativeTask *task = currentTask;
+    if (!task)
+    {
+        return 0;
+    }
+    std::unique_lock<std::mutex> lock(task->mutex);
+    auto ready = [task]()
+    { return task->notifications > 0; };
+    if (ticksToWait == portMAX_DELAY)
+    {
+        task->cv.wait(lock, ready);
+    }
+    else if (!task->cv.wait_for(lock, std::chrono::milliseconds(ticksToWait), ready))
+    {
+        return 0;
+    }
+    uint32_t value = task->notifications;
+    task->notifications = clearOnExit ? 0 : value - 1;
+    return value;
+}
@@ -0,0 +1,315 @@
+#include "LittleFS.h"
+#include <dirent.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+fs::LittleFSFS LittleFS;
+
+// Partition size of the default 4MB layout
+static const size_t PARTITION_BYTES = 1441792;
+
+namespace fs
+{
+
+struct FileImpl
+{
+    std::string path;     // path inside the filesystem, "/history/0.log"
+    std::string hostPath; // where it lives on the host
+    FILE *file = nullptr;
+    DIR *dir = nullptr;
+
+    ~FileImpl()
+    {
+        if (file)
+        {
+            fclose(file);
+        }
+        if (dir)
+        {
+            closedir(dir);
+        }
+    }
+};
+
+File::operator bool() const
+{
+    return mImpl && (mImpl->file || mImpl->dir);
+}
+
+size_t File::write(const uint8_t *data, size_t length)
+{
+    return *this && mImpl->file ? fwrite(data, 1, length, mImpl->file) : 0;
+}
+
+int File::printf(const char *format, ...)
+{
+    if (!*this || !mImpl->file)
+    {
+        return 0;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vfprintf(mImpl->file, format, args);
+    va_end(args);
+    return written;
+}
+
+int File::available()
+{
+    if (!*this || !mImpl->file)
+    {
+        return 0;
+    }
+    long remaining = (long)size() - (long)position();
+    return remaining > 0 ? (int)remaining : 0;
+}
+
+int File::read()
+{
+    uint8_t byte;
+    return read(&byte, 1) == 1 ? byte : -1;
+}
+
+int File::peek()
+{
+    if (!*this || !mImpl->file)
+    {
+        return -1;
+    }
+    int c = fgetc(mImpl->file);
+    if (c != EOF)
+    {
+        ungetc(c, mImpl->file);
+    }
+    return c == EOF ? -1 : c;
+}
+
+size_t File::read(uint8_t *data, size_t length)
+{
+    return *this && mImpl->file ? fread(data, 1, length, mImpl->file) : 0;
+}
+
+size_t File::readBytesUntil(char terminator, char *data, size_t length)
+{
+    size_t count = 0;
+    while (count < length)
+    {
+        int c = read();
+        if (c < 0 || c == terminator)
+        {
+            break;
+        }
+        data[count++] = (char)c;
+    }
+    return count;
+}
+
+String File::readStringUntil(char terminator)
+{
+    String result;
+    for (int c = read(); c >= 0 && c != terminator; c = read())
+    {
+        result += (char)c;
+    }
+    return result;
+}
+
+void File::flush()
+{
+    if (*this && mImpl->file)
+    {
+        fflush(mImpl->file);
+        fsync(fileno(mImpl->file));
+    }
+}
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+    static const int whence[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+    return *this && mImpl->file && fseek(mImpl->file, pos, whence[mode]) == 0;
+}
+
+size_t File::position() const
+{
+    return *this && mImpl->file ? (size_t)ftell(mImpl->file) : 0;
+}
+
+size_t File::size() const
+{
+    if (!*this || !mImpl->file)
+    {
+        return 0;
+    }
+    fflush(mImpl->file);
+    struct stat st;
+    return fstat(fileno(mImpl->file), &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+void File::close()
+{
+    mImpl.reset();
+}
+
+const char *File::path() const
+{
+    return mImpl ? mImpl->path.c_str() : nullptr;
+}
+
+const char *File::name() const
+{
+    if (!mImpl)
+    {
+        return nullptr;
+    }
+    size_t slash = mImpl->path.rfind('/');
+    return mImpl->path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+bool File::isDirectory() const
+{
+    return mImpl && mImpl->dir;
+}
+
+File File::openNextFile(const char *mode)
+{
+    if (!isDirectory())
+    {
+        return File();
+    }
+    for (struct dirent *entry = readdir(mImpl->dir); entry; entry = readdir(mImpl->dir))
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        std::string child = mImpl->path == "/" ? "/" + std::string(entry->d_name) : mImpl->path + "/" + entry->d_name;
+        return LittleFS.open(child.c_str(), mode);
+    }
+    return File();
+}
+
+void File::rewindDirectory()
+{
+    if (isDirectory())
+    {
+        rewinddir(mImpl->dir);
+    }
+}
+
+std::string FS::hostPath(const char *path)
+{
+    const char *root = getenv(mRootEnv);
+    std::string host = root && root[0] ? root : mDefaultRoot;
+    if (path[0] != '/')
+    {
+        host += '/';
+    }
+    return host + path;
+}
+
+File FS::open(const char *path, const char *mode, bool)
+{
+    auto impl = std::make_shared<FileImpl>();
+    impl->path = path;
+    impl->hostPath = hostPath(path);
+
+    struct stat st;
+    if (stat(impl->hostPath.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        impl->dir = opendir(impl->hostPath.c_str());
+        return File(impl);
+    }
+
+    // Always binary; "r+" etc. keep their meaning
+    std::string hostMode = mode;
+    if (hostMode.find('b') == std::string::npos)
+    {
+        hostMode += 'b';
+    }
+    impl->file = fopen(impl->hostPath.c_str(), hostMode.c_str());
+    return impl->file ? File(impl) : File();
+}
+
+bool FS::exists(const char *path)
+{
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char *path)
+{
+    return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to)
+{
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char *path)
+{
+    return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::rmdir(const char *path)
+{
+    return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+bool LittleFSFS::begin(bool formatOnFail, const char *, uint8_t, const char *)
+{
+    std::string root = hostPath("");
+    struct stat st;
+    if (stat(root.c_str(), &st) == 0)
+    {
+        return S_ISDIR(st.st_mode);
+    }
+    return formatOnFail && ::mkdir(root.c_str(), 0755) == 0;
+}
+
+bool LittleFSFS::format()
+{
+    return false;
+}
+
+size_t LittleFSFS::totalBytes()
+{
+    return PARTITION_BYTES;
+}
+
+// Sum of file sizes, like littlefs without the block rounding
+static size_t directoryBytes(const std::string &path)
+{
+    size_t total = 0;
+    DIR *dir = opendir(path.c_str());
+    if (!dir)
+    {
+        return 0;
+    }
+    for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir))
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        std::string child = path + "/" + entry->d_name;
+        struct stat st;
+        if (stat(child.c_str(), &st) == 0)
+        {
+            total += S_ISDIR(st.st_mode) ? directoryBytes(child) : (size_t)st.st_size;
+        }
+    }
+    closedir(dir);
+    return total;
+}
+
+size_t LittleFSFS::usedBytes()
+{
+    return directoryBytes(hostPath(""));
+}
+
+} // namespace fs
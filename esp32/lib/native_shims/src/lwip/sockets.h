@@ -0,0 +1,9 @@
+#pragma once
+
+// lwIP exposes the BSD socket API under this name on the ESP32
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
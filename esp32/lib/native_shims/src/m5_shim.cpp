@@ -0,0 +1,117 @@
+#include "M5Unified.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+m5::M5Unified M5;
+
+namespace m5
+{
+
+void RTC_Class::init() const
+{
+    if (mInitialised)
+    {
+        return;
+    }
+    mInitialised = true;
+    const char *offset = getenv("HELVETIC_RTC_OFFSET");
+    mOffset = offset ? strtoll(offset, nullptr, 10) : 0;
+    const char *disabled = getenv("HELVETIC_RTC_DISABLED");
+    mEnabled = !(disabled && disabled[0] == '1');
+}
+
+bool RTC_Class::isEnabled() const
+{
+    init();
+    return mEnabled;
+}
+
+time_t RTC_Class::now() const
+{
+    init();
+    return time(nullptr) + mOffset;
+}
+
+rtc_datetime_t RTC_Class::getDateTime() const
+{
+    mReads++;
+    time_t t = now();
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    rtc_datetime_t dt;
+    dt.date.year = tm.tm_year + 1900;
+    dt.date.month = tm.tm_mon + 1;
+    dt.date.date = tm.tm_mday;
+    dt.date.weekDay = tm.tm_wday;
+    dt.time.hours = tm.tm_hour;
+    dt.time.minutes = tm.tm_min;
+    dt.time.seconds = tm.tm_sec;
+    return dt;
+}
+
+void RTC_Class::setDateTime(const rtc_datetime_t &datetime)
+{
+    struct tm tm = {};
+    tm.tm_year = datetime.date.year - 1900;
+    tm.tm_mon = datetime.date.month - 1;
+    tm.tm_mday = datetime.date.date;
+    tm.tm_hour = datetime.time.hours;
+    tm.tm_min = datetime.time.minutes;
+    tm.tm_sec = datetime.time.seconds;
+    setDateTime(&tm);
+}
+
+void RTC_Class::setDateTime(const tm *datetime)
+{
+    init();
+    struct tm copy = *datetime;
+    mOffset = (int64_t)timegm(&copy) - (int64_t)time(nullptr);
+}
+
+void Display_Class::setCursor(int32_t x, int32_t y)
+{
+    if (x == 0 && y == 0 && !mFrame.empty())
+    {
+        mLastFrame = mFrame;
+        mFrame.clear();
+        const char *echo = getenv("HELVETIC_DISPLAY");
+        if (echo && echo[0] == '1')
+        {
+            printf("---- display ----\n%s-----------------\n", mLastFrame.c_str());
+        }
+    }
+}
+
+size_t Display_Class::print(const char *text)
+{
+    mFrame += text;
+    return strlen(text);
+}
+
+size_t Display_Class::println(const char *text)
+{
+    size_t written = print(text);
+    mFrame += '\n';
+    return written + 1;
+}
+
+int Display_Class::printf(const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    mFrame += buf;
+    return written;
+}
+
+int32_t Power_Class::getBatteryLevel() const
+{
+    const char *level = getenv("HELVETIC_BATTERY");
+    return level ? atoi(level) : 100;
+}
+
+} // namespace m5
@@ -0,0 +1,432 @@
+#include "NimBLEDevice.h"
+#include <esp_log.h>
+#include <stdio.h>
+#include <algorithm>
+
+static const char *TAG = "NIMBLE_SIM";
+
+NimBLEServer *NimBLEDevice::sServer = nullptr;
+NimBLEAdvertisingType *NimBLEDevice::sAdvertising = nullptr;
+uint16_t NimBLEDevice::sMtu = 255;
+
+static std::string hexString(const std::string &value)
+{
+    std::string hex;
+    char buf[4];
+    for (unsigned char c : value)
+    {
+        snprintf(buf, sizeof(buf), "%02X ", c);
+        hex += buf;
+    }
+    return hex;
+}
+
+NimBLEAddress::NimBLEAddress(const uint8_t *address, uint8_t type) : mType(type)
+{
+    // Stored least significant byte first, as NimBLE does
+    for (size_t i = 0; i < 6; i++)
+    {
+        mValue[i] = address[5 - i];
+    }
+}
+
+std::string NimBLEAddress::toString() const
+{
+    char buf[18];
+    snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x", mValue[5], mValue[4], mValue[3], mValue[2],
+             mValue[1], mValue[0]);
+    return buf;
+}
+
+NimBLEUUID::NimBLEUUID(uint16_t uuid)
+{
+    char buf[8];
+    snprintf(buf, sizeof(buf), "0x%04x", uuid);
+    mValue = buf;
+}
+
+bool NimBLECharacteristic::notify(uint16_t connHandle)
+{
+    return notify((const uint8_t *)mValue.data(), mValue.size(), connHandle);
+}
+
+bool NimBLECharacteristic::notify(const uint8_t *data, size_t length, uint16_t connHandle)
+{
+    mNotifyCount++;
+    std::string value((const char *)data, length);
+    ESP_LOGD(TAG, "notify %s [%u bytes] %s", mUuid.toString().c_str(), (unsigned)length, hexString(value).c_str());
+    NimBLEServer *server = NimBLEDevice::getServer();
+    if (mCallbacks && server && server->getConnectedCount() > 0)
+    {
+        // Delivered immediately, the status callback reports success
+        mCallbacks->onStatus(this, 0);
+    }
+    return true;
+}
+
+void NimBLECharacteristic::simulateWrite(const uint8_t *data, size_t length)
+{
+    mValue.assign((const char *)data, length);
+    NimBLEConnInfo info;
+    if (mCallbacks)
+    {
+        mCallbacks->onWrite(this, info);
+    }
+}
+
+void NimBLECharacteristic::simulateSubscribe(NimBLEConnInfo &connInfo, uint16_t subValue)
+{
+    if (mCallbacks)
+    {
+        mCallbacks->onSubscribe(this, connInfo, subValue);
+    }
+}
+
+void NimBLECharacteristic::simulateRead()
+{
+    NimBLEConnInfo info;
+    if (mCallbacks)
+    {
+        mCallbacks->onRead(this, info);
+    }
+}
+
+NimBLEService::~NimBLEService()
+{
+    for (NimBLECharacteristic *characteristic : mCharacteristics)
+    {
+        delete characteristic;
+    }
+}
+
+NimBLECharacteristic *NimBLEService::createCharacteristic(const NimBLEUUID &uuid, uint16_t properties, uint16_t)
+{
+    NimBLECharacteristic *characteristic = new NimBLECharacteristic(uuid, properties);
+    mCharacteristics.push_back(characteristic);
+    return characteristic;
+}
+
+NimBLECharacteristic *NimBLEService::getCharacteristic(const NimBLEUUID &uuid)
+{
+    for (NimBLECharacteristic *characteristic : mCharacteristics)
+    {
+        if (characteristic->getUUID() == uuid)
+        {
+            return characteristic;
+        }
+    }
+    return nullptr;
+}
+
+NimBLEServer::~NimBLEServer()
+{
+    for (NimBLEService *service : mServices)
+    {
+        delete service;
+    }
+}
+
+NimBLEService *NimBLEServer::createService(const NimBLEUUID &uuid)
+{
+    NimBLEService *service = new NimBLEService(uuid);
+    mServices.push_back(service);
+    return service;
+}
+
+NimBLEService *NimBLEServer::getServiceByUUID(const NimBLEUUID &uuid)
+{
+    for (NimBLEService *service : mServices)
+    {
+        if (service->getUUID() == uuid)
+        {
+            return service;
+        }
+    }
+    return nullptr;
+}
+
+NimBLEAdvertisingType *NimBLEServer::getAdvertising()
+{
+    return NimBLEDevice::getAdvertising();
+}
+
+NimBLEConnInfo *NimBLEServer::findConnection(uint16_t connHandle)
+{
+    for (NimBLEConnInfo &info : mConnections)
+    {
+        if (info.mHandle == connHandle)
+        {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+bool NimBLEServer::disconnect(uint16_t connHandle, uint8_t reason)
+{
+    if (!findConnection(connHandle))
+    {
+        return false;
+    }
+    simulateDisconnect(connHandle);
+    return true;
+}
+
+bool NimBLEServer::updateConnParams(uint16_t connHandle, uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout)
+{
+    NimBLEConnInfo *info = findConnection(connHandle);
+    if (!info)
+    {
+        return false;
+    }
+    // The simulated central accepts the fastest interval offered
+    info->mInterval = minInterval;
+    info->mLatency = latency;
+    info->mTimeout = timeout;
+    ESP_LOGD(TAG, "conn %u params: interval %u-%u latency %u timeout %u", connHandle, minInterval, maxInterval, latency, timeout);
+    if (mCallbacks)
+    {
+        mCallbacks->onConnParamsUpdate(*info);
+    }
+    return true;
+}
+
+bool NimBLEServer::setDataLen(uint16_t connHandle, uint16_t txOctets)
+{
+    ESP_LOGD(TAG, "conn %u data length %u", connHandle, txOctets);
+    return findConnection(connHandle) != nullptr;
+}
+
+bool NimBLEServer::updatePhy(uint16_t connHandle, uint8_t txPhyMask, uint8_t rxPhyMask, uint16_t)
+{
+    NimBLEConnInfo *info = findConnection(connHandle);
+    if (!info)
+    {
+        return false;
+    }
+    if (mCallbacks)
+    {
+        mCallbacks->onPhyUpdate(*info, txPhyMask, rxPhyMask);
+    }
+    return true;
+}
+
+uint16_t NimBLEServer::getPeerMTU(uint16_t connHandle) const
+{
+    for (const NimBLEConnInfo &info : mConnections)
+    {
+        if (info.mHandle == connHandle)
+        {
+            return info.mMtu;
+        }
+    }
+    return 0;
+}
+
+NimBLEConnInfo &NimBLEServer::simulateConnect(uint16_t mtu, const uint8_t *address)
+{
+    NimBLEConnInfo info;
+    info.mHandle = mNextHandle++;
+    // A static random address per handle unless the caller picks one
+    uint8_t generated[6] = {0xC0, 0x00, 0x00, 0x00, 0x00, (uint8_t)info.mHandle};
+    info.mAddress = NimBLEAddress(address ? address : generated, 1);
+    mConnections.push_back(info);
+    mConnected++;
+    NimBLEConnInfo &conn = mConnections.back();
+    ESP_LOGI(TAG, "central %s connected, handle %u", conn.mAddress.toString().c_str(), conn.mHandle);
+    if (mCallbacks)
+    {
+        mCallbacks->onConnect(this, conn);
+    }
+    uint16_t negotiated = std::min(mtu, NimBLEDevice::getMTU());
+    if (negotiated > 23)
+    {
+        conn.mMtu = negotiated;
+        if (mCallbacks)
+        {
+            mCallbacks->onMTUChange(negotiated, conn);
+        }
+    }
+    return conn;
+}
+
+void NimBLEServer::simulateDisconnect(uint16_t connHandle)
+{
+    for (auto it = mConnections.begin(); it != mConnections.end(); ++it)
+    {
+        if (it->mHandle == connHandle)
+        {
+            NimBLEConnInfo info = *it;
+            mConnections.erase(it);
+            mConnected--;
+            ESP_LOGI(TAG, "central disconnected, handle %u", connHandle);
+            if (mCallbacks)
+            {
+                mCallbacks->onDisconnect(this, info, 0x13);
+            }
+            return;
+        }
+    }
+}
+
+#if CONFIG_BT_NIMBLE_EXT_ADV
+bool NimBLEExtAdvertisement::setName(const std::string &name, bool isComplete)
+{
+    mPayload += (char)(name.size() + 1);
+    mPayload += (char)(isComplete ? 0x09 : 0x08);
+    mPayload += name;
+    return true;
+}
+
+bool NimBLEExtAdvertising::setInstanceData(uint8_t instance, NimBLEExtAdvertisement &advertisement)
+{
+    // NimBLE refuses to reconfigure a running set
+    if (instance >= MAX_INSTANCES || mActive[instance])
+    {
+        return false;
+    }
+    if (advertisement.mLegacy && advertisement.mPayload.size() > 31)
+    {
+        ESP_LOGE(TAG, "legacy set %u: %u bytes of data", instance, (unsigned)advertisement.mPayload.size());
+        return false;
+    }
+    mConfigured[instance] = true;
+    ESP_LOGI(TAG, "set %u: %s%s", instance, advertisement.mLegacy ? "legacy" : "extended",
+             advertisement.mConnectable ? ", connectable" : "");
+    return setData(instance, advertisement.mPayload);
+}
+
+bool NimBLEExtAdvertising::setScanResponseData(uint8_t instance, NimBLEExtAdvertisement &data)
+{
+    ESP_LOGD(TAG, "set %u scan response: %s", instance, hexString(data.mPayload).c_str());
+    return instance < MAX_INSTANCES && mConfigured[instance];
+}
+
+bool NimBLEExtAdvertising::start(uint8_t instance, int, int)
+{
+    if (instance >= MAX_INSTANCES || !mConfigured[instance])
+    {
+        return false;
+    }
+    mStarts++;
+    mActive[instance] = true;
+    return true;
+}
+
+bool NimBLEExtAdvertising::stop(uint8_t instance)
+{
+    if (instance >= MAX_INSTANCES)
+    {
+        return false;
+    }
+    mStops++;
+    mActive[instance] = false;
+    return true;
+}
+
+bool NimBLEExtAdvertising::setData(uint8_t instance, const std::string &data)
+{
+    mData[instance] = data;
+    ESP_LOGD(TAG, "set %u data (%u bytes): %s", instance, (unsigned)data.size(), hexString(data).c_str());
+    return true;
+}
+
+os_mbuf *os_msys_get_pkthdr(uint16_t, uint16_t)
+{
+    return new os_mbuf();
+}
+
+int os_mbuf_append(os_mbuf *buffer, const void *data, uint16_t length)
+{
+    buffer->data.append((const char *)data, length);
+    return 0;
+}
+
+int os_mbuf_free_chain(os_mbuf *buffer)
+{
+    delete buffer;
+    return 0;
+}
+
+int ble_gap_ext_adv_set_data(uint8_t instance, os_mbuf *data)
+{
+    NimBLEExtAdvertising *advertising = NimBLEDevice::getAdvertising();
+    int rc = 0;
+    // A running set takes new data only in one HCI fragment
+    if (instance >= NimBLEExtAdvertising::MAX_INSTANCES ||
+        (advertising->isActive(instance) && data->data.size() > 251))
+    {
+        rc = 3; // BLE_HS_EINVAL
+    }
+    else
+    {
+        advertising->setData(instance, data->data);
+    }
+    delete data;
+    return rc;
+}
+#else
+bool NimBLEAdvertising::addServiceUUID(const NimBLEUUID &uuid)
+{
+    ESP_LOGD(TAG, "advertise service %s", uuid.toString().c_str());
+    return true;
+}
+
+bool NimBLEAdvertising::setServiceData(const NimBLEUUID &uuid, const std::string &data)
+{
+    mServiceData = data;
+    ESP_LOGD(TAG, "service data %s: %s", uuid.toString().c_str(), hexString(data).c_str());
+    return true;
+}
+
+bool NimBLEAdvertising::start(uint32_t)
+{
+    mStarts++;
+    mAdvertising = true;
+    return true;
+}
+
+bool NimBLEAdvertising::stop()
+{
+    mStops++;
+    mAdvertising = false;
+    return true;
+}
+
+bool NimBLEAdvertising::refreshAdvertisingData()
+{
+    mRefreshes++;
+    ESP_LOGD(TAG, "advertising data refreshed%s", mAdvertising ? " while advertising" : "");
+    return true;
+}
+#endif
+
+bool NimBLEDevice::init(const std::string &deviceName)
+{
+    ESP_LOGI(TAG, "init \"%s\"", deviceName.c_str());
+    return true;
+}
+
+NimBLEServer *NimBLEDevice::createServer()
+{
+    if (!sServer)
+    {
+        sServer = new NimBLEServer();
+    }
+    return sServer;
+}
+
+NimBLEAdvertisingType *NimBLEDevice::getAdvertising()
+{
+    if (!sAdvertising)
+    {
+        sAdvertising = new NimBLEAdvertisingType();
+    }
+    return sAdvertising;
+}
+
+bool NimBLEDevice::setMTU(uint16_t mtu)
+{
+    sMtu = mtu;
+    return true;
+}
@@ -0,0 +1,465 @@
+#include "WebServer.h"
+#include <esp_log.h>
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char *TAG = "HTTP_SIM";
+static const size_t MAX_HEADER_BYTES = 8192;
+static const int CLIENT_TIMEOUT_SEC = 5; // HTTP_MAX_DATA_WAIT
+
+static const char *statusText(int code)
+{
+    switch (code)
+    {
+    case 200:
+        return "OK";
+    case 206:
+        return "Partial Content";
+    case 302:
+        return "Found";
+    case 304:
+        return "Not Modified";
+    case 400:
+        return "Bad Request";
+    case 403:
+        return "Forbidden";
+    case 404:
+        return "Not Found";
+    case 416:
+        return "Range Not Satisfiable";
+    case 500:
+        return "Internal Server Error";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "";
+    }
+}
+
+static std::string urlDecode(const std::string &in)
+{
+    std::string out;
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        if (in[i] == '+')
+        {
+            out += ' ';
+        }
+        else if (in[i] == '%' && i + 2 < in.size() && isxdigit((unsigned char)in[i + 1]) && isxdigit((unsigned char)in[i + 2]))
+        {
+            out += (char)strtol(in.substr(i + 1, 2).c_str(), nullptr, 16);
+            i += 2;
+        }
+        else
+        {
+            out += in[i];
+        }
+    }
+    return out;
+}
+
+WebServer::~WebServer()
+{
+    close();
+}
+
+void WebServer::begin()
+{
+    const char *portEnv = getenv("HELVETIC_HTTP_PORT");
+    if (portEnv)
+    {
+        mPort = atoi(portEnv);
+    }
+
+    mListenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(mListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(mPort);
+    if (bind(mListenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(mListenFd, 64) != 0)
+    {
+        ESP_LOGE(TAG, "Cannot listen on port %d: %s (set HELVETIC_HTTP_PORT)", mPort, strerror(errno));
+        ::close(mListenFd);
+        mListenFd = -1;
+        return;
+    }
+    fcntl(mListenFd, F_SETFL, fcntl(mListenFd, F_GETFL) | O_NONBLOCK);
+    ESP_LOGI(TAG, "Listening on http://127.0.0.1:%d/", mPort);
+}
+
+void WebServer::close()
+{
+    if (mListenFd >= 0)
+    {
+        ::close(mListenFd);
+        mListenFd = -1;
+    }
+}
+
+void WebServer::on(const String &uri, HTTPMethod method, THandlerFunction fn, THandlerFunction ufn)
+{
+    mHandlers.push_back(Handler{uri, method, fn, ufn});
+}
+
+String WebServer::arg(const String &name) const
+{
+    for (const auto &arg : mArgs)
+    {
+        if (arg.first == name)
+        {
+            return arg.second;
+        }
+    }
+    return String();
+}
+
+bool WebServer::hasArg(const String &name) const
+{
+    for (const auto &arg : mArgs)
+    {
+        if (arg.first == name)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+String WebServer::header(const String &name) const
+{
+    for (const auto &header : mRequestHeaders)
+    {
+        if (header.first.equalsIgnoreCase(name))
+        {
+            return header.second;
+        }
+    }
+    return String();
+}
+
+bool WebServer::hasHeader(const String &name) const
+{
+    for (const auto &header : mRequestHeaders)
+    {
+        if (header.first.equalsIgnoreCase(name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+const WebServer::Handler *WebServer::findHandler() const
+{
+    for (const Handler &handler : mHandlers)
+    {
+        if (handler.uri == mUri && (handler.method == HTTP_ANY || handler.method == mMethod))
+        {
+            return &handler;
+        }
+    }
+    return nullptr;
+}
+
+void WebServer::handleClient()
+{
+    if (mListenFd < 0)
+    {
+        return;
+    }
+    int fd = accept(mListenFd, nullptr, nullptr);
+    if (fd < 0)
+    {
+        return;
+    }
+    timeval timeout = {CLIENT_TIMEOUT_SEC, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    mClient = WiFiClient(fd);
+
+    mArgs.clear();
+    mRequestHeaders.clear();
+    mPending.clear();
+    mResponseHeaders.clear();
+    mContentLength = CONTENT_LENGTH_NOT_SET;
+    mChunked = false;
+
+    if (readRequest())
+    {
+        const Handler *handler = findHandler();
+        if (readBody(handler, header("Content-Type")))
+        {
+            if (handler)
+            {
+                handler->fn();
+            }
+            else if (mNotFound)
+            {
+                mNotFound();
+            }
+            else
+            {
+                send(404, "text/plain", String("Not found: ") + mUri);
+            }
+        }
+    }
+    mClient.stop();
+}
+
+size_t WebServer::readSome(uint8_t *buf, size_t length)
+{
+    if (!mPending.empty())
+    {
+        size_t n = std::min(length, mPending.size());
+        memcpy(buf, mPending.data(), n);
+        mPending.erase(0, n);
+        return n;
+    }
+    int n = mClient.read(buf, length);
+    return n > 0 ? (size_t)n : 0;
+}
+
+bool WebServer::readRequest()
+{
+    std::string head;
+    uint8_t buf[1024];
+    size_t end;
+    while ((end = head.find("\r\n\r\n")) == std::string::npos)
+    {
+        if (head.size() > MAX_HEADER_BYTES)
+        {
+            return false;
+        }
+        int n = mClient.read(buf, sizeof(buf));
+        if (n <= 0)
+        {
+            return false;
+        }
+        head.append((const char *)buf, n);
+    }
+    mPending = head.substr(end + 4);
+    head.resize(end);
+
+    size_t lineEnd = head.find("\r\n");
+    std::string requestLine = head.substr(0, lineEnd);
+    size_t sp1 = requestLine.find(' ');
+    size_t sp2 = requestLine.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos)
+    {
+        return false;
+    }
+    std::string method = requestLine.substr(0, sp1);
+    std::string target = requestLine.substr(sp1 + 1, sp2 - sp1 - 1);
+
+    static const struct
+    {
+        const char *name;
+        HTTPMethod method;
+    } methods[] = {{"GET", HTTP_GET}, {"HEAD", HTTP_HEAD}, {"POST", HTTP_POST}, {"PUT", HTTP_PUT}, {"PATCH", HTTP_PATCH}, {"DELETE", HTTP_DELETE}, {"OPTIONS", HTTP_OPTIONS}};
+    mMethod = HTTP_GET;
+    for (const auto &m : methods)
+    {
+        if (method == m.name)
+        {
+            mMethod = m.method;
+        }
+    }
+
+    size_t query = target.find('?');
+    mUri = String(urlDecode(target.substr(0, query)));
+    if (query != std::string::npos)
+    {
+        parseArgs(target.substr(query + 1));
+    }
+
+    mRequestLength = 0;
+    size_t pos = lineEnd == std::string::npos ? head.size() : lineEnd + 2;
+    while (pos < head.size())
+    {
+        size_t next = head.find("\r\n", pos);
+        if (next == std::string::npos)
+        {
+            next = head.size();
+        }
+        std::string line = head.substr(pos, next - pos);
+        size_t colon = line.find(':');
+        if (colon != std::string::npos)
+        {
+            String name(line.substr(0, colon));
+            String value(line.substr(colon + 1));
+            value.trim();
+            if (name.equalsIgnoreCase("Content-Length"))
+            {
+                mRequestLength = strtoul(value.c_str(), nullptr, 10);
+            }
+            mRequestHeaders.emplace_back(name, value);
+        }
+        pos = next + 2;
+    }
+    return true;
+}
+
+void WebServer::parseArgs(const std::string &query)
+{
+    size_t pos = 0;
+    while (pos <= query.size())
+    {
+        size_t amp = query.find('&', pos);
+        if (amp == std::string::npos)
+        {
+            amp = query.size();
+        }
+        std::string pair = query.substr(pos, amp - pos);
+        if (!pair.empty())
+        {
+            size_t eq = pair.find('=');
+            std::string name = pair.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : pair.substr(eq + 1);
+            mArgs.emplace_back(String(urlDecode(name)), String(urlDecode(value)));
+        }
+        pos = amp + 1;
+    }
+}
+
+bool WebServer::readBody(const Handler *handler, const String &contentType)
+{
+    if (mMethod == HTTP_GET || mMethod == HTTP_HEAD)
+    {
+        return true;
+    }
+
+    // Same rule as arduino-esp32: a handler with an upload function gets the raw body
+    if (handler && handler->ufn && !contentType.startsWith("multipart/"))
+    {
+        if (!mRaw)
+        {
+            mRaw.reset(new HTTPRaw());
+        }
+        mRaw->status = RAW_START;
+        mRaw->totalSize = 0;
+        mRaw->currentSize = 0;
+        handler->ufn();
+        mRaw->status = RAW_WRITE;
+        while (mRaw->totalSize < mRequestLength)
+        {
+            size_t want = std::min(mRequestLength - mRaw->totalSize, (size_t)HTTP_RAW_BUFLEN);
+            mRaw->currentSize = readSome(mRaw->buf, want);
+            if (mRaw->currentSize == 0)
+            {
+                mRaw->status = RAW_ABORTED;
+                handler->ufn();
+                return false;
+            }
+            mRaw->totalSize += mRaw->currentSize;
+            handler->ufn();
+        }
+        mRaw->status = RAW_END;
+        handler->ufn();
+        return true;
+    }
+
+    std::string body;
+    uint8_t buf[1024];
+    while (body.size() < mRequestLength)
+    {
+        size_t n = readSome(buf, std::min(sizeof(buf), mRequestLength - body.size()));
+        if (n == 0)
+        {
+            return false;
+        }
+        body.append((const char *)buf, n);
+    }
+    if (contentType.startsWith("application/x-www-form-urlencoded"))
+    {
+        parseArgs(body);
+    }
+    else
+    {
+        mArgs.emplace_back(String("plain"), String(body));
+    }
+    return true;
+}
+
+void WebServer::sendHeader(const String &name, const String &value, bool first)
+{
+    std::string line = name.str() + ": " + value.str() + "\r\n";
+    if (first)
+    {
+        mResponseHeaders.insert(0, line);
+    }
+    else
+    {
+        mResponseHeaders += line;
+    }
+}
+
+void WebServer::sendHeaders(int code, const char *contentType, size_t contentLength)
+{
+    char status[64];
+    snprintf(status, sizeof(status), "HTTP/1.1 %d %s\r\n", code, statusText(code));
+    std::string head = status;
+    head += "Content-Type: ";
+    head += contentType ? contentType : "text/html";
+    head += "\r\n";
+
+    size_t length = mContentLength == CONTENT_LENGTH_NOT_SET ? contentLength : mContentLength;
+    if (length == CONTENT_LENGTH_UNKNOWN)
+    {
+        head += "Transfer-Encoding: chunked\r\n";
+        mChunked = true;
+    }
+    else
+    {
+        head += "Content-Length: " + std::to_string(length) + "\r\n";
+    }
+    head += mResponseHeaders;
+    head += "Connection: close\r\n\r\n";
+    mResponseHeaders.clear();
+    mContentLength = CONTENT_LENGTH_NOT_SET;
+    mClient.write((const uint8_t *)head.data(), head.size());
+}
+
+void WebServer::send(int code, const char *contentType, const String &content)
+{
+    sendHeaders(code, contentType, content.length());
+    if (content.length())
+    {
+        sendContent(content);
+    }
+}
+
+void WebServer::send_P(int code, const char *contentType, const char *content, size_t contentLength)
+{
+    sendHeaders(code, contentType, contentLength);
+    sendContent(content, contentLength);
+}
+
+void WebServer::sendContent(const char *content, size_t length)
+{
+    if (mChunked)
+    {
+        char size[16];
+        int n = snprintf(size, sizeof(size), "%zx\r\n", length);
+        mClient.write((const uint8_t *)size, n);
+        mClient.write((const uint8_t *)content, length);
+        mClient.write((const uint8_t *)"\r\n", 2);
+        if (length == 0)
+        {
+            mChunked = false;
+        }
+        return;
+    }
+    mClient.write((const uint8_t *)content, length);
+}
@@ -0,0 +1,55 @@
+#include "WiFi.h"
+#include <esp_log.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+WiFiClass WiFi;
+
+bool WiFiClass::softAP(const char *ssid, const char *)
+{
+    ESP_LOGI("WIFI_SIM", "softAP(\"%s\") - serving on the host network instead", ssid);
+    return true;
+}
+
+size_t WiFiClient::write(const uint8_t *data, size_t length)
+{
+    size_t sent = 0;
+    while (mFd >= 0 && sent < length)
+    {
+        ssize_t n = send(mFd, data + sent, length - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+int WiFiClient::read(uint8_t *data, size_t length)
+{
+    if (mFd < 0)
+    {
+        return -1;
+    }
+    ssize_t n;
+    do
+    {
+        n = recv(mFd, data, length, 0);
+    } while (n < 0 && errno == EINTR);
+    return (int)n;
+}
+
+void WiFiClient::stop()
+{
+    if (mFd >= 0)
+    {
+        close(mFd);
+        mFd = -1;
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <NimBLEDevice.h>
+#include <stddef.h>
+
+// How many centrals per-link state is kept for: as many as NimBLE accepts.
+// platformio.ini sets CONFIG_BT_NIMBLE_MAX_CONNECTIONS for the device
+// builds; where it doesn't (the debug and native envs) NimBLE's default of
+// 3 applies.
+#ifndef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 3
+#endif
+
+static const size_t BLE_MAX_LINKS = CONFIG_BT_NIMBLE_MAX_CONNECTIONS;
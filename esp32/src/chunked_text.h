@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+// Sink for text produced in pieces, e.g. WebServer::sendContent
+typedef void (*TextWriter)(void *context, const char *data, size_t length);
+
+// Collects formatted lines and hands them on in chunks of about a TCP segment
+class ChunkedText
+{
+public:
+    ChunkedText(TextWriter write, void *context) : mWrite(write), mContext(context) {}
+    ~ChunkedText() { flush(); }
+
+    void printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+
+    void vprintf(const char *format, va_list args)
+    {
+        if (sizeof(mBuffer) - mLength < MAX_LINE)
+        {
+            flush();
+        }
+        int n = vsnprintf(mBuffer + mLength, sizeof(mBuffer) - mLength, format, args);
+        if (n > 0)
+        {
+            mLength += min((size_t)n, sizeof(mBuffer) - mLength - 1);
+        }
+    }
+
+    // Raw bytes, for binary encodings
+    void write(const uint8_t *data, size_t length)
+    {
+        if (sizeof(mBuffer) - mLength < length)
+        {
+            flush();
+        }
+        if (length > sizeof(mBuffer))
+        {
+            mWrite(mContext, (const char *)data, length);
+            return;
+        }
+        memcpy(mBuffer + mLength, data, length);
+        mLength += length;
+    }
+
+    void flush()
+    {
+        if (mLength)
+        {
+            mWrite(mContext, mBuffer, mLength);
+            mLength = 0;
+        }
+    }
+
+private:
+    static const size_t MAX_LINE = 160;
+    TextWriter mWrite;
+    void *mContext;
+    char mBuffer[1024];
+    size_t mLength = 0;
+};
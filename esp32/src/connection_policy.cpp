@@ -0,0 +1,260 @@
+#include "connection_policy.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+
+static const char *TAG = "BLE_POLICY";
+
+// Connection parameters in 1.25 ms interval units and 10 ms timeout units
+static const uint16_t BULK_MIN_INTERVAL = 6; // 7.5 ms, the shortest allowed
+static const uint16_t BULK_MAX_INTERVAL = 12;
+static const uint16_t BULK_LATENCY = 0;
+static const uint16_t BULK_TIMEOUT = 400;
+static const uint16_t IDLE_MIN_INTERVAL = 80; // 100 ms
+static const uint16_t IDLE_MAX_INTERVAL = 160;
+static const uint16_t IDLE_LATENCY = 4; // the central may skip that many events while idle
+static const uint16_t IDLE_TIMEOUT = 600;
+static const uint16_t MAX_DATA_LENGTH = 251;
+
+ConnectionPolicy::Link *ConnectionPolicy::find(uint16_t connHandle)
+{
+    for (size_t i = 0; i < mLinkCount; i++)
+    {
+        if (mLinks[i].connHandle == connHandle)
+        {
+            return &mLinks[i];
+        }
+    }
+    return nullptr;
+}
+
+void ConnectionPolicy::onConnect(const NimBLEConnInfo &connInfo)
+{
+    taskENTER_CRITICAL(&mLock);
+    if (mLinkCount < MAX_LINKS && !find(connInfo.getConnHandle()))
+    {
+        Link &link = mLinks[mLinkCount++];
+        link = Link{};
+        link.connHandle = connInfo.getConnHandle();
+        link.mtu = connInfo.getMTU();
+        link.interval = connInfo.getConnInterval();
+        link.latency = connInfo.getConnLatency();
+        link.txPhy = 1;
+        link.rxPhy = 1;
+        link.mode = Mode::Connected;
+        link.lastActiveUs = esp_timer_get_time();
+    }
+    taskEXIT_CRITICAL(&mLock);
+}
+
+void ConnectionPolicy::onDisconnect(const NimBLEConnInfo &connInfo)
+{
+    taskENTER_CRITICAL(&mLock);
+    Link *link = find(connInfo.getConnHandle());
+    if (link)
+    {
+        *link = mLinks[--mLinkCount];
+    }
+    taskEXIT_CRITICAL(&mLock);
+}
+
+void ConnectionPolicy::onMtuChange(uint16_t mtu, const NimBLEConnInfo &connInfo)
+{
+    taskENTER_CRITICAL(&mLock);
+    Link *link = find(connInfo.getConnHandle());
+    if (link)
+    {
+        link->mtu = mtu;
+    }
+    taskEXIT_CRITICAL(&mLock);
+    ESP_LOGI(TAG, "Connection %u: MTU %u", connInfo.getConnHandle(), mtu);
+}
+
+void ConnectionPolicy::onConnParams(const NimBLEConnInfo &connInfo)
+{
+    taskENTER_CRITICAL(&mLock);
+    Link *link = find(connInfo.getConnHandle());
+    if (link)
+    {
+        link->interval = connInfo.getConnInterval();
+        link->latency = connInfo.getConnLatency();
+    }
+    taskEXIT_CRITICAL(&mLock);
+    ESP_LOGI(TAG, "Connection %u: interval %u.%02u ms, latency %u", connInfo.getConnHandle(),
+             connInfo.getConnInterval() * 125 / 100, connInfo.getConnInterval() * 125 % 100, connInfo.getConnLatency());
+}
+
+void ConnectionPolicy::onPhyUpdate(const NimBLEConnInfo &connInfo, uint8_t txPhy, uint8_t rxPhy)
+{
+    taskENTER_CRITICAL(&mLock);
+    Link *link = find(connInfo.getConnHandle());
+    if (link)
+    {
+        link->txPhy = txPhy;
+        link->rxPhy = rxPhy;
+    }
+    taskEXIT_CRITICAL(&mLock);
+    ESP_LOGI(TAG, "Connection %u: PHY tx %u rx %u", connInfo.getConnHandle(), txPhy, rxPhy);
+}
+
+void ConnectionPolicy::requestBulk(uint16_t connHandle)
+{
+    bool change = false;
+    bool requestFast = false;
+    taskENTER_CRITICAL(&mLock);
+    Link *link = find(connHandle);
+    if (link && link->mode != Mode::Bulk)
+    {
+        change = true;
+        requestFast = !link->fastRequested;
+        link->fastRequested = true;
+        link->mode = Mode::Bulk;
+        link->bulkStartUs = esp_timer_get_time();
+        link->bulkBytes = 0;
+    }
+    if (link)
+    {
+        link->lastActiveUs = esp_timer_get_time();
+    }
+    taskEXIT_CRITICAL(&mLock);
+
+    // Outside the lock: NimBLE may run the update callbacks right away
+    if (change)
+    {
+        applyBulk(connHandle, requestFast);
+    }
+}
+
+void ConnectionPolicy::noteSent(uint16_t connHandle, size_t bytes)
+{
+    int64_t nowUs = esp_timer_get_time();
+    uint32_t nowMs = (uint32_t)(nowUs / 1000);
+    bool promote = false;
+    taskENTER_CRITICAL(&mLock);
+    Link *link = find(connHandle);
+    if (link)
+    {
+        link->notifications++;
+        link->bytes += bytes;
+        link->lastActiveUs = nowUs;
+        if (link->mode == Mode::Bulk)
+        {
+            link->bulkBytes += bytes;
+        }
+        else
+        {
+            if (nowMs - link->windowStartMs >= 1000)
+            {
+                link->windowStartMs = nowMs;
+                link->windowCount = 0;
+            }
+            promote = ++link->windowCount >= AUTO_BULK_NOTIFICATIONS;
+        }
+    }
+    taskEXIT_CRITICAL(&mLock);
+
+    if (promote)
+    {
+        requestBulk(connHandle);
+    }
+}
+
+void ConnectionPolicy::update()
+{
+    int64_t nowUs = esp_timer_get_time();
+    uint16_t idle[MAX_LINKS];
+    size_t idleCount = 0;
+    taskENTER_CRITICAL(&mLock);
+    for (size_t i = 0; i < mLinkCount; i++)
+    {
+        Link &link = mLinks[i];
+        if (link.mode == Mode::Idle || nowUs - link.lastActiveUs < IDLE_AFTER_MS * 1000LL)
+        {
+            continue;
+        }
+        if (link.mode == Mode::Bulk && link.lastActiveUs > link.bulkStartUs)
+        {
+            link.throughput = (uint32_t)(link.bulkBytes * 1000000 / (link.lastActiveUs - link.bulkStartUs));
+        }
+        link.mode = Mode::Idle;
+        link.windowCount = 0;
+        idle[idleCount++] = link.connHandle;
+    }
+    taskEXIT_CRITICAL(&mLock);
+
+    for (size_t i = 0; i < idleCount; i++)
+    {
+        applyIdle(idle[i]);
+    }
+}
+
+void ConnectionPolicy::applyBulk(uint16_t connHandle, bool requestFast)
+{
+    ESP_LOGI(TAG, "Connection %u: bulk transfer parameters", connHandle);
+    if (requestFast)
+    {
+        // Either may be refused by a central without the feature, which is fine
+        mServer->setDataLen(connHandle, MAX_DATA_LENGTH);
+        mServer->updatePhy(connHandle, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK, 0);
+    }
+    mServer->updateConnParams(connHandle, BULK_MIN_INTERVAL, BULK_MAX_INTERVAL, BULK_LATENCY, BULK_TIMEOUT);
+}
+
+void ConnectionPolicy::applyIdle(uint16_t connHandle)
+{
+    ESP_LOGI(TAG, "Connection %u: idle parameters", connHandle);
+    mServer->updateConnParams(connHandle, IDLE_MIN_INTERVAL, IDLE_MAX_INTERVAL, IDLE_LATENCY, IDLE_TIMEOUT);
+}
+
+void ConnectionPolicy::writePrometheus(ChunkedText &out, void *context)
+{
+    ConnectionPolicy &policy = *static_cast<ConnectionPolicy *>(context);
+    Link links[MAX_LINKS];
+    taskENTER_CRITICAL(&policy.mLock);
+    size_t count = policy.mLinkCount;
+    memcpy(links, policy.mLinks, sizeof(links));
+    taskEXIT_CRITICAL(&policy.mLock);
+
+    int64_t nowUs = esp_timer_get_time();
+    struct Series
+    {
+        const char *name;
+        const char *help;
+        const char *type;
+        uint64_t (*read)(const Link &, int64_t nowUs);
+    };
+    static const Series SERIES[] = {
+        {"helvetic_ble_link_mtu", "Negotiated ATT MTU", "gauge",
+         [](const Link &l, int64_t) { return (uint64_t)l.mtu; }},
+        {"helvetic_ble_link_interval_microseconds", "Connection interval", "gauge",
+         [](const Link &l, int64_t) { return (uint64_t)l.interval * 1250; }},
+        {"helvetic_ble_link_latency", "Connection events the central may skip", "gauge",
+         [](const Link &l, int64_t) { return (uint64_t)l.latency; }},
+        {"helvetic_ble_link_phy", "Transmit PHY (1: 1M, 2: 2M, 3: coded)", "gauge",
+         [](const Link &l, int64_t) { return (uint64_t)l.txPhy; }},
+        {"helvetic_ble_link_bulk", "1 while the link has bulk transfer parameters", "gauge",
+         [](const Link &l, int64_t) { return (uint64_t)(l.mode == Mode::Bulk); }},
+        {"helvetic_ble_link_notifications_total", "Notifications sent on the link", "counter",
+         [](const Link &l, int64_t) { return (uint64_t)l.notifications; }},
+        {"helvetic_ble_link_notify_bytes_total", "Notification payload bytes sent on the link", "counter",
+         [](const Link &l, int64_t) { return l.bytes; }},
+        {"helvetic_ble_link_throughput_bytes_per_second", "Notification throughput of the current or last bulk transfer", "gauge",
+         [](const Link &l, int64_t nowUs)
+         {
+             if (l.mode == Mode::Bulk && nowUs > l.bulkStartUs)
+             {
+                 return l.bulkBytes * 1000000 / (uint64_t)(nowUs - l.bulkStartUs);
+             }
+             return (uint64_t)l.throughput;
+         }},
+    };
+
+    for (const Series &series : SERIES)
+    {
+        out.printf("# HELP %s %s\n# TYPE %s %s\n", series.name, series.help, series.name, series.type);
+        for (size_t i = 0; i < count; i++)
+        {
+            out.printf("%s{conn=\"%u\"} %llu\n", series.name, links[i].connHandle,
+                       (unsigned long long)series.read(links[i], nowUs));
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include "ble_links.h"
+#include "chunked_text.h"
+
+// Connection parameters per central, picked for what the link is doing.
+//
+// An idle central is asked for a slow interval with slave latency, which
+// costs little power on either side. When a bulk transfer starts, either
+// explicitly (history sync) or because notifications keep coming (a
+// delivery backlog), the link is asked for a 7.5-15 ms interval, the 2M PHY
+// and the largest LE data length, so a 244-byte notification fits one
+// radio packet; the ATT MTU itself is proposed by NimBLEDevice::setMTU.
+// After IDLE_AFTER_MS without notifications it drops back to the slow
+// interval. The central has the last word on all of these; what it agreed
+// to, and the notification throughput, are exported per link on /metrics.
+class ConnectionPolicy
+{
+public:
+    static const size_t MAX_LINKS = BLE_MAX_LINKS;
+    static const uint32_t IDLE_AFTER_MS = 2000;
+    // This many notifications within a second make a link bulk on its own
+    static const uint32_t AUTO_BULK_NOTIFICATIONS = 8;
+
+    void begin(NimBLEServer *server) { mServer = server; }
+
+    // NimBLE host task
+    void onConnect(const NimBLEConnInfo &connInfo);
+    void onDisconnect(const NimBLEConnInfo &connInfo);
+    void onMtuChange(uint16_t mtu, const NimBLEConnInfo &connInfo);
+    void onConnParams(const NimBLEConnInfo &connInfo);
+    void onPhyUpdate(const NimBLEConnInfo &connInfo, uint8_t txPhy, uint8_t rxPhy);
+
+    // Any task: a transfer is about to start, or a notification went out
+    void requestBulk(uint16_t connHandle);
+    void noteSent(uint16_t connHandle, size_t bytes);
+
+    // Call from loop(); returns idle links to the low-power parameters
+    void update();
+
+    // Labelled per-link series, see metrics::addSection
+    static void writePrometheus(ChunkedText &out, void *context);
+
+private:
+    enum class Mode : uint8_t
+    {
+        Connected, // the central's own parameters, e.g. during service discovery
+        Bulk,
+        Idle
+    };
+
+    struct Link
+    {
+        uint16_t connHandle;
+        uint16_t mtu;
+        uint16_t interval; // 1.25 ms units
+        uint16_t latency;
+        uint8_t txPhy;
+        uint8_t rxPhy;
+        Mode mode;
+        bool fastRequested; // 2M PHY and data length asked for once per link
+        uint32_t notifications;
+        uint64_t bytes;
+        int64_t bulkStartUs;
+        uint64_t bulkBytes;
+        int64_t lastActiveUs; // connection or last notification
+        uint32_t windowStartMs; // for AUTO_BULK_NOTIFICATIONS
+        uint32_t windowCount;
+        uint32_t throughput; // bytes per second over the last bulk period
+    };
+
+    Link *find(uint16_t connHandle);
+    void applyBulk(uint16_t connHandle, bool requestFast);
+    void applyIdle(uint16_t connHandle);
+
+    NimBLEServer *mServer = nullptr;
+    mutable portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+    Link mLinks[MAX_LINKS] = {};
+    size_t mLinkCount = 0;
+};
@@ -0,0 +1,284 @@
+#include "delivery_queue.h"
+#include <crc16.h>
+#include <esp_log.h>
+
+static const char *TAG = "DELIVERY";
+const char *DeliveryQueue::PATH = "/delivery.bin";
+const char *DeliveryQueue::TEMP_PATH = "/delivery.tmp";
+
+// File layout: u8 version, u8 peer size, u8 peer count, the peers as they
+// are in RAM, u16 CRC of everything before it
+static const uint8_t FILE_VERSION = 1;
+
+// Below the shortest interval a central may pick (7.5 ms) is pointless
+static const uint16_t MIN_INTERVAL = 6;
+
+bool DeliveryQueue::begin(MeasurementLog *history)
+{
+    mHistory = history;
+    if (!LittleFS.exists(PATH) && LittleFS.exists(TEMP_PATH))
+    {
+        LittleFS.rename(TEMP_PATH, PATH);
+    }
+
+    File file = LittleFS.open(PATH, "r");
+    if (!file)
+    {
+        return true;
+    }
+
+    static Peer peers[MAX_PEERS];
+    uint8_t header[3];
+    uint16_t storedCrc = 0;
+    bool ok = file.read(header, sizeof(header)) == sizeof(header) && header[0] == FILE_VERSION &&
+              header[1] == sizeof(Peer) && header[2] == MAX_PEERS &&
+              file.read((uint8_t *)peers, sizeof(peers)) == sizeof(peers) &&
+              file.read((uint8_t *)&storedCrc, sizeof(storedCrc)) == sizeof(storedCrc);
+    file.close();
+    if (!ok || Crc16Xmodem::compute((const uint8_t *)peers, sizeof(peers), Crc16Xmodem::compute(header, sizeof(header))) != storedCrc)
+    {
+        ESP_LOGW(TAG, "Ignoring unreadable %s, centrals start from the newest record", PATH);
+        return false;
+    }
+
+    size_t known = 0;
+    for (size_t i = 0; i < MAX_PEERS; i++)
+    {
+        mPeers[i] = peers[i];
+        if (mPeers[i].used)
+        {
+            known++;
+            mConnections = max(mConnections, mPeers[i].lastSeen);
+        }
+    }
+    ESP_LOGI(TAG, "Delivery cursors for %u centrals", (unsigned)known);
+    return true;
+}
+
+void DeliveryQueue::setWake(Wake wake, void *context)
+{
+    mWake = wake;
+    mWakeContext = context;
+}
+
+void DeliveryQueue::wake()
+{
+    if (mWake)
+    {
+        mWake(mWakeContext);
+    }
+}
+
+int DeliveryQueue::findLink(uint16_t connHandle) const
+{
+    for (size_t i = 0; i < mLinkCount; i++)
+    {
+        if (mLinks[i].connHandle == connHandle)
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void DeliveryQueue::onConnect(const NimBLEConnInfo &connInfo)
+{
+    NimBLEAddress address = connInfo.getIdAddress();
+    uint32_t newest = mHistory->nextSeq();
+
+    taskENTER_CRITICAL(&mLock);
+    if (mLinkCount == MAX_LINKS || findLink(connInfo.getConnHandle()) >= 0)
+    {
+        taskEXIT_CRITICAL(&mLock);
+        return;
+    }
+
+    // Known central, else a free slot, else the one seen least recently
+    size_t peer = MAX_PEERS;
+    size_t victim = 0;
+    for (size_t i = 0; i < MAX_PEERS; i++)
+    {
+        const Peer &candidate = mPeers[i];
+        if (candidate.used && candidate.addressType == address.getType() &&
+            memcmp(candidate.address, address.getVal(), sizeof(candidate.address)) == 0)
+        {
+            peer = i;
+            break;
+        }
+        if (mPeers[victim].used && (!candidate.used || candidate.lastSeen < mPeers[victim].lastSeen))
+        {
+            victim = i;
+        }
+    }
+    bool known = peer < MAX_PEERS;
+    if (!known)
+    {
+        peer = victim;
+        mPeers[peer] = Peer{};
+        memcpy(mPeers[peer].address, address.getVal(), sizeof(mPeers[peer].address));
+        mPeers[peer].addressType = address.getType();
+        mPeers[peer].used = 1;
+        mPeers[peer].cursor = newest;
+    }
+    mPeers[peer].lastSeen = ++mConnections;
+    mLinks[mLinkCount++] = {connInfo.getConnHandle(), (uint8_t)peer, 0, connInfo.getConnInterval()};
+    uint32_t backlog = newest - mPeers[peer].cursor;
+    mDirty = true;
+    taskEXIT_CRITICAL(&mLock);
+
+    ESP_LOGI(TAG, "%s central %s, %u records pending", known ? "Known" : "New", address.toString().c_str(),
+             (unsigned)backlog);
+}
+
+void DeliveryQueue::onSubscribe(const NimBLEConnInfo &connInfo, Channel channel, bool subscribed)
+{
+    taskENTER_CRITICAL(&mLock);
+    int link = findLink(connInfo.getConnHandle());
+    if (link >= 0)
+    {
+        mLinks[link].channels = subscribed ? mLinks[link].channels | channel : mLinks[link].channels & ~channel;
+    }
+    taskEXIT_CRITICAL(&mLock);
+    if (link >= 0 && subscribed)
+    {
+        wake();
+    }
+}
+
+void DeliveryQueue::onConnParams(const NimBLEConnInfo &connInfo)
+{
+    taskENTER_CRITICAL(&mLock);
+    int link = findLink(connInfo.getConnHandle());
+    if (link >= 0)
+    {
+        mLinks[link].interval = connInfo.getConnInterval();
+    }
+    taskEXIT_CRITICAL(&mLock);
+}
+
+void DeliveryQueue::onDisconnect(const NimBLEConnInfo &connInfo)
+{
+    taskENTER_CRITICAL(&mLock);
+    int link = findLink(connInfo.getConnHandle());
+    if (link >= 0)
+    {
+        mLinks[link] = mLinks[--mLinkCount];
+    }
+    taskEXIT_CRITICAL(&mLock);
+    if (link >= 0)
+    {
+        // Lets the worker save the cursor
+        wake();
+    }
+}
+
+TickType_t DeliveryQueue::pump(Sender send, void *context)
+{
+    uint32_t end = mHistory->nextSeq();
+    TickType_t next = portMAX_DELAY;
+
+    for (size_t i = 0;; i++)
+    {
+        taskENTER_CRITICAL(&mLock);
+        if (i >= mLinkCount)
+        {
+            taskEXIT_CRITICAL(&mLock);
+            break;
+        }
+        Link link = mLinks[i];
+        uint32_t cursor = mPeers[link.peer].cursor;
+        uint8_t step = mPeers[link.peer].step;
+        taskEXIT_CRITICAL(&mLock);
+        if (!link.channels || cursor >= end)
+        {
+            continue;
+        }
+
+        uint32_t seq = cursor;
+        size_t count = mHistory->read(seq, mRecords, BURST, mSeqs);
+        bool busy = false;
+        size_t r = 0;
+        for (; r < count && !busy; r++)
+        {
+            for (; step < CHANNELS; step++)
+            {
+                Channel channel = (Channel)(1 << step);
+                if ((link.channels & channel) && !send(context, link.connHandle, channel, mRecords[r]))
+                {
+                    busy = true;
+                    break;
+                }
+            }
+            if (!busy)
+            {
+                step = 0;
+                cursor = mSeqs[r] + 1;
+            }
+        }
+        if (!busy)
+        {
+            cursor = seq; // also past records rotated out of the log
+        }
+
+        taskENTER_CRITICAL(&mLock);
+        // The central may have left meanwhile, the cursor is still its own
+        Peer &peer = mPeers[link.peer];
+        peer.cursor = cursor;
+        peer.step = step;
+        mDirty = true;
+        taskEXIT_CRITICAL(&mLock);
+
+        if (busy || cursor < end)
+        {
+            uint16_t interval = link.interval > MIN_INTERVAL ? link.interval : MIN_INTERVAL;
+            TickType_t ticks = pdMS_TO_TICKS(interval * 5 / 4);
+            next = min(next, ticks > 0 ? ticks : (TickType_t)1);
+        }
+    }
+
+    // Caught up: a good moment to make the cursors survive a reset
+    if (next == portMAX_DELAY && mDirty)
+    {
+        save();
+    }
+    return next;
+}
+
+uint32_t DeliveryQueue::backlog() const
+{
+    uint32_t end = mHistory ? mHistory->nextSeq() : 0;
+    uint32_t total = 0;
+    taskENTER_CRITICAL(&mLock);
+    for (size_t i = 0; i < mLinkCount; i++)
+    {
+        total += end - mPeers[mLinks[i].peer].cursor;
+    }
+    taskEXIT_CRITICAL(&mLock);
+    return total;
+}
+
+// Written to a temporary file and renamed, so a reset keeps the old cursors
+bool DeliveryQueue::save()
+{
+    static Peer peers[MAX_PEERS];
+    taskENTER_CRITICAL(&mLock);
+    memcpy(peers, mPeers, sizeof(peers));
+    mDirty = false;
+    taskEXIT_CRITICAL(&mLock);
+
+    uint8_t header[3] = {FILE_VERSION, sizeof(Peer), MAX_PEERS};
+    uint16_t crc = Crc16Xmodem::compute((const uint8_t *)peers, sizeof(peers), Crc16Xmodem::compute(header, sizeof(header)));
+    File file = LittleFS.open(TEMP_PATH, "w");
+    bool ok = file && file.write(header, sizeof(header)) == sizeof(header) &&
+              file.write((const uint8_t *)peers, sizeof(peers)) == sizeof(peers) &&
+              file.write((const uint8_t *)&crc, sizeof(crc)) == sizeof(crc);
+    file.close();
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Failed to write %s", TEMP_PATH);
+        mDirty = true;
+        return false;
+    }
+    LittleFS.rename(TEMP_PATH, PATH);
+    return true;
+}
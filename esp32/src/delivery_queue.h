@@ -0,0 +1,103 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <NimBLEDevice.h>
+#include "ble_links.h"
+#include "measurement_log.h"
+
+// Per-central delivery cursors over the measurement history.
+//
+// The history log already holds every measurement in order, so the queue
+// for a central is just the sequence number of the first record it has not
+// been sent. Cursors are kept per identity address for the last MAX_PEERS
+// centrals and saved to /delivery.bin, so a phone that was away gets what
+// it missed on its next connection, and a record is sent to it only once.
+// A central seen for the first time starts at the newest record; older ones
+// are for the history transfer.
+//
+// Delivery starts once the central subscribes to one of the measurement
+// characteristics. pump() runs on the measurement worker and sends up to
+// BURST records per link, then asks to be called again one connection
+// interval later, so a backlog goes out at the link's pace instead of
+// overrunning the controller's buffers. A refused notify is retried on
+// the next pass from the channel where it stopped.
+class DeliveryQueue
+{
+public:
+    static const size_t MAX_PEERS = 8;
+    static const size_t MAX_LINKS = BLE_MAX_LINKS;
+    static const size_t BURST = 4;
+
+    // Measurement characteristics, one bit each
+    enum Channel : uint8_t
+    {
+        CHANNEL_WSS = 1 << 0,
+        CHANNEL_BCS = 1 << 1,
+        CHANNEL_HM10 = 1 << 2
+    };
+    static const size_t CHANNELS = 3;
+
+    // Sends one record on one channel to one connection; false if refused
+    typedef bool (*Sender)(void *context, uint16_t connHandle, Channel channel, const WeightHistoryRecord &record);
+    typedef void (*Wake)(void *context);
+
+    // Loads the cursors; call after LittleFS is mounted and the log is open
+    bool begin(MeasurementLog *history);
+    // Lets the NimBLE callbacks get pump() called soon
+    void setWake(Wake wake, void *context);
+
+    // NimBLE host task
+    void onConnect(const NimBLEConnInfo &connInfo);
+    void onSubscribe(const NimBLEConnInfo &connInfo, Channel channel, bool subscribed);
+    void onConnParams(const NimBLEConnInfo &connInfo);
+    void onDisconnect(const NimBLEConnInfo &connInfo);
+
+    // Measurement worker: sends what is due, saves cursors once caught up.
+    // Returns the ticks until it should run again, portMAX_DELAY if idle.
+    TickType_t pump(Sender send, void *context);
+
+    uint32_t backlog() const; // records not yet sent to the connected centrals
+
+private:
+    struct Peer // as stored in /delivery.bin
+    {
+        uint8_t address[6];
+        uint8_t addressType;
+        uint8_t used;
+        uint32_t cursor;   // first record not completely sent
+        uint32_t lastSeen; // connection count at the last connection, for eviction
+        uint8_t step;      // channels of the cursor record already sent
+        uint8_t reserved[3];
+    };
+
+    struct Link
+    {
+        uint16_t connHandle;
+        uint8_t peer;      // index into mPeers
+        uint8_t channels;  // subscribed Channel bits
+        uint16_t interval; // connection interval, 1.25 ms units
+    };
+
+    int findLink(uint16_t connHandle) const;
+    bool save();
+    void wake();
+
+    static const char *PATH;
+    static const char *TEMP_PATH;
+
+    MeasurementLog *mHistory = nullptr;
+    Wake mWake = nullptr;
+    void *mWakeContext = nullptr;
+
+    // Links and cursors change on the host task and the worker
+    mutable portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+    Peer mPeers[MAX_PEERS] = {};
+    Link mLinks[MAX_LINKS] = {};
+    size_t mLinkCount = 0;
+    uint32_t mConnections = 0;
+    bool mDirty = false;
+
+    WeightHistoryRecord mRecords[BURST];
+    uint32_t mSeqs[BURST];
+};
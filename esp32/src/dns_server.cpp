@@ -1,28 +1,194 @@
 #include "dns_server.h"
+#include "metrics.h"
+#include "trace.h"
 #include <esp_log.h>
 
 static const char *TAG = "DNS";
 
-CaptiveDNSServer::CaptiveDNSServer() {}
+// Exact names get a prebuilt answer; the wildcard catches the rest of fitbit.com
+const dns::Name CaptiveDNSServer::NAMES[NAME_COUNT] = {
+    {"www.fitbit.com", false},
+    {"api.fitbit.com", false},
+    {"fitbit.com", true},
+};
+
+CaptiveDNSServer::CaptiveDNSServer() : mResponder(NAMES) {}
 
 bool CaptiveDNSServer::begin(const char *ssid, const char *password)
 {
     WiFi.mode(WIFI_AP);
     WiFi.softAP(ssid, password);
 
-    if (dnsServer.start(53, "*", WiFi.softAPIP()))
+    IPAddress ip = WiFi.softAPIP();
+    uint8_t address[4] = {ip[0], ip[1], ip[2], ip[3]};
+    mResponder.setAddress(address);
+
+    mSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in bindAddress = {};
+    bindAddress.sin_family = AF_INET;
+    bindAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+    bindAddress.sin_port = htons(HELVETIC_DNS_PORT);
+    if (mSocket < 0 || bind(mSocket, (struct sockaddr *)&bindAddress, sizeof(bindAddress)) != 0)
     {
-        ESP_LOGI(TAG, "Started DNS server in captive portal-mode");
-        return true;
+        ESP_LOGE(TAG, "Can't start DNS server on port %d: errno %d", HELVETIC_DNS_PORT, errno);
+        if (mSocket >= 0)
+        {
+            close(mSocket);
+            mSocket = -1;
+        }
+        return false;
     }
-    else
+
+    registerMetrics();
+    if (xTaskCreatePinnedToCore(taskEntry, "dns", 4096, this, 2, &mTask, 0) != pdPASS)
     {
-        ESP_LOGE(TAG, "Can't start DNS server!");
+        ESP_LOGE(TAG, "Failed to start DNS task");
         return false;
     }
+    ESP_LOGI(TAG, "Answering fitbit.com with %s on port %d, %s other names", ip.toString().c_str(),
+             HELVETIC_DNS_PORT, mUpstream ? "forwarding" : "refusing");
+    return true;
+}
+
+void CaptiveDNSServer::setUpstream(const IPAddress &upstream)
+{
+    uint8_t octets[4] = {upstream[0], upstream[1], upstream[2], upstream[3]};
+    memcpy(&mUpstream, octets, 4);
+    mResponder.setForwardUnknown(mUpstream != 0);
+}
+
+void CaptiveDNSServer::registerMetrics()
+{
+    for (size_t i = 0; i < NAME_COUNT; i++)
+    {
+        HitGauge &gauge = mHitGauges[i];
+        gauge.server = this;
+        gauge.index = i;
+        snprintf(gauge.name, sizeof(gauge.name), "helvetic_dns_hits_total{name=\"%s\"}", NAMES[i].name);
+        metrics::addGauge(gauge.name, "DNS queries answered per table entry", [](void *context)
+                          {
+                              const HitGauge *gauge = (const HitGauge *)context;
+                              return gauge->server->mResponder.hits(gauge->index); },
+                          &gauge, true);
+    }
 }
 
-void CaptiveDNSServer::processNextRequest()
+void CaptiveDNSServer::taskEntry(void *arg)
 {
-    dnsServer.processNextRequest();
-}
\ No newline at end of file
+    static_cast<CaptiveDNSServer *>(arg)->run();
+}
+
+void CaptiveDNSServer::run()
+{
+    uint8_t packet[dns::MAX_PACKET];
+    for (;;)
+    {
+        // Block for the first datagram, then answer everything already queued
+        int flags = 0;
+        for (;;)
+        {
+            struct sockaddr_in from;
+            socklen_t fromLength = sizeof(from);
+            int length = recvfrom(mSocket, packet, sizeof(packet), flags, (struct sockaddr *)&from, &fromLength);
+            if (length < 0)
+            {
+                if (flags == 0)
+                {
+                    ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+                    vTaskDelay(pdMS_TO_TICKS(100));
+                }
+                break;
+            }
+            handlePacket(packet, length, from);
+            flags = MSG_DONTWAIT;
+        }
+    }
+}
+
+void CaptiveDNSServer::handlePacket(const uint8_t *packet, size_t length, const struct sockaddr_in &from)
+{
+    if (mUpstream && from.sin_addr.s_addr == mUpstream && from.sin_port == htons(53))
+    {
+        relayResponse((uint8_t *)packet, length);
+        return;
+    }
+
+    metrics::dnsQueries.add();
+    dns::Result result;
+    int match;
+    size_t size = mResponder.respond(packet, length, mResponse, result, match);
+    TRACE(DNS_QUERY, (uint32_t)result, match);
+
+    if (result == dns::Result::Forward)
+    {
+        forwardQuery(packet, length, from);
+        return;
+    }
+    if (result == dns::Result::Refused)
+    {
+        metrics::dnsRefused.add();
+    }
+    if (size)
+    {
+        sendto(mSocket, mResponse, size, 0, (const struct sockaddr *)&from, sizeof(from));
+    }
+}
+
+// Rewrites the id so answers for different clients cannot be confused
+void CaptiveDNSServer::forwardQuery(const uint8_t *packet, size_t length, const struct sockaddr_in &from)
+{
+    uint32_t now = millis();
+    PendingForward *slot = nullptr;
+    for (PendingForward &pending : mForwards)
+    {
+        if (!pending.used || now - pending.sentAt > FORWARD_TIMEOUT_MS)
+        {
+            slot = &pending;
+            break;
+        }
+    }
+    if (!slot)
+    {
+        ESP_LOGW(TAG, "Too many forwarded queries in flight, dropping one");
+        return;
+    }
+
+    slot->used = true;
+    slot->clientAddress = from.sin_addr.s_addr;
+    slot->clientPort = from.sin_port;
+    slot->clientId = dns::read16(packet);
+    slot->upstreamId = mNextForwardId++;
+    slot->sentAt = now;
+
+    memcpy(mResponse, packet, length);
+    dns::write16(mResponse, slot->upstreamId);
+    struct sockaddr_in upstream = {};
+    upstream.sin_family = AF_INET;
+    upstream.sin_addr.s_addr = mUpstream;
+    upstream.sin_port = htons(53);
+    sendto(mSocket, mResponse, length, 0, (const struct sockaddr *)&upstream, sizeof(upstream));
+    metrics::dnsForwarded.add();
+}
+
+void CaptiveDNSServer::relayResponse(uint8_t *packet, size_t length)
+{
+    if (length < dns::HEADER_SIZE)
+    {
+        return;
+    }
+    uint16_t id = dns::read16(packet);
+    for (PendingForward &pending : mForwards)
+    {
+        if (pending.used && pending.upstreamId == id)
+        {
+            pending.used = false;
+            dns::write16(packet, pending.clientId);
+            struct sockaddr_in client = {};
+            client.sin_family = AF_INET;
+            client.sin_addr.s_addr = pending.clientAddress;
+            client.sin_port = pending.clientPort;
+            sendto(mSocket, packet, length, 0, (const struct sockaddr *)&client, sizeof(client));
+            return;
+        }
+    }
+}
@@ -1,15 +1,64 @@
 #pragma once
 
-#include <DNSServer.h>
+#include <Arduino.h>
 #include <WiFi.h>
+#include <lwip/sockets.h>
+#include <dns_responder.h>
 
+#ifndef HELVETIC_DNS_PORT
+#define HELVETIC_DNS_PORT 53
+#endif
+
+// DNS for the AP. Only the Fitbit names the Aria looks up are answered,
+// with the AP's address; everything else is refused, or forwarded when an
+// upstream resolver is configured. Runs on its own task and answers every
+// datagram that is waiting each time it wakes up, so lookups never wait
+// behind the web server or the display.
 class CaptiveDNSServer
 {
 public:
     CaptiveDNSServer();
     bool begin(const char *ssid, const char *password);
-    void processNextRequest();
+    // Forward names outside the table here instead of refusing them
+    void setUpstream(const IPAddress &upstream);
 
 private:
-    DNSServer dnsServer;
-};
\ No newline at end of file
+    static const size_t NAME_COUNT = 3;
+    static const dns::Name NAMES[NAME_COUNT];
+    static const size_t MAX_FORWARDS = 16;
+    static const uint32_t FORWARD_TIMEOUT_MS = 3000;
+
+    struct PendingForward
+    {
+        uint32_t clientAddress; // network order
+        uint16_t clientPort;    // network order
+        uint16_t clientId;
+        uint16_t upstreamId;
+        uint32_t sentAt;
+        bool used;
+    };
+
+    // Context for the per-name hit counters on /metrics
+    struct HitGauge
+    {
+        CaptiveDNSServer *server;
+        size_t index;
+        char name[64];
+    };
+
+    static void taskEntry(void *arg);
+    void run();
+    void handlePacket(const uint8_t *packet, size_t length, const struct sockaddr_in &from);
+    void forwardQuery(const uint8_t *packet, size_t length, const struct sockaddr_in &from);
+    void relayResponse(uint8_t *packet, size_t length);
+    void registerMetrics();
+
+    dns::Responder<NAME_COUNT> mResponder;
+    int mSocket = -1;
+    TaskHandle_t mTask = nullptr;
+    uint32_t mUpstream = 0; // network order, 0 = refuse unknown names
+    uint16_t mNextForwardId = 1;
+    PendingForward mForwards[MAX_FORWARDS] = {};
+    uint8_t mResponse[dns::MAX_PACKET];
+    HitGauge mHitGauges[NAME_COUNT];
+};
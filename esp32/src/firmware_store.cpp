@@ -0,0 +1,103 @@
+#include "firmware_store.h"
+#include <esp_log.h>
+
+static const char *TAG = "FIRMWARE";
+static const char *DIRECTORY = "/firmware";
+
+// Published hashes of the images Fitbit served, see firmware.md
+static const struct
+{
+    uint32_t version;
+    const char *sha256;
+} KNOWN_IMAGES[] = {
+    {33, "2e66bd71855914119d16b872e70f3b307685c08abfb3abc5bb8a235f769a5020"},
+    {35, "22827f019ef69284fed36b1e16cd8a7d68bc295937d1bf5f07cdbf91e1a9a9ca"},
+    {38, "f0a315fcfa1e5add944869628ea775934670255ac4b540a9dd87ab518c37b03f"},
+    {39, "75038492de789cc57a3250fc1f27fcee312215601acf7d5a665668129d87cc3b"},
+};
+
+void FirmwareStore::imagePath(uint32_t version, char *path, size_t size)
+{
+    snprintf(path, size, "%s/firmware-%u.dat", DIRECTORY, (unsigned)version);
+}
+
+bool FirmwareStore::hashFile(File &file, uint8_t *digest)
+{
+    static uint8_t buffer[CHUNK_SIZE];
+    Sha256 sha;
+    size_t length;
+    while ((length = file.read(buffer, sizeof(buffer))) > 0)
+    {
+        sha.update(buffer, length);
+    }
+    sha.finish(digest);
+    return file.position() == file.size();
+}
+
+bool FirmwareStore::begin()
+{
+    mImageCount = 0;
+    for (const auto &known : KNOWN_IMAGES)
+    {
+        char path[40];
+        imagePath(known.version, path, sizeof(path));
+        if (!LittleFS.exists(path))
+        {
+            continue;
+        }
+
+        Image image = {known.version, 0, {}};
+        uint8_t digest[Sha256::DIGEST_SIZE];
+        Sha256::parseHex(known.sha256, image.sha256);
+        uint32_t startMs = millis();
+        File file = LittleFS.open(path, "r");
+        bool read = file && hashFile(file, digest);
+        image.size = file ? file.size() : 0;
+        file.close();
+        if (!read || memcmp(digest, image.sha256, sizeof(digest)) != 0)
+        {
+            ESP_LOGW(TAG, "Ignoring %s: SHA-256 does not match version %u", path, (unsigned)known.version);
+            continue;
+        }
+        mImages[mImageCount++] = image;
+        ESP_LOGI(TAG, "Firmware %u: %u bytes, verified in %u ms", (unsigned)image.version, (unsigned)image.size,
+                 (unsigned)(millis() - startMs));
+    }
+
+    if (mTarget && !find(mTarget))
+    {
+        ESP_LOGW(TAG, "No verified image for target firmware %u, not offering updates", (unsigned)mTarget);
+    }
+    return mImageCount > 0;
+}
+
+const FirmwareStore::Image *FirmwareStore::find(uint32_t version) const
+{
+    for (size_t i = 0; i < mImageCount; i++)
+    {
+        if (mImages[i].version == version)
+        {
+            return &mImages[i];
+        }
+    }
+    return nullptr;
+}
+
+File FirmwareStore::open(const Image &image) const
+{
+    char path[40];
+    imagePath(image.version, path, sizeof(path));
+    return LittleFS.open(path, "r");
+}
+
+bool FirmwareStore::updateUrl(uint32_t firmware, const uint8_t *serial, char *url, size_t size) const
+{
+    if (!mTarget || firmware >= mTarget || !find(mTarget))
+    {
+        return false;
+    }
+    // The host the scale asks for anyway; the captive DNS points it at us
+    int length = snprintf(url, size, "http://www.fitbit.com/scale/firmware/%u?serialNumber=%02X%02X%02X%02X%02X%02X",
+                          (unsigned)mTarget, serial[0], serial[1], serial[2], serial[3], serial[4], serial[5]);
+    return length > 0 && (size_t)length < size;
+}
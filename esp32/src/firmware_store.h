@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <sha256.h>
+
+// Aria firmware images served to scales from /scale/firmware/<version>.
+//
+// Images are copied by hand into /firmware on LittleFS as firmware-NN.dat,
+// as they are named in firmware.md. At boot every image is hashed once and
+// kept only if its SHA-256 matches the published one for its version, so a
+// truncated or foreign file is never offered to a scale. With a target
+// version configured (firmwareVersion= in config.txt), an upload from a
+// scale reporting an older firmware is answered with update_available and
+// the URL of the target image; the scale then downloads it from us through
+// the captive DNS.
+//
+// Everything runs on the loop task, no locking.
+class FirmwareStore
+{
+public:
+    static const size_t MAX_IMAGES = 4;
+    static const size_t CHUNK_SIZE = 4096; // bytes per flash read while serving
+
+    struct Image
+    {
+        uint32_t version;
+        uint32_t size;
+        uint8_t sha256[Sha256::DIGEST_SIZE];
+    };
+
+    // Lists and verifies the images; call after LittleFS is mounted
+    bool begin();
+    void setTarget(uint32_t version) { mTarget = version; }
+
+    const Image *find(uint32_t version) const;
+    File open(const Image &image) const;
+
+    // The URL to offer a scale running `firmware`, or false if it should
+    // not update. `serial` is the scale's 6-byte MAC.
+    bool updateUrl(uint32_t firmware, const uint8_t *serial, char *url, size_t size) const;
+
+private:
+    static void imagePath(uint32_t version, char *path, size_t size);
+    static bool hashFile(File &file, uint8_t *digest);
+
+    Image mImages[MAX_IMAGES];
+    size_t mImageCount = 0;
+    uint32_t mTarget = 0;
+};
@@ -0,0 +1,125 @@
+#include "history_export.h"
+#include <civil_time.h>
+
+static const char *const CONTENT_TYPES[] = {"text/csv", "application/x-ndjson", "application/cbor"};
+static const char *const FILE_NAMES[] = {"history.csv", "history.ndjson", "history.cbor"};
+
+// CBOR major types and simple values
+static const uint8_t CBOR_UINT = 0 << 5;
+static const uint8_t CBOR_ARRAY = 4 << 5;
+static const uint8_t CBOR_TAG = 6 << 5;
+static const uint8_t CBOR_FALSE = 0xF4;
+static const uint8_t CBOR_TRUE = 0xF5;
+static const uint8_t CBOR_INDEFINITE_ARRAY = 0x9F;
+static const uint8_t CBOR_BREAK = 0xFF;
+static const uint8_t CBOR_TAG_EPOCH = 1;
+
+const char *HistoryExport::contentType(Format format)
+{
+    return CONTENT_TYPES[format];
+}
+
+const char *HistoryExport::fileName(Format format)
+{
+    return FILE_NAMES[format];
+}
+
+// Shortest head for a major type and argument
+static uint8_t *putCborHead(uint8_t *p, uint8_t major, uint32_t value)
+{
+    if (value < 24)
+    {
+        *p++ = major | value;
+    }
+    else if (value <= 0xFF)
+    {
+        *p++ = major | 24;
+        *p++ = value;
+    }
+    else if (value <= 0xFFFF)
+    {
+        *p++ = major | 25;
+        *p++ = value >> 8;
+        *p++ = value & 0xFF;
+    }
+    else
+    {
+        *p++ = major | 26;
+        *p++ = value >> 24;
+        *p++ = (value >> 16) & 0xFF;
+        *p++ = (value >> 8) & 0xFF;
+        *p++ = value & 0xFF;
+    }
+    return p;
+}
+
+static void writeRecord(ChunkedText &out, HistoryExport::Format format, uint32_t seq, const history::Record &record)
+{
+    bool stable = (record.flags & history::FLAG_STABLE) != 0;
+    switch (format)
+    {
+    case HistoryExport::CSV:
+    {
+        civil::DateTime dt = civil::fromUnix(record.timestamp);
+        out.printf("%u,%u,%04u-%02u-%02uT%02u:%02u:%02uZ,%u,%u,%u,%u,%u\n", (unsigned)seq, (unsigned)record.timestamp,
+                   dt.year, dt.month, dt.day, dt.hour, dt.minute, dt.second, record.user,
+                   (unsigned)record.weightGrams, (unsigned)record.fat, record.impedance, stable ? 1 : 0);
+        break;
+    }
+    case HistoryExport::NDJSON:
+        out.printf("{\"seq\":%u,\"timestamp\":%u,\"user\":%u,\"weight_g\":%u,\"fat_millipercent\":%u,"
+                   "\"impedance_ohm\":%u,\"stable\":%s}\n",
+                   (unsigned)seq, (unsigned)record.timestamp, record.user, (unsigned)record.weightGrams,
+                   (unsigned)record.fat, record.impedance, stable ? "true" : "false");
+        break;
+    case HistoryExport::CBOR:
+    {
+        uint8_t item[32];
+        uint8_t *p = putCborHead(item, CBOR_ARRAY, 7);
+        p = putCborHead(p, CBOR_UINT, seq);
+        p = putCborHead(p, CBOR_TAG, CBOR_TAG_EPOCH);
+        p = putCborHead(p, CBOR_UINT, record.timestamp);
+        p = putCborHead(p, CBOR_UINT, record.user);
+        p = putCborHead(p, CBOR_UINT, record.weightGrams);
+        p = putCborHead(p, CBOR_UINT, record.fat);
+        p = putCborHead(p, CBOR_UINT, record.impedance);
+        *p++ = stable ? CBOR_TRUE : CBOR_FALSE;
+        out.write(item, p - item);
+        break;
+    }
+    }
+}
+
+uint32_t HistoryExport::write(MeasurementLog &log, const MeasurementLog::Filter &filter, Format format, ChunkedText &out)
+{
+    if (format == CSV)
+    {
+        out.printf("seq,timestamp,time,user,weight_g,fat_millipercent,impedance_ohm,stable\n");
+    }
+    else if (format == CBOR)
+    {
+        out.write(&CBOR_INDEFINITE_ARRAY, 1);
+    }
+
+    // Segments that end before `since` are not even looked at
+    history::Record records[BATCH];
+    uint32_t seqs[BATCH];
+    uint32_t seq = log.seqForTimestamp(filter.since);
+    uint32_t end = log.nextSeq();
+    uint32_t written = 0;
+    while (seq < end)
+    {
+        size_t n = log.readPacked(seq, filter, records, BATCH, seqs);
+        for (size_t i = 0; i < n; i++)
+        {
+            writeRecord(out, format, seqs[i], records[i]);
+        }
+        written += n;
+    }
+
+    if (format == CBOR)
+    {
+        out.write(&CBOR_BREAK, 1);
+    }
+    return written;
+}
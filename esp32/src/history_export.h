@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+#include "chunked_text.h"
+#include "measurement_log.h"
+
+// Measurement history as CSV, NDJSON or CBOR, for GET /export/...
+//
+// Records come from MeasurementLog::readPacked() a block at a time and are
+// formatted into the ChunkedText buffer, so an export of any length needs
+// the same few KiB of stack and no heap. Every format has the same fields,
+// in the Aria's units:
+//
+//   seq, timestamp (Unix seconds), user, weight_g, fat_millipercent,
+//   impedance_ohm, stable
+//
+// CSV starts with a header line and adds an ISO 8601 UTC time after the
+// timestamp. CBOR is one indefinite-length array holding a 7-element array
+// per record, the timestamp tagged as epoch time (tag 1).
+class HistoryExport
+{
+public:
+    enum Format : uint8_t
+    {
+        CSV,
+        NDJSON,
+        CBOR
+    };
+
+    static const char *contentType(Format format);
+    static const char *fileName(Format format);
+
+    // Returns the number of records written
+    static uint32_t write(MeasurementLog &log, const MeasurementLog::Filter &filter, Format format, ChunkedText &out);
+
+private:
+    static const size_t BATCH = MeasurementLog::READ_BLOCK; // records per readPacked()
+};
@@ -0,0 +1,310 @@
+#include "history_sync.h"
+#include "metrics.h"
+#include "scale_ble_service.h"
+#include <aria_protocol.h>
+#include <esp_log.h>
+
+static const char *TAG = "HISTORY_SYNC";
+
+static const size_t ATT_HEADER_SIZE = 3;
+
+static void putLE32(uint8_t *dest, uint32_t value)
+{
+    dest[0] = value & 0xFF;
+    dest[1] = (value >> 8) & 0xFF;
+    dest[2] = (value >> 16) & 0xFF;
+    dest[3] = (value >> 24) & 0xFF;
+}
+
+static void putLE16(uint8_t *dest, uint16_t value)
+{
+    dest[0] = value & 0xFF;
+    dest[1] = (value >> 8) & 0xFF;
+}
+
+void HistorySync::begin(MeasurementLog *history, NimBLECharacteristic *characteristic, ConnectionPolicy *policy)
+{
+    mHistory = history;
+    mCharacteristic = characteristic;
+    mPolicy = policy;
+    mMutex = xSemaphoreCreateRecursiveMutex();
+}
+
+void HistorySync::onCommand(const uint8_t *data, size_t length, const NimBLEConnInfo &connInfo)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    xSemaphoreTakeRecursive(mMutex, portMAX_DELAY);
+    switch (data[0])
+    {
+    case MI_HISTORY_CMD_START:
+        start(length >= 5 ? aria::readLE<uint32_t>(data + 1) : 0, 0, connInfo);
+        break;
+    case MI_HISTORY_CMD_REQUEST:
+        if (length < 5)
+        {
+            ESP_LOGW(TAG, "REQUEST without a timestamp");
+            break;
+        }
+        {
+            uint32_t since = aria::readLE<uint32_t>(data + 1);
+            start(mHistory->seqForTimestamp(since), since, connInfo);
+        }
+        break;
+    case MI_HISTORY_CMD_STOP:
+        if (mActive && connInfo.getConnHandle() == mConnHandle)
+        {
+            mStopping = true;
+            pump();
+        }
+        break;
+    default:
+        ESP_LOGD(TAG, "Ignoring command 0x%02x, %u bytes", data[0], (unsigned)length);
+        break;
+    }
+    xSemaphoreGiveRecursive(mMutex);
+}
+
+void HistorySync::start(uint32_t cursor, uint32_t since, const NimBLEConnInfo &connInfo)
+{
+    if (mActive)
+    {
+        ESP_LOGW(TAG, "Replacing the running transfer at cursor %u", mCursor);
+    }
+
+    // Short interval, 2M PHY and long packets before the first frame
+    mPolicy->requestBulk(connInfo.getConnHandle());
+
+    uint16_t mtu = connInfo.getMTU();
+    size_t payload = mtu > ATT_HEADER_SIZE ? min((size_t)(mtu - ATT_HEADER_SIZE), MAX_FRAME) : 0;
+    mRecordsPerFrame = payload > FRAME_HEADER_SIZE + RECORD_SIZE ? (payload - FRAME_HEADER_SIZE) / RECORD_SIZE : 1;
+
+    uint32_t first = mHistory->firstSeq();
+    uint32_t end = mHistory->nextSeq();
+    mConnHandle = connInfo.getConnHandle();
+    mCursor = cursor < first ? first : cursor > end ? end : cursor;
+    mSince = since;
+    mEnd = end;
+    mSent = 0;
+    mInFlight = 0;
+    mBufferStart = 0;
+    mBufferCount = 0;
+    mStopping = false;
+    mStalled = false;
+    mPhase = Phase::Start;
+    mActive = true;
+    ESP_LOGI(TAG, "Sending records %u to %u, %u per notification (MTU %u)", mCursor, end,
+             (unsigned)mRecordsPerFrame, mtu);
+    pump();
+}
+
+void HistorySync::onSent(int status)
+{
+    // The callback does not say whose notification it was; one expected
+    // from the delivery queue frees nothing of ours
+    uint32_t other = mOtherPending.load(std::memory_order_relaxed);
+    while (other > 0 && !mOtherPending.compare_exchange_weak(other, other - 1, std::memory_order_relaxed))
+    {
+    }
+    if (other > 0)
+    {
+        return;
+    }
+
+    xSemaphoreTakeRecursive(mMutex, portMAX_DELAY);
+    if (mInFlight > 0)
+    {
+        mInFlight--;
+    }
+    if (mActive)
+    {
+        pump();
+    }
+    xSemaphoreGiveRecursive(mMutex);
+}
+
+void HistorySync::onDisconnect(uint16_t connHandle)
+{
+    xSemaphoreTakeRecursive(mMutex, portMAX_DELAY);
+    if (mActive && connHandle == mConnHandle)
+    {
+        ESP_LOGI(TAG, "Central left after %u records, resumes from %u", mSent,
+                 mBufferCount ? mSeqs[mBufferStart] : mCursor);
+        mActive = false;
+        mStalled = false;
+    }
+    xSemaphoreGiveRecursive(mMutex);
+}
+
+void HistorySync::update()
+{
+    if (!mStalled.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    xSemaphoreTakeRecursive(mMutex, portMAX_DELAY);
+    if (mStalled && millis() - mStalledAt >= RETRY_MS)
+    {
+        mStalled = false;
+        if (mActive)
+        {
+            pump();
+        }
+    }
+    xSemaphoreGiveRecursive(mMutex);
+}
+
+// Sends frames while the window has room. Re-entered from onSent() when a
+// notification completes synchronously; the outer call keeps going then.
+void HistorySync::pump()
+{
+    if (mPumping)
+    {
+        return;
+    }
+    mPumping = true;
+    while (mActive && mInFlight < WINDOW)
+    {
+        FrameResult result;
+        switch (mPhase)
+        {
+        case Phase::Start:
+            result = sendStart();
+            break;
+        case Phase::Records:
+            result = mStopping ? FrameResult::Done : sendFrame();
+            break;
+        default:
+            result = sendComplete();
+            break;
+        }
+        if (result == FrameResult::Done)
+        {
+            mPhase = Phase::Complete;
+        }
+        else if (result == FrameResult::Busy)
+        {
+            // No status callback is coming to pump again, update() will
+            if (mInFlight == 0)
+            {
+                mStalled = true;
+                mStalledAt = millis();
+            }
+            break;
+        }
+    }
+    mPumping = false;
+}
+
+HistorySync::FrameResult HistorySync::sendStart()
+{
+    uint8_t frame[9] = {MI_HISTORY_CMD_START};
+    putLE32(frame + 1, mCursor);
+    putLE32(frame + 5, mEnd);
+    if (!notify(frame, sizeof(frame)))
+    {
+        return FrameResult::Busy;
+    }
+    mPhase = Phase::Records;
+    return FrameResult::Sent;
+}
+
+// Tops the buffer up from flash so it holds at least a full frame where the
+// log has one, dropping records taken before mSince
+void HistorySync::refill()
+{
+    memmove(mBuffer, mBuffer + mBufferStart, mBufferCount * sizeof(mBuffer[0]));
+    memmove(mSeqs, mSeqs + mBufferStart, mBufferCount * sizeof(mSeqs[0]));
+    mBufferStart = 0;
+    while (mBufferCount < mRecordsPerFrame)
+    {
+        size_t n = mHistory->read(mCursor, mBuffer + mBufferCount, READ_AHEAD - mBufferCount, mSeqs + mBufferCount);
+        if (n == 0)
+        {
+            return;
+        }
+        size_t end = mBufferCount + n;
+        for (size_t i = mBufferCount; i < end; i++)
+        {
+            if (mBuffer[i].timestamp < mSince)
+            {
+                continue;
+            }
+            mBuffer[mBufferCount] = mBuffer[i];
+            mSeqs[mBufferCount++] = mSeqs[i];
+        }
+    }
+}
+
+HistorySync::FrameResult HistorySync::sendFrame()
+{
+    if (mBufferCount < mRecordsPerFrame)
+    {
+        refill();
+    }
+    if (mBufferCount == 0)
+    {
+        return FrameResult::Done;
+    }
+
+    size_t count = min(mRecordsPerFrame, mBufferCount);
+    uint8_t frame[MAX_FRAME];
+    frame[0] = MI_HISTORY_RECORDS;
+    frame[1] = count;
+    putLE32(frame + 2, mSeqs[mBufferStart + count - 1] + 1);
+    uint8_t *out = frame + FRAME_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++, out += RECORD_SIZE)
+    {
+        const WeightHistoryRecord &record = mBuffer[mBufferStart + i];
+        putLE32(out, record.timestamp);
+        putLE16(out + 4, (uint16_t)(record.weight * 200));
+        putLE16(out + 6, record.impedance > 0xFFFF ? 0xFFFF : record.impedance);
+        putLE16(out + 8, (uint16_t)(record.bodyFat * 10));
+        out[10] = record.user_id;
+        out[11] = record.isStabilized ? MEASUREMENT_STABLE : 0;
+    }
+
+    if (!notify(frame, out - frame))
+    {
+        return FrameResult::Busy;
+    }
+    mBufferStart += count;
+    mBufferCount -= count;
+    mSent += count;
+    return FrameResult::Sent;
+}
+
+// Ends the transfer once the stack takes the frame
+HistorySync::FrameResult HistorySync::sendComplete()
+{
+    // Unsent buffered records are where the next sync picks up
+    uint32_t cursor = mBufferCount ? mSeqs[mBufferStart] : mCursor;
+    uint8_t frame[9] = {MI_HISTORY_CMD_COMPLETE};
+    putLE32(frame + 1, cursor);
+    putLE32(frame + 5, mSent);
+    if (!notify(frame, sizeof(frame)))
+    {
+        return FrameResult::Busy;
+    }
+    mActive = false;
+    metrics::historySynced.add(mSent);
+    ESP_LOGI(TAG, "Transfer %s after %u records, cursor %u", mStopping ? "stopped" : "complete", mSent, cursor);
+    return FrameResult::Sent;
+}
+
+bool HistorySync::notify(const uint8_t *frame, size_t length)
+{
+    // Counted first: the status callback may run before notify() returns
+    mInFlight++;
+    if (!mCharacteristic->notify(frame, length, mConnHandle))
+    {
+        mInFlight--;
+        return false;
+    }
+    mPolicy->noteSent(mConnHandle, length);
+    metrics::bleNotifications.add();
+    return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include <atomic>
+#include "measurement_log.h"
+#include "connection_policy.h"
+
+// History transfer over the HM-10 characteristic.
+//
+// The central writes a command, the service answers with notifications:
+//
+//   write  START    01 [u32 cursor]     records from sequence number `cursor` on
+//                                       (0 or absent: everything kept)
+//   write  REQUEST  02 u32 since        records taken at or after Unix time `since`
+//   write  STOP     03                  abort, a COMPLETE still follows
+//   notify START    01 u32 cursor u32 end        transfer begins, `end` is the
+//                                                next sequence number to be stored
+//   notify RECORDS  05 u8 n u32 cursor n * 12 bytes
+//   notify COMPLETE 04 u32 cursor u32 sent       `cursor` resumes the next sync
+//
+// Each RECORDS notification holds as many records as fit in the ATT MTU.
+// A record is u32 timestamp, u16 weight (5 g units, as the WSS), u16
+// impedance, u16 body fat (0.1 %), u8 user id, u8 flags (MEASUREMENT_STABLE).
+// The cursor in a RECORDS notification is where the following one starts,
+// so a central that loses the connection can START again from the last
+// cursor it received.
+//
+// At most WINDOW notifications are queued in the stack at a time; each
+// status callback releases one and sends the next, so a long backlog goes
+// out at the link's pace without overrunning NimBLE's buffers. START and
+// COMPLETE go through the same window, so every transfer the central sees
+// begins with its range and ends with its resume cursor. When the stack
+// refuses a frame with none of ours in flight, no status callback will
+// come, so update() retries it from loop() after RETRY_MS. The rest
+// runs in NimBLE callbacks, a mutex keeps the two apart; one transfer at a
+// time.
+class HistorySync
+{
+public:
+    static const size_t RECORD_SIZE = 12;
+    static const size_t FRAME_HEADER_SIZE = 6;
+    static const size_t WINDOW = 4;
+
+    void begin(MeasurementLog *history, NimBLECharacteristic *characteristic, ConnectionPolicy *policy);
+
+    // From ScaleBLEService's callbacks
+    void onCommand(const uint8_t *data, size_t length, const NimBLEConnInfo &connInfo);
+    void onSent(int status);
+    void onDisconnect(uint16_t connHandle);
+
+    // Another HM-10 notification is about to go out; its status callback
+    // must not free a slot in the window. Cancel if notify() refuses it.
+    void expectOtherStatus() { mOtherPending.fetch_add(1, std::memory_order_relaxed); }
+    void cancelOtherStatus() { mOtherPending.fetch_sub(1, std::memory_order_relaxed); }
+
+    // Call from loop(); retries a stalled transfer
+    void update();
+
+    bool active() const { return mActive; }
+
+private:
+    enum class FrameResult : uint8_t
+    {
+        Sent,
+        Busy, // the stack is out of buffers, wait for a status callback
+        Done
+    };
+
+    // What the next frame of the transfer is
+    enum class Phase : uint8_t
+    {
+        Start,
+        Records,
+        Complete
+    };
+
+    // constexpr: std::min() takes MAX_FRAME by reference
+    static constexpr size_t MAX_FRAME = 244; // data length of the largest ATT MTU NimBLE negotiates (247)
+    static constexpr size_t READ_AHEAD = 2 * ((MAX_FRAME - FRAME_HEADER_SIZE) / RECORD_SIZE);
+    static const uint32_t RETRY_MS = 20;
+
+    void start(uint32_t cursor, uint32_t since, const NimBLEConnInfo &connInfo);
+    void pump();
+    FrameResult sendStart();
+    FrameResult sendFrame();
+    FrameResult sendComplete();
+    void refill();
+    bool notify(const uint8_t *frame, size_t length);
+
+    MeasurementLog *mHistory = nullptr;
+    NimBLECharacteristic *mCharacteristic = nullptr;
+    ConnectionPolicy *mPolicy = nullptr;
+    SemaphoreHandle_t mMutex = nullptr; // recursive: a status callback can run inside notify()
+
+    bool mActive = false; // until COMPLETE is queued or the central leaves
+    Phase mPhase = Phase::Start;
+    bool mStopping = false;
+    bool mPumping = false;
+    uint16_t mConnHandle = BLE_HS_CONN_HANDLE_NONE;
+    size_t mRecordsPerFrame = 1;
+    uint32_t mCursor = 0; // next sequence number to read from the log
+    uint32_t mSince = 0;  // REQUEST: skip records taken before this
+    uint32_t mEnd = 0;    // next sequence number stored when the transfer started
+    uint32_t mSent = 0;
+    uint32_t mInFlight = 0;
+    std::atomic<uint32_t> mOtherPending{0}; // HM-10 notifications from the delivery queue
+    std::atomic<bool> mStalled{false};      // refused with nothing in flight, see update()
+    uint32_t mStalledAt = 0;
+
+    // Records read from flash but not sent yet, with their sequence numbers
+    WeightHistoryRecord mBuffer[READ_AHEAD];
+    uint32_t mSeqs[READ_AHEAD];
+    size_t mBufferStart = 0;
+    size_t mBufferCount = 0;
+};
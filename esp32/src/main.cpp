@@ -5,6 +5,13 @@
 #include "dns_server.h"
 #include "web_server.h"
 #include "scale_ble_service.h"
+#include "measurement_pipeline.h"
+#include "upload_dedupe.h"
+#include "scale_registry.h"
+#include "firmware_store.h"
+#include "metrics.h"
+#include "trace.h"
+#include "wall_clock.h"
 #include <LittleFS.h>
 #include <M5Unified.h>
 
@@ -15,6 +22,8 @@ const char *userName = "You";             // Default userName
 uint8_t gender = 2;                       // Default gender (2=male, 0=female)
 int age = 18;                             // Default age
 int height = 1800;                        // Default height in mm
+aria::UserTable users;                    // userN= lines, or the single user above
+aria::ResponseCache responseCache(users);
 
 static const char *TAG = "MAIN"; // Tag for ESP logging
 
@@ -23,6 +32,10 @@ static const char *TAG = "MAIN"; // Tag for ESP logging
 CaptiveDNSServer dnsServer;
 CaptiveWebServer webServer;
 ScaleBLEService bleService;
+MeasurementPipeline pipeline;
+UploadDedupe dedupe;
+ScaleRegistry scales;
+FirmwareStore firmware;
 
 void updateDisplay()
 {
@@ -52,8 +65,8 @@ void updateDisplay()
     M5.Display.printf("Weight: %.2f kg\n", last.weight);
     M5.Display.setTextColor(WHITE, BLACK);
 
-    auto dt = M5.Rtc.getDateTime();
-    M5.Display.printf("\nTime: %04d-%02d-%02d\n      %02d:%02d:%02d\n", dt.date.year, dt.date.month, dt.date.date, dt.time.hours, dt.time.minutes, dt.time.seconds);
+    civil::DateTime dt = wallclock::dateTime(wallclock::now());
+    M5.Display.printf("\nTime: %04d-%02d-%02d\n      %02d:%02d:%02d\n", dt.year, dt.month, dt.day, dt.hour, dt.minute, dt.second);
 }
 
 // WiFi event handler
@@ -82,6 +95,7 @@ void setup()
 {
     auto cfg = M5.config();
     M5.begin(cfg);
+    wallclock::begin();
 
     M5.Display.setRotation(1);
     M5.Display.fillScreen(BLACK);
@@ -95,8 +109,38 @@ void setup()
     // Initialize BLE service
     bleService.begin();
 
+    // Keys of measurements already stored, so re-sent ones are skipped
+    dedupe.begin();
+    // Every Aria that has uploaded here, by MAC
+    scales.begin();
+
+    // Persistence and BLE notifications run on their own task
+    pipeline.begin(&bleService, &dedupe);
+
+    // Sampled on every /metrics scrape or BLE read
+    metrics::addGauge("helvetic_pipeline_queue_depth", "Measurements waiting for the worker",
+                      [](void *) { return (uint32_t)pipeline.queueDepth(); }, nullptr);
+    metrics::addGauge("helvetic_pipeline_queue_high_watermark", "Deepest the measurement queue has been",
+                      [](void *) { return (uint32_t)pipeline.queueHighWatermark(); }, nullptr);
+    metrics::addGauge("helvetic_pipeline_dropped_total", "Measurements dropped on a full queue",
+                      [](void *) { return pipeline.dropped(); }, nullptr, true);
+    metrics::addGauge("helvetic_pipeline_processed_total", "Measurements handled by the worker",
+                      [](void *) { return pipeline.processed(); }, nullptr, true);
+    metrics::addSection(ScaleRegistry::writePrometheus, &scales);
+    metrics::addSection(ConnectionPolicy::writePrometheus, &bleService.getConnectionPolicy());
+    metrics::addSection(MeasurementLog::writePrometheus, &bleService.getHistory());
+    metrics::addGauge("helvetic_history_records", "Measurements kept in the history log",
+                      [](void *) { return bleService.getHistory().count(); }, nullptr);
+    metrics::addGauge("helvetic_ble_connections", "Connected BLE centrals",
+                      [](void *) { return bleService.getConnectedCount(); }, nullptr);
+    metrics::addGauge("helvetic_ble_delivery_backlog", "Measurements connected centrals have not been sent yet",
+                      [](void *) { return bleService.getDeliveryBacklog(); }, nullptr);
+
     // Pass BLE service to web server
     webServer.setScaleBLEService(&bleService);
+    webServer.setMeasurementPipeline(&pipeline);
+    webServer.setUploadDedupe(&dedupe);
+    webServer.setScaleRegistry(&scales);
 
     // Manually parse key=value configuration
     File file = LittleFS.open("/config.txt", "r");
@@ -135,6 +179,44 @@ void setup()
                 // Convert 'f'/'m' to 0/2
                 gender = (tolower(value[0]) == 'f') ? 0 : 2;
             }
+            else if (strcmp(key, "age") == 0)
+            {
+                age = atoi(value);
+            }
+            else if (strcmp(key, "height") == 0)
+            {
+                height = atoi(value);
+            }
+            else if (strncmp(key, "user", 4) == 0 && isdigit(key[4]))
+            {
+                // user1=id,name,birthdate,height_mm,gender[,tolerance_g]
+                aria::UserProfile profile;
+                if (!aria::parseUserProfile(value, profile))
+                {
+                    ESP_LOGW(TAG, "Ignoring malformed %s", key);
+                }
+                else if (!users.add(profile))
+                {
+                    ESP_LOGW(TAG, "Ignoring %s: duplicate id or more than %d users", key, (int)aria::MAX_USERS);
+                }
+            }
+            else if (strcmp(key, "firmwareVersion") == 0)
+            {
+                // Offered to scales running anything older
+                firmware.setTarget(strtoul(value, nullptr, 10));
+            }
+            else if (strcmp(key, "dnsUpstream") == 0)
+            {
+                IPAddress upstream;
+                if (upstream.fromString(value))
+                {
+                    dnsServer.setUpstream(upstream);
+                }
+                else
+                {
+                    ESP_LOGW(TAG, "Ignoring invalid dnsUpstream %s", value);
+                }
+            }
         }
     }
 
@@ -159,8 +241,40 @@ void setup()
         return;
     }
 
-    // Pass userName to web server
-    webServer.setUserParams(userName, gender, age, height);
+    // Without userN= lines the old single user settings still apply
+    if (users.size() == 0)
+    {
+        aria::UserProfile profile = {};
+        profile.id = 0x1234;
+        strncpy(profile.name, userName, aria::USER_NAME_SIZE);
+        profile.age = age;
+        profile.heightMm = height;
+        profile.gender = gender;
+        profile.toleranceG = aria::DEFAULT_TOLERANCE_G;
+        users.add(profile);
+    }
+    users.compile();
+    // Windows follow each user's weigh-ins and start from each one's newest
+    // stored measurement; with a single user guests are theirs too. Oldest
+    // first, so the newer of a lone user's own and guest records wins
+    WeightHistoryRecord latest[16];
+    for (size_t i = bleService.getHistory().latestPerUser(latest, sizeof(latest) / sizeof(latest[0])); i-- > 0;)
+    {
+        size_t user = latest[i].user_id == 0 && users.size() == 1 ? 1 : latest[i].user_id;
+        if (user >= 1 && user <= users.size() && latest[i].weight > 0)
+        {
+            users.setLastWeight(user - 1, (uint32_t)(latest[i].weight * 1000.0f));
+        }
+    }
+    for (size_t i = 0; i < users.size(); i++)
+    {
+        ESP_LOGI(TAG, "User %u: %s, id 0x%x", (unsigned)i + 1, users.user(i).name, (unsigned)users.user(i).id);
+    }
+    webServer.setUserTable(&users, &responseCache);
+
+    // Images under /firmware, checked against their published hashes
+    firmware.begin();
+    webServer.setFirmwareStore(&firmware);
 
     // Configure and start web server
     webServer.begin();
@@ -168,10 +282,20 @@ void setup()
 
 void loop()
 {
+    ScopedTimer timer(metrics::loopIteration);
     M5.update();
-    dnsServer.processNextRequest();
+    wallclock::update();
     webServer.handleClient();
+    bleService.update();
+    scales.update();
     updateDisplay();
+
+    // 't' on the serial console dumps the trace buffer
+    if (Serial.available() && Serial.read() == 't')
+    {
+        trace::drain([](void *, const char *data, size_t length)
+                     { Serial.write((const uint8_t *)data, length); }, nullptr);
+    }
     // Get and log current RTC time every 10 seconds
     // static unsigned long lastPrint = 0;
     // if (millis() - lastPrint >= 10000)
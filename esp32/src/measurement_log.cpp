@@ -0,0 +1,652 @@
+#include "measurement_log.h"
+#include "trace.h"
+#include <esp_log.h>
+#include <crc16.h>
+
+static const char *TAG = "HISTORY";
+const char *MeasurementLog::DIRECTORY = "/history";
+
+// A new segment's base is this far before its first record, so cached
+// older measurements uploaded a little later still fit into it
+static const uint32_t BASE_SLACK = 30 * 24 * 3600;
+static const uint32_t TREND_SECONDS = 30 * 24 * 3600;
+
+uint16_t MeasurementLog::legacyCrc(const LegacyRecord &record)
+{
+    return Crc16Xmodem::compute((const uint8_t *)&record, offsetof(LegacyRecord, crc));
+}
+
+void MeasurementLog::segmentPath(uint32_t id, char *path, size_t size, const char *extension)
+{
+    snprintf(path, size, "%s/%08lx.%s", DIRECTORY, (unsigned long)id, extension);
+}
+
+history::Record MeasurementLog::pack(const WeightHistoryRecord &measurement)
+{
+    history::Record record;
+    record.timestamp = measurement.timestamp;
+    record.weightGrams = measurement.weight > 0 ? (uint32_t)lroundf(measurement.weight * 1000) : 0;
+    record.fat = measurement.bodyFat > 0 ? (uint32_t)lroundf(measurement.bodyFat * 1000) : 0;
+    record.impedance = measurement.impedance > 0xFFFF ? 0xFFFF : measurement.impedance;
+    record.user = measurement.user_id;
+    record.flags = measurement.isStabilized ? history::FLAG_STABLE : 0;
+    return record;
+}
+
+WeightHistoryRecord MeasurementLog::unpack(const history::Record &record)
+{
+    // The Aria reports neither water nor muscle
+    return WeightHistoryRecord{
+        .weight = record.weightGrams / 1000.0f,
+        .impedance = record.impedance,
+        .bodyFat = record.fat / 1000.0f,
+        .water = 0.0f,
+        .muscle = 0.0f,
+        .timestamp = record.timestamp,
+        .user_id = record.user,
+        .isStabilized = (record.flags & history::FLAG_STABLE) != 0};
+}
+
+// Ids of the newest MAX_SEGMENTS files with the extension, ascending
+static size_t listSegments(const char *directory, const char *extension, uint32_t *ids, size_t maxIds)
+{
+    size_t idCount = 0;
+    File dir = LittleFS.open(directory);
+    for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile())
+    {
+        char *end = nullptr;
+        unsigned long id = strtoul(entry.name(), &end, 16);
+        bool isSegment = !entry.isDirectory() && end != entry.name() && *end == '.' && strcmp(end + 1, extension) == 0;
+        entry.close();
+        if (!isSegment)
+        {
+            continue;
+        }
+        if (idCount == maxIds)
+        {
+            // Only left behind if MAX_SEGMENTS shrank between builds
+            uint32_t stale = id < ids[0] ? (uint32_t)id : ids[0];
+            char path[32];
+            snprintf(path, sizeof(path), "%s/%08lx.%s", directory, (unsigned long)stale, extension);
+            LittleFS.remove(path);
+            if (stale == id)
+            {
+                continue;
+            }
+            memmove(ids, ids + 1, --idCount * sizeof(uint32_t));
+        }
+        size_t pos = idCount++;
+        while (pos > 0 && ids[pos - 1] > id)
+        {
+            ids[pos] = ids[pos - 1];
+            pos--;
+        }
+        ids[pos] = (uint32_t)id;
+    }
+    dir.close();
+    return idCount;
+}
+
+bool MeasurementLog::begin()
+{
+    // Runs before the worker and BLE tasks use the log, so without the lock
+    if (!mMutex)
+    {
+        mMutex = xSemaphoreCreateMutex();
+    }
+
+    if (!LittleFS.exists(DIRECTORY) && !LittleFS.mkdir(DIRECTORY))
+    {
+        ESP_LOGE(TAG, "Failed to create %s", DIRECTORY);
+        return false;
+    }
+
+    uint32_t ids[MAX_SEGMENTS];
+    size_t idCount = listSegments(DIRECTORY, "seg", ids, MAX_SEGMENTS);
+
+    mSegmentCount = 0;
+    mHasLast = false;
+    mTailWritable = false;
+    mNextSeq = 0;
+    mCache.clear(0);
+    bool torn = false;
+    for (size_t i = 0; i < idCount; i++)
+    {
+        Segment &segment = mSegments[mSegmentCount];
+        segment.id = ids[i];
+        if (scanSegment(segment, torn) && segment.count > 0)
+        {
+            mSegmentCount++;
+        }
+        else
+        {
+            char path[32];
+            segmentPath(ids[i], path, sizeof(path));
+            LittleFS.remove(path);
+        }
+    }
+
+    // A torn or full tail is left alone; the next append starts a new segment
+    mTailWritable = mSegmentCount > 0 && !torn && mSegments[mSegmentCount - 1].count < RECORDS_PER_SEGMENT;
+    migrateLegacy();
+
+    ESP_LOGI(TAG, "History: %u records in %u segments, next seq %u, %u cached%s",
+             (unsigned)count(), (unsigned)mSegmentCount, (unsigned)mNextSeq, (unsigned)mCache.size(), torn ? " (recovered torn tail)" : "");
+    return true;
+}
+
+bool MeasurementLog::scanSegment(Segment &segment, bool &torn)
+{
+    char path[32];
+    segmentPath(segment.id, path, sizeof(path));
+    File file = LittleFS.open(path, "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    uint8_t buffer[16 * history::RECORD_SIZE];
+    history::SegmentHeader header;
+    // Sequence numbers must keep increasing across segments
+    if (file.read(buffer, history::HEADER_SIZE) != history::HEADER_SIZE || !history::decodeHeader(buffer, header) ||
+        (mHasLast && header.firstSeq < mNextSeq))
+    {
+        file.close();
+        return false;
+    }
+
+    segment.firstSeq = header.firstSeq;
+    segment.baseTimestamp = header.baseTimestamp;
+    segment.count = 0;
+    segment.minTimestamp = UINT32_MAX;
+    segment.maxTimestamp = 0;
+    torn = false;
+
+    size_t length;
+    while (!torn && (length = file.read(buffer, sizeof(buffer))) > 0)
+    {
+        for (size_t offset = 0; offset < length; offset += history::RECORD_SIZE)
+        {
+            history::Record record;
+            if (length - offset < history::RECORD_SIZE ||
+                !history::decode(buffer + offset, segment.baseTimestamp, record))
+            {
+                torn = true;
+                break;
+            }
+            uint32_t seq = segment.firstSeq + segment.count++;
+            segment.minTimestamp = min(segment.minTimestamp, record.timestamp);
+            segment.maxTimestamp = max(segment.maxTimestamp, record.timestamp);
+            mCache.push(seq, record);
+            mLast = unpack(record);
+            mHasLast = true;
+            mNextSeq = seq + 1;
+        }
+    }
+    file.close();
+    return true;
+}
+
+// Converts version 1 segments, oldest first. Each file is deleted once its
+// records are appended; records an interrupted run already converted are
+// recognised by their sequence numbers.
+void MeasurementLog::migrateLegacy()
+{
+    uint32_t ids[MAX_SEGMENTS];
+    size_t idCount = listSegments(DIRECTORY, "log", ids, MAX_SEGMENTS);
+    uint32_t migrated = 0;
+    for (size_t i = 0; i < idCount; i++)
+    {
+        char path[32];
+        segmentPath(ids[i], path, sizeof(path), "log");
+        File file = LittleFS.open(path, "r");
+        LegacyRecord legacy;
+        while (file && file.read((uint8_t *)&legacy, sizeof(legacy)) == sizeof(legacy))
+        {
+            if (legacy.magic != LEGACY_MAGIC || legacy.crc != legacyCrc(legacy))
+            {
+                break;
+            }
+            if (mHasLast && legacy.seq < mNextSeq)
+            {
+                continue;
+            }
+            if (legacy.seq != mNextSeq)
+            {
+                // Segments hold consecutive numbers only
+                mNextSeq = legacy.seq;
+                mTailWritable = false;
+            }
+            if (!appendLocked(pack(legacy.measurement)))
+            {
+                file.close();
+                ESP_LOGE(TAG, "Converting %s failed, retrying on the next boot", path);
+                return;
+            }
+            migrated++;
+        }
+        file.close();
+        if (mTailFile)
+        {
+            mTailFile.flush();
+        }
+        LittleFS.remove(path);
+    }
+    if (idCount > 0)
+    {
+        ESP_LOGI(TAG, "Converted %u records from %u version 1 segments", migrated, (unsigned)idCount);
+    }
+}
+
+bool MeasurementLog::startSegment(uint32_t baseTimestamp)
+{
+    if (mTailFile)
+    {
+        mTailFile.close();
+    }
+    if (mSegmentCount == MAX_SEGMENTS)
+    {
+        dropOldestSegment();
+    }
+
+    Segment &segment = mSegments[mSegmentCount];
+    segment.id = mSegmentCount ? mSegments[mSegmentCount - 1].id + 1 : 0;
+    segment.firstSeq = mNextSeq;
+    segment.count = 0;
+    segment.minTimestamp = UINT32_MAX;
+    segment.maxTimestamp = 0;
+    segment.baseTimestamp = baseTimestamp;
+
+    char path[32];
+    segmentPath(segment.id, path, sizeof(path));
+    uint8_t header[history::HEADER_SIZE];
+    history::encodeHeader({segment.firstSeq, segment.baseTimestamp}, header);
+    mTailFile = LittleFS.open(path, "w");
+    if (!mTailFile || mTailFile.write(header, sizeof(header)) != sizeof(header))
+    {
+        ESP_LOGE(TAG, "Failed to create %s", path);
+        mTailFile.close();
+        LittleFS.remove(path);
+        mTailWritable = false;
+        return false;
+    }
+    mSegmentCount++;
+    mTailWritable = true;
+    return true;
+}
+
+bool MeasurementLog::openTailSegment()
+{
+    char path[32];
+    segmentPath(mSegments[mSegmentCount - 1].id, path, sizeof(path));
+    mTailFile = LittleFS.open(path, "a");
+    if (!mTailFile)
+    {
+        ESP_LOGE(TAG, "Failed to open %s for appending", path);
+        return false;
+    }
+    return true;
+}
+
+void MeasurementLog::dropOldestSegment()
+{
+    char path[32];
+    segmentPath(mSegments[0].id, path, sizeof(path));
+    LittleFS.remove(path);
+    memmove(mSegments, mSegments + 1, (mSegmentCount - 1) * sizeof(Segment));
+    mSegmentCount--;
+    ESP_LOGI(TAG, "Rotated out %s", path);
+}
+
+bool MeasurementLog::appendLocked(const history::Record &record)
+{
+    Segment *tail = mSegmentCount ? &mSegments[mSegmentCount - 1] : nullptr;
+    if (!mTailWritable || !tail || tail->count >= RECORDS_PER_SEGMENT || !history::fits(record, tail->baseTimestamp))
+    {
+        if (!startSegment(record.timestamp > BASE_SLACK ? record.timestamp - BASE_SLACK : 0))
+        {
+            return false;
+        }
+        tail = &mSegments[mSegmentCount - 1];
+    }
+    else if (!mTailFile && !openTailSegment())
+    {
+        return false;
+    }
+
+    uint8_t packed[history::RECORD_SIZE];
+    history::encode(record, tail->baseTimestamp, packed);
+    if (mTailFile.write(packed, sizeof(packed)) != sizeof(packed))
+    {
+        // Whatever made it to flash fails the CRC on the next boot
+        ESP_LOGE(TAG, "Failed to append record %u", mNextSeq);
+        mTailFile.close();
+        mTailWritable = false;
+        return false;
+    }
+
+    tail->count++;
+    tail->minTimestamp = min(tail->minTimestamp, record.timestamp);
+    tail->maxTimestamp = max(tail->maxTimestamp, record.timestamp);
+    mCache.push(mNextSeq, record);
+    mLast = unpack(record);
+    mHasLast = true;
+    mNextSeq++;
+    return true;
+}
+
+bool MeasurementLog::append(const WeightHistoryRecord *records, size_t count)
+{
+    Lock lock(mMutex);
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; i++)
+    {
+        ok = appendLocked(pack(records[i]));
+    }
+
+    if (mTailFile)
+    {
+        mTailFile.flush();
+    }
+    TRACE(HISTORY_APPEND, count, mNextSeq);
+    return ok;
+}
+
+bool MeasurementLog::last(WeightHistoryRecord &record) const
+{
+    Lock lock(mMutex);
+    if (!mHasLast)
+    {
+        return false;
+    }
+    record = mLast;
+    return true;
+}
+
+uint32_t MeasurementLog::count() const
+{
+    Lock lock(mMutex);
+    uint32_t total = 0;
+    for (size_t i = 0; i < mSegmentCount; i++)
+    {
+        total += mSegments[i].count;
+    }
+    return total;
+}
+
+uint32_t MeasurementLog::firstSeq() const
+{
+    Lock lock(mMutex);
+    return mSegmentCount ? mSegments[0].firstSeq : mNextSeq;
+}
+
+uint32_t MeasurementLog::nextSeq() const
+{
+    Lock lock(mMutex);
+    return mNextSeq;
+}
+
+uint32_t MeasurementLog::seqForTimestamp(uint32_t since) const
+{
+    Lock lock(mMutex);
+    for (size_t i = 0; i < mSegmentCount; i++)
+    {
+        if (mSegments[i].maxTimestamp >= since)
+        {
+            return mSegments[i].firstSeq;
+        }
+    }
+    return mNextSeq;
+}
+
+int MeasurementLog::findSegment(uint32_t seq) const
+{
+    // Binary search, segments are ordered by firstSeq
+    int lo = 0;
+    int hi = (int)mSegmentCount - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        const Segment &segment = mSegments[mid];
+        if (seq < segment.firstSeq)
+        {
+            hi = mid - 1;
+        }
+        else if (seq >= segment.firstSeq + segment.count)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            return mid;
+        }
+    }
+    // Not stored; point at the next segment that is
+    return lo < (int)mSegmentCount ? lo : -1;
+}
+
+size_t MeasurementLog::read(uint32_t &seq, WeightHistoryRecord *records, size_t max, uint32_t *seqs)
+{
+    Lock lock(mMutex);
+    size_t n = 0;
+    while (n < max && seq < mNextSeq)
+    {
+        int index = findSegment(seq);
+        if (index < 0)
+        {
+            break;
+        }
+        const Segment &segment = mSegments[index];
+        if (seq < segment.firstSeq)
+        {
+            seq = segment.firstSeq;
+        }
+
+        // The newest records come from RAM
+        if (mCache.contains(seq))
+        {
+            for (; n < max && seq < mNextSeq; seq++)
+            {
+                if (seqs)
+                {
+                    seqs[n] = seq;
+                }
+                records[n++] = unpack(mCache.at(seq));
+            }
+            break;
+        }
+
+        if (mTailFile)
+        {
+            mTailFile.flush();
+        }
+        char path[32];
+        segmentPath(segment.id, path, sizeof(path));
+        File file = LittleFS.open(path, "r");
+        if (!file || !file.seek(history::HEADER_SIZE + (seq - segment.firstSeq) * history::RECORD_SIZE))
+        {
+            ESP_LOGE(TAG, "Failed to read %s", path);
+            break;
+        }
+
+        uint8_t packed[history::RECORD_SIZE];
+        while (n < max && seq < segment.firstSeq + segment.count && !mCache.contains(seq) &&
+               file.read(packed, sizeof(packed)) == sizeof(packed))
+        {
+            history::Record record;
+            if (history::decode(packed, segment.baseTimestamp, record))
+            {
+                if (seqs)
+                {
+                    seqs[n] = seq;
+                }
+                records[n++] = unpack(record);
+            }
+            seq++;
+        }
+        file.close();
+
+        if (seq < segment.firstSeq + segment.count && n < max && !mCache.contains(seq))
+        {
+            // Short read, do not spin on this segment
+            seq = segment.firstSeq + segment.count;
+        }
+    }
+    return n;
+}
+
+size_t MeasurementLog::readPacked(uint32_t &seq, const Filter &filter, history::Record *records, size_t max,
+                                  uint32_t *seqs)
+{
+    Lock lock(mMutex);
+    size_t n = 0;
+    size_t scanned = 0;
+    while (n < max && seq < mNextSeq && scanned < RECORDS_PER_SEGMENT)
+    {
+        int index = findSegment(seq);
+        if (index < 0)
+        {
+            seq = mNextSeq;
+            break;
+        }
+        const Segment &segment = mSegments[index];
+        uint32_t end = segment.firstSeq + segment.count;
+        if (seq < segment.firstSeq)
+        {
+            seq = segment.firstSeq;
+        }
+        if (segment.count == 0 || segment.maxTimestamp < filter.since || segment.minTimestamp > filter.until)
+        {
+            seq = end;
+            continue;
+        }
+
+        if (mCache.contains(seq))
+        {
+            for (; n < max && seq < end; seq++, scanned++)
+            {
+                history::Record record = mCache.at(seq);
+                if (filter.matches(record))
+                {
+                    if (seqs)
+                    {
+                        seqs[n] = seq;
+                    }
+                    records[n++] = record;
+                }
+            }
+            continue;
+        }
+
+        // From flash up to where the cache takes over
+        uint32_t flashEnd = mCache.size() && mCache.firstSeq() > seq && mCache.firstSeq() < end ? mCache.firstSeq() : end;
+        if (mTailFile)
+        {
+            mTailFile.flush();
+        }
+        char path[32];
+        segmentPath(segment.id, path, sizeof(path));
+        File file = LittleFS.open(path, "r");
+        if (!file || !file.seek(history::HEADER_SIZE + (seq - segment.firstSeq) * history::RECORD_SIZE))
+        {
+            ESP_LOGE(TAG, "Failed to read %s", path);
+            seq = end;
+            continue;
+        }
+
+        uint8_t block[READ_BLOCK * history::RECORD_SIZE];
+        while (seq < flashEnd && n < max && scanned < RECORDS_PER_SEGMENT)
+        {
+            // Never more than fit into `records`, so no record is read twice
+            size_t want = min((size_t)(flashEnd - seq), min((size_t)READ_BLOCK, max - n));
+            size_t length = file.read(block, want * history::RECORD_SIZE);
+            if (length < want * history::RECORD_SIZE)
+            {
+                // Short read, do not spin on this segment
+                seq = flashEnd;
+                break;
+            }
+            scanned += want;
+            for (size_t offset = 0; offset < length; offset += history::RECORD_SIZE, seq++)
+            {
+                history::Record record;
+                if (history::decode(block + offset, segment.baseTimestamp, record) && filter.matches(record))
+                {
+                    if (seqs)
+                    {
+                        seqs[n] = seq;
+                    }
+                    records[n++] = record;
+                }
+            }
+        }
+        file.close();
+    }
+    return n;
+}
+
+bool MeasurementLog::latest(uint8_t user, WeightHistoryRecord &record) const
+{
+    Lock lock(mMutex);
+    history::Record packed;
+    if (!mCache.latest(user, packed))
+    {
+        return false;
+    }
+    record = unpack(packed);
+    return true;
+}
+
+size_t MeasurementLog::latestPerUser(WeightHistoryRecord *records, size_t max) const
+{
+    history::Record packed[16];
+    size_t n;
+    {
+        Lock lock(mMutex);
+        n = mCache.latestPerUser(packed, min(max, sizeof(packed) / sizeof(packed[0])));
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        records[i] = unpack(packed[i]);
+    }
+    return n;
+}
+
+history::Trend MeasurementLog::trend(uint8_t user, uint32_t since) const
+{
+    Lock lock(mMutex);
+    return mCache.trend(user, since);
+}
+
+void MeasurementLog::writePrometheus(ChunkedText &out, void *context)
+{
+    const MeasurementLog &log = *static_cast<const MeasurementLog *>(context);
+    WeightHistoryRecord latest[16];
+    size_t users = log.latestPerUser(latest, sizeof(latest) / sizeof(latest[0]));
+    history::Trend trends[16];
+    for (size_t i = 0; i < users; i++)
+    {
+        // The month up to the user's own newest record, whatever our clock says
+        uint32_t since = latest[i].timestamp > TREND_SECONDS ? latest[i].timestamp - TREND_SECONDS : 0;
+        trends[i] = log.trend(latest[i].user_id, since);
+    }
+
+    out.printf("# HELP helvetic_user_weight_grams Newest weight of the user\n# TYPE helvetic_user_weight_grams gauge\n");
+    for (size_t i = 0; i < users; i++)
+    {
+        out.printf("helvetic_user_weight_grams{user=\"%u\"} %u\n", latest[i].user_id, trends[i].lastWeight);
+    }
+    out.printf("# HELP helvetic_user_last_measurement_timestamp_seconds Time of the user's newest measurement\n"
+               "# TYPE helvetic_user_last_measurement_timestamp_seconds gauge\n");
+    for (size_t i = 0; i < users; i++)
+    {
+        out.printf("helvetic_user_last_measurement_timestamp_seconds{user=\"%u\"} %u\n", latest[i].user_id,
+                   latest[i].timestamp);
+    }
+    out.printf("# HELP helvetic_user_weight_change_30d_grams Weight change over the 30 days up to the newest measurement\n"
+               "# TYPE helvetic_user_weight_change_30d_grams gauge\n");
+    for (size_t i = 0; i < users; i++)
+    {
+        out.printf("helvetic_user_weight_change_30d_grams{user=\"%u\"} %d\n", latest[i].user_id, trends[i].change());
+    }
+}
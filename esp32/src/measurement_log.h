@@ -0,0 +1,153 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <history_columns.h>
+#include <packed_record.h>
+#include "chunked_text.h"
+#include "measurement_record.h"
+
+// Append-only measurement history on LittleFS.
+//
+// Records are packed to 16 bytes in the Aria's integer units (see
+// packed_record.h) and appended to segment files of one flash block each; a
+// full segment is never written again and the oldest one is deleted once
+// MAX_SEGMENTS exist. On boot every segment is scanned once to rebuild the
+// per-segment index and to find the last intact record, so a write torn by
+// a reset is simply dropped. Segments of the older raw-struct format are
+// converted on the first boot, keeping their sequence numbers.
+//
+// The newest CACHE_RECORDS records are also kept in RAM, column by column:
+// reads within them and the per-user queries never touch flash.
+// The measurement worker appends while BLE history syncs read, so the public
+// methods take a mutex.
+class MeasurementLog
+{
+public:
+    static const size_t SEGMENT_BYTES = 4096; // one LittleFS block
+    static const size_t MAX_SEGMENTS = 32;
+    static const size_t CACHE_RECORDS = 2048; // 32 KiB
+    static const size_t READ_BLOCK = 32;       // records per flash read in readPacked()
+
+    // Which records readPacked() returns; timestamps are inclusive
+    struct Filter
+    {
+        uint32_t since = 0;
+        uint32_t until = UINT32_MAX;
+        int user = -1; // any
+
+        bool matches(const history::Record &record) const
+        {
+            return record.timestamp >= since && record.timestamp <= until && (user < 0 || record.user == user);
+        }
+    };
+
+    bool begin();
+    bool append(const WeightHistoryRecord &record) { return append(&record, 1); }
+    // Writes all records and syncs the segment once
+    bool append(const WeightHistoryRecord *records, size_t count);
+
+    bool last(WeightHistoryRecord &record) const;
+    uint32_t count() const;
+    uint32_t firstSeq() const;
+    uint32_t nextSeq() const;
+
+    // First sequence number that may hold a measurement taken at or after
+    // `since`, found through the per-segment timestamp index
+    uint32_t seqForTimestamp(uint32_t since) const;
+
+    // Reads up to `max` records starting at `seq` and advances `seq` past them.
+    // Sequence numbers that were rotated out are skipped. `seqs`, if given,
+    // receives the sequence number of each record.
+    size_t read(uint32_t &seq, WeightHistoryRecord *records, size_t max, uint32_t *seqs = nullptr);
+    // The same for bulk export, in the stored units: only records matching
+    // `filter`, skipping segments whose timestamp range rules them out
+    // without opening them and reading the others READ_BLOCK records at a
+    // time. Stops after about one segment's worth of records, so appends
+    // are not held up; the export is complete once `seq` reaches nextSeq().
+    size_t readPacked(uint32_t &seq, const Filter &filter, history::Record *records, size_t max,
+                      uint32_t *seqs = nullptr);
+
+    // Over the cached records: the newest of one user, the newest of each
+    // user (newest first), and one user's weight since a time
+    bool latest(uint8_t user, WeightHistoryRecord &record) const;
+    size_t latestPerUser(WeightHistoryRecord *records, size_t max) const;
+    history::Trend trend(uint8_t user, uint32_t since) const;
+
+    // Labelled per-user series, see metrics::addSection
+    static void writePrometheus(ChunkedText &out, void *context);
+
+    static history::Record pack(const WeightHistoryRecord &measurement);
+    static WeightHistoryRecord unpack(const history::Record &record);
+
+private:
+    // Version 1 segments: the struct as the compiler laid it out
+    struct LegacyRecord
+    {
+        uint32_t seq;
+        WeightHistoryRecord measurement;
+        uint16_t magic;
+        uint16_t crc;
+    };
+
+    // Sparse index, one entry per segment file
+    struct Segment
+    {
+        uint32_t id;
+        uint32_t firstSeq;
+        uint32_t count;
+        uint32_t minTimestamp;
+        uint32_t maxTimestamp;
+        uint32_t baseTimestamp; // from the segment header
+    };
+
+    static const uint16_t LEGACY_MAGIC = 0x4857; // "HW"
+    static const size_t RECORDS_PER_SEGMENT = (SEGMENT_BYTES - history::HEADER_SIZE) / history::RECORD_SIZE;
+    static const char *DIRECTORY;
+
+    // Holds the mutex for a scope; a no-op before begin()
+    class Lock
+    {
+    public:
+        explicit Lock(SemaphoreHandle_t mutex) : mMutex(mutex)
+        {
+            if (mMutex)
+            {
+                xSemaphoreTake(mMutex, portMAX_DELAY);
+            }
+        }
+        ~Lock()
+        {
+            if (mMutex)
+            {
+                xSemaphoreGive(mMutex);
+            }
+        }
+
+    private:
+        SemaphoreHandle_t mMutex;
+    };
+
+    static uint16_t legacyCrc(const LegacyRecord &record);
+    static void segmentPath(uint32_t id, char *path, size_t size, const char *extension = "seg");
+
+    bool scanSegment(Segment &segment, bool &torn);
+    bool startSegment(uint32_t baseTimestamp);
+    bool openTailSegment();
+    void dropOldestSegment();
+    bool appendLocked(const history::Record &record);
+    void migrateLegacy();
+    int findSegment(uint32_t seq) const;
+
+    Segment mSegments[MAX_SEGMENTS];
+    size_t mSegmentCount = 0;
+    uint32_t mNextSeq = 0;
+    bool mTailWritable = false;
+    File mTailFile;
+    WeightHistoryRecord mLast = {};
+    bool mHasLast = false;
+    history::Columns<CACHE_RECORDS> mCache;
+    SemaphoreHandle_t mMutex = nullptr;
+};
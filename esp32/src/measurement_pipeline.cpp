@@ -0,0 +1,88 @@
+#include "measurement_pipeline.h"
+#include <esp_log.h>
+
+static const char *TAG = "PIPELINE";
+
+// Arduino's loop() and the web server run on core 1
+static const BaseType_t WORKER_CORE = 0;
+static const uint32_t WORKER_STACK_SIZE = 6144;
+
+bool MeasurementPipeline::begin(ScaleBLEService *service, UploadDedupe *dedupe)
+{
+    mService = service;
+    mDedupe = dedupe;
+    if (xTaskCreatePinnedToCore(taskEntry, "measurements", WORKER_STACK_SIZE, this, 1, &mTask, WORKER_CORE) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to start measurement worker");
+        mTask = nullptr;
+        return false;
+    }
+    // A central connecting or subscribing has the worker send its backlog
+    mService->setDeliveryWake([](void *context)
+                              { xTaskNotifyGive(static_cast<MeasurementPipeline *>(context)->mTask); }, this);
+    ESP_LOGI(TAG, "Measurement worker started on core %d", WORKER_CORE);
+    return true;
+}
+
+size_t MeasurementPipeline::submit(const WeightHistoryRecord *measurements, const uint64_t *keys, size_t count)
+{
+    if (!mTask)
+    {
+        // No worker, fall back to doing the work inline
+        mService->setAndNotifyMeasurements(measurements, count);
+        if (mDedupe)
+        {
+            mDedupe->persist(keys, count);
+        }
+        return count;
+    }
+
+    size_t queued = 0;
+    while (queued < count && mQueue.push({measurements[queued], keys[queued]}))
+    {
+        queued++;
+    }
+    if (queued < count)
+    {
+        ESP_LOGW(TAG, "Queue full, dropped %u measurements (%u total)", (unsigned)(count - queued), (unsigned)mQueue.dropped());
+    }
+    xTaskNotifyGive(mTask);
+    return queued;
+}
+
+void MeasurementPipeline::taskEntry(void *arg)
+{
+    static_cast<MeasurementPipeline *>(arg)->run();
+}
+
+void MeasurementPipeline::run()
+{
+    TickType_t wait = portMAX_DELAY;
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        // Everything one upload pushed is in the ring before the notify,
+        // so a drain normally picks up whole uploads
+        size_t count;
+        while ((count = mQueue.pop(mItems, ScaleBLEService::MAX_BATCH)) > 0)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                mBatch[i] = mItems[i].measurement;
+                mKeys[i] = mItems[i].dedupeKey;
+            }
+            mService->setAndNotifyMeasurements(mBatch, count);
+            // After the history append, so a reset in between re-accepts rather than loses
+            if (mDedupe)
+            {
+                mDedupe->persist(mKeys, count);
+            }
+            mProcessed += count;
+            ESP_LOGD(TAG, "Processed %u measurements, %u still queued", (unsigned)count, (unsigned)mQueue.size());
+        }
+
+        // Paced to the connection interval while a central has a backlog
+        wait = mService->deliverPending();
+    }
+}
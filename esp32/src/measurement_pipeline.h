@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+#include <spsc_ring.h>
+#include "scale_ble_service.h"
+#include "upload_dedupe.h"
+
+// Moves the slow side effects of an upload (flash, advertising, GATT
+// notifications) off the HTTP handler. The handler pushes decoded records
+// into a lock-free ring and returns; a worker task on the other core drains
+// the ring, hands each batch to ScaleBLEService and journals the batch's
+// dedupe keys.
+class MeasurementPipeline
+{
+public:
+    static const size_t QUEUE_CAPACITY = 64;
+
+    bool begin(ScaleBLEService *service, UploadDedupe *dedupe = nullptr);
+    // Called from the web server task only (single producer). `keys` are the
+    // measurements' dedupe keys. Returns how many were queued, in order.
+    size_t submit(const WeightHistoryRecord *measurements, const uint64_t *keys, size_t count);
+
+    size_t queueDepth() const { return mQueue.size(); }
+    size_t queueHighWatermark() const { return mQueue.highWatermark(); }
+    uint32_t dropped() const { return mQueue.dropped(); }
+    uint32_t processed() const { return mProcessed; }
+
+private:
+    struct Item
+    {
+        WeightHistoryRecord measurement;
+        uint64_t dedupeKey;
+    };
+
+    static void taskEntry(void *arg);
+    void run();
+
+    ScaleBLEService *mService = nullptr;
+    UploadDedupe *mDedupe = nullptr;
+    TaskHandle_t mTask = nullptr;
+    SpscRing<Item, QUEUE_CAPACITY> mQueue;
+    Item mItems[ScaleBLEService::MAX_BATCH];
+    WeightHistoryRecord mBatch[ScaleBLEService::MAX_BATCH];
+    uint64_t mKeys[ScaleBLEService::MAX_BATCH];
+    volatile uint32_t mProcessed = 0;
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+struct WeightHistoryRecord
+{
+    float weight;
+    uint32_t impedance;
+    float bodyFat;
+    float water;
+    float muscle;
+    uint32_t timestamp;
+    uint8_t user_id; // position in the user table plus one, 0 for guests
+    bool isStabilized;
+};
@@ -0,0 +1,218 @@
+#include "metrics.h"
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+static const char *TAG = "METRICS";
+
+uint32_t Histogram::quantileUs(float q) const
+{
+    uint32_t total = count();
+    if (total == 0)
+    {
+        return 0;
+    }
+    uint32_t rank = (uint32_t)(q * total);
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < BUCKETS - 1; i++)
+    {
+        cumulative += bucket(i);
+        if (cumulative > rank)
+        {
+            return min((uint32_t)1u << i, maxUs());
+        }
+    }
+    return maxUs();
+}
+
+namespace metrics
+{
+
+Histogram uploadParse("helvetic_upload_parse_seconds", "Upload envelope CRC check and measurement decode");
+Histogram responseBuild("helvetic_response_build_seconds", "Upload response envelope construction");
+Histogram rtcRead("helvetic_rtc_read_seconds", "RTC read and conversion to Unix time");
+Counter uploads("helvetic_uploads_total", "Uploads answered with a response envelope");
+Counter uploadsRejected("helvetic_uploads_rejected_total", "Uploads rejected as malformed");
+Counter measurementsReceived("helvetic_measurements_received_total", "Measurements decoded from valid uploads");
+Counter responseCacheHits("helvetic_response_cache_hits_total", "Upload responses patched from the scale's previous one");
+Counter responseCacheMisses("helvetic_response_cache_misses_total", "Upload responses built from the user table");
+Counter measurementsDuplicate("helvetic_measurements_duplicate_total", "Re-sent measurements acknowledged without storing them again");
+Counter firmwareOffers("helvetic_firmware_offers_total", "Upload responses offering a firmware update");
+Counter firmwareBytesSent("helvetic_firmware_bytes_sent_total", "Firmware image bytes sent to scales");
+
+Histogram historyAppend("helvetic_history_append_seconds", "Measurement history append and flush per batch");
+Histogram notifyBatch("helvetic_notify_batch_seconds", "Store, advertise and notify one batch of measurements");
+Histogram notifyWss("helvetic_notify_wss_seconds", "Weight Scale Service notification");
+Histogram notifyBcs("helvetic_notify_bcs_seconds", "Body Composition Service notification");
+Histogram notifyHm10("helvetic_notify_hm10_seconds", "HM-10 measurement notification");
+Counter historySynced("helvetic_history_synced_records_total", "History records sent to BLE centrals on request");
+Counter bleNotifications("helvetic_ble_notifications_total", "GATT notifications sent");
+
+Counter dnsQueries("helvetic_dns_queries_total", "DNS queries received from clients");
+Counter dnsRefused("helvetic_dns_refused_total", "DNS queries refused as outside the Fitbit names");
+Counter dnsForwarded("helvetic_dns_forwarded_total", "DNS queries forwarded to the upstream resolver");
+
+Histogram loopIteration("helvetic_loop_iteration_seconds", "One pass of the Arduino loop()");
+
+static Counter *const COUNTERS[] = {
+    &uploads, &uploadsRejected, &measurementsReceived, &bleNotifications,
+    &dnsQueries, &dnsRefused, &dnsForwarded, &responseCacheHits, &responseCacheMisses,
+    &measurementsDuplicate, &historySynced, &firmwareOffers, &firmwareBytesSent};
+
+static Histogram *const HISTOGRAMS[] = {
+    &uploadParse, &responseBuild, &rtcRead,
+    &historyAppend, &notifyBatch, &notifyWss, &notifyBcs, &notifyHm10,
+    &loopIteration};
+
+struct Gauge
+{
+    const char *name;
+    const char *help;
+    GaugeReader read;
+    void *context;
+    bool monotonic;
+};
+
+static uint32_t readUptime(void *) { return (uint32_t)(esp_timer_get_time() / 1000000); }
+static uint32_t readFreeHeap(void *) { return heap_caps_get_free_size(MALLOC_CAP_8BIT); }
+static uint32_t readMinFreeHeap(void *) { return heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT); }
+static uint32_t readLargestFreeBlock(void *) { return heap_caps_get_largest_free_block(MALLOC_CAP_8BIT); }
+
+static const size_t MAX_GAUGES = 16;
+static Gauge gauges[MAX_GAUGES] = {
+    {"helvetic_uptime_seconds", "Time since boot", readUptime, nullptr, true},
+    {"helvetic_heap_free_bytes", "Free 8-bit capable heap", readFreeHeap, nullptr, false},
+    {"helvetic_heap_min_free_bytes", "Lowest free heap since boot", readMinFreeHeap, nullptr, false},
+    {"helvetic_heap_largest_free_block_bytes", "Largest allocatable heap block", readLargestFreeBlock, nullptr, false},
+};
+static size_t gaugeCount = 4;
+
+struct Section
+{
+    SectionWriter write;
+    void *context;
+};
+
+static const size_t MAX_SECTIONS = 3;
+static Section sections[MAX_SECTIONS];
+static size_t sectionCount = 0;
+
+static_assert(4 + sizeof(COUNTERS) / sizeof(COUNTERS[0]) * 4 + sizeof(HISTOGRAMS) / sizeof(HISTOGRAMS[0]) * 20 + MAX_GAUGES * 4 <= BINARY_MAX_SIZE,
+              "metrics blob does not fit BINARY_MAX_SIZE");
+
+bool addGauge(const char *name, const char *help, GaugeReader read, void *context, bool monotonic)
+{
+    if (gaugeCount == MAX_GAUGES)
+    {
+        ESP_LOGE(TAG, "No room for gauge %s", name);
+        return false;
+    }
+    gauges[gaugeCount++] = {name, help, read, context, monotonic};
+    return true;
+}
+
+bool addSection(SectionWriter write, void *context)
+{
+    if (sectionCount == MAX_SECTIONS)
+    {
+        ESP_LOGE(TAG, "No room for another metrics section");
+        return false;
+    }
+    sections[sectionCount++] = {write, context};
+    return true;
+}
+
+void writePrometheus(TextWriter write, void *context)
+{
+    ChunkedText out(write, context);
+
+    for (const Counter *counter : COUNTERS)
+    {
+        out.printf("# HELP %s %s\n# TYPE %s counter\n%s %u\n", counter->name(), counter->help(),
+                   counter->name(), counter->name(), (unsigned)counter->value());
+    }
+
+    for (size_t i = 0; i < gaugeCount; i++)
+    {
+        const Gauge &gauge = gauges[i];
+        size_t baseLength = strcspn(gauge.name, "{");
+        if (i == 0 || strncmp(gauge.name, gauges[i - 1].name, baseLength) != 0 ||
+            strcspn(gauges[i - 1].name, "{") != baseLength)
+        {
+            out.printf("# HELP %.*s %s\n# TYPE %.*s %s\n", (int)baseLength, gauge.name, gauge.help,
+                       (int)baseLength, gauge.name, gauge.monotonic ? "counter" : "gauge");
+        }
+        out.printf("%s %u\n", gauge.name, (unsigned)gauge.read(gauge.context));
+    }
+
+    for (size_t i = 0; i < sectionCount; i++)
+    {
+        sections[i].write(out, sections[i].context);
+    }
+
+    for (const Histogram *histogram : HISTOGRAMS)
+    {
+        const char *name = histogram->name();
+        out.printf("# HELP %s %s\n# TYPE %s histogram\n", name, histogram->help(), name);
+        uint32_t cumulative = 0;
+        for (size_t i = 0; i < Histogram::BUCKETS - 1; i++)
+        {
+            cumulative += histogram->bucket(i);
+            out.printf("%s_bucket{le=\"%.6f\"} %u\n", name, (1u << i) / 1e6, (unsigned)cumulative);
+        }
+        uint32_t count = histogram->count();
+        out.printf("%s_bucket{le=\"+Inf\"} %u\n%s_sum %.6f\n%s_count %u\n", name, (unsigned)count,
+                   name, histogram->sumUs() / 1e6, name, (unsigned)count);
+    }
+}
+
+// Binary layout, all little-endian:
+//   u8 version (1), u8 counters, u8 histograms, u8 gauges
+//   u32 value per counter
+//   per histogram: u32 count, u32 mean us, u32 p50 us, u32 p99 us, u32 max us
+//   u32 value per gauge
+// Names are not sent; the order is that of the Prometheus output.
+size_t writeBinary(uint8_t *buffer, size_t size)
+{
+    size_t length = 4;
+    auto put = [&](uint32_t value)
+    {
+        if (length + 4 <= size)
+        {
+            buffer[length] = value & 0xFF;
+            buffer[length + 1] = (value >> 8) & 0xFF;
+            buffer[length + 2] = (value >> 16) & 0xFF;
+            buffer[length + 3] = (value >> 24) & 0xFF;
+            length += 4;
+        }
+    };
+
+    if (size < length)
+    {
+        return 0;
+    }
+    buffer[0] = 1;
+    buffer[1] = sizeof(COUNTERS) / sizeof(COUNTERS[0]);
+    buffer[2] = sizeof(HISTOGRAMS) / sizeof(HISTOGRAMS[0]);
+    buffer[3] = gaugeCount;
+
+    for (const Counter *counter : COUNTERS)
+    {
+        put(counter->value());
+    }
+    for (const Histogram *histogram : HISTOGRAMS)
+    {
+        uint32_t count = histogram->count();
+        put(count);
+        put(count ? (uint32_t)(histogram->sumUs() / count) : 0);
+        put(histogram->quantileUs(0.5f));
+        put(histogram->quantileUs(0.99f));
+        put(histogram->maxUs());
+    }
+    for (size_t i = 0; i < gaugeCount; i++)
+    {
+        put(gauges[i].read(gauges[i].context));
+    }
+    return length;
+}
+
+} // namespace metrics
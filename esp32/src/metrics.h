@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_timer.h>
+#include "chunked_text.h"
+
+// Runtime instrumentation: counters, log2 latency histograms and gauges.
+//
+// Everything lives in static storage and recording is a couple of relaxed
+// atomic adds, so it is safe from any task and never allocates. Formatting
+// only happens when the metrics are exported, either as Prometheus text
+// (GET /metrics) or as the compact binary blob read over BLE.
+
+class Counter
+{
+public:
+    constexpr Counter(const char *name, const char *help) : mName(name), mHelp(help) {}
+
+    void add(uint32_t n = 1) { mValue.fetch_add(n, std::memory_order_relaxed); }
+    uint32_t value() const { return mValue.load(std::memory_order_relaxed); }
+
+    const char *name() const { return mName; }
+    const char *help() const { return mHelp; }
+
+private:
+    const char *mName;
+    const char *mHelp;
+    std::atomic<uint32_t> mValue{0};
+};
+
+// Bucket i counts durations below 2^i microseconds (and at least 2^(i-1)),
+// the last bucket everything from 2^(BUCKETS-2) us (about 4 s) upwards
+class Histogram
+{
+public:
+    static const size_t BUCKETS = 24;
+
+    constexpr Histogram(const char *name, const char *help) : mName(name), mHelp(help) {}
+
+    void record(uint32_t us)
+    {
+        size_t bucket = us ? 32 - __builtin_clz(us) : 0;
+        if (bucket >= BUCKETS)
+        {
+            bucket = BUCKETS - 1;
+        }
+        mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        mCount.fetch_add(1, std::memory_order_relaxed);
+        mSumUs.fetch_add(us, std::memory_order_relaxed);
+        uint32_t max = mMaxUs.load(std::memory_order_relaxed);
+        while (us > max && !mMaxUs.compare_exchange_weak(max, us, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint32_t count() const { return mCount.load(std::memory_order_relaxed); }
+    uint64_t sumUs() const { return mSumUs.load(std::memory_order_relaxed); }
+    uint32_t maxUs() const { return mMaxUs.load(std::memory_order_relaxed); }
+    uint32_t bucket(size_t i) const { return mBuckets[i].load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the given quantile
+    uint32_t quantileUs(float q) const;
+
+    const char *name() const { return mName; }
+    const char *help() const { return mHelp; }
+
+private:
+    const char *mName;
+    const char *mHelp;
+    std::atomic<uint32_t> mBuckets[BUCKETS] = {};
+    std::atomic<uint32_t> mCount{0};
+    std::atomic<uint64_t> mSumUs{0};
+    std::atomic<uint32_t> mMaxUs{0};
+};
+
+// Records the lifetime of the scope into a histogram
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(Histogram &histogram) : mHistogram(histogram), mStart(esp_timer_get_time()) {}
+    ~ScopedTimer() { mHistogram.record((uint32_t)(esp_timer_get_time() - mStart)); }
+
+private:
+    Histogram &mHistogram;
+    int64_t mStart;
+};
+
+namespace metrics
+{
+
+// Upload path
+extern Histogram uploadParse;
+extern Histogram responseBuild;
+extern Histogram rtcRead;
+extern Counter uploads;
+extern Counter uploadsRejected;
+extern Counter measurementsReceived;
+extern Counter responseCacheHits;
+extern Counter responseCacheMisses;
+extern Counter measurementsDuplicate;
+extern Counter firmwareOffers;
+extern Counter firmwareBytesSent;
+
+// Measurement worker
+extern Histogram historyAppend;
+extern Histogram notifyBatch;
+extern Histogram notifyWss;
+extern Histogram notifyBcs;
+extern Histogram notifyHm10;
+extern Counter bleNotifications;
+extern Counter historySynced;
+
+// Captive DNS
+extern Counter dnsQueries;
+extern Counter dnsRefused;
+extern Counter dnsForwarded;
+
+// Main loop
+extern Histogram loopIteration;
+
+// Gauges are sampled when exporting. Register them during setup only.
+// A name may carry labels, name{label="value"}; consecutive gauges with
+// the same base name share one HELP and TYPE line.
+typedef uint32_t (*GaugeReader)(void *context);
+bool addGauge(const char *name, const char *help, GaugeReader read, void *context, bool monotonic = false);
+
+// Writes a variable number of labelled series, e.g. one per scale, after
+// the gauges. Prometheus output only. Register during setup only.
+typedef void (*SectionWriter)(ChunkedText &out, void *context);
+bool addSection(SectionWriter write, void *context);
+
+// Prometheus text exposition format, handed to `write` in pieces
+void writePrometheus(TextWriter write, void *context);
+
+// Little-endian blob, see metrics.cpp for the layout. Returns the length used.
+size_t writeBinary(uint8_t *buffer, size_t size);
+static const size_t BINARY_MAX_SIZE = 320;
+
+} // namespace metrics
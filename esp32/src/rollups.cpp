@@ -0,0 +1,300 @@
+#include "rollups.h"
+#include <civil_time.h>
+#include <crc16.h>
+#include <esp_log.h>
+
+static const char *TAG = "ROLLUPS";
+const char *Rollups::PATH = "/rollups.bin";
+const char *Rollups::TEMP_PATH = "/rollups.tmp";
+
+// File layout: u8 version, u8 entry count, u16 entry size, u32 next sequence
+// number, the entries as RollupTable::encode() writes them, u16 CRC of
+// everything before it, all little-endian
+static const uint8_t FILE_VERSION = 2;
+static const size_t HEADER_SIZE = 8;
+
+static const char *const PERIOD_NAMES[] = {"daily", "weekly"};
+static const char *const METRIC_NAMES[history::METRICS] = {"weight_g", "fat_millipercent", "impedance_ohm"};
+
+// Records folded in per log read
+static const size_t READ_CHUNK = 16;
+
+bool Rollups::begin(MeasurementLog *history)
+{
+    mHistory = history;
+    mMutex = xSemaphoreCreateMutex();
+    if (!LittleFS.exists(PATH) && LittleFS.exists(TEMP_PATH))
+    {
+        LittleFS.rename(TEMP_PATH, PATH);
+    }
+
+    // A log that was cleared or restarted is behind the table: start over
+    if (!load() || mNextSeq > mHistory->nextSeq())
+    {
+        mTable.clear();
+        mNextSeq = mHistory->firstSeq();
+    }
+    uint32_t from = mNextSeq;
+    addFrom(mNextSeq);
+    if (mNextSeq != from)
+    {
+        save();
+    }
+
+    uint8_t known[USERS];
+    ESP_LOGI(TAG, "Rollups for %u users, %u records folded in at boot", (unsigned)users(known, USERS),
+             (unsigned)(mNextSeq - from));
+    return true;
+}
+
+// Caller holds the mutex, or is begin() before the other tasks start
+void Rollups::addFrom(uint32_t seq)
+{
+    WeightHistoryRecord records[READ_CHUNK];
+    uint32_t end = mHistory->nextSeq();
+    while (seq < end)
+    {
+        size_t count = mHistory->read(seq, records, READ_CHUNK);
+        if (count == 0)
+        {
+            break;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            mTable.add(MeasurementLog::pack(records[i]));
+        }
+        mDirty = true;
+    }
+    mNextSeq = seq > mNextSeq ? seq : mNextSeq;
+}
+
+void Rollups::catchUp()
+{
+    if (!mMutex)
+    {
+        return;
+    }
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    addFrom(mNextSeq);
+    xSemaphoreGive(mMutex);
+}
+
+void Rollups::update()
+{
+    uint32_t nowMs = millis();
+    if (mDirty && nowMs - mLastSaveMs >= SAVE_INTERVAL_MS)
+    {
+        save();
+    }
+}
+
+size_t Rollups::users(uint8_t *out, size_t max) const
+{
+    uint32_t newest[USERS];
+    size_t n = 0;
+    if (mMutex)
+    {
+        xSemaphoreTake(mMutex, portMAX_DELAY);
+    }
+    for (size_t i = 0; i < Table::SIZE && n < max; i++)
+    {
+        const Table::Entry &entry = mTable.entry(i);
+        if (!entry.used)
+        {
+            continue;
+        }
+        size_t pos = n++;
+        while (pos > 0 && newest[pos - 1] < entry.lastTimestamp)
+        {
+            out[pos] = out[pos - 1];
+            newest[pos] = newest[pos - 1];
+            pos--;
+        }
+        out[pos] = entry.user;
+        newest[pos] = entry.lastTimestamp;
+    }
+    if (mMutex)
+    {
+        xSemaphoreGive(mMutex);
+    }
+    return n;
+}
+
+size_t Rollups::buckets(uint8_t user, Period period, history::Bucket *out) const
+{
+    size_t n = 0;
+    if (mMutex)
+    {
+        xSemaphoreTake(mMutex, portMAX_DELAY);
+    }
+    const Table::Entry *entry = mTable.find(user);
+    if (entry)
+    {
+        n = period == DAILY ? Table::sorted(entry->days, DAYS, out) : Table::sorted(entry->weeks, WEEKS, out);
+    }
+    if (mMutex)
+    {
+        xSemaphoreGive(mMutex);
+    }
+    return n;
+}
+
+void Rollups::writeJson(ChunkedText &out, Period period, int user) const
+{
+    uint8_t selected[USERS];
+    size_t userCount = 0;
+    if (user >= 0)
+    {
+        selected[userCount++] = (uint8_t)user;
+    }
+    else
+    {
+        userCount = users(selected, USERS);
+    }
+
+    out.printf("{\"period\":\"%s\",\"users\":[", PERIOD_NAMES[period]);
+    history::Bucket list[MAX_BUCKETS];
+    bool firstUser = true;
+    for (size_t u = 0; u < userCount; u++)
+    {
+        // Copied out, so the mutex is not held while the client reads
+        size_t n = buckets(selected[u], period, list);
+        if (n == 0)
+        {
+            continue;
+        }
+        out.printf("%s\n{\"user\":%u,\"buckets\":[", firstUser ? "" : ",", selected[u]);
+        firstUser = false;
+        for (size_t b = 0; b < n; b++)
+        {
+            const history::Bucket &bucket = list[b];
+            uint32_t year, month, day;
+            civil::civilFromDays(bucket.day, year, month, day);
+            out.printf("%s\n{\"start\":\"%04u-%02u-%02u\",", b ? "," : "", (unsigned)year, (unsigned)month,
+                       (unsigned)day);
+            if (period == WEEKLY)
+            {
+                // The ISO week belongs to the year its Thursday is in
+                uint32_t thursday = bucket.day + 3;
+                civil::civilFromDays(thursday, year, month, day);
+                uint32_t week = (thursday - civil::daysFromCivil(year, 1, 1)) / 7 + 1;
+                out.printf("\"week\":\"%04u-W%02u\",", (unsigned)year, (unsigned)week);
+            }
+            out.printf("\"count\":%u", bucket.count);
+            for (size_t m = 0; m < history::METRICS; m++)
+            {
+                const history::Aggregate &aggregate = bucket.metrics[m];
+                out.printf(",\"%s\":{\"min\":%u,\"max\":%u,\"mean\":%u,\"ewma\":%u}", METRIC_NAMES[m],
+                           (unsigned)aggregate.min, (unsigned)aggregate.max,
+                           (unsigned)bucket.mean((history::Metric)m), (unsigned)aggregate.ewma);
+            }
+            out.printf("}");
+        }
+        out.printf("]}");
+    }
+    out.printf("]}\n");
+}
+
+size_t Rollups::writeBinary(uint8_t *out, size_t size, Period period, uint8_t user) const
+{
+    history::Bucket list[MAX_BUCKETS];
+    size_t n = buckets(user, period, list);
+    if (size < 3 + n * BUCKET_BINARY_SIZE)
+    {
+        return 0;
+    }
+
+    uint8_t *p = out;
+    *p++ = period;
+    *p++ = user;
+    *p++ = (uint8_t)n;
+    for (size_t b = 0; b < n; b++)
+    {
+        const history::Bucket &bucket = list[b];
+        history::detail::put(p, bucket.day, 2);
+        history::detail::put(p + 2, bucket.count, 2);
+        p += 4;
+        for (size_t m = 0; m < history::METRICS; m++)
+        {
+            const history::Aggregate &aggregate = bucket.metrics[m];
+            history::detail::put(p, aggregate.min, 4);
+            history::detail::put(p + 4, aggregate.max, 4);
+            history::detail::put(p + 8, bucket.mean((history::Metric)m), 4);
+            history::detail::put(p + 12, aggregate.ewma, 4);
+            p += 16;
+        }
+    }
+    return p - out;
+}
+
+bool Rollups::load()
+{
+    File file = LittleFS.open(PATH, "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    static Table table;
+    static uint8_t buffer[Table::ENTRY_SIZE];
+    uint8_t header[HEADER_SIZE];
+    bool ok = file.read(header, sizeof(header)) == sizeof(header) && header[0] == FILE_VERSION &&
+              header[1] == Table::SIZE && history::detail::get(header + 2, 2) == Table::ENTRY_SIZE;
+    Crc16Xmodem crc;
+    crc.update(header, sizeof(header));
+    for (size_t i = 0; ok && i < Table::SIZE; i++)
+    {
+        ok = file.read(buffer, sizeof(buffer)) == sizeof(buffer);
+        crc.update(buffer, sizeof(buffer));
+        Table::decode(buffer, table.entry(i));
+    }
+    uint8_t storedCrc[2];
+    ok = ok && file.read(storedCrc, sizeof(storedCrc)) == sizeof(storedCrc);
+    file.close();
+    if (!ok || history::detail::get(storedCrc, 2) != crc.finalize())
+    {
+        ESP_LOGW(TAG, "Ignoring unreadable %s, rebuilding from history", PATH);
+        return false;
+    }
+    mTable = table;
+    mNextSeq = history::detail::get(header + 4, 4);
+    return true;
+}
+
+// Written to a temporary file and renamed, so a reset keeps the old table
+bool Rollups::save()
+{
+    static Table table;
+    static uint8_t buffer[Table::ENTRY_SIZE];
+    uint8_t header[HEADER_SIZE] = {FILE_VERSION, Table::SIZE};
+    history::detail::put(header + 2, Table::ENTRY_SIZE, 2);
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    table = mTable;
+    history::detail::put(header + 4, mNextSeq, 4);
+    mDirty = false;
+    xSemaphoreGive(mMutex);
+    mLastSaveMs = millis();
+
+    File file = LittleFS.open(TEMP_PATH, "w");
+    bool ok = file && file.write(header, sizeof(header)) == sizeof(header);
+    Crc16Xmodem crc;
+    crc.update(header, sizeof(header));
+    for (size_t i = 0; ok && i < Table::SIZE; i++)
+    {
+        Table::encode(table.entry(i), buffer);
+        crc.update(buffer, sizeof(buffer));
+        ok = file.write(buffer, sizeof(buffer)) == sizeof(buffer);
+    }
+    uint8_t crcBytes[2];
+    history::detail::put(crcBytes, crc.finalize(), 2);
+    ok = ok && file.write(crcBytes, sizeof(crcBytes)) == sizeof(crcBytes);
+    file.close();
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Failed to write %s", TEMP_PATH);
+        mDirty = true;
+        return false;
+    }
+    LittleFS.rename(TEMP_PATH, PATH);
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <rollup_table.h>
+#include "chunked_text.h"
+#include "measurement_log.h"
+
+// Daily and weekly aggregates per user, kept up to date as measurements
+// are stored, so trend queries never scan the history.
+//
+// The table (see rollup_table.h) is folded forward from the history log:
+// catchUp() adds every record from the sequence number it reached so far,
+// which is the newest few records and read from the log's RAM cache. The
+// table and that sequence number are saved to /rollups.bin at most every
+// SAVE_INTERVAL_MS; after a reset the records stored since are folded in
+// again from the log, and a missing or unreadable file means the table is
+// rebuilt from the whole log.
+//
+// Users are keyed as the history stores them: the position in the user
+// table plus one, 0 for guests, not the id configured for the scale.
+//
+// The measurement worker adds while the web server and BLE reads copy
+// buckets out, so the public methods take a mutex.
+class Rollups
+{
+public:
+    static const size_t USERS = 9; // the Aria's eight, and guests
+    static const size_t DAYS = 7;
+    static const size_t WEEKS = 8;
+    static const uint32_t SAVE_INTERVAL_MS = 5 * 60 * 1000;
+    static const size_t MAX_BUCKETS = DAYS > WEEKS ? DAYS : WEEKS;
+
+    enum Period : uint8_t
+    {
+        DAILY,
+        WEEKLY
+    };
+
+    // Loads the table and folds in what the log has beyond it; call after
+    // the log is open
+    bool begin(MeasurementLog *history);
+    // Measurement worker: adds the records appended since the last call
+    void catchUp();
+    // Call from loop(); saves the table when due
+    void update();
+
+    // Users with aggregates, most recently measured first
+    size_t users(uint8_t *out, size_t max) const;
+    // Non-empty buckets of one user, newest first, at most MAX_BUCKETS
+    size_t buckets(uint8_t user, Period period, history::Bucket *out) const;
+
+    // JSON for one user, or every user if `user` is negative
+    void writeJson(ChunkedText &out, Period period, int user) const;
+    // u8 period, u8 user, u8 count, then per bucket u16 day, u16 count and
+    // for weight, fat and impedance u32 min, max, mean and moving average,
+    // all little-endian; 0 if it does not fit
+    size_t writeBinary(uint8_t *out, size_t size, Period period, uint8_t user) const;
+    static const size_t BUCKET_BINARY_SIZE = 4 + history::METRICS * 16;
+    static const size_t BINARY_MAX_SIZE = 3 + MAX_BUCKETS * BUCKET_BINARY_SIZE;
+
+private:
+    typedef history::RollupTable<USERS, DAYS, WEEKS> Table;
+
+    void addFrom(uint32_t seq);
+    bool load();
+    bool save();
+
+    static const char *PATH;
+    static const char *TEMP_PATH;
+
+    MeasurementLog *mHistory = nullptr;
+    SemaphoreHandle_t mMutex = nullptr;
+    Table mTable;
+    uint32_t mNextSeq = 0; // first record not yet in the table
+    bool mDirty = false;
+    uint32_t mLastSaveMs = 0;
+};
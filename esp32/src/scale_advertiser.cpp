@@ -0,0 +1,232 @@
+#include "scale_advertiser.h"
+#include "scale_ble_service.h"
+#include "trace.h"
+#include <esp_log.h>
+
+static const char *TAG = "BLE_ADV";
+
+static const char DEVICE_NAME[] = "openScale";
+static const uint16_t SERVICE_DATA_UUID = 0x181B;
+static const size_t SERVICE_DATA_SIZE = 13;
+
+// AD structure types
+static const uint8_t AD_FLAGS = 0x01;
+static const uint8_t AD_UUID16_COMPLETE = 0x03;
+static const uint8_t AD_NAME_COMPLETE = 0x09;
+static const uint8_t AD_SERVICE_DATA16 = 0x16;
+
+// Name, then one service data element of 2 + 2 + 13 + 1 bytes per user
+static_assert(2 + sizeof(DEVICE_NAME) - 1 + ScaleAdvertiser::MAX_USERS * 18 <= 251,
+              "extended payload must fit one HCI fragment");
+
+static size_t putServiceData(uint8_t *out, const WeightHistoryRecord &record, bool withUser)
+{
+    out[0] = 3 + SERVICE_DATA_SIZE + (withUser ? 1 : 0);
+    out[1] = AD_SERVICE_DATA16;
+    out[2] = SERVICE_DATA_UUID & 0xFF;
+    out[3] = SERVICE_DATA_UUID >> 8;
+    ScaleBLEService::encodeServiceData(record, out + 4);
+    if (withUser)
+    {
+        out[4 + SERVICE_DATA_SIZE] = record.user_id;
+    }
+    return 1 + out[0];
+}
+
+#if CONFIG_BT_NIMBLE_EXT_ADV
+// Replaces the data of a running set; the host consumes the buffer
+static bool setInstanceData(uint8_t instance, const uint8_t *data, size_t length)
+{
+    os_mbuf *buffer = os_msys_get_pkthdr(length, 0);
+    if (!buffer)
+    {
+        return false;
+    }
+    if (os_mbuf_append(buffer, data, length) != 0)
+    {
+        os_mbuf_free_chain(buffer);
+        return false;
+    }
+    int rc = ble_gap_ext_adv_set_data(instance, buffer);
+    if (rc != 0)
+    {
+        ESP_LOGW(TAG, "Advertising set %u: data update failed, rc %d", instance, rc);
+        return false;
+    }
+    return true;
+}
+#endif
+
+void ScaleAdvertiser::begin(MeasurementLog &history, const uint16_t *services, size_t serviceCount)
+{
+    mServices = services;
+    mServiceCount = serviceCount;
+
+    WeightHistoryRecord latest[MAX_USERS];
+    size_t users = history.latestPerUser(latest, MAX_USERS);
+    for (size_t i = 0; i < users; i++)
+    {
+        remember(latest[i]);
+    }
+    ESP_LOGI(TAG, "Advertising the newest measurement of %u users", (unsigned)mUserCount);
+
+    uint8_t payload[EXTENDED_MAX];
+#if CONFIG_BT_NIMBLE_EXT_ADV
+    NimBLEExtAdvertising *advertising = NimBLEDevice::getAdvertising();
+
+    NimBLEExtAdvertisement legacy;
+    legacy.setLegacyAdvertising(true);
+    legacy.setConnectable(true);
+    legacy.setScannable(true);
+    legacy.setMinInterval(0x20);
+    legacy.setMaxInterval(0x40);
+    legacy.setData(payload, buildLegacy(payload));
+    NimBLEExtAdvertisement response;
+    response.setName(DEVICE_NAME);
+    if (!advertising->setInstanceData(LEGACY_INSTANCE, legacy) ||
+        !advertising->setScanResponseData(LEGACY_INSTANCE, response) || !advertising->start(LEGACY_INSTANCE))
+    {
+        ESP_LOGE(TAG, "Failed to start legacy advertising");
+    }
+
+    // Not connectable, so it may be slow: listeners scan continuously
+    NimBLEExtAdvertisement extended(BLE_HCI_LE_PHY_1M, BLE_HCI_LE_PHY_1M);
+    extended.setConnectable(false);
+    extended.setScannable(false);
+    extended.setMinInterval(1600); // 1 s
+    extended.setMaxInterval(2048);
+    extended.setData(payload, buildExtended(payload));
+    if (!advertising->setInstanceData(EXTENDED_INSTANCE, extended) || !advertising->start(EXTENDED_INSTANCE))
+    {
+        ESP_LOGE(TAG, "Failed to start extended advertising");
+    }
+#else
+    NimBLEAdvertising *advertising = NimBLEDevice::getAdvertising();
+    for (size_t i = 0; i < mServiceCount; i++)
+    {
+        advertising->addServiceUUID(NimBLEUUID(mServices[i]));
+    }
+    size_t length = putServiceData(payload, newest(), false);
+    advertising->setServiceData(NimBLEUUID(SERVICE_DATA_UUID), std::string((char *)payload + 4, length - 4));
+    advertising->enableScanResponse(true);
+    advertising->setMinInterval(0x20); // Minimum advertising interval
+    advertising->setMaxInterval(0x40); // Maximum advertising interval
+    advertising->start();
+#endif
+}
+
+void ScaleAdvertiser::update(const WeightHistoryRecord *records, size_t count)
+{
+    bool changed = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        changed |= remember(records[i]);
+    }
+    if (changed)
+    {
+        publish();
+    }
+}
+
+void ScaleAdvertiser::resume()
+{
+#if CONFIG_BT_NIMBLE_EXT_ADV
+    NimBLEDevice::getAdvertising()->start(LEGACY_INSTANCE);
+#else
+    NimBLEDevice::getAdvertising()->start();
+#endif
+}
+
+// Keeps the newest record per user, newest first. A user not yet shown
+// takes the place of the one that weighed in longest ago.
+bool ScaleAdvertiser::remember(const WeightHistoryRecord &record)
+{
+    size_t slot = 0;
+    while (slot < mUserCount && mLatest[slot].user_id != record.user_id)
+    {
+        slot++;
+    }
+    if (slot < mUserCount)
+    {
+        if (mLatest[slot].timestamp > record.timestamp)
+        {
+            return false;
+        }
+    }
+    else if (mUserCount < MAX_USERS)
+    {
+        mUserCount++;
+    }
+    else
+    {
+        slot = MAX_USERS - 1;
+        if (mLatest[slot].timestamp > record.timestamp)
+        {
+            return false;
+        }
+    }
+
+    while (slot > 0 && mLatest[slot - 1].timestamp <= record.timestamp)
+    {
+        mLatest[slot] = mLatest[slot - 1];
+        slot--;
+    }
+    mLatest[slot] = record;
+    return true;
+}
+
+const WeightHistoryRecord &ScaleAdvertiser::newest() const
+{
+    static const WeightHistoryRecord none = {};
+    return mUserCount ? mLatest[0] : none;
+}
+
+void ScaleAdvertiser::publish()
+{
+    const WeightHistoryRecord &record = newest();
+    uint8_t payload[EXTENDED_MAX];
+    size_t length = putServiceData(payload, record, false);
+    TRACE_BYTES(BLE_ADVERTISE, record.timestamp, (uint16_t)(record.weight * 200), payload + 4, length - 4);
+
+#if CONFIG_BT_NIMBLE_EXT_ADV
+    setInstanceData(LEGACY_INSTANCE, payload, buildLegacy(payload));
+    setInstanceData(EXTENDED_INSTANCE, payload, buildExtended(payload));
+#else
+    NimBLEAdvertising *advertising = NimBLEDevice::getAdvertising();
+    advertising->setServiceData(NimBLEUUID(SERVICE_DATA_UUID), std::string((char *)payload + 4, length - 4));
+    advertising->refreshAdvertisingData();
+#endif
+}
+
+// Flags, the 16-bit service list and the newest record: 28 of 31 bytes
+// with the three services
+size_t ScaleAdvertiser::buildLegacy(uint8_t *out) const
+{
+    uint8_t *p = out;
+    *p++ = 2;
+    *p++ = AD_FLAGS;
+    *p++ = 0x06; // general discoverable, no BR/EDR
+    *p++ = 1 + 2 * mServiceCount;
+    *p++ = AD_UUID16_COMPLETE;
+    for (size_t i = 0; i < mServiceCount; i++)
+    {
+        *p++ = mServices[i] & 0xFF;
+        *p++ = mServices[i] >> 8;
+    }
+    p += putServiceData(p, newest(), false);
+    return p - out;
+}
+
+size_t ScaleAdvertiser::buildExtended(uint8_t *out) const
+{
+    uint8_t *p = out;
+    *p++ = sizeof(DEVICE_NAME);
+    *p++ = AD_NAME_COMPLETE;
+    memcpy(p, DEVICE_NAME, sizeof(DEVICE_NAME) - 1);
+    p += sizeof(DEVICE_NAME) - 1;
+    for (size_t i = 0; i < mUserCount; i++)
+    {
+        p += putServiceData(p, mLatest[i], true);
+    }
+    return p - out;
+}
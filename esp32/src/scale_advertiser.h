@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include "measurement_log.h"
+#include "measurement_record.h"
+
+// Measurement advertising for passive listeners.
+//
+// The connectable legacy set carries the newest measurement as 13 bytes of
+// 0x181B service data, as ESPHome's Mi Scale component reads it. Built with
+// CONFIG_BT_NIMBLE_EXT_ADV (BLE 5 targets such as the ESP32-S3), a second,
+// non-connectable extended set carries the newest measurement of each of up
+// to MAX_USERS users, newest first: one 0x181B service data element per
+// user, the 13 legacy bytes followed by the user's position in the user
+// table plus one (0 for guests).
+//
+// Both sets are updated in place, without stopping advertising. The
+// extended payload is kept within one HCI fragment (251 bytes), the most a
+// controller accepts while the set is enabled.
+class ScaleAdvertiser
+{
+public:
+    static const size_t MAX_USERS = 8;
+
+    // Seeds the per-user records from the history and starts advertising
+    void begin(MeasurementLog &history, const uint16_t *services, size_t serviceCount);
+    // Measurement worker: records were stored, advertise what is newer
+    void update(const WeightHistoryRecord *records, size_t count);
+    // NimBLE host task: a central left, the connectable set has stopped
+    void resume();
+
+private:
+    static const uint8_t LEGACY_INSTANCE = 0;
+    static const uint8_t EXTENDED_INSTANCE = 1;
+    static const size_t LEGACY_MAX = 31;
+    static const size_t EXTENDED_MAX = 251;
+
+    bool remember(const WeightHistoryRecord &record);
+    void publish();
+    size_t buildLegacy(uint8_t *out) const;
+    size_t buildExtended(uint8_t *out) const;
+    const WeightHistoryRecord &newest() const;
+
+    const uint16_t *mServices = nullptr;
+    size_t mServiceCount = 0;
+    // Newest record of each user, newest first
+    WeightHistoryRecord mLatest[MAX_USERS] = {};
+    size_t mUserCount = 0;
+};
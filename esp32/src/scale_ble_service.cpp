@@ -1,9 +1,12 @@
 #include "scale_ble_service.h"
+#include "metrics.h"
+#include "trace.h"
+#include "wall_clock.h"
 #include <esp_log.h>
 #include <LittleFS.h>
 
 static const char *TAG = "BLE_SCALE";
-const char *ScaleBLEService::LAST_MEASUREMENT_FILE = "/last_measurement.bin";
+const char *ScaleBLEService::LEGACY_MEASUREMENT_FILE = "/last_measurement.bin";
 
 ScaleBLEService::ScaleBLEService()
 {
@@ -36,6 +39,8 @@ void ScaleBLEService::begin()
 
     // Initialize BLE device
     NimBLEDevice::init("openScale");
+    // Largest ATT MTU, so a history sync packs many records per notification
+    NimBLEDevice::setMTU(247);
 
     // Create the BLE Server
     pServer = NimBLEDevice::createServer();
@@ -45,59 +50,33 @@ void ScaleBLEService::begin()
     setupWeightScaleService();
     setupBodyCompositionService();
     setupHm10WeightService();
+    setupDiagnosticsService();
+    mPolicy.begin(pServer);
+    mSync.begin(&mHistory, pHm10MeasurementCharacteristic, &mPolicy);
+    mDelivery.begin(&mHistory);
+    mRollups.begin(&mHistory);
 
-    // Start advertising
-    NimBLEAdvertising *pAdvertising = NimBLEDevice::getAdvertising();
-    pAdvertising->addServiceUUID(WSS_SERVICE_UUID);
-    pAdvertising->addServiceUUID(BCS_SERVICE_UUID);
-    pAdvertising->addServiceUUID(HM10_SERVICE_UUID);
-
-    // Add service data for 0x181B with loaded measurements
-    setMeasurementServiceData(mLastMeasurement);
-    pAdvertising->setServiceData(NimBLEUUID((uint16_t)0x181B), std::string((char *)mServiceData, 13));
-
-    pAdvertising->enableScanResponse(true);
-    // Set minimum connection interval preference for better power efficiency
-    // 0x12 = 18 * 1.25ms = 22.5ms minimum connection interval
-    pAdvertising->setMinInterval(0x20); // Minimum advertising interval
-    pAdvertising->setMaxInterval(0x40); // Maximum advertising interval
-    pAdvertising->start();              // Start advertising
+    // Start advertising, the newest record of each user as service data
+    static const uint16_t ADVERTISED_SERVICES[] = {0x181D, 0x181B, 0xFFE0}; // WSS, BCS, HM-10
+    mAdvertiser.begin(mHistory, ADVERTISED_SERVICES, sizeof(ADVERTISED_SERVICES) / sizeof(ADVERTISED_SERVICES[0]));
 
     ESP_LOGI(TAG, "BLE Scale Service Started with all services");
 }
 
 bool ScaleBLEService::loadLastMeasurement()
 {
-    ESP_LOGI(TAG, "Checking for measurement file: %s", LAST_MEASUREMENT_FILE);
-    ESP_LOGI(TAG, "WeightHistoryRecord size: %d bytes", sizeof(WeightHistoryRecord));
-
-    if (LittleFS.exists(LAST_MEASUREMENT_FILE))
+    if (!mHistory.begin())
     {
-        ESP_LOGD(TAG, "Loading last measurement from LittleFS");
-        File file = LittleFS.open(LAST_MEASUREMENT_FILE, "rb");
-        if (!file)
-        {
-            ESP_LOGE(TAG, "Failed to open measurement file for reading");
-            return false;
-        }
-
-        size_t bytesRead = file.read((uint8_t *)&mLastMeasurement, sizeof(WeightHistoryRecord));
-        file.close();
-
-        if (bytesRead != sizeof(WeightHistoryRecord))
-        {
-            ESP_LOGE(TAG, "Failed to read measurement data (read %d bytes, expected %d)",
-                     bytesRead, sizeof(WeightHistoryRecord));
-            return false;
-        }
+        return false;
+    }
+    importLegacyMeasurement();
 
-        ESP_LOGI(TAG, "Successfully read %d bytes from measurement file", bytesRead);
+    if (mHistory.last(mLastMeasurement))
+    {
         return true;
     }
 
-    ESP_LOGI(TAG, "No saved measurement file found, creating default");
-
-    // Initialize with default values
+    ESP_LOGI(TAG, "No saved measurement found, using default");
     mLastMeasurement = {
         .weight = 0.0f,
         .impedance = 0,
@@ -107,40 +86,31 @@ bool ScaleBLEService::loadLastMeasurement()
         .timestamp = 0,
         .user_id = 0,
         .isStabilized = false};
-
-    // Save the default measurement
-    ESP_LOGI(TAG, "Saving default measurement to file");
-    if (!saveLastMeasurement())
-    {
-        ESP_LOGE(TAG, "Failed to save default measurement");
-        return false;
-    }
-    ESP_LOGI(TAG, "Default measurement saved successfully");
     return true;
 }
 
-bool ScaleBLEService::saveLastMeasurement()
+// Moves the single record kept by older firmware into the history log
+void ScaleBLEService::importLegacyMeasurement()
 {
-    File file = LittleFS.open(LAST_MEASUREMENT_FILE, "wb");
-    if (!file)
+    if (!LittleFS.exists(LEGACY_MEASUREMENT_FILE))
     {
-        ESP_LOGE(TAG, "Failed to open measurement file for writing");
-        return false;
+        return;
     }
 
-    size_t bytesWritten = file.write((uint8_t *)&mLastMeasurement, sizeof(WeightHistoryRecord));
+    File file = LittleFS.open(LEGACY_MEASUREMENT_FILE, "rb");
+    WeightHistoryRecord legacy;
+    size_t bytesRead = file ? file.read((uint8_t *)&legacy, sizeof(legacy)) : 0;
     file.close();
 
-    if (bytesWritten != sizeof(WeightHistoryRecord))
+    if (bytesRead == sizeof(legacy) && legacy.timestamp != 0 && mHistory.count() == 0)
     {
-        ESP_LOGE(TAG, "Failed to write measurement data (wrote %d bytes, expected %d)",
-                 bytesWritten, sizeof(WeightHistoryRecord));
-        return false;
+        ESP_LOGI(TAG, "Importing %s into history", LEGACY_MEASUREMENT_FILE);
+        if (!mHistory.append(legacy))
+        {
+            return;
+        }
     }
-
-    ESP_LOGI(TAG, "Saved measurement to file - Weight: %.1f kg, Body Fat: %.1f%%, Impedance: %u ohms",
-             mLastMeasurement.weight, mLastMeasurement.bodyFat, mLastMeasurement.impedance);
-    return true;
+    LittleFS.remove(LEGACY_MEASUREMENT_FILE);
 }
 
 void ScaleBLEService::setupWeightScaleService()
@@ -198,25 +168,47 @@ void ScaleBLEService::setupHm10WeightService()
     ESP_LOGI(TAG, "HM-10 Weight Service setup complete");
 }
 
+void ScaleBLEService::setupDiagnosticsService()
+{
+    pDiagService = pServer->createService(DIAG_SERVICE_UUID);
+
+    // Runtime metrics as a binary blob, refreshed on every read
+    pMetricsCharacteristic = pDiagService->createCharacteristic(
+        METRICS_CHAR_UUID,
+        NIMBLE_PROPERTY::READ);
+
+    pMetricsCharacteristic->setCallbacks(this);
+
+    // Daily or weekly aggregates of one user: write period (0 daily,
+    // 1 weekly) and user (position in the user table plus one, 0 for
+    // guests), then read
+    pRollupsCharacteristic = pDiagService->createCharacteristic(
+        ROLLUPS_CHAR_UUID,
+        NIMBLE_PROPERTY::READ |
+            NIMBLE_PROPERTY::WRITE);
+
+    pRollupsCharacteristic->setCallbacks(this);
+    ESP_LOGI(TAG, "Diagnostics service setup complete");
+}
+
 // Helper function to format timestamp into byte array
 void formatTimestamp(time_t rawtime, uint8_t *data)
 {
-    struct tm timeinfo;
-    gmtime_r(&rawtime, &timeinfo);
-    uint16_t year = timeinfo.tm_year + 1900;
-    data[0] = year & 0xFF;
-    data[1] = (year >> 8) & 0xFF;
-    data[2] = timeinfo.tm_mon + 1;
-    data[3] = timeinfo.tm_mday;
-    data[4] = timeinfo.tm_hour;
-    data[5] = timeinfo.tm_min;
-    data[6] = timeinfo.tm_sec;
+    civil::DateTime dt = wallclock::dateTime(rawtime);
+    data[0] = dt.year & 0xFF;
+    data[1] = (dt.year >> 8) & 0xFF;
+    data[2] = dt.month;
+    data[3] = dt.day;
+    data[4] = dt.hour;
+    data[5] = dt.minute;
+    data[6] = dt.second;
 }
 
-void ScaleBLEService::setAndNotifyWssMeasurement(const WeightHistoryRecord &measurement)
+bool ScaleBLEService::setAndNotifyWssMeasurement(const WeightHistoryRecord &measurement, uint16_t connHandle)
 {
     if (pWssMeasurementCharacteristic)
     {
+        ScopedTimer timer(metrics::notifyWss);
         uint8_t weightData[10]; // 1 byte flags + 2 bytes weight + 7 bytes timestamp
         memset(weightData, 0, sizeof(weightData));
 
@@ -232,15 +224,23 @@ void ScaleBLEService::setAndNotifyWssMeasurement(const WeightHistoryRecord &meas
         formatTimestamp(measurement.timestamp, &weightData[3]);
 
         pWssMeasurementCharacteristic->setValue(weightData, sizeof(weightData));
-        pWssMeasurementCharacteristic->notify();
+        if (!pWssMeasurementCharacteristic->notify(connHandle))
+        {
+            return false;
+        }
+        mPolicy.noteSent(connHandle, sizeof(weightData));
+        metrics::bleNotifications.add();
+        TRACE(BLE_NOTIFY, 'W', sizeof(weightData));
         ESP_LOGI(TAG, "WSS measurement sent - Weight: %.2f kg", measurement.weight);
     }
+    return true;
 }
 
-void ScaleBLEService::setAndNotifyBcsMeasurement(const WeightHistoryRecord &measurement)
+bool ScaleBLEService::setAndNotifyBcsMeasurement(const WeightHistoryRecord &measurement, uint16_t connHandle)
 {
     if (pBcsCharacteristic)
     {
+        ScopedTimer timer(metrics::notifyBcs);
         const size_t dataSize = 19;
         uint8_t bodyCompData[dataSize];
         memset(bodyCompData, 0, dataSize);
@@ -259,28 +259,34 @@ void ScaleBLEService::setAndNotifyBcsMeasurement(const WeightHistoryRecord &meas
         formatTimestamp(measurement.timestamp, &bodyCompData[4]);
 
         pBcsCharacteristic->setValue(bodyCompData, dataSize);
-        pBcsCharacteristic->notify();
+        if (!pBcsCharacteristic->notify(connHandle))
+        {
+            return false;
+        }
+        mPolicy.noteSent(connHandle, dataSize);
+        metrics::bleNotifications.add();
+        TRACE(BLE_NOTIFY, 'B', dataSize);
         ESP_LOGI(TAG, "BCS measurement sent - Body Fat: %.1f%%", measurement.bodyFat);
     }
+    return true;
 }
 
-void ScaleBLEService::setAndNotifyHm10Measurement(const WeightHistoryRecord &measurement)
+bool ScaleBLEService::setAndNotifyHm10Measurement(const WeightHistoryRecord &measurement, uint16_t connHandle)
 {
     if (pHm10MeasurementCharacteristic)
     {
+        ScopedTimer timer(metrics::notifyHm10);
         // Extract time components
-        time_t rawtime = measurement.timestamp;
-        struct tm timeinfo;
-        gmtime_r(&rawtime, &timeinfo);
+        civil::DateTime dt = wallclock::dateTime(measurement.timestamp);
 
         // Calculate checksum
         int checksum = 0;
         checksum ^= measurement.user_id;
-        checksum ^= timeinfo.tm_year + 1900;
-        checksum ^= timeinfo.tm_mon + 1;
-        checksum ^= timeinfo.tm_mday;
-        checksum ^= timeinfo.tm_hour;
-        checksum ^= timeinfo.tm_min;
+        checksum ^= dt.year;
+        checksum ^= dt.month;
+        checksum ^= dt.day;
+        checksum ^= dt.hour;
+        checksum ^= dt.minute;
         checksum ^= (int)(measurement.weight);
         checksum ^= (int)(measurement.bodyFat);
         checksum ^= 0; // water
@@ -291,11 +297,11 @@ void ScaleBLEService::setAndNotifyHm10Measurement(const WeightHistoryRecord &mea
         int len = snprintf(buffer, sizeof(buffer),
                            "$D$%d,%d,%d,%d,%d,%d,%.1f,%.1f,0.0,0.0,%d\n",
                            measurement.user_id,
-                           timeinfo.tm_year + 1900,
-                           timeinfo.tm_mon + 1,
-                           timeinfo.tm_mday,
-                           timeinfo.tm_hour,
-                           timeinfo.tm_min,
+                           dt.year,
+                           dt.month,
+                           dt.day,
+                           dt.hour,
+                           dt.minute,
                            measurement.weight,
                            measurement.bodyFat,
                            checksum);
@@ -304,64 +310,136 @@ void ScaleBLEService::setAndNotifyHm10Measurement(const WeightHistoryRecord &mea
         {
             ESP_LOGD(TAG, "Sending HM-10 measurement str: %s", buffer);
             pHm10MeasurementCharacteristic->setValue((uint8_t *)buffer, len);
-            pHm10MeasurementCharacteristic->notify();
+            // Counted first: the status callback may run before notify() returns
+            mSync.expectOtherStatus();
+            if (!pHm10MeasurementCharacteristic->notify(connHandle))
+            {
+                mSync.cancelOtherStatus();
+                return false;
+            }
+            mPolicy.noteSent(connHandle, len);
+            metrics::bleNotifications.add();
+            TRACE(BLE_NOTIFY, 'H', len);
             ESP_LOGI(TAG, "HM-10 measurement sent: %s", buffer);
         }
     }
+    return true;
 }
 
-void ScaleBLEService::setMeasurementServiceData(const WeightHistoryRecord &measurement)
+void ScaleBLEService::encodeServiceData(const WeightHistoryRecord &measurement, uint8_t *data)
 {
     // byte[0] = unit (0x02 for kg, 0x03 for lbs)
-    mServiceData[0] = 0x02; // Use kg as unit
+    data[0] = 0x02; // Use kg as unit
 
     // Set flags based on impedance using ternary operator
-    mServiceData[1] = (1 << 5) | ((measurement.impedance != 0) ? (1 << 1) : 0);
+    data[1] = (1 << 5) | ((measurement.impedance != 0) ? (1 << 1) : 0);
 
     // bytes[2-8] = timestamp
-    formatTimestamp(measurement.timestamp, &mServiceData[2]);
+    formatTimestamp(measurement.timestamp, &data[2]);
 
     // bytes[9-10] = impedance (truncate to 16 bits for BLE advertisement)
     uint16_t impedance = (uint16_t)(measurement.impedance & 0xFFFF); // Explicitly truncate to 16 bits
-    mServiceData[9] = impedance & 0xFF;
-    mServiceData[10] = (impedance >> 8) & 0xFF;
+    data[9] = impedance & 0xFF;
+    data[10] = (impedance >> 8) & 0xFF;
 
     // bytes[11-12] = weight (weight * 200 for kg with 0.01/2.0 scale factor)
     uint16_t weight = (uint16_t)(measurement.weight * 200);
-    mServiceData[11] = weight & 0xFF;
-    mServiceData[12] = (weight >> 8) & 0xFF;
-
-    // Log the service data for debugging
-    ESP_LOGD(TAG, "Service Data: Unit: %02X, Flags: %02X, Timestamp: %02X%02X%02X%02X%02X%02X%02X, Impedance: %02X%02X, Weight: %02X%02X",
-             mServiceData[0], mServiceData[1],
-             mServiceData[2], mServiceData[3], mServiceData[4], mServiceData[5], mServiceData[6], mServiceData[7], mServiceData[8],
-             mServiceData[9], mServiceData[10],
-             mServiceData[11], mServiceData[12]);
-
-    NimBLEDevice::getAdvertising()->setServiceData(NimBLEUUID((uint16_t)0x181B), std::string((char *)mServiceData, 13));
-    // Stop and restart advertising to update service data
-    NimBLEDevice::getAdvertising()->stop();
-    NimBLEDevice::getAdvertising()->start();
-
-    // // Set service data to an empty string
-    // NimBLEDevice::getAdvertising()->setServiceData(NimBLEUUID((uint16_t)0x181B), "");
-
-    // // Stop and restart advertising to update service data
-    // NimBLEDevice::getAdvertising()->stop();
-    // NimBLEDevice::getAdvertising()->start();
+    data[11] = weight & 0xFF;
+    data[12] = (weight >> 8) & 0xFF;
+}
+
+WeightHistoryRecord ScaleBLEService::getLastMeasurement()
+{
+    taskENTER_CRITICAL(&mLastMeasurementLock);
+    WeightHistoryRecord measurement = mLastMeasurement;
+    taskEXIT_CRITICAL(&mLastMeasurementLock);
+    return measurement;
 }
 
 void ScaleBLEService::setAndNotifyMeasurement(const WeightHistoryRecord &measurement)
 {
-    // Store the measurement
-    mLastMeasurement = measurement;
-    saveLastMeasurement();
-
-    setMeasurementServiceData(measurement);
-    setAndNotifyWssMeasurement(measurement);
-    setAndNotifyBcsMeasurement(measurement);
-    setAndNotifyHm10Measurement(measurement);
+    setAndNotifyMeasurements(&measurement, 1);
+}
+
+void ScaleBLEService::setAndNotifyMeasurements(const WeightHistoryRecord *measurements, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    ScopedTimer timer(metrics::notifyBatch);
+    if (count > MAX_BATCH)
+    {
+        ESP_LOGW(TAG, "Batch of %u measurements truncated to %u", (unsigned)count, (unsigned)MAX_BATCH);
+        count = MAX_BATCH;
+    }
+
+    // The Aria sends the newest record first and the cached ones oldest
+    // first; store and notify them in measurement order
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t pos = i;
+        while (pos > 0 && mBatch[pos - 1].timestamp > measurements[i].timestamp)
+        {
+            mBatch[pos] = mBatch[pos - 1];
+            pos--;
+        }
+        mBatch[pos] = measurements[i];
+    }
+
+    // One flash sync for the whole batch
+    {
+        ScopedTimer appendTimer(metrics::historyAppend);
+        mHistory.append(mBatch, count);
+    }
+    // Read back from the log's cache, so the rollups see exactly what was stored
+    mRollups.catchUp();
+
+    const WeightHistoryRecord &newest = mBatch[count - 1];
+    if (newest.timestamp >= mLastMeasurement.timestamp)
+    {
+        taskENTER_CRITICAL(&mLastMeasurementLock);
+        mLastMeasurement = newest;
+        taskEXIT_CRITICAL(&mLastMeasurementLock);
+    }
+    // Advertising data is updated once per batch, in place
+    mAdvertiser.update(mBatch, count);
+
+    // Connected centrals get the new records through their delivery
+    // cursors, the others when they next connect
+    deliverPending();
     mLastStatus = "Sent";
+    ESP_LOGI(TAG, "Batch of %u measurements stored and notified", (unsigned)count);
+}
+
+bool ScaleBLEService::sendDelivery(void *context, uint16_t connHandle, DeliveryQueue::Channel channel,
+                                   const WeightHistoryRecord &measurement)
+{
+    ScaleBLEService *service = static_cast<ScaleBLEService *>(context);
+    switch (channel)
+    {
+    case DeliveryQueue::CHANNEL_WSS:
+        return service->setAndNotifyWssMeasurement(measurement, connHandle);
+    case DeliveryQueue::CHANNEL_BCS:
+        return service->setAndNotifyBcsMeasurement(measurement, connHandle);
+    case DeliveryQueue::CHANNEL_HM10:
+        return service->setAndNotifyHm10Measurement(measurement, connHandle);
+    }
+    return true;
+}
+
+void ScaleBLEService::onRead(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo)
+{
+    if (pCharacteristic == pMetricsCharacteristic)
+    {
+        uint8_t blob[metrics::BINARY_MAX_SIZE];
+        pCharacteristic->setValue(blob, metrics::writeBinary(blob, sizeof(blob)));
+    }
+    else if (pCharacteristic == pRollupsCharacteristic)
+    {
+        uint8_t blob[Rollups::BINARY_MAX_SIZE];
+        pCharacteristic->setValue(blob, mRollups.writeBinary(blob, sizeof(blob), mRollupsPeriod, mRollupsUser));
+    }
 }
 
 void ScaleBLEService::onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo& connInfo)
@@ -369,22 +447,81 @@ void ScaleBLEService::onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnI
     if (pCharacteristic == pHm10MeasurementCharacteristic)
     {
         std::string value = pCharacteristic->getValue();
-        ESP_LOGI(TAG, "Received write on HM-10 characteristic, length: %d", value.length());
-
-        if (value.length() > 0)
+        ESP_LOGD(TAG, "Received write on HM-10 characteristic, length: %u", (unsigned)value.length());
+        mSync.onCommand((const uint8_t *)value.data(), value.length(), connInfo);
+    }
+    else if (pCharacteristic == pRollupsCharacteristic)
+    {
+        std::string value = pCharacteristic->getValue();
+        if (value.length() == 2 && (uint8_t)value[0] <= Rollups::WEEKLY)
         {
-            ESP_LOGI(TAG, "Received data: ");
-            for (int i = 0; i < value.length(); i++)
-            {
-                ESP_LOGI(TAG, "byte[%d]: 0x%02X", i, (uint8_t)value[i]);
-            }
+            mRollupsPeriod = (Rollups::Period)value[0];
+            mRollupsUser = (uint8_t)value[1];
         }
     }
 }
 
+void ScaleBLEService::onStatus(NimBLECharacteristic *pCharacteristic, int code)
+{
+    // Frees a slot in the history transfer's notification window, unless
+    // it was for a delivery queue notification
+    if (pCharacteristic == pHm10MeasurementCharacteristic)
+    {
+        mSync.onSent(code);
+    }
+}
+
+void ScaleBLEService::onSubscribe(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo, uint16_t subValue)
+{
+    DeliveryQueue::Channel channel;
+    if (pCharacteristic == pWssMeasurementCharacteristic)
+    {
+        channel = DeliveryQueue::CHANNEL_WSS;
+    }
+    else if (pCharacteristic == pBcsCharacteristic)
+    {
+        channel = DeliveryQueue::CHANNEL_BCS;
+    }
+    else if (pCharacteristic == pHm10MeasurementCharacteristic)
+    {
+        channel = DeliveryQueue::CHANNEL_HM10;
+    }
+    else
+    {
+        return;
+    }
+    mDelivery.onSubscribe(connInfo, channel, subValue != 0);
+}
+
+void ScaleBLEService::onConnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo)
+{
+    ESP_LOGI(TAG, "Client connected");
+    mPolicy.onConnect(connInfo);
+    mDelivery.onConnect(connInfo);
+}
+
+void ScaleBLEService::onConnParamsUpdate(NimBLEConnInfo &connInfo)
+{
+    mPolicy.onConnParams(connInfo);
+    mDelivery.onConnParams(connInfo);
+}
+
+void ScaleBLEService::onMTUChange(uint16_t MTU, NimBLEConnInfo &connInfo)
+{
+    mPolicy.onMtuChange(MTU, connInfo);
+}
+
+void ScaleBLEService::onPhyUpdate(NimBLEConnInfo &connInfo, uint8_t txPhy, uint8_t rxPhy)
+{
+    mPolicy.onPhyUpdate(connInfo, txPhy, rxPhy);
+}
+
 void ScaleBLEService::onDisconnect(NimBLEServer *pServer, NimBLEConnInfo& connInfo, int reason)
 {
     ESP_LOGI(TAG, "Client disconnected");
+    mSync.onDisconnect(connInfo.getConnHandle());
+    mDelivery.onDisconnect(connInfo);
+    mPolicy.onDisconnect(connInfo);
     // Start advertising again to allow a new client to connect
-    NimBLEDevice::getAdvertising()->start();
+    mAdvertiser.resume();
 }
\ No newline at end of file
@@ -4,41 +4,70 @@
 #include <NimBLEServer.h>
 #include <NimBLEUtils.h>
 #include <vector>
+#include "measurement_record.h"
+#include "measurement_log.h"
+#include "history_sync.h"
+#include "delivery_queue.h"
+#include "connection_policy.h"
+#include "scale_advertiser.h"
+#include "rollups.h"
 
 // History command types
 #define MI_HISTORY_CMD_START 0x01
 #define MI_HISTORY_CMD_STOP 0x03
 #define MI_HISTORY_CMD_REQUEST 0x02
 #define MI_HISTORY_CMD_COMPLETE 0x04
+#define MI_HISTORY_RECORDS 0x05 // notification carrying packed records, see history_sync.h
 
 // Measurement flags
 #define MEASUREMENT_STABLE 0x20
 
-struct WeightHistoryRecord
-{
-    float weight;
-    uint32_t impedance;
-    float bodyFat;
-    float water;
-    float muscle;
-    uint32_t timestamp;
-    uint8_t user_id;
-    bool isStabilized;
-};
-
 class ScaleBLEService : public NimBLECharacteristicCallbacks, public NimBLEServerCallbacks
 {
 public:
     ScaleBLEService();
     void begin();
     void setAndNotifyMeasurement(const WeightHistoryRecord &measurement);
+    // Persists once, advertises the newest record once, then notifies each in order
+    void setAndNotifyMeasurements(const WeightHistoryRecord *measurements, size_t count);
+    static const size_t MAX_BATCH = 17; // newest + 16 cached uploads
     uint32_t getConnectedCount() { return pServer ? pServer->getConnectedCount() : 0; }
-    WeightHistoryRecord getLastMeasurement() { return mLastMeasurement; }
+    WeightHistoryRecord getLastMeasurement();
     const char* getLastStatus() { return mLastStatus; }
+    MeasurementLog &getHistory() { return mHistory; }
+
+    // Measurement worker: sends what connected centrals have not had yet.
+    // Returns the ticks until it should be called again.
+    TickType_t deliverPending() { return mDelivery.pump(sendDelivery, this); }
+    // Called from the NimBLE task when deliverPending() has work
+    void setDeliveryWake(DeliveryQueue::Wake wake, void *context) { mDelivery.setWake(wake, context); }
+    uint32_t getDeliveryBacklog() const { return mDelivery.backlog(); }
+
+    // Call from loop(); settles idle connections, saves the rollups when due,
+    // retries a stalled history transfer
+    void update()
+    {
+        mPolicy.update();
+        mRollups.update();
+        mSync.update();
+    }
+    ConnectionPolicy &getConnectionPolicy() { return mPolicy; }
+    const Rollups &getRollups() const { return mRollups; }
+
+    // The 13 bytes of 0x181B service data for one measurement
+    static void encodeServiceData(const WeightHistoryRecord &measurement, uint8_t *data);
 
 private:
     // NimBLECharacteristicCallbacks
+    void onRead(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override;
     void onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo& connInfo) override;
+    void onStatus(NimBLECharacteristic *pCharacteristic, int code) override;
+    void onSubscribe(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo, uint16_t subValue) override;
+    // NimBLEServerCallbacks
+    void onConnect(NimBLEServer *pServer, NimBLEConnInfo &connInfo) override;
+    void onConnParamsUpdate(NimBLEConnInfo &connInfo) override;
+    void onMTUChange(uint16_t MTU, NimBLEConnInfo &connInfo) override;
+    void onPhyUpdate(NimBLEConnInfo &connInfo, uint8_t txPhy, uint8_t rxPhy) override;
     void onDisconnect(NimBLEServer *pServer, NimBLEConnInfo& connInfo, int reason) override;
 
     NimBLEServer *pServer = nullptr;
@@ -55,6 +84,14 @@ private:
     NimBLEService *pHm10Service = nullptr;
     NimBLECharacteristic *pHm10MeasurementCharacteristic = nullptr;
 
+    // Diagnostics Service
+    NimBLEService *pDiagService = nullptr;
+    NimBLECharacteristic *pMetricsCharacteristic = nullptr;
+    NimBLECharacteristic *pRollupsCharacteristic = nullptr;
+    // Selected by the last write to the rollups characteristic
+    Rollups::Period mRollupsPeriod = Rollups::DAILY;
+    uint8_t mRollupsUser = 0;
+
     // Service UUIDs
     const NimBLEUUID WSS_SERVICE_UUID = NimBLEUUID((uint16_t)0x181D);          // Weight Scale Service
     const NimBLEUUID WSS_MEASUREMENT_CHAR_UUID = NimBLEUUID((uint16_t)0x2A9D); // Weight Measurement Characteristic
@@ -67,26 +104,46 @@ private:
     const NimBLEUUID HM10_SERVICE_UUID = NimBLEUUID("FFE0");          // HM-10 Weight Service
     const NimBLEUUID HM10_MEASUREMENT_CHAR_UUID = NimBLEUUID("FFE1"); // HM-10 Weight Measurement
 
+    // Diagnostics Service UUIDs (vendor specific)
+    const NimBLEUUID DIAG_SERVICE_UUID = NimBLEUUID("6d2b0001-8b1a-4c5e-9f3a-68656c766574");
+    const NimBLEUUID METRICS_CHAR_UUID = NimBLEUUID("6d2b0002-8b1a-4c5e-9f3a-68656c766574"); // metrics::writeBinary blob
+    const NimBLEUUID ROLLUPS_CHAR_UUID = NimBLEUUID("6d2b0003-8b1a-4c5e-9f3a-68656c766574"); // Rollups::writeBinary blob
+
     // Service setup methods
     void setupWeightScaleService();
     void setupBodyCompositionService();
     void setupHm10WeightService();
+    void setupDiagnosticsService();
 
-    // Set and notify methods
-    void setAndNotifyWssMeasurement(const WeightHistoryRecord &measurement);
-    void setAndNotifyBcsMeasurement(const WeightHistoryRecord &measurement);
-    void setAndNotifyHm10Measurement(const WeightHistoryRecord &measurement);
-    void setMeasurementServiceData(const WeightHistoryRecord &measurement);
+    // Set and notify methods, to one central; false if the stack refused
+    bool setAndNotifyWssMeasurement(const WeightHistoryRecord &measurement, uint16_t connHandle);
+    bool setAndNotifyBcsMeasurement(const WeightHistoryRecord &measurement, uint16_t connHandle);
+    bool setAndNotifyHm10Measurement(const WeightHistoryRecord &measurement, uint16_t connHandle);
+    static bool sendDelivery(void *context, uint16_t connHandle, DeliveryQueue::Channel channel,
+                             const WeightHistoryRecord &measurement);
 
-    // File operations for last measurement
+    // Measurement history, the newest record doubles as the last measurement
+    MeasurementLog mHistory;
     bool loadLastMeasurement();
-    bool saveLastMeasurement();
-    static const char *LAST_MEASUREMENT_FILE;
+    void importLegacyMeasurement();
+    static const char *LEGACY_MEASUREMENT_FILE;
+
+    // History transfer on the HM-10 characteristic
+    HistorySync mSync;
+    // What each central has been sent
+    DeliveryQueue mDelivery;
+    // Connection parameters for idle and bulk transfers
+    ConnectionPolicy mPolicy;
+
+    // Legacy and extended advertising sets
+    ScaleAdvertiser mAdvertiser;
 
-    // Service data for advertising
-    uint8_t mServiceData[13] = {0};
+    // Daily and weekly aggregates per user
+    Rollups mRollups;
 
-    // Last measurement
+    // Last measurement, written by the measurement worker and read from loop()
     WeightHistoryRecord mLastMeasurement = {0};
+    portMUX_TYPE mLastMeasurementLock = portMUX_INITIALIZER_UNLOCKED;
+    WeightHistoryRecord mBatch[MAX_BATCH];
     const char* mLastStatus = "Idle";
 };
\ No newline at end of file
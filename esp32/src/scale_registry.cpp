@@ -0,0 +1,204 @@
+#include "scale_registry.h"
+#include <crc16.h>
+#include <esp_log.h>
+
+static const char *TAG = "SCALES";
+const char *ScaleRegistry::PATH = "/scales.bin";
+const char *ScaleRegistry::TEMP_PATH = "/scales.tmp";
+
+// File layout: u8 version, u8 entry size, u16 entry count, the entries as
+// they are in RAM, u16 CRC of everything before it
+static const uint8_t FILE_VERSION = 1;
+
+bool ScaleRegistry::begin()
+{
+    if (!LittleFS.exists(PATH) && LittleFS.exists(TEMP_PATH))
+    {
+        LittleFS.rename(TEMP_PATH, PATH);
+    }
+
+    File file = LittleFS.open(PATH, "r");
+    if (!file)
+    {
+        ESP_LOGI(TAG, "No scales known yet");
+        return true;
+    }
+
+    static aria::ScaleState entries[CAPACITY];
+    uint8_t header[4];
+    uint16_t storedCrc = 0;
+    bool ok = file.read(header, sizeof(header)) == sizeof(header) && header[0] == FILE_VERSION &&
+              header[1] == sizeof(aria::ScaleState);
+    size_t count = ok ? aria::readLE<uint16_t>(header + 2) : 0;
+    ok = ok && count <= CAPACITY &&
+         file.read((uint8_t *)entries, count * sizeof(aria::ScaleState)) == count * sizeof(aria::ScaleState) &&
+         file.read((uint8_t *)&storedCrc, sizeof(storedCrc)) == sizeof(storedCrc);
+    file.close();
+    if (ok)
+    {
+        uint16_t crc = Crc16Xmodem::compute((const uint8_t *)entries, count * sizeof(aria::ScaleState),
+                                            Crc16Xmodem::compute(header, sizeof(header)));
+        ok = crc == storedCrc;
+    }
+    if (!ok)
+    {
+        ESP_LOGW(TAG, "Ignoring unreadable %s", PATH);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        mTable.restore(entries[i]);
+    }
+    ESP_LOGI(TAG, "Loaded %u scales", (unsigned)mTable.size());
+    return true;
+}
+
+aria::ScaleState &ScaleRegistry::observe(const aria::UploadHeader &header, uint32_t now)
+{
+    bool added;
+    aria::ScaleState &scale = mTable.findOrAdd(header.mac, added);
+    const uint8_t *mac = header.mac;
+    if (added)
+    {
+        ESP_LOGI(TAG, "New scale %02x:%02x:%02x:%02x:%02x:%02x, firmware %u", mac[0], mac[1], mac[2], mac[3],
+                 mac[4], mac[5], header.firmwareVersion);
+        scale.firstSeen = now;
+        memcpy(scale.authCode, header.authCode, aria::AUTH_CODE_SIZE);
+        scale.firmwareVersion = header.firmwareVersion;
+        mIdentityChanged = true;
+    }
+    else
+    {
+        if (memcmp(scale.authCode, header.authCode, aria::AUTH_CODE_SIZE) != 0)
+        {
+            // The scale was set up again
+            ESP_LOGW(TAG, "Scale %02x:%02x:%02x:%02x:%02x:%02x has a new auth code", mac[0], mac[1], mac[2],
+                     mac[3], mac[4], mac[5]);
+            memcpy(scale.authCode, header.authCode, aria::AUTH_CODE_SIZE);
+            mIdentityChanged = true;
+        }
+        if (scale.firmwareVersion != header.firmwareVersion)
+        {
+            ESP_LOGI(TAG, "Scale %02x:%02x:%02x:%02x:%02x:%02x firmware %u -> %u", mac[0], mac[1], mac[2], mac[3],
+                     mac[4], mac[5], scale.firmwareVersion, header.firmwareVersion);
+            scale.firmwareVersion = header.firmwareVersion;
+            mIdentityChanged = true;
+        }
+    }
+
+    scale.batteryPercent = header.batteryPercent > 100 ? 100 : header.batteryPercent;
+    scale.lastSeen = now;
+    scale.clockSkew = (int32_t)(header.timestamp - now);
+    scale.uploads++;
+    scale.measurements += header.measurementCount;
+    mChanged = true;
+    return scale;
+}
+
+void ScaleRegistry::bindUser(aria::ScaleState &scale, size_t user)
+{
+    if (user >= 8 * sizeof(scale.userMask) || (scale.userMask >> user & 1))
+    {
+        return;
+    }
+    scale.userMask |= 1 << user;
+    mIdentityChanged = true;
+}
+
+void ScaleRegistry::update()
+{
+    uint32_t nowMs = millis();
+    if (mIdentityChanged || (mChanged && nowMs - mLastSaveMs >= SAVE_INTERVAL_MS))
+    {
+        if (save())
+        {
+            mIdentityChanged = false;
+            mChanged = false;
+        }
+        // Retry on the interval rather than every loop() if flash is unhappy
+        mLastSaveMs = nowMs;
+    }
+}
+
+// Written to a temporary file and renamed, so a reset keeps the old table
+bool ScaleRegistry::save()
+{
+    File file = LittleFS.open(TEMP_PATH, "w");
+    if (!file)
+    {
+        ESP_LOGE(TAG, "Failed to open %s", TEMP_PATH);
+        return false;
+    }
+
+    uint8_t header[4] = {FILE_VERSION, sizeof(aria::ScaleState), (uint8_t)(mTable.size() & 0xFF),
+                         (uint8_t)(mTable.size() >> 8)};
+    uint16_t crc = Crc16Xmodem::compute(header, sizeof(header));
+    bool ok = file.write(header, sizeof(header)) == sizeof(header);
+    for (size_t i = 0; ok && i < mTable.SLOTS; i++)
+    {
+        if (mTable.used(i))
+        {
+            const uint8_t *bytes = (const uint8_t *)&mTable.slot(i);
+            crc = Crc16Xmodem::compute(bytes, sizeof(aria::ScaleState), crc);
+            ok = file.write(bytes, sizeof(aria::ScaleState)) == sizeof(aria::ScaleState);
+        }
+    }
+    ok = ok && file.write((const uint8_t *)&crc, sizeof(crc)) == sizeof(crc);
+    file.close();
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Failed to write %s", TEMP_PATH);
+        return false;
+    }
+    LittleFS.rename(TEMP_PATH, PATH);
+    ESP_LOGD(TAG, "Saved %u scales", (unsigned)mTable.size());
+    return true;
+}
+
+void ScaleRegistry::writePrometheus(ChunkedText &out, void *context)
+{
+    const ScaleRegistry &registry = *static_cast<const ScaleRegistry *>(context);
+    const auto &table = registry.mTable;
+
+    struct Series
+    {
+        const char *name;
+        const char *help;
+        const char *type;
+        int64_t (*read)(const aria::ScaleState &);
+    };
+    static const Series SERIES[] = {
+        {"helvetic_scale_battery_percent", "Battery level reported by the scale", "gauge",
+         [](const aria::ScaleState &s) { return (int64_t)s.batteryPercent; }},
+        {"helvetic_scale_firmware_version", "Firmware version reported by the scale", "gauge",
+         [](const aria::ScaleState &s) { return (int64_t)s.firmwareVersion; }},
+        {"helvetic_scale_last_seen_timestamp_seconds", "Time of the scale's last upload", "gauge",
+         [](const aria::ScaleState &s) { return (int64_t)s.lastSeen; }},
+        {"helvetic_scale_clock_skew_seconds", "Scale clock minus ours at the last upload", "gauge",
+         [](const aria::ScaleState &s) { return (int64_t)s.clockSkew; }},
+        {"helvetic_scale_users", "Users that have weighed in on the scale", "gauge",
+         [](const aria::ScaleState &s) { return (int64_t)__builtin_popcount(s.userMask); }},
+        {"helvetic_scale_uploads_total", "Uploads from the scale", "counter",
+         [](const aria::ScaleState &s) { return (int64_t)s.uploads; }},
+        {"helvetic_scale_measurements_total", "Measurements uploaded by the scale", "counter",
+         [](const aria::ScaleState &s) { return (int64_t)s.measurements; }},
+    };
+
+    out.printf("# HELP helvetic_scales Scales known to the gateway\n# TYPE helvetic_scales gauge\n"
+               "helvetic_scales %u\n", (unsigned)table.size());
+    for (const Series &series : SERIES)
+    {
+        out.printf("# HELP %s %s\n# TYPE %s %s\n", series.name, series.help, series.name, series.type);
+        for (size_t i = 0; i < table.SLOTS; i++)
+        {
+            if (!table.used(i))
+            {
+                continue;
+            }
+            const aria::ScaleState &s = table.slot(i);
+            out.printf("%s{mac=\"%02x:%02x:%02x:%02x:%02x:%02x\"} %lld\n", series.name, s.mac[0], s.mac[1],
+                       s.mac[2], s.mac[3], s.mac[4], s.mac[5], (long long)series.read(s));
+        }
+    }
+}
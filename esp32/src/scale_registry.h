@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <aria_protocol.h>
+#include <scale_table.h>
+#include "chunked_text.h"
+
+// Per-scale state for every Aria that uploads to this gateway: auth code,
+// firmware, battery, clock skew, counters and which users weighed in on it.
+//
+// The upload handler updates the table in RAM; loop() writes it to
+// /scales.bin, right away when a scale appears or changes identity and
+// otherwise at most every SAVE_INTERVAL_MS, so routine uploads (battery,
+// last seen) do not each cost a flash write. Everything runs on the loop
+// task, including /metrics, so there is no locking.
+class ScaleRegistry
+{
+public:
+    static const size_t CAPACITY = 32;
+    static const uint32_t SAVE_INTERVAL_MS = 15 * 60 * 1000;
+
+    // Loads the table; call after LittleFS is mounted
+    bool begin();
+
+    // Upload handler: the entry for the uploading scale, refreshed from the header
+    aria::ScaleState &observe(const aria::UploadHeader &header, uint32_t now);
+    void bindUser(aria::ScaleState &scale, size_t user);
+
+    // Call from loop(); writes pending changes back to flash
+    void update();
+
+    size_t size() const { return mTable.size(); }
+
+    // Labelled per-scale series, see metrics::addSection
+    static void writePrometheus(ChunkedText &out, void *context);
+
+private:
+    bool save();
+
+    static const char *PATH;
+    static const char *TEMP_PATH;
+
+    aria::ScaleTable<CAPACITY> mTable;
+    bool mIdentityChanged = false; // new scale, auth code or firmware
+    bool mChanged = false;
+    uint32_t mLastSaveMs = 0;
+};
@@ -0,0 +1,161 @@
+#include "trace.h"
+
+namespace trace
+{
+
+#if HELVETIC_TRACE_CATEGORIES
+
+struct EventHeader
+{
+    uint32_t timestampUs; // low 32 bits of esp_timer, wraps after 71 minutes
+    uint16_t event;
+    uint8_t length; // payload bytes following the header
+    uint8_t reserved;
+    uint32_t args[2];
+};
+
+static const char *const NAMES[] = {
+#define TRACE_NAME(id, category, format) #id,
+    HELVETIC_TRACE_EVENTS(TRACE_NAME)
+#undef TRACE_NAME
+};
+
+static const char *const FORMATS[] = {
+#define TRACE_FORMAT(id, category, format) format,
+    HELVETIC_TRACE_EVENTS(TRACE_FORMAT)
+#undef TRACE_FORMAT
+};
+
+// Byte ring; head and tail count bytes ever written and freed
+static uint8_t buffer[BUFFER_SIZE];
+static size_t head = 0;
+static size_t tail = 0;
+static uint32_t lost = 0;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+static size_t recordSize(size_t length)
+{
+    return sizeof(EventHeader) + ((length + 3) & ~(size_t)3);
+}
+
+static void copyIn(size_t pos, const void *data, size_t length)
+{
+    size_t offset = pos % BUFFER_SIZE;
+    size_t first = min(length, BUFFER_SIZE - offset);
+    memcpy(buffer + offset, data, first);
+    memcpy(buffer, (const uint8_t *)data + first, length - first);
+}
+
+static void copyOut(size_t pos, void *data, size_t length)
+{
+    size_t offset = pos % BUFFER_SIZE;
+    size_t first = min(length, BUFFER_SIZE - offset);
+    memcpy(data, buffer + offset, first);
+    memcpy((uint8_t *)data + first, buffer, length - first);
+}
+
+void record(Event event, uint32_t arg0, uint32_t arg1, const void *payload, size_t length)
+{
+    if (length > MAX_PAYLOAD)
+    {
+        length = MAX_PAYLOAD;
+    }
+    EventHeader header = {(uint32_t)esp_timer_get_time(), event, (uint8_t)length, 0, {arg0, arg1}};
+    size_t size = recordSize(length);
+
+    taskENTER_CRITICAL(&lock);
+    while (head - tail + size > BUFFER_SIZE)
+    {
+        EventHeader oldest;
+        copyOut(tail, &oldest, sizeof(oldest));
+        tail += recordSize(oldest.length);
+        lost++;
+    }
+    copyIn(head, &header, sizeof(header));
+    if (length)
+    {
+        copyIn(head + sizeof(header), payload, length);
+    }
+    head += size;
+    taskEXIT_CRITICAL(&lock);
+}
+
+size_t drain(TextWriter write, void *context)
+{
+    ChunkedText out(write, context);
+    size_t count = 0;
+    for (;;)
+    {
+        // Copy one event out under the lock, format it without
+        EventHeader header;
+        uint8_t payload[MAX_PAYLOAD];
+        taskENTER_CRITICAL(&lock);
+        bool empty = head == tail;
+        if (!empty)
+        {
+            copyOut(tail, &header, sizeof(header));
+            copyOut(tail + sizeof(header), payload, header.length);
+            tail += recordSize(header.length);
+        }
+        taskEXIT_CRITICAL(&lock);
+        if (empty)
+        {
+            break;
+        }
+
+        out.printf("%10u.%06u %-18s ", (unsigned)(header.timestampUs / 1000000),
+                   (unsigned)(header.timestampUs % 1000000),
+                   header.event < EVENT_COUNT ? NAMES[header.event] : "?");
+        if (header.event < EVENT_COUNT)
+        {
+            char line[64];
+            snprintf(line, sizeof(line), FORMATS[header.event], header.args[0], header.args[1]);
+            out.printf("%s", line);
+        }
+        for (size_t i = 0; i < header.length; i += 32)
+        {
+            // 32 bytes per line, the size of one measurement record
+            char hex[32 * 3 + 1];
+            size_t n = min((size_t)header.length - i, (size_t)32);
+            for (size_t j = 0; j < n; j++)
+            {
+                snprintf(hex + j * 3, 4, " %02X", payload[i + j]);
+            }
+            out.printf("\n                 %s", hex);
+        }
+        out.printf("\n");
+        count++;
+    }
+
+    uint32_t lostNow = overwritten();
+    if (lostNow)
+    {
+        out.printf("(%u older events overwritten since boot)\n", (unsigned)lostNow);
+    }
+    return count;
+}
+
+uint32_t overwritten()
+{
+    return lost;
+}
+
+#else
+
+void record(Event, uint32_t, uint32_t, const void *, size_t) {}
+
+size_t drain(TextWriter write, void *context)
+{
+    static const char message[] = "Tracing is disabled in this build, set HELVETIC_TRACE_CATEGORIES\n";
+    write(context, message, sizeof(message) - 1);
+    return 0;
+}
+
+uint32_t overwritten()
+{
+    return 0;
+}
+
+#endif
+
+} // namespace trace
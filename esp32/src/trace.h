@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "chunked_text.h"
+
+// Deferred binary tracing.
+//
+// TRACE() stores an event id, a timestamp, two integer arguments and
+// optionally a few raw bytes in a RAM ring buffer; nothing is formatted
+// until the buffer is drained (GET /trace or 't' on the serial console).
+// When the ring is full the oldest events are overwritten.
+//
+// Categories not enabled in HELVETIC_TRACE_CATEGORIES compile to nothing:
+// the arguments are not evaluated and no buffer is linked in. Release
+// builds enable none; the debug and native environments enable all.
+
+#ifndef HELVETIC_TRACE_CATEGORIES
+#define HELVETIC_TRACE_CATEGORIES 0
+#endif
+
+#define TRACE_CAT_UPLOAD 0x01
+#define TRACE_CAT_BLE 0x02
+#define TRACE_CAT_HISTORY 0x04
+#define TRACE_CAT_DNS 0x08
+
+// X(id, category, format for the two arguments)
+#define HELVETIC_TRACE_EVENTS(X)                                              \
+    X(UPLOAD_CHUNK, TRACE_CAT_UPLOAD, "chunk %u bytes, %u total")             \
+    X(UPLOAD_ABORTED, TRACE_CAT_UPLOAD, "aborted after %u bytes")             \
+    X(UPLOAD_HEADER, TRACE_CAT_UPLOAD, "header protocol %u battery %u%%")     \
+    X(UPLOAD_MEASUREMENT, TRACE_CAT_UPLOAD, "measurement %u weight %u g")     \
+    X(UPLOAD_REJECTED, TRACE_CAT_UPLOAD, "rejected, parse status %u")         \
+    X(UPLOAD_RESPONSE, TRACE_CAT_UPLOAD, "response %u users, crc %04x")       \
+    X(BLE_NOTIFY, TRACE_CAT_BLE, "notify %c, %u bytes")                       \
+    X(BLE_ADVERTISE, TRACE_CAT_BLE, "advertise ts %u weight %u x 5 g")       \
+    X(HISTORY_APPEND, TRACE_CAT_HISTORY, "append %u records, next seq %u")    \
+    X(DNS_QUERY, TRACE_CAT_DNS, "query result %u, table entry %d")
+
+namespace trace
+{
+
+enum Event : uint16_t
+{
+#define TRACE_ENUM(id, category, format) id,
+    HELVETIC_TRACE_EVENTS(TRACE_ENUM)
+#undef TRACE_ENUM
+        EVENT_COUNT
+};
+
+constexpr uint8_t category(Event event)
+{
+    constexpr uint8_t categories[] = {
+#define TRACE_CATEGORY(id, category, format) category,
+        HELVETIC_TRACE_EVENTS(TRACE_CATEGORY)
+#undef TRACE_CATEGORY
+    };
+    return categories[event];
+}
+
+constexpr bool enabled(Event event)
+{
+    return (HELVETIC_TRACE_CATEGORIES & category(event)) != 0;
+}
+
+static const size_t BUFFER_SIZE = 4096;
+static const size_t MAX_PAYLOAD = 64; // longer byte ranges are truncated
+
+void record(Event event, uint32_t arg0, uint32_t arg1, const void *payload = nullptr, size_t length = 0);
+
+// Formats and removes all buffered events, one line each
+size_t drain(TextWriter write, void *context);
+
+// Events lost to overwrites since boot
+uint32_t overwritten();
+
+} // namespace trace
+
+#define TRACE(event, arg0, arg1)                                              \
+    do                                                                        \
+    {                                                                         \
+        if constexpr (trace::enabled(trace::event))                           \
+        {                                                                     \
+            trace::record(trace::event, (uint32_t)(arg0), (uint32_t)(arg1));  \
+        }                                                                     \
+    } while (0)
+
+// Also keeps up to MAX_PAYLOAD raw bytes, printed in hex when drained
+#define TRACE_BYTES(event, arg0, arg1, data, length)                          \
+    do                                                                        \
+    {                                                                         \
+        if constexpr (trace::enabled(trace::event))                           \
+        {                                                                     \
+            trace::record(trace::event, (uint32_t)(arg0), (uint32_t)(arg1),   \
+                          (data), (length));                                  \
+        }                                                                     \
+    } while (0)
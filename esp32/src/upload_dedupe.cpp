@@ -0,0 +1,91 @@
+#include "upload_dedupe.h"
+#include <esp_log.h>
+
+static const char *TAG = "DEDUPE";
+const char *UploadDedupe::PATH = "/dedupe.bin";
+const char *UploadDedupe::TEMP_PATH = "/dedupe.tmp";
+
+bool UploadDedupe::begin()
+{
+    if (!LittleFS.exists(PATH) && LittleFS.exists(TEMP_PATH))
+    {
+        // Reset between writing a compacted journal and renaming it
+        LittleFS.rename(TEMP_PATH, PATH);
+    }
+
+    // Journal of 8-byte keys, oldest first; a torn last entry is ignored
+    File file = LittleFS.open(PATH, "r");
+    if (file)
+    {
+        uint64_t key;
+        while (file.read((uint8_t *)&key, sizeof(key)) == sizeof(key))
+        {
+            mSet.insert(key);
+            mJournalEntries++;
+        }
+        file.close();
+    }
+    ESP_LOGI(TAG, "Remembering %u recent measurements", (unsigned)mSet.size());
+
+    if (mJournalEntries > CAPACITY)
+    {
+        compact();
+    }
+    mJournal = LittleFS.open(PATH, "a");
+    if (!mJournal)
+    {
+        ESP_LOGE(TAG, "Failed to open %s, duplicates are only caught until reboot", PATH);
+        return false;
+    }
+    return true;
+}
+
+void UploadDedupe::persist(const uint64_t *keys, size_t count)
+{
+    if (!mJournal)
+    {
+        return;
+    }
+    if (mJournal.write((const uint8_t *)keys, count * sizeof(uint64_t)) != count * sizeof(uint64_t))
+    {
+        ESP_LOGE(TAG, "Failed to append to %s", PATH);
+    }
+    mJournal.flush();
+    mJournalEntries += count;
+
+    // Only the last CAPACITY keys matter; rewrite once twice that piled up
+    if (mJournalEntries >= 2 * CAPACITY)
+    {
+        mJournal.close();
+        compact();
+        mJournal = LittleFS.open(PATH, "a");
+    }
+}
+
+// Keeps the newest CAPACITY journal entries, written to a temporary file
+// and renamed over the journal so a reset leaves one or the other
+void UploadDedupe::compact()
+{
+    static uint64_t keys[CAPACITY];
+    File in = LittleFS.open(PATH, "r");
+    if (!in)
+    {
+        return;
+    }
+    size_t total = in.size() / sizeof(uint64_t);
+    size_t skip = total > CAPACITY ? total - CAPACITY : 0;
+    in.seek(skip * sizeof(uint64_t));
+    size_t kept = in.read((uint8_t *)keys, (total - skip) * sizeof(uint64_t)) / sizeof(uint64_t);
+    in.close();
+
+    File out = LittleFS.open(TEMP_PATH, "w");
+    if (!out || out.write((const uint8_t *)keys, kept * sizeof(uint64_t)) != kept * sizeof(uint64_t))
+    {
+        ESP_LOGE(TAG, "Failed to compact %s", PATH);
+        return;
+    }
+    out.close();
+    LittleFS.rename(TEMP_PATH, PATH);
+    mJournalEntries = kept;
+    ESP_LOGD(TAG, "Compacted journal to %u keys", (unsigned)kept);
+}
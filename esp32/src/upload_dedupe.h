@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <dedupe_set.h>
+
+// Recognises measurements the Aria sends again after an upload it thinks
+// failed (it keeps up to 16 and re-sends them with the next upload).
+//
+// Keys come from aria::uploadKey() (upload_key.h), a hash of (MAC,
+// timestamp, weight, impedance) shared with the ingest server. The set
+// lives in RAM and is only touched by the upload handler. Keys of new
+// measurements travel with them through the measurement pipeline and the
+// worker appends them to a journal, so the set is rebuilt after a reboot
+// without the upload path ever waiting for flash.
+class UploadDedupe
+{
+public:
+    static const size_t CAPACITY = 256;
+
+    // Loads the journal; call after LittleFS is mounted, before uploads
+    bool begin();
+
+    // Upload handler: true the first time a key is seen
+    bool insert(uint64_t key) { return mSet.insert(key); }
+    // Upload handler: forget a key whose measurement could not be queued
+    void forget(uint64_t key) { mSet.erase(key); }
+
+    // Measurement worker: makes the keys survive a reboot
+    void persist(const uint64_t *keys, size_t count);
+
+private:
+    void compact();
+
+    static const char *PATH;
+    static const char *TEMP_PATH;
+
+    DedupeSet<CAPACITY> mSet;
+    File mJournal;
+    uint32_t mJournalEntries = 0; // worker only after begin()
+};
@@ -0,0 +1,314 @@
+#include "wall_clock.h"
+#include "metrics.h"
+#include <M5Unified.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+static const char *TAG = "CLOCK";
+
+namespace wallclock
+{
+
+static const int64_t RESYNC_INTERVAL_US = 10 * 60 * 1000000LL;
+static const int64_t MIN_DRIFT_SPAN_US = 60 * 60 * 1000000LL; // edge error is a few ppm over this
+static const int64_t EDGE_MAX_GAP_US = 20000;                  // reads further apart place the edge too loosely
+static const int64_t EDGE_TIMEOUT_US = 2000000;                // the RTC seconds should have ticked by then
+static const int32_t MAX_DRIFT_PPM = 500;
+static const int64_t STEP_THRESHOLD_US = 2000000;
+static const uint32_t VALID_AFTER = 1577836800; // 2020-01-01, earlier means the clock was never set
+static const int32_t SCALE_OFFSET_REPORT_S = 30;
+
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Unix time is baseUnixUs at esp_timer baseTimerUs, running drift ppm fast
+static int64_t baseTimerUs = 0;
+static int64_t baseUnixUs = 0;
+static int32_t drift = 0;
+static Source currentSource = Source::None;
+
+// RTC seconds edges the drift is measured against
+static int64_t firstSyncTimerUs = -1;
+static int64_t firstSyncRtcUs = 0;
+static int64_t lastSyncTimerUs = 0;
+
+// Edge search: the RTC is polled from update() until its seconds change
+static bool edgePending = false;
+static uint32_t edgeSeconds = 0;
+static int64_t edgeReadUs = 0; // esp_timer at the last read still showing edgeSeconds
+
+static int32_t lastScaleOffset = 0;
+
+static uint32_t cachedDay = UINT32_MAX;
+static civil::DateTime cachedDate = {};
+
+static int64_t unixAt(int64_t timerUs)
+{
+    int64_t elapsed = timerUs - baseTimerUs;
+    return baseUnixUs + elapsed + elapsed * drift / 1000000;
+}
+
+static void setBase(int64_t timerUs, int64_t unixUs)
+{
+    taskENTER_CRITICAL(&lock);
+    baseTimerUs = timerUs;
+    baseUnixUs = unixUs;
+    taskEXIT_CRITICAL(&lock);
+}
+
+// Whole seconds only
+static bool readRtc(uint32_t &timestamp)
+{
+    if (!M5.Rtc.isEnabled())
+    {
+        return false;
+    }
+    ScopedTimer timer(metrics::rtcRead);
+    auto dt = M5.Rtc.getDateTime();
+    if (dt.date.year < 1970 || dt.date.month < 1 || dt.date.month > 12 || dt.date.date < 1)
+    {
+        return false;
+    }
+    civil::DateTime date = {(uint16_t)dt.date.year, (uint8_t)dt.date.month, (uint8_t)dt.date.date,
+                            (uint8_t)dt.time.hours, (uint8_t)dt.time.minutes, (uint8_t)dt.time.seconds};
+    timestamp = civil::toUnix(date);
+    return timestamp >= VALID_AFTER;
+}
+
+// Reads the RTC, returning the esp_timer time halfway through the read
+static bool readRtcAt(uint32_t &timestamp, int64_t &timerUs)
+{
+    int64_t before = esp_timer_get_time();
+    bool ok = readRtc(timestamp);
+    timerUs = (before + esp_timer_get_time()) / 2;
+    return ok;
+}
+
+static void writeRtc(uint32_t timestamp)
+{
+    if (!M5.Rtc.isEnabled())
+    {
+        return;
+    }
+    civil::DateTime date = civil::fromUnix(timestamp);
+    m5::rtc_datetime_t dt;
+    dt.date.year = date.year;
+    dt.date.month = date.month;
+    dt.date.date = date.day;
+    dt.date.weekDay = (timestamp / 86400 + 4) % 7; // 1970-01-01 was a Thursday
+    dt.time.hours = date.hour;
+    dt.time.minutes = date.minute;
+    dt.time.seconds = date.second;
+    M5.Rtc.setDateTime(dt);
+    ESP_LOGI(TAG, "RTC set to %04u-%02u-%02u %02u:%02u:%02u", date.year, date.month, date.day,
+             date.hour, date.minute, date.second);
+}
+
+void begin()
+{
+    int64_t timerUs = esp_timer_get_time();
+    uint32_t rtc;
+    if (readRtc(rtc))
+    {
+        // The midpoint of the second until update() finds an edge
+        setBase(timerUs, rtc * 1000000LL + 500000);
+        currentSource = Source::Rtc;
+    }
+    else
+    {
+        // Same fallback as before: whatever the system clock says
+        time_t system = time(nullptr);
+        setBase(timerUs, (int64_t)system * 1000000);
+        if (system >= VALID_AFTER)
+        {
+            currentSource = Source::System;
+            // An RTC that lost its time gets it back from the system clock
+            writeRtc((uint32_t)system);
+        }
+        else
+        {
+            ESP_LOGW(TAG, "RTC not available or not set, waiting for the scale's clock");
+        }
+    }
+    // Start the first edge search right away
+    lastSyncTimerUs = timerUs - RESYNC_INTERVAL_US;
+}
+
+// Polls for the next RTC seconds edge; true once found, with the RTC time
+// at the edge and the esp_timer time it happened, to within half a loop
+static bool findEdge(int64_t &timerUs, int64_t &rtcUs)
+{
+    uint32_t seconds;
+    int64_t readUs;
+    if (!edgePending)
+    {
+        if (esp_timer_get_time() - lastSyncTimerUs < RESYNC_INTERVAL_US)
+        {
+            return false;
+        }
+        lastSyncTimerUs = esp_timer_get_time();
+        if (readRtcAt(seconds, readUs))
+        {
+            edgePending = true;
+            edgeSeconds = seconds;
+            edgeReadUs = readUs;
+        }
+        return false;
+    }
+
+    if (!readRtcAt(seconds, readUs))
+    {
+        edgePending = false;
+        return false;
+    }
+    if (seconds == edgeSeconds)
+    {
+        edgeReadUs = readUs;
+        if (readUs - lastSyncTimerUs > EDGE_TIMEOUT_US)
+        {
+            ESP_LOGW(TAG, "RTC seconds did not change in %lld ms", (long long)(EDGE_TIMEOUT_US / 1000));
+            edgePending = false;
+        }
+        return false;
+    }
+
+    // The edge lies between the two reads; a slow loop iteration leaves
+    // it too uncertain, so look for the next one
+    int64_t gap = readUs - edgeReadUs;
+    if (seconds != edgeSeconds + 1 || gap > EDGE_MAX_GAP_US)
+    {
+        edgeSeconds = seconds;
+        edgeReadUs = readUs;
+        return false;
+    }
+    edgePending = false;
+    timerUs = edgeReadUs + gap / 2;
+    rtcUs = seconds * 1000000LL;
+    return true;
+}
+
+void update()
+{
+    int64_t timerUs;
+    int64_t rtcUs;
+    if (!findEdge(timerUs, rtcUs))
+    {
+        return;
+    }
+    if (firstSyncTimerUs < 0)
+    {
+        // begin() could only guess the fraction of the second
+        firstSyncTimerUs = timerUs;
+        firstSyncRtcUs = rtcUs;
+        if (currentSource == Source::Rtc)
+        {
+            setBase(timerUs, rtcUs);
+        }
+    }
+
+    int64_t span = timerUs - firstSyncTimerUs;
+    int64_t predicted = unixAt(timerUs);
+    if (span >= MIN_DRIFT_SPAN_US)
+    {
+        int64_t ppm = ((rtcUs - firstSyncRtcUs) - span) * 1000000 / span;
+        drift = (int32_t)(ppm > MAX_DRIFT_PPM ? MAX_DRIFT_PPM : ppm < -MAX_DRIFT_PPM ? -MAX_DRIFT_PPM : ppm);
+    }
+
+    int64_t error = rtcUs - predicted;
+    if (currentSource != Source::Rtc || error > STEP_THRESHOLD_US || error < -STEP_THRESHOLD_US)
+    {
+        ESP_LOGW(TAG, "Stepping clock by %lld ms to the RTC", (long long)(error / 1000));
+        setBase(timerUs, rtcUs);
+        currentSource = Source::Rtc;
+    }
+    else
+    {
+        // Continue from the prediction so the new drift applies from here on
+        setBase(timerUs, predicted);
+    }
+    ESP_LOGD(TAG, "RTC edge: error %lld ms, drift %d ppm over %lld s", (long long)(error / 1000), (int)drift,
+             (long long)(span / 1000000));
+}
+
+int64_t nowUs()
+{
+    int64_t timerUs = esp_timer_get_time();
+    taskENTER_CRITICAL(&lock);
+    int64_t unixUs = unixAt(timerUs);
+    taskEXIT_CRITICAL(&lock);
+    return unixUs;
+}
+
+uint32_t now()
+{
+    return (uint32_t)(nowUs() / 1000000);
+}
+
+civil::DateTime dateTime(uint32_t timestamp)
+{
+    uint32_t day = timestamp / 86400;
+    civil::DateTime date;
+    taskENTER_CRITICAL(&lock);
+    bool cached = day == cachedDay;
+    if (cached)
+    {
+        date = cachedDate;
+    }
+    taskEXIT_CRITICAL(&lock);
+
+    if (!cached)
+    {
+        date = civil::fromUnix(timestamp);
+        taskENTER_CRITICAL(&lock);
+        cachedDay = day;
+        cachedDate = date;
+        taskEXIT_CRITICAL(&lock);
+    }
+    uint32_t seconds = timestamp % 86400;
+    date.hour = seconds / 3600;
+    date.minute = seconds / 60 % 60;
+    date.second = seconds % 60;
+    return date;
+}
+
+void observeScale(uint32_t scaleTime)
+{
+    uint32_t ours = now();
+    if (currentSource == Source::None && scaleTime >= VALID_AFTER)
+    {
+        // Nothing better to go on; the RTC keeps it across reboots
+        ESP_LOGW(TAG, "Setting clock from the scale");
+        setBase(esp_timer_get_time(), scaleTime * 1000000LL + 500000);
+        currentSource = Source::Scale;
+        writeRtc(scaleTime);
+        firstSyncTimerUs = -1;
+        edgePending = false;
+        ours = scaleTime;
+    }
+
+    // Only reported, not used for drift: the scale takes its clock from our
+    // upload responses, so the offset measures its crystal against ours
+
+    int32_t offset = (int32_t)(scaleTime - ours);
+    if (abs(offset - lastScaleOffset) > SCALE_OFFSET_REPORT_S)
+    {
+        ESP_LOGI(TAG, "Scale clock is %d s off", (int)offset);
+    }
+    lastScaleOffset = offset;
+}
+
+Source source()
+{
+    return currentSource;
+}
+
+int32_t driftPpm()
+{
+    return drift;
+}
+
+int32_t scaleOffset()
+{
+    return lastScaleOffset;
+}
+
+} // namespace wallclock
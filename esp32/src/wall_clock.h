@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+#include <civil_time.h>
+
+// Wall clock kept from esp_timer between occasional RTC reads.
+//
+// The RTC is read once in begin(). Every ten minutes update() polls it for a
+// few loop iterations until its seconds tick over, which times the edge to
+// a few milliseconds; now() never touches the I2C bus. The esp_timer rate
+// error against the RTC is estimated between edges at least an hour apart
+// and corrected for. When the RTC holds no valid time it is set from the
+// system clock, or else from the first plausible timestamp sent by the Aria.
+namespace wallclock
+{
+
+enum class Source : uint8_t
+{
+    None,   // not set, counts from boot
+    System, // no RTC, but the system clock was already set
+    Rtc,    // disciplined to the RTC
+    Scale   // set from an upload timestamp
+};
+
+void begin();
+
+// Call from loop(); does the periodic RTC read and drift update
+void update();
+
+uint32_t now();
+int64_t nowUs();
+
+// UTC date for a Unix time; cached per day so repeated lookups are O(1)
+civil::DateTime dateTime(uint32_t timestamp);
+
+// The Aria's own clock at upload time
+void observeScale(uint32_t scaleTime);
+
+Source source();
+int32_t driftPpm();    // esp_timer rate error against the RTC
+int32_t scaleOffset(); // scale clock minus ours at the last upload, seconds
+
+} // namespace wallclock
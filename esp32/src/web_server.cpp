@@ -1,52 +1,12 @@
 #include "web_server.h"
+#include "metrics.h"
+#include "trace.h"
+#include "wall_clock.h"
 #include <esp_log.h>
+#include <upload_key.h>
 
 static const char *TAG = "PORTAL";
-
-// CRC16-XMODEM lookup table
-const uint16_t CaptiveWebServer::crc16tab[256] = {
-    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
-    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
-    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
-    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
-    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
-    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
-    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
-    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
-    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
-    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
-    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
-    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
-    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
-    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
-    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
-    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
-    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
-    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
-    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
-    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
-    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
-    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
-    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
-    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
-    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
-    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
-    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
-    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
-    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
-    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
-    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0};
-
-// Helper function to pack integers in little-endian format
-template <typename T>
-void packLE(uint8_t *dest, T value)
-{
-    for (size_t i = 0; i < sizeof(T); i++)
-    {
-        dest[i] = (value >> (i * 8)) & 0xFF;
-    }
-}
+static const char FIRMWARE_PREFIX[] = "/scale/firmware/";
 
 const char CaptiveWebServer::responsePortal[] = R"===(
 <!DOCTYPE html><html><head><title>ESP32 CaptivePortal</title></head><body>
@@ -54,7 +14,7 @@ const char CaptiveWebServer::responsePortal[] = R"===(
 be redirected here.</p></body></html>
 )===";
 
-CaptiveWebServer::CaptiveWebServer() : server(80) {}
+CaptiveWebServer::CaptiveWebServer() : server(80), uploadParser(uploadBuffer, sizeof(uploadBuffer)) {}
 
 void CaptiveWebServer::begin()
 {
@@ -78,10 +38,30 @@ void CaptiveWebServer::setupHandlers()
               { handleScaleRegister(); });
     server.on("/scale/validate", [this]()
               { handleScaleValidate(); });
+    // The body handler makes WebServer hand us the raw body instead of
+    // url-decoding it into server.arg("plain")
     server.on("/scale/upload", HTTP_POST, [this]()
-              { handleScaleUpload(); });
+              { handleScaleUpload(); }, [this]()
+              { handleScaleUploadBody(); });
+    server.on("/metrics", HTTP_GET, [this]()
+              { handleMetrics(); });
+    server.on("/trace", HTTP_GET, [this]()
+              { handleTrace(); });
+    server.on("/rollups/daily", HTTP_GET, [this]()
+              { handleRollups(Rollups::DAILY); });
+    server.on("/rollups/weekly", HTTP_GET, [this]()
+              { handleRollups(Rollups::WEEKLY); });
+    server.on("/export/csv", HTTP_GET, [this]()
+              { handleExport(HistoryExport::CSV); });
+    server.on("/export/ndjson", HTTP_GET, [this]()
+              { handleExport(HistoryExport::NDJSON); });
+    server.on("/export/cbor", HTTP_GET, [this]()
+              { handleExport(HistoryExport::CBOR); });
     server.onNotFound([this]()
                       { handleNotFound(); });
+    // Firmware downloads may resume from an offset
+    static const char *headerKeys[] = {"Range"};
+    server.collectHeaders(headerKeys, 1);
 }
 
 void CaptiveWebServer::handleRoot()
@@ -114,217 +94,386 @@ void CaptiveWebServer::handleScaleValidate()
     server.send(200, "text/plain", "T");
 }
 
-// Helper function to convert RTC time to Unix timestamp
-uint32_t CaptiveWebServer::rtcToUnixTime()
+// Prometheus text format, streamed in chunks instead of built in a String
+void CaptiveWebServer::handleMetrics()
 {
-    if (!M5.Rtc.isEnabled())
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/plain; version=0.0.4", "");
+    metrics::writePrometheus([](void *context, const char *data, size_t length)
+                             { static_cast<WebServer *>(context)->sendContent(data, length); }, &server);
+    server.sendContent("");
+}
+
+// Formats and empties the trace buffer
+void CaptiveWebServer::handleTrace()
+{
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/plain", "");
+    trace::drain([](void *context, const char *data, size_t length)
+                 { static_cast<WebServer *>(context)->sendContent(data, length); }, &server);
+    server.sendContent("");
+}
+
+// Leaves `value` as is if the argument is absent; answers 400 and
+// returns false if it is not a number up to `maxValue`
+bool CaptiveWebServer::numericArg(const char *name, uint32_t maxValue, uint32_t &value)
+{
+    if (!server.hasArg(name))
     {
-        ESP_LOGW(TAG, "RTC not available or not running, using current time");
-        return time(nullptr);
+        return true;
     }
-
-    auto dt = M5.Rtc.getDateTime();
-    uint16_t year = dt.date.year;
-    uint8_t month = dt.date.month;
-    uint8_t day = dt.date.date;
-    uint8_t hour = dt.time.hours;
-    uint8_t minute = dt.time.minutes;
-    uint8_t second = dt.time.seconds;
-
-    // Convert to Unix timestamp
-    // Code from https://en.wikipedia.org/wiki/Unix_time#Encoding_time_as_a_number
-    if (month <= 2)
+    String text = server.arg(name);
+    char *end = nullptr;
+    unsigned long parsed = strtoul(text.c_str(), &end, 10);
+    if (text.length() == 0 || !isdigit((unsigned char)text[0]) || *end != '\0' || parsed > maxValue)
     {
-        year -= 1;
-        month += 12;
+        char message[48];
+        snprintf(message, sizeof(message), "%s must be 0-%lu\n", name, (unsigned long)maxValue);
+        server.send(400, "text/plain", message);
+        return false;
     }
-    uint32_t days = 365 * year + year / 4 - year / 100 + year / 400 + (153 * month - 457) / 5 + day - 1;
-    uint32_t seconds = days * 86400 + hour * 3600 + minute * 60 + second;
-    seconds -= static_cast<uint32_t>(719468) * 86400; // Adjust for Unix epoch (1970-01-01)
-
-    return seconds;
+    value = parsed;
+    return true;
 }
 
-void CaptiveWebServer::handleScaleUpload()
+// Per-user aggregates as JSON, all users or ?user=N, N being the position
+// in the user table plus one (0 for guests); served from RAM
+void CaptiveWebServer::handleRollups(Rollups::Period period)
 {
-    ESP_LOGV(TAG, "POST /scale/upload");
-    ESP_LOGV(TAG, "Method: %s", (server.method() == HTTP_POST) ? "POST" : "OTHER");
+    uint32_t user = UINT32_MAX;
+    if (!numericArg("user", 255, user))
+    {
+        return;
+    }
+    if (!bleService)
+    {
+        server.send(503, "text/plain", "not ready\n");
+        return;
+    }
 
-    String body = server.arg("plain");
-    ESP_LOGV(TAG, "Upload body length: %d", body.length());
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "application/json", "");
+    {
+        ChunkedText out([](void *context, const char *data, size_t length)
+                        { static_cast<WebServer *>(context)->sendContent(data, length); }, &server);
+        bleService->getRollups().writeJson(out, period, user == UINT32_MAX ? -1 : (int)user);
+    }
+    server.sendContent("");
+}
 
-    // Debug print body content in hex
-    ESP_LOGV(TAG, "Body hex dump:");
+// The whole history, or ?since=&until= (Unix seconds, inclusive) and
+// ?user=N, streamed in the requested format
+void CaptiveWebServer::handleExport(HistoryExport::Format format)
+{
+    MeasurementLog::Filter filter;
+    uint32_t user = UINT32_MAX;
+    if (!numericArg("since", UINT32_MAX, filter.since) || !numericArg("until", UINT32_MAX, filter.until) ||
+        !numericArg("user", 255, user))
+    {
+        return;
+    }
+    filter.user = user == UINT32_MAX ? -1 : (int)user;
+    if (!bleService)
+    {
+        server.send(503, "text/plain", "not ready\n");
+        return;
+    }
 
-    // Helper function to print a block of bytes in hex format
-    auto printHexBlock = [&](const char *label, size_t start, size_t length)
+    char disposition[48];
+    snprintf(disposition, sizeof(disposition), "attachment; filename=%s", HistoryExport::fileName(format));
+    server.sendHeader("Content-Disposition", disposition);
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, HistoryExport::contentType(format), "");
+    uint32_t written;
     {
-        char hex_buf[100]; // Max 32 bytes * 3 chars each (2 hex digits + space) + null
-        ESP_LOGV(TAG, "%s (%d bytes):", label, length);
+        ChunkedText out([](void *context, const char *data, size_t length)
+                        { static_cast<WebServer *>(context)->sendContent(data, length); }, &server);
+        written = HistoryExport::write(bleService->getHistory(), filter, format, out);
+    }
+    server.sendContent("");
+    ESP_LOGI(TAG, "Exported %u records as %s", (unsigned)written, HistoryExport::fileName(format));
+}
 
-        for (size_t i = 0; i < length; i++)
+void CaptiveWebServer::handleScaleUploadBody()
+{
+    HTTPRaw &raw = server.raw();
+    switch (raw.status)
+    {
+    case RAW_START:
+        uploadParser.reset();
+        uploadMeasurementsSeen = 0;
+        break;
+    case RAW_WRITE:
+        uploadParser.feed(raw.buf, raw.currentSize);
+        TRACE(UPLOAD_CHUNK, raw.currentSize, raw.totalSize);
+        // Trace records as soon as they are complete; side effects wait for the CRC
+        for (size_t count = uploadParser.completeMeasurements(); uploadMeasurementsSeen < count; uploadMeasurementsSeen++)
         {
-            snprintf(hex_buf + (i * 3), 4, "%02X ", (uint8_t)body[start + i]);
+            const uint8_t *record = uploadParser.data() + aria::REQUEST_PREAMBLE_SIZE + uploadMeasurementsSeen * aria::MEASUREMENT_SIZE;
+            TRACE_BYTES(UPLOAD_MEASUREMENT, uploadMeasurementsSeen, aria::readLE<uint32_t>(record + 8),
+                        record, aria::MEASUREMENT_SIZE);
         }
-        ESP_LOGV(TAG, "%s", hex_buf);
-    };
+        break;
+    case RAW_END:
+        ESP_LOGV(TAG, "Upload body length: %u", (unsigned)raw.totalSize);
+        break;
+    case RAW_ABORTED:
+        ESP_LOGW(TAG, "Upload aborted after %u bytes", (unsigned)raw.totalSize);
+        TRACE(UPLOAD_ABORTED, raw.totalSize, 0);
+        uploadParser.reset();
+        break;
+    }
+}
 
-    // Print header blocks
-    printHexBlock("Header", 0, 30);
-    printHexBlock("Measurement header", 30, 16);
+void CaptiveWebServer::handleScaleUpload()
+{
+    ESP_LOGV(TAG, "POST /scale/upload");
+
+    if (uploadParser.overflowed())
+    {
+        ESP_LOGW(TAG, "Upload body larger than %u bytes, ignoring the excess", (unsigned)sizeof(uploadBuffer));
+    }
 
-    // Print measurement data blocks
-    ESP_LOGV(TAG, "Measurement data:");
-    for (size_t i = 46; i < body.length(); i += 32)
+    int64_t parseStart = esp_timer_get_time();
+    aria::UploadRequest request;
+    aria::ParseStatus status = uploadParser.finish(request);
+    metrics::uploadParse.record(esp_timer_get_time() - parseStart);
+    // The view keeps pointing at the buffer; this only stops a later
+    // request without a raw body from seeing this one
+    uploadParser.reset();
+    if (status != aria::ParseStatus::Ok)
     {
-        int bytes_to_print = min(32, (int)(body.length() - i));
-        printHexBlock("", i, bytes_to_print);
+        ESP_LOGW(TAG, "Rejecting upload: %s", aria::parseStatusName(status));
+        metrics::uploadsRejected.add();
+        TRACE(UPLOAD_REJECTED, (uint32_t)status, 0);
+        server.send(400, "text/plain", "Invalid request");
+        return;
     }
 
-    // Parse protocol version 3 format
-    if (body.length() >= 46)
-    { // 30 bytes header + 16 bytes measurement header
-        uint32_t proto_ver, battery_pc;
-        uint8_t mac[6];
-        uint8_t authcode[16];
-        uint32_t fw_ver, unknown2, ts_scale, measurement_count;
-
-        // Copy first 30 bytes into variables
-        memcpy(&proto_ver, body.c_str(), 4);
-        memcpy(&battery_pc, body.c_str() + 4, 4);
-        memcpy(mac, body.c_str() + 8, 6);
-        memcpy(authcode, body.c_str() + 14, 16);
-
-        // Copy next 16 bytes into measurement header variables
-        memcpy(&fw_ver, body.c_str() + 30, 4);
-        memcpy(&unknown2, body.c_str() + 34, 4);
-        memcpy(&ts_scale, body.c_str() + 38, 4);
-        memcpy(&measurement_count, body.c_str() + 42, 4);
-
-        // Log parsed data
-        ESP_LOGV(TAG, "Protocol: v%d, Battery: %d%%, MAC: %02X:%02X:%02X:%02X:%02X:%02X, Auth: %02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X",
-                 proto_ver, battery_pc,
-                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
-                 authcode[0], authcode[1], authcode[2], authcode[3],
-                 authcode[4], authcode[5], authcode[6], authcode[7],
-                 authcode[8], authcode[9], authcode[10], authcode[11],
-                 authcode[12], authcode[13], authcode[14], authcode[15]);
-
-        ESP_LOGV(TAG, "Firmware: v%d, Unknown: %d, Timestamp: %d, Measurements: %d",
-                 fw_ver, unknown2, ts_scale, measurement_count);
-
-        // Parse measurement blocks
-        const char *curr_pos = body.c_str() + 46; // Start after headers
-        uint32_t id2, imp, weight, measure_ts, uid, fat1, covar, fat2;
-        for (uint32_t i = 0; i < measurement_count; i++)
+    const aria::UploadHeader &header = request.header();
+    uint32_t ts_scale = header.timestamp;
+    wallclock::observeScale(ts_scale);
+    // Battery, firmware and skew per MAC; after observeScale, which may set our clock
+    aria::ScaleState *scale = scales ? &scales->observe(header, wallclock::now()) : nullptr;
+
+    // Protocol, battery, MAC, auth code and measurement header, raw
+    TRACE_BYTES(UPLOAD_HEADER, header.protocolVersion, header.batteryPercent,
+                request.body(), aria::REQUEST_PREAMBLE_SIZE);
+
+    WeightHistoryRecord batch[aria::MAX_MEASUREMENTS];
+    uint64_t keys[aria::MAX_MEASUREMENTS];
+    size_t batchCount = 0;
+    size_t duplicates = 0;
+    for (const aria::Measurement &m : request.measurements())
+    {
+        // Re-sent after an upload the scale thinks failed: acknowledge, don't store again
+        uint64_t key = aria::uploadKey(header.mac, m);
+        if (dedupe && !dedupe->insert(key))
         {
-            if (curr_pos + 32 > body.c_str() + body.length())
-            {
-                ESP_LOGV(TAG, "Not enough bytes to decode measurement %d!", i + 1);
-                break;
-            }
+            ESP_LOGD(TAG, "Skipping re-sent measurement from %u", m.timestamp);
+            duplicates++;
+            continue;
+        }
 
-            memcpy(&id2, curr_pos, 4);
-            memcpy(&imp, curr_pos + 4, 4);
-            memcpy(&weight, curr_pos + 8, 4);
-            memcpy(&measure_ts, curr_pos + 12, 4);
-            memcpy(&uid, curr_pos + 16, 4);
-            memcpy(&fat1, curr_pos + 20, 4);
-            memcpy(&covar, curr_pos + 24, 4);
-            memcpy(&fat2, curr_pos + 28, 4);
-
-            ESP_LOGV(TAG, "Measurement %d:", i + 1);
-            ESP_LOGV(TAG, "  id2 = %d / imp = %d / weight = %.3f / ts_scale = %d",
-                     id2, imp, weight / 1000.0f, measure_ts);
-            ESP_LOGV(TAG, "  uid = %d / fat1 = %d / covar = %d / fat2 = %d",
-                     uid, fat1, covar, fat2);
-
-            // Broadcast measurement over BLE if service is available
-            if (bleService)
+        // Recentre the owner's tolerance window on new weigh-ins only, so an
+        // old measurement sent again can't pull it back; with a single user
+        // guests are theirs too
+        int user = users->find(m.user_id);
+        if (user < 0 && m.user_id == 0 && users->size() == 1)
+        {
+            user = 0;
+        }
+        if (user >= 0)
+        {
+            users->setLastWeight(user, m.weight_g);
+            if (scale)
             {
-                WeightHistoryRecord measurement = {
-                    .weight = weight / 1000.0f, // Convert mg to kg (weight is in milligrams)
-                    .impedance = imp,           // Impedance is already in ohms
-                    .bodyFat = fat1 / 1000.0f,  // Convert to percentage (fat1 is in 0.001%)
-                    .timestamp = measure_ts,    // Unix timestamp
-                    .isStabilized = true        // Saved measurements are always stable
-                };
-
-                ESP_LOGI(TAG, "Broadcasting measurement - Weight: %.3f kg, Body Fat: %.3f%%, Impedance: %u Ω, Time: %u",
-                         measurement.weight, measurement.bodyFat, measurement.impedance, measure_ts);
-
-                bleService->setAndNotifyMeasurement(measurement);
+                scales->bindUser(*scale, user);
             }
+        }
+        keys[batchCount] = key;
+        batch[batchCount++] = {
+            .weight = m.weight_g / 1000.0f, // Convert g to kg
+            .impedance = m.impedance,       // Impedance is already in ohms
+            .bodyFat = m.fat1 / 1000.0f,    // Convert to percentage (fat1 is in 0.001%)
+            .timestamp = m.timestamp,       // Unix timestamp
+            .user_id = (uint8_t)(user + 1), // Position in the user table, 0 for guests
+            .isStabilized = true            // Saved measurements are always stable
+        };
+        ESP_LOGI(TAG, "Received measurement - User: %u, Weight: %.3f kg, Body Fat: %.3f%%, Impedance: %u Ω, Time: %u",
+                 m.user_id, m.weight_g / 1000.0f, m.fat1 / 1000.0f, m.impedance, m.timestamp);
+    }
+
+    metrics::measurementsReceived.add(batchCount);
+    metrics::measurementsDuplicate.add(duplicates);
 
-            curr_pos += 32;
+    // Persist and broadcast the upload off the response path; the worker
+    // does the flash and BLE work while the Aria gets its answer
+    if (pipeline && batchCount > 0)
+    {
+        size_t queued = pipeline->submit(batch, keys, batchCount);
+        // Dropped ones must be accepted when the scale sends them again
+        for (size_t i = queued; dedupe && i < batchCount; i++)
+        {
+            dedupe->forget(keys[i]);
         }
+    }
+    else if (bleService && batchCount > 0)
+    {
+        bleService->setAndNotifyMeasurements(batch, batchCount);
+        if (dedupe)
+        {
+            dedupe->persist(keys, batchCount);
+        }
+    }
+
+    // Scales behind the configured firmware are told where to get it
+    char updateUrl[aria::MAX_UPDATE_URL_SIZE];
+    bool update = firmware && firmware->updateUrl(header.firmwareVersion, header.mac, updateUrl, sizeof(updateUrl));
+    if (update)
+    {
+        ESP_LOGI(TAG, "Offering %s to a scale on firmware %u", updateUrl, (unsigned)header.firmwareVersion);
+        metrics::firmwareOffers.add();
+    }
+
+    // Patch this scale's previous response, or copy the compiled user table
+    int64_t buildStart = esp_timer_get_time();
+    uint32_t curr_time = wallclock::now(); // Our clock, not the request timestamp
+    size_t responseLength;
+    bool cached;
+    const uint8_t *response = responses->get(header.mac, curr_time, ts_scale, responseLength, cached,
+                                             update ? updateUrl : nullptr);
+    metrics::responseBuild.record(esp_timer_get_time() - buildStart);
+    (cached ? metrics::responseCacheHits : metrics::responseCacheMisses).add();
+    TRACE(UPLOAD_RESPONSE, users->size(), aria::readLE<uint16_t>(response + responseLength - aria::RESPONSE_FOOTER_SIZE));
+    metrics::uploads.add();
+
+    // Send the cached bytes as is, Content-Length is required
+    server.send_P(200, "application/octet-stream", (const char *)response, responseLength);
+}
 
-        // Generate response
-        uint8_t response[104];                 // 100 bytes data + 2 bytes CRC + 2 bytes size
-        memset(response, 0, sizeof(response)); // Zero out the buffer
-
-        // Fill in the first 100 bytes according to the format
-        uint32_t curr_time = rtcToUnixTime(); // Use RTC time instead of request timestamp
-        packLE(response, curr_time);
-
-        response[4] = 0x00; // units (KG, 0x02) (lbs, 0x00)
-        response[5] = 0x32; // status (configured)
-        response[6] = 0x01; // unknown
-        // user count = 1
-        packLE(response + 7, (uint32_t)1);
-
-        // userid = 1
-        packLE(response + 11, (uint32_t)0x1234);
-        // 16 bytes padding (zeroed by memset)
-        // 20 bytes name (zeroed by memset)
-        memcpy(response + 31, userName, strlen(userName) + 1);
-
-        // Set min/max tolerance to be current weight +/- 4kg
-        uint32_t min_tol = weight - 4000; // 4kg = 4000g
-        packLE(response + 51, min_tol);
-        uint32_t max_tol = weight + 4000; // 4kg = 4000g
-        packLE(response + 55, max_tol);
-
-        // age (4 bytes), gender (1 byte), height (4 bytes)
-        packLE(response + 59, (uint32_t)userAge);    // age is 4 bytes
-        response[63] = userGender;                   // gender is 1 byte at offset 63
-        packLE(response + 64, (uint32_t)userHeight); // height is 4 bytes at offset 64
-
-        packLE(response + 68, (uint32_t)0);     // some weight
-        packLE(response + 72, (uint32_t)0);     // body fat
-        packLE(response + 76, (uint32_t)0);     // covariance
-        packLE(response + 80, (uint32_t)0);     // some other weight
-        packLE(response + 84, ts_scale - 1000); // timestamp moved to offset 84
-
-        // Rest of the fields are 0 (already set by memset)
-        // Last 3 uint32_t values, second one is 3
-        packLE(response + 88, (uint32_t)0); // unknown
-        packLE(response + 92, (uint32_t)3); // always 3 (now 4 bytes)
-        packLE(response + 96, (uint32_t)0); // unknown
-
-        // Calculate CRC16-XMODEM
-        uint16_t crc = 0;
-        for (int i = 0; i < 100; i++)
+// "bytes=first-last", "bytes=first-" or "bytes=-suffix". 1 for a range
+// within the image, -1 if it starts past the end, 0 to send everything
+// (other units, several ranges or nonsense, which HTTP allows ignoring).
+static int parseRange(const char *text, uint32_t size, uint32_t &first, uint32_t &last)
+{
+    if (strncmp(text, "bytes=", 6) != 0 || strchr(text, ','))
+    {
+        return 0;
+    }
+    const char *p = text + 6;
+    char *end;
+    if (*p == '-')
+    {
+        unsigned long suffix = strtoul(p + 1, &end, 10);
+        if (end == p + 1 || *end != '\0')
         {
-            crc = (crc << 8) ^ crc16tab[((crc >> 8) ^ response[i]) & 0xFF];
+            return 0;
         }
-        packLE(response + 100, crc);
+        if (suffix == 0)
+        {
+            return -1;
+        }
+        first = suffix < size ? size - suffix : 0;
+        last = size - 1;
+        return 1;
+    }
+    unsigned long from = strtoul(p, &end, 10);
+    if (end == p || *end != '-')
+    {
+        return 0;
+    }
+    p = end + 1;
+    unsigned long to = size - 1;
+    if (*p != '\0')
+    {
+        to = strtoul(p, &end, 10);
+        if (end == p || *end != '\0' || to < from)
+        {
+            return 0;
+        }
+    }
+    if (from >= size)
+    {
+        return -1;
+    }
+    first = from;
+    last = to < size ? to : size - 1;
+    return 1;
+}
 
-        // Set message size
-        uint16_t msg_size = 0x19 + (1 * 0x4d);
-        packLE(response + 102, msg_size);
+// GET /scale/firmware/<version>?serialNumber=..., straight from flash in
+// CHUNK_SIZE reads, with Content-Length and single byte ranges
+void CaptiveWebServer::handleScaleFirmware()
+{
+    String uri = server.uri();
+    const char *versionText = uri.c_str() + sizeof(FIRMWARE_PREFIX) - 1;
+    char *end;
+    unsigned long version = strtoul(versionText, &end, 10);
+    const FirmwareStore::Image *image = firmware && end != versionText && *end == '\0' ? firmware->find(version) : nullptr;
+    if (!image || image->size == 0)
+    {
+        ESP_LOGW(TAG, "GET %s: no such firmware", uri.c_str());
+        server.send(404, "text/plain", "Unknown firmware");
+        return;
+    }
 
-        // Send response
-        server.send(200, "application/octet-stream", String((const char *)response, sizeof(response)));
+    uint32_t first = 0;
+    uint32_t last = image->size - 1;
+    char contentRange[48];
+    int range = server.hasHeader("Range") ? parseRange(server.header("Range").c_str(), image->size, first, last) : 0;
+    if (range < 0)
+    {
+        snprintf(contentRange, sizeof(contentRange), "bytes */%u", (unsigned)image->size);
+        server.sendHeader("Content-Range", contentRange);
+        server.send(416, "text/plain", "");
         return;
     }
 
-    // If we get here, something went wrong
-    server.send(400, "text/plain", "Invalid request");
+    File file = firmware->open(*image);
+    if (!file || !file.seek(first))
+    {
+        ESP_LOGE(TAG, "Failed to read firmware %u", (unsigned)image->version);
+        server.send(500, "text/plain", "Firmware unreadable");
+        return;
+    }
+
+    server.sendHeader("Accept-Ranges", "bytes");
+    if (range > 0)
+    {
+        snprintf(contentRange, sizeof(contentRange), "bytes %u-%u/%u", (unsigned)first, (unsigned)last,
+                 (unsigned)image->size);
+        server.sendHeader("Content-Range", contentRange);
+    }
+    server.setContentLength(last - first + 1);
+    server.send(range > 0 ? 206 : 200, "application/octet-stream", "");
+
+    // Word aligned, so the flash driver can DMA straight into it
+    alignas(4) static uint8_t chunk[FirmwareStore::CHUNK_SIZE];
+    uint32_t remaining = last - first + 1;
+    while (remaining > 0)
+    {
+        size_t length = file.read(chunk, min((uint32_t)sizeof(chunk), remaining));
+        if (length == 0)
+        {
+            break;
+        }
+        server.sendContent((const char *)chunk, length);
+        remaining -= length;
+        metrics::firmwareBytesSent.add(length);
+    }
+    file.close();
+    ESP_LOGI(TAG, "Sent firmware %u bytes %u-%u%s", (unsigned)image->version, (unsigned)first,
+             (unsigned)(last - remaining), remaining ? ", cut short" : "");
 }
 
 void CaptiveWebServer::handleNotFound()
 {
+    if (server.uri().startsWith(FIRMWARE_PREFIX))
+    {
+        handleScaleFirmware();
+        return;
+    }
     ESP_LOGV(TAG, "GET %s (redirecting to portal)", server.uri().c_str());
     server.sendHeader("Location", "/portal");
     server.send(302, "text/plain", "redirect to captive portal");
@@ -4,6 +4,13 @@
 #include <WiFi.h>
 #include <M5Unified.h>
 #include "scale_ble_service.h"
+#include "measurement_pipeline.h"
+#include "upload_dedupe.h"
+#include "scale_registry.h"
+#include "history_export.h"
+#include "firmware_store.h"
+#include <aria_protocol.h>
+#include <aria_response.h>
 
 class CaptiveWebServer
 {
@@ -12,30 +19,45 @@ public:
     void begin();
     void handleClient();
     void setScaleBLEService(ScaleBLEService *service) { bleService = service; }
-    void setUserParams(const char *name, uint8_t gender, int age, int height)
+    void setMeasurementPipeline(MeasurementPipeline *measurementPipeline) { pipeline = measurementPipeline; }
+    void setUploadDedupe(UploadDedupe *uploadDedupe) { dedupe = uploadDedupe; }
+    void setScaleRegistry(ScaleRegistry *registry) { scales = registry; }
+    void setFirmwareStore(FirmwareStore *store) { firmware = store; }
+    // The table must be compiled, both must outlive the server
+    void setUserTable(aria::UserTable *table, aria::ResponseCache *cache)
     {
-        userName = name;
-        userGender = gender;
-        userAge = age;
-        userHeight = height;
+        users = table;
+        responses = cache;
     }
 
 private:
     WebServer server;
     ScaleBLEService *bleService = nullptr;
+    MeasurementPipeline *pipeline = nullptr;
+    UploadDedupe *dedupe = nullptr;
+    ScaleRegistry *scales = nullptr;
+    FirmwareStore *firmware = nullptr;
     static const char responsePortal[];
-    static const uint16_t crc16tab[256];
-    const char *userName;
-    uint8_t userGender;
-    int userAge;
-    int userHeight;
+    aria::UserTable *users = nullptr;
+    aria::ResponseCache *responses = nullptr;
+
+    // Upload bodies are streamed into this buffer instead of server.arg("plain")
+    uint8_t uploadBuffer[aria::MAX_REQUEST_SIZE];
+    aria::UploadStreamParser uploadParser;
+    size_t uploadMeasurementsSeen = 0;
 
     // Request handlers
     void handleRoot();
     void handleScaleRegister();
     void handleScaleValidate();
     void handleScaleUpload();
+    void handleScaleUploadBody();
+    void handleScaleFirmware();
+    void handleMetrics();
+    void handleTrace();
+    void handleRollups(Rollups::Period period);
+    void handleExport(HistoryExport::Format format);
+    bool numericArg(const char *name, uint32_t maxValue, uint32_t &value);
     void handleNotFound();
     void setupHandlers();
-    uint32_t rtcToUnixTime();
 };
\ No newline at end of file
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Throughput benchmark: builds ingest and loadgen, then drives a fresh
+# server through a day's check-ins, a retry storm and a write-heavy run.
+#
+#   ./bench.sh [seconds per run] [loadgen concurrency]
+set -e
+
+DURATION=${1:-10}
+CONCURRENCY=${2:-32}
+PORT=${PORT:-18000}
+HERE=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'kill $SERVER 2>/dev/null || true; rm -rf "$WORK"' EXIT
+
+g++ -std=c++17 -O2 -pthread -I"$HERE/../esp32/lib/helvetic/src" "$HERE"/*.cpp -o "$WORK/ingest"
+g++ -std=c++17 -O2 -pthread -I"$HERE/../esp32/lib/helvetic/src" "$HERE/../loadgen/loadgen.cpp" -o "$WORK/loadgen"
+
+cat > "$WORK/config.txt" <<EOF
+user1=1001,ALICE,1990-04-02,1650,f
+user2=1002,BOB,1985-11-30,1800,m
+EOF
+
+# run <title> <ingest options> -- <loadgen options>
+run()
+{
+    title=$1
+    shift
+    options=
+    while [ "$1" != "--" ]; do
+        options="$options $1"
+        shift
+    done
+    shift
+    rm -f "$WORK/measurements.bin"
+    "$WORK/ingest" -p "$PORT" -c "$WORK/config.txt" -s "$WORK/measurements.bin" $options 2> "$WORK/ingest.log" &
+    SERVER=$!
+    sleep 0.5
+    echo "== $title"
+    "$WORK/loadgen" -d "$DURATION" -u 1001,1002,0 "$@" "http://127.0.0.1:$PORT/scale/upload" 2>/dev/null | grep -E '^(requests|latency|error)'
+    kill $SERVER
+    wait $SERVER 2>/dev/null || true
+    tail -n 1 "$WORK/ingest.log"
+}
+
+# 5000 scales checking in over a day is well under one upload per second;
+# this offers 200/s with every upload carrying a backlog of measurements
+run "daily check-ins, 5000 scales at 200 uploads/s" -- -r 200 -s 5000 -m 1-17 -c "$CONCURRENCY"
+
+# Every scale re-sending the same bodies as fast as the server answers
+run "retry storm, closed loop" -- -r 0 -s 5000 -c "$CONCURRENCY"
+
+# No dedupe, so every measurement is appended
+run "append every measurement, closed loop" -n -- -r 0 -s 5000 -c "$CONCURRENCY"
+
+# fdatasync before every answer instead of once a second
+run "fdatasync per upload, closed loop" -n -y 0 -- -r 0 -s 5000 -c "$CONCURRENCY"
@@ -0,0 +1,183 @@
+#include "households.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint64_t Households::macKey(const uint8_t *mac)
+{
+    uint64_t key = 0;
+    for (size_t i = 0; i < aria::MAC_SIZE; i++)
+    {
+        key = key << 8 | mac[i];
+    }
+    return key;
+}
+
+// 12 hex digits, colons or dashes between the bytes allowed
+bool Households::parseMac(const char *text, uint64_t &key)
+{
+    key = 0;
+    size_t digits = 0;
+    for (const char *p = text; *p; p++)
+    {
+        if (*p == ':' || *p == '-')
+        {
+            continue;
+        }
+        if (!isxdigit((unsigned char)*p) || digits == 2 * aria::MAC_SIZE)
+        {
+            return false;
+        }
+        char digit[2] = {*p, 0};
+        key = key << 4 | strtoul(digit, nullptr, 16);
+        digits++;
+    }
+    return digits == 2 * aria::MAC_SIZE;
+}
+
+bool Households::load(const char *path)
+{
+    // The firmware's defaults for a config without userN= lines
+    const char *userName = "You";
+    char userNameBuffer[aria::USER_NAME_SIZE + 1] = {};
+    uint8_t gender = 2;
+    int age = 18;
+    int height = 1800;
+
+    bool ok = true;
+    FILE *file = path ? fopen(path, "r") : nullptr;
+    if (path && !file)
+    {
+        fprintf(stderr, "Cannot read %s, using the default user\n", path);
+        ok = false;
+    }
+
+    Household *household = &mDefault;
+    char line[128];
+    unsigned lineNumber = 0;
+    while (file && fgets(line, sizeof(line), file))
+    {
+        lineNumber++;
+        line[strcspn(line, "\r\n")] = 0;
+        char *key = strtok(line, "=");
+        char *value = strtok(nullptr, "=");
+        if (!key || !value)
+        {
+            continue;
+        }
+        if (strcmp(key, "scale") == 0)
+        {
+            uint64_t mac;
+            if (!parseMac(value, mac))
+            {
+                fprintf(stderr, "%s:%u: bad scale MAC %s\n", path, lineNumber, value);
+                ok = false;
+                household = nullptr; // its users would end up somewhere else
+                continue;
+            }
+            std::unique_ptr<Household> &slot = mScales[mac];
+            if (slot)
+            {
+                fprintf(stderr, "%s:%u: scale %s listed twice\n", path, lineNumber, value);
+                ok = false;
+            }
+            slot.reset(new Household);
+            household = slot.get();
+        }
+        else if (strncmp(key, "user", 4) == 0 && isdigit((unsigned char)key[4]))
+        {
+            // user1=id,name,birthdate,height_mm,gender[,tolerance_g]
+            aria::UserProfile profile;
+            if (!household)
+            {
+                continue;
+            }
+            if (!aria::parseUserProfile(value, profile))
+            {
+                fprintf(stderr, "%s:%u: ignoring malformed %s\n", path, lineNumber, key);
+                ok = false;
+            }
+            else if (!household->users.add(profile))
+            {
+                fprintf(stderr, "%s:%u: ignoring %s: duplicate id or more than %d users\n", path, lineNumber, key,
+                        (int)aria::MAX_USERS);
+                ok = false;
+            }
+        }
+        else if (strcmp(key, "userName") == 0)
+        {
+            size_t length = strnlen(value, aria::USER_NAME_SIZE);
+            memcpy(userNameBuffer, value, length);
+            userNameBuffer[length] = 0;
+            userName = userNameBuffer;
+        }
+        else if (strcmp(key, "gender") == 0)
+        {
+            gender = (tolower(value[0]) == 'f') ? 0 : 2;
+        }
+        else if (strcmp(key, "age") == 0)
+        {
+            age = atoi(value);
+        }
+        else if (strcmp(key, "height") == 0)
+        {
+            height = atoi(value);
+        }
+    }
+    if (file)
+    {
+        fclose(file);
+    }
+
+    // Without userN= lines the old single user settings still apply
+    if (mDefault.users.size() == 0)
+    {
+        aria::UserProfile profile = {};
+        profile.id = 0x1234;
+        size_t length = strnlen(userName, aria::USER_NAME_SIZE);
+        memcpy(profile.name, userName, length);
+        profile.name[length] = 0;
+        profile.age = age;
+        profile.heightMm = height;
+        profile.gender = gender;
+        profile.toleranceG = aria::DEFAULT_TOLERANCE_G;
+        mDefault.users.add(profile);
+    }
+    mDefault.users.compile();
+    mShared.users = mDefault.users;
+    for (auto &entry : mScales)
+    {
+        entry.second->users.compile();
+    }
+    return ok;
+}
+
+Household &Households::forScale(const uint8_t *mac)
+{
+    // Configured scales never change once loaded, so they need no lock
+    uint64_t key = macKey(mac);
+    auto it = mScales.find(key);
+    if (it != mScales.end())
+    {
+        return *it->second;
+    }
+
+    Shard &shard = mShards[dedupeHash(0, key) % SHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    std::unique_ptr<Household> &slot = shard.scales[key];
+    if (!slot)
+    {
+        if (mSeen.load(std::memory_order_relaxed) >= MAX_SCALES)
+        {
+            shard.scales.erase(key);
+            return mShared;
+        }
+        mSeen.fetch_add(1, std::memory_order_relaxed);
+        // The template is only read once loaded
+        slot.reset(new Household);
+        slot->users = mDefault.users;
+    }
+    return *slot;
+}
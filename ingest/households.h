@@ -0,0 +1,119 @@
+#pragma once
+
+#include <aria_response.h>
+#include <dedupe_set.h>
+#include <upload_key.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+
+// The users each scale is answered with.
+//
+// The config file is the firmware's config.txt: userN= lines, and the
+// legacy userName/age/height/gender keys when there are none, make up the
+// default household. A scale=AABBCCDDEEFF line starts a household of its
+// own for that MAC; the userN= lines after it belong to that scale until
+// the next scale= line. Other keys are ignored, so a firmware config file
+// works as is.
+//
+// Each household compiles its UserTable once and keeps a ResponseCache,
+// exactly as the firmware does, so the envelopes are the same bytes. A
+// scale not in the config gets a copy of the default household the first
+// time it is seen, so its tolerance windows and cached response are its
+// own, as they would be on its own gateway. Households are locked one by
+// one; scales never wait for each other.
+struct Household
+{
+    aria::UserTable users;
+    aria::ResponseCache responses{users};
+    std::mutex lock;
+
+    // Recentres the owner's tolerance window; with a single user guests are
+    // theirs too. Call with the lock held.
+    void observe(const aria::Measurement &measurement)
+    {
+        int user = users.find(measurement.user_id);
+        if (user < 0 && measurement.user_id == 0 && users.size() == 1)
+        {
+            user = 0;
+        }
+        if (user >= 0)
+        {
+            users.setLastWeight(user, measurement.weight_g);
+        }
+    }
+};
+
+class Households
+{
+public:
+    bool load(const char *path);
+
+    // Past this many unconfigured scales the rest share one household
+    static const size_t MAX_SCALES = 65536; // about 4.5 KiB each
+    static const size_t SHARDS = 64;
+
+    // The scale's own household, created from the default one on first
+    // sight. Stays valid for the life of the server.
+    Household &forScale(const uint8_t *mac);
+
+    size_t scaleCount() const { return mScales.size(); } // configured ones
+    size_t seenCount() const { return mSeen.load(std::memory_order_relaxed); }
+
+private:
+    struct Shard
+    {
+        std::mutex lock;
+        std::unordered_map<uint64_t, std::unique_ptr<Household>> scales;
+    };
+
+    static uint64_t macKey(const uint8_t *mac);
+    static bool parseMac(const char *text, uint64_t &key);
+
+    Household mDefault; // the template, never answered with
+    Household mShared;  // for the scales past MAX_SCALES
+    std::unordered_map<uint64_t, std::unique_ptr<Household>> mScales; // from the config, read-only
+    Shard mShards[SHARDS];
+    std::atomic<size_t> mSeen{0};
+};
+
+// Measurements already stored, so a scale re-sending an upload it thinks
+// failed is acknowledged without storing it twice. Keys are
+// aria::uploadKey(), as on the firmware, remembered in SHARDS independently
+// locked sets.
+class UploadDedupe
+{
+public:
+    static const size_t SHARDS = 64;
+    static const size_t SHARD_CAPACITY = 4096; // 256 Ki keys in all, about 6 MiB
+
+    // False if the key was already there
+    bool insert(uint64_t key)
+    {
+        Shard &shard = mShards[key >> 58];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        return shard.set.insert(key);
+    }
+
+    void forget(uint64_t key)
+    {
+        Shard &shard = mShards[key >> 58];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        shard.set.erase(key);
+    }
+
+private:
+    using Set = DedupeSet<SHARD_CAPACITY>;
+    static_assert(SHARDS == 64, "the shard is the top six bits of the key");
+
+    struct Shard
+    {
+        std::mutex lock;
+        Set set;
+    };
+
+    Shard mShards[SHARDS];
+};
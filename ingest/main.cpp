@@ -0,0 +1,278 @@
+// Aria ingest server for Linux.
+//
+// Serves /scale/register, /scale/validate and /scale/upload with the same
+// bytes the firmware's CaptiveWebServer answers with, for as many scales as
+// one machine can take: N epoll workers, each with its own listening
+// socket, a fixed connection arena and the compiled response envelopes.
+// Measurements are deduplicated against the ones already stored and
+// appended to a file (see storage.h). At start the file is replayed, which
+// recentres every user's tolerance window on their last weigh-in and
+// refills the dedupe sets.
+
+#include "households.h"
+#include "server.h"
+#include "storage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <getopt.h>
+#include <memory>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+struct Options
+{
+    std::string address = "::";
+    uint16_t port = 8000;
+    unsigned threads = 0; // 0 = one per CPU
+    std::string config;
+    std::string storage = "file:measurements.bin";
+    unsigned syncMs = 1000;
+    size_t maxConnections = 1024; // per worker
+    unsigned timeoutMs = 10000;
+    bool dedupe = true;
+    unsigned statsInterval = 0; // seconds, 0 = only at exit
+    std::string dump;
+};
+
+void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "       %s -D FILE\n"
+            "\n"
+            "  -l, --listen ADDRESS     address to listen on (default ::, IPv4 too)\n"
+            "  -p, --port PORT          TCP port (default 8000)\n"
+            "  -t, --threads N          worker threads (default: one per CPU)\n"
+            "  -c, --config FILE        users, in the firmware's config.txt format\n"
+            "  -s, --storage SPEC       file:PATH, PATH or none (default file:measurements.bin)\n"
+            "  -y, --sync-ms MS         fdatasync interval, 0 = before every answer (default 1000)\n"
+            "  -m, --max-connections N  connection arena size per worker (default 1024)\n"
+            "  -T, --timeout MS         close connections idle this long (default 10000)\n"
+            "  -n, --no-dedupe          store re-sent measurements again\n"
+            "  -i, --interval S         print counters every S seconds\n"
+            "  -D, --dump FILE          print a measurement file as NDJSON and exit\n"
+            "  -h, --help\n",
+            argv0, argv0);
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+    static const option longOptions[] = {
+        {"listen", required_argument, nullptr, 'l'},
+        {"port", required_argument, nullptr, 'p'},
+        {"threads", required_argument, nullptr, 't'},
+        {"config", required_argument, nullptr, 'c'},
+        {"storage", required_argument, nullptr, 's'},
+        {"sync-ms", required_argument, nullptr, 'y'},
+        {"max-connections", required_argument, nullptr, 'm'},
+        {"timeout", required_argument, nullptr, 'T'},
+        {"no-dedupe", no_argument, nullptr, 'n'},
+        {"interval", required_argument, nullptr, 'i'},
+        {"dump", required_argument, nullptr, 'D'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:p:t:c:s:y:m:T:ni:D:h", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'l':
+            options.address = optarg;
+            break;
+        case 'p':
+            options.port = (uint16_t)atoi(optarg);
+            break;
+        case 't':
+            options.threads = (unsigned)atoi(optarg);
+            break;
+        case 'c':
+            options.config = optarg;
+            break;
+        case 's':
+            options.storage = optarg;
+            break;
+        case 'y':
+            options.syncMs = (unsigned)atoi(optarg);
+            break;
+        case 'm':
+            options.maxConnections = (size_t)atol(optarg);
+            if (options.maxConnections == 0 || options.maxConnections >= UINT32_MAX)
+            {
+                fprintf(stderr, "--max-connections must be at least 1\n");
+                return false;
+            }
+            break;
+        case 'T':
+            options.timeoutMs = (unsigned)atoi(optarg);
+            break;
+        case 'n':
+            options.dedupe = false;
+            break;
+        case 'i':
+            options.statsInterval = (unsigned)atoi(optarg);
+            break;
+        case 'D':
+            options.dump = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return false;
+        }
+    }
+    if (optind != argc)
+    {
+        usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+int dump(const char *path)
+{
+    if (access(path, R_OK) != 0)
+    {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 1;
+    }
+    ingest::AppendFileStorage storage(path, 0);
+    if (!storage.open())
+    {
+        return 1;
+    }
+    long count = storage.replay([](const ingest::StoredRecord &record)
+                                {
+        const uint8_t *mac = record.mac();
+        aria::Measurement m = record.measurement();
+        printf("{\"received\":%u,\"mac\":\"%02X%02X%02X%02X%02X%02X\",\"battery\":%u,\"firmware\":%u,"
+               "\"timestamp\":%u,\"user_id\":%u,\"weight_g\":%u,\"fat_millipercent\":%u,\"impedance_ohm\":%u}\n",
+               (unsigned)record.received(), mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+               (unsigned)record.battery(), (unsigned)record.firmware(), (unsigned)m.timestamp,
+               (unsigned)m.user_id, (unsigned)m.weight_g, (unsigned)m.fat1, (unsigned)m.impedance); });
+    return count < 0 ? 1 : 0;
+}
+
+void printStats(const IngestStats &stats, double seconds)
+{
+    uint64_t uploads = stats.uploads.load();
+    fprintf(stderr,
+            "%8.0f s  %llu uploads (%.1f/s)  %llu stored  %llu duplicate  %llu rejected  %llu storage errors"
+            "  %llu refused  %llu timeouts\n",
+            seconds, (unsigned long long)uploads, seconds > 0 ? uploads / seconds : 0.0,
+            (unsigned long long)stats.measurementsStored.load(), (unsigned long long)stats.measurementsDuplicate.load(),
+            (unsigned long long)stats.uploadsRejected.load(), (unsigned long long)stats.storageErrors.load(),
+            (unsigned long long)stats.refused.load(), (unsigned long long)stats.timeouts.load());
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 2;
+    }
+    if (!options.dump.empty())
+    {
+        return dump(options.dump.c_str());
+    }
+
+    // Configured households are read-only once loaded; only their caches change
+    Households households;
+    if (!households.load(options.config.empty() ? nullptr : options.config.c_str()))
+    {
+        return 1;
+    }
+
+    std::unique_ptr<ingest::Storage> storage(ingest::Storage::create(options.storage.c_str(), options.syncMs));
+    if (!storage)
+    {
+        fprintf(stderr, "Unknown storage %s\n", options.storage.c_str());
+        return 2;
+    }
+    if (!storage->open())
+    {
+        return 1;
+    }
+
+    std::unique_ptr<UploadDedupe> dedupe(options.dedupe ? new UploadDedupe() : nullptr);
+    time_t replayStart = time(nullptr);
+    long replayed = storage->replay([&](const ingest::StoredRecord &record)
+                                    {
+        aria::Measurement measurement = record.measurement();
+        households.forScale(record.mac()).observe(measurement);
+        if (dedupe)
+        {
+            dedupe->insert(aria::uploadKey(record.mac(), measurement));
+        } });
+    if (replayed < 0)
+    {
+        return 1;
+    }
+    fprintf(stderr, "%zu configured scales, %zu more seen, %ld stored measurements replayed in %ld s\n",
+            households.scaleCount(), households.seenCount(), replayed, (long)(time(nullptr) - replayStart));
+
+    // Signals are taken by sigtimedwait() below, never by a worker
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    IngestStats stats;
+    std::atomic<bool> stopping{false};
+    IngestContext context = {&households, dedupe.get(), storage.get(), &stats, &stopping};
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::unique_ptr<IngestWorker>> workers;
+    for (unsigned i = 0; i < threads; i++)
+    {
+        workers.emplace_back(new IngestWorker(context, options.maxConnections, options.timeoutMs));
+        if (!workers.back()->listen(options.address.c_str(), options.port))
+        {
+            return 1;
+        }
+    }
+    std::vector<std::thread> running;
+    for (auto &worker : workers)
+    {
+        running.emplace_back(&IngestWorker::run, worker.get());
+    }
+    fprintf(stderr, "Listening on [%s]:%u with %u workers\n", options.address.c_str(), (unsigned)options.port,
+            threads);
+
+    time_t start = time(nullptr);
+    for (;;)
+    {
+        timespec wait = {options.statsInterval ? (time_t)options.statsInterval : 3600, 0};
+        int signal = sigtimedwait(&signals, nullptr, &wait);
+        if (signal == SIGINT || signal == SIGTERM)
+        {
+            break;
+        }
+        if (options.statsInterval)
+        {
+            printStats(stats, difftime(time(nullptr), start));
+        }
+    }
+
+    stopping = true;
+    for (std::thread &thread : running)
+    {
+        thread.join();
+    }
+    storage->close();
+    printStats(stats, difftime(time(nullptr), start));
+    return 0;
+}
@@ -0,0 +1,459 @@
+#include "server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Byte for byte what the firmware's WebServer sends for these
+#define HTTP_HEAD(status, type, length) "HTTP/1.1 " status "\r\nContent-Type: " type "\r\nContent-Length: " #length "\r\nConnection: close\r\n\r\n"
+
+static const char REGISTER_RESPONSE[] = HTTP_HEAD("200 OK", "text/plain", 0);
+static const char VALIDATE_RESPONSE[] = HTTP_HEAD("200 OK", "text/plain", 1) "T";
+static const char INVALID_RESPONSE[] = HTTP_HEAD("400 Bad Request", "text/plain", 15) "Invalid request";
+static const char NOT_FOUND_RESPONSE[] = HTTP_HEAD("404 Not Found", "text/plain", 9) "Not found";
+static const char TOO_LARGE_RESPONSE[] = HTTP_HEAD("413 Payload Too Large", "text/plain", 17) "Payload too large";
+static const char STORAGE_RESPONSE[] = HTTP_HEAD("500 Internal Server Error", "text/plain", 13) "Storage error";
+static const char TOO_LONG_RESPONSE[] = HTTP_HEAD("500 Internal Server Error", "text/plain", 17) "Response too long";
+
+static const uint32_t LISTEN_INDEX = UINT32_MAX; // epoll data of the listening socket
+static const int MAX_EVENTS = 256;
+static const int SWEEP_INTERVAL_MS = 1000;
+
+static const struct
+{
+    const char *name;
+    std::atomic<uint64_t> IngestStats::*counter;
+} COUNTERS[] = {
+    {"helvetic_ingest_connections_total", &IngestStats::connections},
+    {"helvetic_ingest_connections_refused_total", &IngestStats::refused},
+    {"helvetic_ingest_timeouts_total", &IngestStats::timeouts},
+    {"helvetic_ingest_requests_total", &IngestStats::requests},
+    {"helvetic_ingest_bad_requests_total", &IngestStats::badRequests},
+    {"helvetic_uploads_total", &IngestStats::uploads},
+    {"helvetic_uploads_rejected_total", &IngestStats::uploadsRejected},
+    {"helvetic_ingest_storage_errors_total", &IngestStats::storageErrors},
+    {"helvetic_measurements_stored_total", &IngestStats::measurementsStored},
+    {"helvetic_measurements_duplicate_total", &IngestStats::measurementsDuplicate},
+    {"helvetic_response_cache_hits_total", &IngestStats::responseCacheHits},
+    {"helvetic_response_cache_misses_total", &IngestStats::responseCacheMisses},
+};
+
+static uint64_t monotonicMs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+IngestWorker::~IngestWorker()
+{
+    for (Connection &connection : mConnections)
+    {
+        if (connection.state != FREE)
+        {
+            close(connection.fd);
+        }
+    }
+    if (mListen >= 0)
+    {
+        close(mListen);
+    }
+    if (mEpoll >= 0)
+    {
+        close(mEpoll);
+    }
+}
+
+bool IngestWorker::listen(const char *address, uint16_t port)
+{
+    sockaddr_in6 addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(port);
+    in_addr v4;
+    if (inet_pton(AF_INET6, address, &addr.sin6_addr) != 1)
+    {
+        // IPv4 literals as mapped addresses, so one socket type serves both
+        if (inet_pton(AF_INET, address, &v4) != 1)
+        {
+            fprintf(stderr, "Bad listen address %s\n", address);
+            return false;
+        }
+        addr.sin6_addr.s6_addr[10] = 0xFF;
+        addr.sin6_addr.s6_addr[11] = 0xFF;
+        memcpy(&addr.sin6_addr.s6_addr[12], &v4, sizeof(v4));
+    }
+
+    mListen = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    int zero = 0;
+    if (mListen < 0 || setsockopt(mListen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        setsockopt(mListen, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+        setsockopt(mListen, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero)) != 0 ||
+        bind(mListen, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(mListen, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "Cannot listen on [%s]:%u: %s\n", address, (unsigned)port, strerror(errno));
+        return false;
+    }
+
+    mEpoll = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = LISTEN_INDEX;
+    if (mEpoll < 0 || epoll_ctl(mEpoll, EPOLL_CTL_ADD, mListen, &event) != 0)
+    {
+        fprintf(stderr, "Cannot set up epoll: %s\n", strerror(errno));
+        return false;
+    }
+
+    mFree.reserve(mConnections.size());
+    for (size_t i = mConnections.size(); i > 0; i--)
+    {
+        mFree.push_back((uint32_t)(i - 1));
+    }
+    return true;
+}
+
+void IngestWorker::run()
+{
+    epoll_event events[MAX_EVENTS];
+    uint64_t lastSweepMs = monotonicMs();
+    while (!mContext.stopping->load(std::memory_order_relaxed))
+    {
+        int n = epoll_wait(mEpoll, events, MAX_EVENTS, SWEEP_INTERVAL_MS);
+        if (n < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+            return;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.u32 == LISTEN_INDEX)
+            {
+                acceptAll();
+                continue;
+            }
+            Connection &connection = mConnections[events[i].data.u32];
+            if (connection.state == READING)
+            {
+                onReadable(connection);
+            }
+            else if (connection.state == WRITING)
+            {
+                onWritable(connection);
+            }
+        }
+
+        uint64_t nowMs = monotonicMs();
+        if (nowMs - lastSweepMs >= SWEEP_INTERVAL_MS)
+        {
+            closeIdle(nowMs);
+            lastSweepMs = nowMs;
+        }
+    }
+}
+
+void IngestWorker::acceptAll()
+{
+    for (;;)
+    {
+        int fd = accept4(mListen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            // EAGAIN once the backlog is empty; anything else is the client's problem
+            return;
+        }
+        if (mFree.empty())
+        {
+            mContext.stats->refused.fetch_add(1, std::memory_order_relaxed);
+            close(fd);
+            continue;
+        }
+        uint32_t index = mFree.back();
+        mFree.pop_back();
+        Connection &connection = mConnections[index];
+        connection.fd = fd;
+        connection.state = READING;
+        connection.lastActiveMs = monotonicMs();
+        connection.received = 0;
+        connection.sent = 0;
+        connection.responseLength = 0;
+        connection.output = nullptr;
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u32 = index;
+        if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            release(connection);
+            continue;
+        }
+        mContext.stats->connections.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void IngestWorker::onReadable(Connection &connection)
+{
+    ssize_t n = recv(connection.fd, connection.request + connection.received,
+                     REQUEST_BUFFER_SIZE - connection.received, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+        return;
+    }
+    if (n <= 0)
+    {
+        release(connection); // gone before finishing its request
+        return;
+    }
+    connection.received += (size_t)n;
+    connection.lastActiveMs = monotonicMs();
+
+    const char *head = (const char *)connection.request;
+    const char *headEnd = (const char *)memmem(head, connection.received, "\r\n\r\n", 4);
+    if (!headEnd)
+    {
+        if (connection.received == REQUEST_BUFFER_SIZE)
+        {
+            mContext.stats->badRequests.fetch_add(1, std::memory_order_relaxed);
+            respond(connection, INVALID_RESPONSE);
+        }
+        return;
+    }
+    size_t headLength = (size_t)(headEnd - head) + 4;
+
+    // "METHOD /path[?query] HTTP/1.x"
+    const char *lineEnd = (const char *)memchr(head, '\r', headLength);
+    const char *methodEnd = (const char *)memchr(head, ' ', (size_t)(lineEnd - head));
+    const char *target = methodEnd ? methodEnd + 1 : nullptr;
+    const char *targetEnd = target ? (const char *)memchr(target, ' ', (size_t)(lineEnd - target)) : nullptr;
+    if (!targetEnd || *target != '/')
+    {
+        mContext.stats->badRequests.fetch_add(1, std::memory_order_relaxed);
+        respond(connection, INVALID_RESPONSE);
+        return;
+    }
+    const char *query = (const char *)memchr(target, '?', (size_t)(targetEnd - target));
+    size_t pathLength = (size_t)((query ? query : targetEnd) - target);
+
+    // Only Content-Length matters; the scale never sends chunked bodies
+    size_t contentLength = 0;
+    for (const char *line = lineEnd + 2; line < headEnd; line = (const char *)memchr(line, '\n', headEnd + 2 - line) + 1)
+    {
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            contentLength = strtoul(line + 15, nullptr, 10);
+        }
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+        {
+            mContext.stats->badRequests.fetch_add(1, std::memory_order_relaxed);
+            respond(connection, INVALID_RESPONSE);
+            return;
+        }
+    }
+    if (contentLength > REQUEST_BUFFER_SIZE - headLength)
+    {
+        mContext.stats->badRequests.fetch_add(1, std::memory_order_relaxed);
+        respond(connection, TOO_LARGE_RESPONSE);
+        return;
+    }
+    if (connection.received < headLength + contentLength)
+    {
+        return; // more body to come
+    }
+
+    char method[8] = {};
+    memcpy(method, head, (size_t)(methodEnd - head) < sizeof(method) - 1 ? (size_t)(methodEnd - head) : sizeof(method) - 1);
+    dispatch(connection, method, target, pathLength, connection.request + headLength, contentLength);
+}
+
+static bool pathIs(const char *path, size_t length, const char *expected)
+{
+    return length == strlen(expected) && memcmp(path, expected, length) == 0;
+}
+
+void IngestWorker::dispatch(Connection &connection, const char *method, const char *path, size_t pathLength,
+                            const uint8_t *body, size_t bodyLength)
+{
+    mContext.stats->requests.fetch_add(1, std::memory_order_relaxed);
+    // Registered without a method in the firmware, so any method will do
+    if (pathIs(path, pathLength, "/scale/register"))
+    {
+        respond(connection, REGISTER_RESPONSE);
+    }
+    else if (pathIs(path, pathLength, "/scale/validate"))
+    {
+        respond(connection, VALIDATE_RESPONSE);
+    }
+    else if (pathIs(path, pathLength, "/scale/upload") && strcmp(method, "POST") == 0)
+    {
+        handleUpload(connection, body, bodyLength);
+    }
+    else if (pathIs(path, pathLength, "/metrics") && strcmp(method, "GET") == 0)
+    {
+        char text[RESPONSE_BUFFER_SIZE - 128];
+        size_t length = 0;
+        for (const auto &counter : COUNTERS)
+        {
+            int n = snprintf(text + length, sizeof(text) - length, "# TYPE %s counter\n%s %llu\n", counter.name, counter.name,
+                             (unsigned long long)(mContext.stats->*counter.counter).load(std::memory_order_relaxed));
+            if (n < 0 || (size_t)n >= sizeof(text) - length)
+            {
+                break;
+            }
+            length += (size_t)n;
+        }
+        respond(connection, "text/plain; version=0.0.4", (const uint8_t *)text, length);
+    }
+    else
+    {
+        respond(connection, NOT_FOUND_RESPONSE);
+    }
+}
+
+void IngestWorker::handleUpload(Connection &connection, const uint8_t *body, size_t bodyLength)
+{
+    aria::UploadRequest request;
+    aria::ParseStatus status = request.parse(body, bodyLength);
+    if (status != aria::ParseStatus::Ok)
+    {
+        mContext.stats->uploadsRejected.fetch_add(1, std::memory_order_relaxed);
+        respond(connection, INVALID_RESPONSE);
+        return;
+    }
+
+    const aria::UploadHeader &header = request.header();
+    uint32_t now = (uint32_t)time(nullptr);
+
+    // Re-sent after an upload the scale thinks failed: acknowledge, don't store again
+    ingest::StoredRecord records[aria::MAX_MEASUREMENTS];
+    aria::Measurement accepted[aria::MAX_MEASUREMENTS];
+    uint64_t keys[aria::MAX_MEASUREMENTS];
+    size_t count = 0;
+    size_t duplicates = 0;
+    for (auto it = request.measurements().begin(); it != request.measurements().end(); ++it)
+    {
+        uint64_t key = aria::uploadKey(header.mac, *it);
+        if (mContext.dedupe && !mContext.dedupe->insert(key))
+        {
+            duplicates++;
+            continue;
+        }
+        keys[count] = key;
+        accepted[count] = *it;
+        records[count++] = ingest::StoredRecord::encode(now, header, it.raw());
+    }
+
+    // Not stored means not acknowledged; the retry must be accepted then
+    if (!mContext.storage->append(records, count))
+    {
+        for (size_t i = 0; mContext.dedupe && i < count; i++)
+        {
+            mContext.dedupe->forget(keys[i]);
+        }
+        mContext.stats->storageErrors.fetch_add(1, std::memory_order_relaxed);
+        respond(connection, STORAGE_RESPONSE);
+        return;
+    }
+    mContext.stats->measurementsStored.fetch_add(count, std::memory_order_relaxed);
+    mContext.stats->measurementsDuplicate.fetch_add(duplicates, std::memory_order_relaxed);
+
+    Household &household = mContext.households->forScale(header.mac);
+    bool cached;
+    {
+        std::lock_guard<std::mutex> guard(household.lock);
+        // New weigh-ins only, so a re-sent old one can't pull a window back
+        for (size_t i = 0; i < count; i++)
+        {
+            household.observe(accepted[i]);
+        }
+        // Our clock, the scale's clock for the user timestamps
+        size_t length;
+        const uint8_t *envelope = household.responses.get(header.mac, now, header.timestamp, length, cached);
+        respond(connection, "application/octet-stream", envelope, length);
+    }
+    (cached ? mContext.stats->responseCacheHits : mContext.stats->responseCacheMisses).fetch_add(1, std::memory_order_relaxed);
+    mContext.stats->uploads.fetch_add(1, std::memory_order_relaxed);
+}
+
+void IngestWorker::respond(Connection &connection, const char *preformatted)
+{
+    connection.output = (const uint8_t *)preformatted;
+    connection.responseLength = strlen(preformatted);
+    connection.sent = 0;
+    connection.state = WRITING;
+    onWritable(connection);
+}
+
+void IngestWorker::respond(Connection &connection, const char *contentType, const uint8_t *body, size_t length)
+{
+    int head = snprintf((char *)connection.response, sizeof(connection.response),
+                        "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",
+                        contentType, (unsigned)length);
+    if (head < 0 || (size_t)head + length > sizeof(connection.response))
+    {
+        respond(connection, TOO_LONG_RESPONSE);
+        return;
+    }
+    memcpy(connection.response + head, body, length);
+    connection.output = connection.response;
+    connection.responseLength = (size_t)head + length;
+    connection.sent = 0;
+    connection.state = WRITING;
+    onWritable(connection);
+}
+
+// Writes what the socket takes; the rest waits for EPOLLOUT
+void IngestWorker::onWritable(Connection &connection)
+{
+    while (connection.sent < connection.responseLength)
+    {
+        ssize_t n = send(connection.fd, connection.output + connection.sent,
+                         connection.responseLength - connection.sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN)
+        {
+            epoll_event event = {};
+            event.events = EPOLLOUT;
+            event.data.u32 = (uint32_t)(&connection - mConnections.data());
+            epoll_ctl(mEpoll, EPOLL_CTL_MOD, connection.fd, &event);
+            connection.lastActiveMs = monotonicMs();
+            return;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        connection.sent += (size_t)n;
+    }
+    release(connection);
+}
+
+void IngestWorker::release(Connection &connection)
+{
+    // Closing removes it from the epoll set too
+    close(connection.fd);
+    connection.fd = -1;
+    connection.state = FREE;
+    mFree.push_back((uint32_t)(&connection - mConnections.data()));
+}
+
+void IngestWorker::closeIdle(uint64_t nowMs)
+{
+    for (Connection &connection : mConnections)
+    {
+        if (connection.state != FREE && nowMs - connection.lastActiveMs > mTimeoutMs)
+        {
+            mContext.stats->timeouts.fetch_add(1, std::memory_order_relaxed);
+            release(connection);
+        }
+    }
+}
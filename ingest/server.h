@@ -0,0 +1,102 @@
+#pragma once
+
+#include "households.h"
+#include "storage.h"
+
+#include <aria_response.h>
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Counters shared by the workers, relaxed increments only
+struct IngestStats
+{
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint64_t> refused{0}; // arena full
+    std::atomic<uint64_t> timeouts{0};
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> badRequests{0};
+    std::atomic<uint64_t> uploads{0};
+    std::atomic<uint64_t> uploadsRejected{0};
+    std::atomic<uint64_t> storageErrors{0};
+    std::atomic<uint64_t> measurementsStored{0};
+    std::atomic<uint64_t> measurementsDuplicate{0};
+    std::atomic<uint64_t> responseCacheHits{0};
+    std::atomic<uint64_t> responseCacheMisses{0};
+};
+
+struct IngestContext
+{
+    Households *households;
+    UploadDedupe *dedupe; // nullptr to store re-sent measurements again
+    ingest::Storage *storage;
+    IngestStats *stats;
+    const std::atomic<bool> *stopping;
+};
+
+// One event loop thread: its own epoll instance and its own SO_REUSEPORT
+// listening socket, so the kernel spreads new connections across workers
+// and nothing on the request path is shared but the household and dedupe
+// locks and the storage append.
+//
+// Connections live in an arena allocated once at start; a connection
+// holds its request and its response in fixed buffers, so serving a
+// request allocates nothing but a new scale's household. Like the
+// firmware's WebServer every response closes the connection. Connections
+// idle for longer than the timeout, or sending a request that cannot be an
+// Aria one, are closed.
+class IngestWorker
+{
+public:
+    static const size_t REQUEST_BUFFER_SIZE = 2048; // headers and the largest upload
+    static const size_t RESPONSE_BUFFER_SIZE = 2048; // an envelope, or /metrics
+
+    IngestWorker(const IngestContext &context, size_t maxConnections, unsigned timeoutMs)
+        : mContext(context), mConnections(maxConnections), mTimeoutMs(timeoutMs) {}
+    ~IngestWorker();
+
+    // Binds before the thread starts, so errors reach main()
+    bool listen(const char *address, uint16_t port);
+    void run();
+
+private:
+    enum State : uint8_t
+    {
+        FREE,
+        READING,
+        WRITING
+    };
+
+    struct Connection
+    {
+        int fd;
+        State state;
+        uint64_t lastActiveMs;
+        size_t received;
+        size_t sent;
+        size_t responseLength;
+        const uint8_t *output; // a preformatted response or `response`
+        uint8_t request[REQUEST_BUFFER_SIZE];
+        uint8_t response[RESPONSE_BUFFER_SIZE];
+    };
+
+    void acceptAll();
+    void onReadable(Connection &connection);
+    void onWritable(Connection &connection);
+    void dispatch(Connection &connection, const char *method, const char *path, size_t pathLength,
+                  const uint8_t *body, size_t bodyLength);
+    void handleUpload(Connection &connection, const uint8_t *body, size_t bodyLength);
+    void respond(Connection &connection, const char *preformatted);
+    void respond(Connection &connection, const char *contentType, const uint8_t *body, size_t length); // 200 OK
+    void release(Connection &connection);
+    void closeIdle(uint64_t nowMs);
+
+    IngestContext mContext;
+    std::vector<Connection> mConnections;
+    std::vector<uint32_t> mFree; // indices into mConnections
+    unsigned mTimeoutMs;
+    int mEpoll = -1;
+    int mListen = -1;
+};
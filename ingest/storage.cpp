@@ -0,0 +1,222 @@
+#include "storage.h"
+
+#include <crc16.h>
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace ingest
+{
+
+StoredRecord StoredRecord::encode(uint32_t received, const aria::UploadHeader &header, const uint8_t *measurement)
+{
+    StoredRecord record = {};
+    aria::writeLE(record.bytes, received);
+    memcpy(record.bytes + 4, header.mac, aria::MAC_SIZE);
+    record.bytes[10] = header.batteryPercent > 0xFF ? 0xFF : (uint8_t)header.batteryPercent;
+    memcpy(record.bytes + 12, measurement, aria::MEASUREMENT_SIZE);
+    aria::writeLE(record.bytes + 44, (uint16_t)(header.firmwareVersion > 0xFFFF ? 0xFFFF : header.firmwareVersion));
+    aria::writeLE(record.bytes + 46, Crc16Xmodem::compute(record.bytes, RECORD_SIZE - aria::CRC_SIZE));
+    return record;
+}
+
+bool StoredRecord::valid() const
+{
+    return Crc16Xmodem::compute(bytes, RECORD_SIZE - aria::CRC_SIZE) == aria::readLE<uint16_t>(bytes + 46);
+}
+
+Storage *Storage::create(const char *spec, unsigned syncMs)
+{
+    if (strcmp(spec, "none") == 0)
+    {
+        return new NullStorage();
+    }
+    if (strncmp(spec, "file:", 5) == 0)
+    {
+        spec += 5;
+    }
+    else if (strchr(spec, ':'))
+    {
+        return nullptr; // someone else's scheme
+    }
+    return *spec ? new AppendFileStorage(spec, syncMs) : nullptr;
+}
+
+// Writes everything or fails; retries short writes and EINTR
+static bool writeAll(int fd, const uint8_t *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+bool AppendFileStorage::open()
+{
+    mFd = ::open(mPath, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (mFd < 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", mPath, strerror(errno));
+        return false;
+    }
+    struct stat info;
+    if (fstat(mFd, &info) != 0)
+    {
+        fprintf(stderr, "Cannot stat %s: %s\n", mPath, strerror(errno));
+        return false;
+    }
+
+    uint8_t header[HEADER_SIZE] = {};
+    if (info.st_size == 0)
+    {
+        aria::writeLE(header, MAGIC);
+        aria::writeLE(header + 4, VERSION);
+        aria::writeLE(header + 6, (uint16_t)RECORD_SIZE);
+        aria::writeLE(header + 8, (uint32_t)time(nullptr)); // created
+        if (!writeAll(mFd, header, sizeof(header)) || fdatasync(mFd) != 0)
+        {
+            fprintf(stderr, "Cannot write %s: %s\n", mPath, strerror(errno));
+            return false;
+        }
+    }
+    else
+    {
+        if (pread(mFd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            aria::readLE<uint32_t>(header) != MAGIC || aria::readLE<uint16_t>(header + 4) != VERSION ||
+            aria::readLE<uint16_t>(header + 6) != RECORD_SIZE)
+        {
+            fprintf(stderr, "%s is not a version %u measurement store\n", mPath, (unsigned)VERSION);
+            return false;
+        }
+        // A crash in the middle of a write leaves part of a record behind
+        off_t torn = (info.st_size - (off_t)HEADER_SIZE) % (off_t)RECORD_SIZE;
+        if (torn && ftruncate(mFd, info.st_size - torn) != 0)
+        {
+            fprintf(stderr, "Cannot truncate %s: %s\n", mPath, strerror(errno));
+            return false;
+        }
+        if (torn)
+        {
+            fprintf(stderr, "%s: dropped %ld bytes of a torn record\n", mPath, (long)torn);
+        }
+    }
+
+    mStopping = false;
+    if (mSyncMs)
+    {
+        mSyncThread = std::thread(&AppendFileStorage::syncLoop, this);
+    }
+    return true;
+}
+
+bool AppendFileStorage::append(const StoredRecord *records, size_t count)
+{
+    if (count == 0)
+    {
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(mLock);
+    if (!writeAll(mFd, records[0].bytes, count * RECORD_SIZE))
+    {
+        fprintf(stderr, "Cannot append to %s: %s\n", mPath, strerror(errno));
+        return false;
+    }
+    if (!mSyncMs)
+    {
+        return fdatasync(mFd) == 0;
+    }
+    mDirty = true;
+    return true;
+}
+
+long AppendFileStorage::replay(const std::function<void(const StoredRecord &)> &visit)
+{
+    static const size_t BLOCK = 4096; // records per read
+    std::unique_ptr<StoredRecord[]> block(new StoredRecord[BLOCK]);
+    off_t offset = HEADER_SIZE;
+    long count = 0;
+    long corrupt = 0;
+    for (;;)
+    {
+        ssize_t n = pread(mFd, block.get(), BLOCK * RECORD_SIZE, offset);
+        if (n < 0)
+        {
+            fprintf(stderr, "Cannot read %s: %s\n", mPath, strerror(errno));
+            return -1;
+        }
+        size_t records = (size_t)n / RECORD_SIZE;
+        if (records == 0)
+        {
+            break;
+        }
+        for (size_t i = 0; i < records; i++)
+        {
+            if (!block[i].valid())
+            {
+                corrupt++;
+                continue;
+            }
+            visit(block[i]);
+            count++;
+        }
+        offset += (off_t)(records * RECORD_SIZE);
+    }
+    if (corrupt)
+    {
+        fprintf(stderr, "%s: skipped %ld records with a bad CRC\n", mPath, corrupt);
+    }
+    return count;
+}
+
+void AppendFileStorage::close()
+{
+    if (mSyncThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(mSyncLock);
+            mStopping = true;
+        }
+        mSyncWake.notify_all();
+        mSyncThread.join();
+    }
+    if (mFd >= 0)
+    {
+        fdatasync(mFd);
+        ::close(mFd);
+        mFd = -1;
+    }
+}
+
+// Group commit: one fdatasync covers everything appended since the last
+void AppendFileStorage::syncLoop()
+{
+    std::unique_lock<std::mutex> lock(mSyncLock);
+    while (!mStopping)
+    {
+        mSyncWake.wait_for(lock, std::chrono::milliseconds(mSyncMs));
+        if (mDirty.exchange(false) && fdatasync(mFd) != 0)
+        {
+            fprintf(stderr, "Cannot sync %s: %s\n", mPath, strerror(errno));
+        }
+    }
+}
+
+} // namespace ingest
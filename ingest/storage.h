@@ -0,0 +1,106 @@
+#pragma once
+
+#include <aria_protocol.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+
+// Where accepted measurements go.
+//
+// A stored record is the measurement exactly as the scale sent it, plus
+// who sent it and when we got it:
+//
+//   u32 received   server clock, Unix seconds
+//   u8  mac[6]
+//   u8  battery    percent
+//   u8  reserved
+//   u8  raw[32]    aria_scale_measurement, little endian
+//   u16 firmware   the scale's firmware version
+//   u16 crc        CRC-16/XMODEM of the 46 bytes before it
+//
+// append() is called by the workers concurrently and returns once the
+// records are safe enough to acknowledge; a scale that gets no 200 sends
+// them again. replay() hands back everything stored, oldest first, before
+// the workers start.
+namespace ingest
+{
+
+constexpr size_t RECORD_SIZE = 48;
+
+struct StoredRecord
+{
+    uint8_t bytes[RECORD_SIZE];
+
+    static StoredRecord encode(uint32_t received, const aria::UploadHeader &header, const uint8_t *measurement);
+    bool valid() const;
+
+    uint32_t received() const { return aria::readLE<uint32_t>(bytes); }
+    const uint8_t *mac() const { return bytes + 4; }
+    uint8_t battery() const { return bytes[10]; }
+    aria::Measurement measurement() const { return aria::Measurement::decode(bytes + 12); }
+    uint16_t firmware() const { return aria::readLE<uint16_t>(bytes + 44); }
+};
+
+class Storage
+{
+public:
+    virtual ~Storage() = default;
+
+    virtual bool open() = 0;
+    virtual bool append(const StoredRecord *records, size_t count) = 0;
+    // Returns the number of records read, or -1 if the store is unreadable
+    virtual long replay(const std::function<void(const StoredRecord &)> &visit) = 0;
+    virtual void close() {}
+
+    // "file:PATH", a bare path or "none"; nullptr for anything else
+    static Storage *create(const char *spec, unsigned syncMs);
+};
+
+// Accepts and forgets everything, for benchmarking the request path
+class NullStorage : public Storage
+{
+public:
+    bool open() override { return true; }
+    bool append(const StoredRecord *, size_t) override { return true; }
+    long replay(const std::function<void(const StoredRecord &)> &) override { return 0; }
+};
+
+// One file, a 16-byte header and records appended after it. Each append is
+// a single write() under a lock with O_APPEND, so records never interleave;
+// a background thread fdatasync()s every syncMs, or every append waits for
+// it when syncMs is 0. A record torn by a crash is cut off at open.
+class AppendFileStorage : public Storage
+{
+public:
+    static const uint32_t MAGIC = 0x49564C48; // "HLVI"
+    static const uint16_t VERSION = 1;
+    static const size_t HEADER_SIZE = 16;
+
+    AppendFileStorage(const char *path, unsigned syncMs) : mPath(path), mSyncMs(syncMs) {}
+    ~AppendFileStorage() override { close(); }
+
+    bool open() override;
+    bool append(const StoredRecord *records, size_t count) override;
+    long replay(const std::function<void(const StoredRecord &)> &visit) override;
+    void close() override;
+
+private:
+    void syncLoop();
+
+    const char *mPath;
+    unsigned mSyncMs;
+    int mFd = -1;
+    std::mutex mLock; // serializes writes
+    std::atomic<bool> mDirty{false};
+    std::mutex mSyncLock;
+    std::condition_variable mSyncWake;
+    bool mStopping = false;
+    std::thread mSyncThread;
+};
+
+} // namespace ingest
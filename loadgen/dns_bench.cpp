@@ -0,0 +1,93 @@
+// Microbenchmark for the captive DNS responder (dns_responder.h).
+//
+// Times Responder::respond for the queries the DNS task sees: the Aria's
+// exact query (template copy), other spellings and wildcard subdomains
+// (parse and echo), names outside the table, and malformed packets. Uses
+// the firmware's own name table. Each reply is checked once before timing.
+
+#include <dns_responder.h>
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr int ITERATIONS = 10000000;
+
+// As in CaptiveDNSServer
+const dns::Name NAMES[] = {
+    {"www.fitbit.com", false},
+    {"api.fitbit.com", false},
+    {"fitbit.com", true},
+};
+
+std::vector<uint8_t> buildQuery(const char *name, uint16_t type = dns::TYPE_A)
+{
+    std::vector<uint8_t> query(dns::HEADER_SIZE + dns::MAX_NAME + 2 + 4);
+    uint8_t *p = query.data();
+    dns::write16(p, 0x1234);
+    p[2] = 0x01;
+    dns::write16(p + 4, 1);
+    size_t pos = dns::HEADER_SIZE + dns::encodeName(name, p + dns::HEADER_SIZE, query.size() - dns::HEADER_SIZE - 4);
+    dns::write16(p + pos, type);
+    dns::write16(p + pos + 2, dns::CLASS_IN);
+    query.resize(pos + 4);
+    return query;
+}
+
+} // namespace
+
+int main()
+{
+    dns::Responder<3> responder(NAMES);
+    const uint8_t address[4] = {192, 168, 4, 1};
+    responder.setAddress(address);
+    uint8_t out[dns::MAX_PACKET];
+    bool ok = true;
+
+    std::vector<uint8_t> truncated = buildQuery("www.fitbit.com");
+    truncated.resize(truncated.size() - 3);
+    struct
+    {
+        const char *label;
+        std::vector<uint8_t> query;
+        dns::Result expected;
+    } cases[] = {
+        {"www.fitbit.com A (template)", buildQuery("www.fitbit.com"), dns::Result::Answered},
+        {"fitbit.com A (template)", buildQuery("fitbit.com"), dns::Result::Answered},
+        {"WWW.FITBIT.COM A", buildQuery("WWW.FITBIT.COM"), dns::Result::Answered},
+        {"client.fitbit.com A (wildcard)", buildQuery("client.fitbit.com"), dns::Result::Answered},
+        {"www.fitbit.com AAAA", buildQuery("www.fitbit.com", 28), dns::Result::NoData},
+        {"connectivitycheck.gstatic.com", buildQuery("connectivitycheck.gstatic.com"), dns::Result::Refused},
+        {"truncated question", truncated, dns::Result::Malformed},
+    };
+
+    printf("%-32s %6s %10s %12s\n", "query", "bytes", "ns", "queries/s");
+    for (const auto &c : cases)
+    {
+        dns::Result result;
+        int match;
+        responder.respond(c.query.data(), c.query.size(), out, result, match);
+        if (result != c.expected)
+        {
+            fprintf(stderr, "%s: unexpected result %d\n", c.label, (int)result);
+            ok = false;
+            continue;
+        }
+
+        volatile size_t sink = 0;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < ITERATIONS; i++)
+        {
+            sink = sink + responder.respond(c.query.data(), c.query.size(), out, result, match);
+        }
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ITERATIONS;
+        printf("%-32s %6u %10.1f %12.0f\n", c.label, (unsigned)c.query.size(), ns, 1e9 / ns);
+    }
+    return ok ? 0 : 1;
+}
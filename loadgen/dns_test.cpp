@@ -0,0 +1,356 @@
+// Host tests for the captive DNS responder (dns_responder.h).
+//
+// Question parsing, table and wildcard matching, the prebuilt fast path
+// against the slow path, compressed names, and every truncation of a
+// query. Uses the firmware's own name table. Exits non-zero on the first
+// failure.
+
+#include <dns_responder.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+int failures = 0;
+
+#define CHECK(condition)                                                  \
+    do                                                                    \
+    {                                                                     \
+        if (!(condition))                                                 \
+        {                                                                 \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                   \
+        }                                                                 \
+    } while (0)
+
+// As in CaptiveDNSServer
+const dns::Name NAMES[] = {
+    {"www.fitbit.com", false},
+    {"api.fitbit.com", false},
+    {"fitbit.com", true},
+};
+
+const uint8_t ADDRESS[4] = {192, 168, 4, 1};
+
+// A standard query with one question, as a stub resolver sends it
+std::vector<uint8_t> buildQuery(const char *name, uint16_t type = dns::TYPE_A, uint16_t id = 0x1234, bool rd = true)
+{
+    std::vector<uint8_t> query(dns::HEADER_SIZE + dns::MAX_NAME + 2 + 4);
+    uint8_t *p = query.data();
+    dns::write16(p, id);
+    p[2] = rd ? 0x01 : 0x00;
+    dns::write16(p + 4, 1);
+    size_t nameLength = dns::encodeName(name, p + dns::HEADER_SIZE, query.size() - dns::HEADER_SIZE - 4);
+    size_t pos = dns::HEADER_SIZE + nameLength;
+    dns::write16(p + pos, type);
+    dns::write16(p + pos + 2, dns::CLASS_IN);
+    query.resize(pos + 4);
+    return query;
+}
+
+struct Reply
+{
+    std::vector<uint8_t> bytes;
+    dns::Result result;
+    int match;
+};
+
+Reply ask(dns::Responder<3> &responder, const std::vector<uint8_t> &query)
+{
+    Reply reply;
+    reply.bytes.resize(dns::MAX_PACKET);
+    size_t size = responder.respond(query.data(), query.size(), reply.bytes.data(), reply.result, reply.match);
+    reply.bytes.resize(size);
+    return reply;
+}
+
+uint8_t rcode(const Reply &reply)
+{
+    return reply.bytes.size() >= dns::HEADER_SIZE ? reply.bytes[3] & 0x0F : 0xFF;
+}
+
+// Checks a NOERROR reply carrying one A record for ADDRESS after the echoed question
+void checkAnswer(const Reply &reply, const std::vector<uint8_t> &query)
+{
+    const uint8_t *r = reply.bytes.data();
+    CHECK(reply.result == dns::Result::Answered);
+    CHECK(reply.bytes.size() == query.size() + dns::Responder<3>::ANSWER_SIZE);
+    if (reply.bytes.size() != query.size() + dns::Responder<3>::ANSWER_SIZE)
+    {
+        return;
+    }
+    CHECK(r[0] == query[0] && r[1] == query[1]);
+    CHECK((r[2] & 0x80) && (r[2] & 0x04));       // QR, AA
+    CHECK((r[2] & 0x01) == (query[2] & 0x01));   // RD echoed
+    CHECK(rcode(reply) == dns::NOERROR);
+    CHECK(dns::read16(r + 4) == 1 && dns::read16(r + 6) == 1);
+    CHECK(dns::read16(r + 8) == 0 && dns::read16(r + 10) == 0);
+    CHECK(memcmp(r + dns::HEADER_SIZE, query.data() + dns::HEADER_SIZE, query.size() - dns::HEADER_SIZE) == 0);
+    const uint8_t *answer = r + query.size();
+    CHECK(dns::read16(answer) == 0xC00C); // compressed, points at the question
+    CHECK(dns::read16(answer + 2) == dns::TYPE_A);
+    CHECK(dns::read16(answer + 4) == dns::CLASS_IN);
+    CHECK(answer[6] == 0 && answer[7] == 0 && answer[8] == 0 && answer[9] == dns::DEFAULT_TTL);
+    CHECK(dns::read16(answer + 10) == 4);
+    CHECK(memcmp(answer + 12, ADDRESS, 4) == 0);
+}
+
+void testParseQuestion()
+{
+    std::vector<uint8_t> query = buildQuery("WWW.Fitbit.COM", 28);
+    dns::Question question;
+    CHECK(dns::parseQuestion(query.data(), query.size(), question));
+    CHECK(strcmp(question.name, "www.fitbit.com") == 0);
+    CHECK(question.nameLength == 14);
+    CHECK(question.type == 28);
+    CHECK(question.qclass == dns::CLASS_IN);
+    CHECK(question.end == query.size());
+
+    // The root name
+    query = buildQuery("");
+    CHECK(dns::parseQuestion(query.data(), query.size(), question));
+    CHECK(question.nameLength == 0 && question.name[0] == 0);
+
+    // Longest legal name, and one label too many
+    std::string name;
+    while (name.size() + 64 <= dns::MAX_NAME)
+    {
+        name += std::string(63, 'a') + ".";
+    }
+    name += std::string(dns::MAX_NAME - name.size(), 'b');
+    query = buildQuery(name.c_str());
+    CHECK(dns::parseQuestion(query.data(), query.size(), question));
+    CHECK(question.nameLength == dns::MAX_NAME);
+    uint8_t wire[dns::HEADER_SIZE + 300] = {};
+    memcpy(wire, query.data(), dns::HEADER_SIZE);
+    size_t pos = dns::HEADER_SIZE;
+    for (int i = 0; i < 4; i++)
+    {
+        wire[pos++] = 63;
+        memset(wire + pos, 'c', 63);
+        pos += 63;
+    }
+    wire[pos++] = 0;
+    pos += 4;
+    CHECK(!dns::parseQuestion(wire, pos, question));
+
+    // Label lengths 64..255 are not labels
+    wire[dns::HEADER_SIZE] = 64;
+    CHECK(!dns::parseQuestion(wire, pos, question));
+}
+
+void testEncodeName()
+{
+    uint8_t out[32];
+    CHECK(dns::encodeName("a.bc", out, sizeof(out)) == 6);
+    CHECK(memcmp(out, "\x01" "a" "\x02" "bc" "\x00", 6) == 0);
+    CHECK(dns::encodeName("", out, sizeof(out)) == 1 && out[0] == 0);
+    CHECK(dns::encodeName("a.bc", out, 5) == 0);  // no room for the root label
+    CHECK(dns::encodeName("a..bc", out, sizeof(out)) == 0);
+}
+
+void testMatching(dns::Responder<3> &responder)
+{
+    // Exact entries hit the prebuilt templates
+    for (int i = 0; i < 3; i++)
+    {
+        std::vector<uint8_t> query = buildQuery(NAMES[i].name);
+        Reply reply = ask(responder, query);
+        checkAnswer(reply, query);
+        CHECK(reply.match == i);
+    }
+
+    // Other spellings, the wildcard and ANY go through the slow path with the same answer
+    struct
+    {
+        const char *name;
+        uint16_t type;
+        int match;
+    } cases[] = {
+        {"WWW.FITBIT.COM", dns::TYPE_A, 0},
+        {"Api.Fitbit.Com", dns::TYPE_A, 1},
+        {"client.fitbit.com", dns::TYPE_A, 2},
+        {"a.b.c.fitbit.com", dns::TYPE_A, 2},
+        {"www.fitbit.com", dns::TYPE_ANY, 0},
+    };
+    for (const auto &c : cases)
+    {
+        std::vector<uint8_t> query = buildQuery(c.name, c.type, 0xBEEF, false);
+        Reply reply = ask(responder, query);
+        checkAnswer(reply, query);
+        CHECK(reply.match == c.match);
+    }
+
+    // Suffixes and prefixes of table names; the wildcard needs a label boundary
+    for (const char *name : {"www.fitbit.com.example", "notfitbit.com", "fitbit.co", "fitbit.com.example", "com"})
+    {
+        std::vector<uint8_t> query = buildQuery(name);
+        Reply reply = ask(responder, query);
+        CHECK(reply.result == dns::Result::Refused);
+        CHECK(reply.match == -1);
+        CHECK(rcode(reply) == dns::REFUSED);
+        CHECK(reply.bytes.size() == query.size());
+        CHECK(dns::read16(reply.bytes.data() + 6) == 0);
+    }
+
+    // A table name asked for another type: NOERROR, no answer
+    std::vector<uint8_t> query = buildQuery("www.fitbit.com", 28);
+    Reply reply = ask(responder, query);
+    CHECK(reply.result == dns::Result::NoData);
+    CHECK(reply.match == 0);
+    CHECK(rcode(reply) == dns::NOERROR);
+    CHECK(reply.bytes.size() == query.size());
+    CHECK(dns::read16(reply.bytes.data() + 6) == 0);
+
+    // Forwarding instead of refusing
+    responder.setForwardUnknown(true);
+    reply = ask(responder, buildQuery("example.org"));
+    CHECK(reply.result == dns::Result::Forward);
+    CHECK(reply.bytes.empty());
+    responder.setForwardUnknown(false);
+}
+
+void testFastPathEqualsSlowPath(dns::Responder<3> &responder)
+{
+    // The same query with one letter in uppercase misses the templates; apart
+    // from the echoed letter the slow path must produce the same bytes
+    for (int i = 0; i < 3; i++)
+    {
+        std::vector<uint8_t> query = buildQuery(NAMES[i].name);
+        Reply fast = ask(responder, query);
+        std::vector<uint8_t> upper = query;
+        upper[dns::HEADER_SIZE + 1] -= 32;
+        Reply slow = ask(responder, upper);
+        CHECK(fast.bytes.size() == slow.bytes.size());
+        CHECK(slow.bytes.size() > dns::HEADER_SIZE + 1 && slow.bytes[dns::HEADER_SIZE + 1] == upper[dns::HEADER_SIZE + 1]);
+        slow.bytes[dns::HEADER_SIZE + 1] += 32;
+        CHECK(fast.bytes == slow.bytes);
+    }
+
+    // A new address rebuilds the templates
+    const uint8_t other[4] = {10, 0, 0, 7};
+    responder.setAddress(other);
+    Reply reply = ask(responder, buildQuery("www.fitbit.com"));
+    CHECK(memcmp(reply.bytes.data() + reply.bytes.size() - 4, other, 4) == 0);
+    responder.setAddress(ADDRESS);
+}
+
+void testCompression(dns::Responder<3> &responder)
+{
+    // A pointer is not valid in the first question of a query: FORMERR
+    std::vector<uint8_t> query = buildQuery("www.fitbit.com");
+    query.resize(dns::HEADER_SIZE);
+    for (uint8_t b : {0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01})
+    {
+        query.push_back(b);
+    }
+    Reply reply = ask(responder, query);
+    CHECK(reply.result == dns::Result::Malformed);
+    CHECK(rcode(reply) == dns::FORMERR);
+    CHECK(reply.bytes.size() == dns::HEADER_SIZE);
+
+    // Nor after a label
+    query.resize(dns::HEADER_SIZE);
+    const uint8_t afterLabel[] = {0x03, 'w', 'w', 'w', 0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01};
+    query.insert(query.end(), afterLabel, afterLabel + sizeof(afterLabel));
+    reply = ask(responder, query);
+    CHECK(rcode(reply) == dns::FORMERR);
+}
+
+void testMalformed(dns::Responder<3> &responder)
+{
+    // Every truncation of a query: dropped without a header, FORMERR after it
+    for (const char *name : {"www.fitbit.com", "client.fitbit.com"})
+    {
+        std::vector<uint8_t> query = buildQuery(name);
+        for (size_t length = 0; length < query.size(); length++)
+        {
+            std::vector<uint8_t> cut(query.begin(), query.begin() + length);
+            Reply reply = ask(responder, cut);
+            if (length < dns::HEADER_SIZE)
+            {
+                CHECK(reply.result == dns::Result::Dropped);
+                CHECK(reply.bytes.empty());
+            }
+            else
+            {
+                CHECK(reply.result == dns::Result::Malformed);
+                CHECK(rcode(reply) == dns::FORMERR);
+                CHECK(reply.bytes[0] == 0x12 && reply.bytes[1] == 0x34);
+            }
+        }
+    }
+
+    // Responses are never answered
+    std::vector<uint8_t> query = buildQuery("www.fitbit.com");
+    query[2] |= 0x80;
+    CHECK(ask(responder, query).result == dns::Result::Dropped);
+
+    // Other opcodes
+    query = buildQuery("www.fitbit.com");
+    query[2] |= 0x10; // STATUS
+    Reply reply = ask(responder, query);
+    CHECK(reply.result == dns::Result::Malformed);
+    CHECK(rcode(reply) == dns::NOTIMP);
+    CHECK((reply.bytes[2] & 0x78) == 0x10);
+
+    // Zero or two questions
+    for (uint16_t questions : {0, 2})
+    {
+        query = buildQuery("www.fitbit.com");
+        dns::write16(query.data() + 4, questions);
+        reply = ask(responder, query);
+        CHECK(reply.result == dns::Result::Malformed);
+        CHECK(rcode(reply) == dns::FORMERR);
+    }
+
+    // Additional records (EDNS) skip the fast path but are still answered
+    query = buildQuery("www.fitbit.com");
+    dns::write16(query.data() + 10, 1);
+    for (uint8_t b : {0x00, 0x00, 0x29, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00})
+    {
+        query.push_back(b);
+    }
+    reply = ask(responder, query);
+    CHECK(reply.result == dns::Result::Answered);
+    CHECK(dns::read16(reply.bytes.data() + 10) == 0);
+}
+
+void testCounters(dns::Responder<3> &responder)
+{
+    uint32_t hits = responder.hits(0);
+    uint32_t refused = responder.refused();
+    ask(responder, buildQuery("www.fitbit.com"));
+    ask(responder, buildQuery("WWW.fitbit.com"));
+    ask(responder, buildQuery("example.org"));
+    CHECK(responder.hits(0) == hits + 2);
+    CHECK(responder.refused() == refused + 1);
+}
+
+} // namespace
+
+int main()
+{
+    dns::Responder<3> responder(NAMES);
+    responder.setAddress(ADDRESS);
+
+    testParseQuestion();
+    testEncodeName();
+    testMatching(responder);
+    testFastPathEqualsSlowPath(responder);
+    testCompression(responder);
+    testMalformed(responder);
+    testCounters(responder);
+    if (failures)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("dns_test: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,699 @@
+// Load generator for the Aria /scale/upload endpoint.
+//
+// Synthesizes aria_upload_request_envelope3 bodies for a fleet of simulated
+// scales (or replays captured ones), sends them at a target rate and checks
+// every response envelope. Latency is measured from the time a request was
+// scheduled, not from when it was sent, so a server that falls behind shows
+// up in the percentiles instead of silently lowering the offered load.
+
+#include <aria_protocol.h>
+#include <crc16.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <fstream>
+#include <getopt.h>
+#include <iterator>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+enum Outcome
+{
+    OK,
+    CONNECT_FAILED,
+    SEND_FAILED,
+    RECV_FAILED, // includes timeouts
+    BAD_HTTP,
+    HTTP_STATUS,
+    SHORT_RESPONSE,
+    BAD_CRC,
+    BAD_TRAILER,
+    OUTCOME_COUNT
+};
+
+const char *OUTCOME_NAMES[OUTCOME_COUNT] = {
+    "ok", "connect failed", "send failed", "recv failed/timeout", "malformed http",
+    "http status != 200", "short response", "bad response crc", "bad trailer"};
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    std::string port = "8000";
+    std::string path = "/scale/upload";
+    double rate = 10;       // requests per second, 0 = closed loop
+    double duration = 10;   // seconds, ignored when requests is set
+    uint64_t requests = 0;  // total requests, 0 = use duration
+    unsigned burst = 1;     // requests released together at each tick
+    unsigned concurrency = 8;
+    unsigned scales = 16;
+    unsigned minMeasurements = 0;
+    unsigned maxMeasurements = aria::MAX_MEASUREMENTS;
+    std::vector<uint32_t> users = {0};
+    int maxSkew = 0; // seconds of clock error per scale, +/-
+    double timeout = 5;
+    uint32_t seed = 1;
+    std::vector<std::vector<uint8_t>> replay;
+    std::string writeBody;
+};
+
+struct Scale
+{
+    uint8_t mac[aria::MAC_SIZE];
+    uint8_t authCode[aria::AUTH_CODE_SIZE];
+    int32_t skew;
+    uint32_t battery;
+    uint32_t nextId;
+};
+
+struct WorkerStats
+{
+    std::vector<uint32_t> latencyUs; // scheduled time to last response byte
+    std::vector<uint32_t> serviceUs; // connect to last response byte
+    uint64_t outcomes[OUTCOME_COUNT] = {};
+    uint64_t bytesSent = 0;
+};
+
+std::vector<Scale> makeScales(const Options &options, std::mt19937 &rng)
+{
+    std::vector<Scale> scales(options.scales);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::uniform_int_distribution<int> skew(-options.maxSkew, options.maxSkew);
+    for (size_t i = 0; i < scales.size(); i++)
+    {
+        Scale &scale = scales[i];
+        // Locally administered unicast range, index in the low bytes
+        uint8_t mac[aria::MAC_SIZE] = {0x02, 0x48, 0x45, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i};
+        memcpy(scale.mac, mac, sizeof(mac));
+        for (uint8_t &b : scale.authCode)
+        {
+            b = (uint8_t)byte(rng);
+        }
+        scale.skew = skew(rng);
+        scale.battery = 20 + byte(rng) % 81;
+        scale.nextId = 1;
+    }
+    return scales;
+}
+
+// Newest measurement first, then the cached ones oldest first (protocol.md)
+std::vector<uint8_t> buildUpload(const Options &options, Scale &scale, std::mt19937 &rng)
+{
+    std::uniform_int_distribution<unsigned> countDist(options.minMeasurements, options.maxMeasurements);
+    std::uniform_int_distribution<size_t> userDist(0, options.users.size() - 1);
+    std::uniform_int_distribution<uint32_t> weightDist(45000, 130000);
+    std::uniform_int_distribution<uint32_t> impedanceDist(400, 700);
+    std::uniform_int_distribution<uint32_t> fatDist(8000, 40000);
+
+    uint32_t count = countDist(rng);
+    uint32_t now = (uint32_t)(time(nullptr) + scale.skew);
+
+    std::vector<uint8_t> body(aria::REQUEST_PREAMBLE_SIZE + count * aria::MEASUREMENT_SIZE + aria::CRC_SIZE);
+    uint8_t *p = body.data();
+    aria::writeLE<uint32_t>(p, aria::PROTOCOL_VERSION);
+    aria::writeLE<uint32_t>(p + 4, scale.battery);
+    memcpy(p + 8, scale.mac, aria::MAC_SIZE);
+    memcpy(p + 14, scale.authCode, aria::AUTH_CODE_SIZE);
+    aria::writeLE<uint32_t>(p + 30, 39); // firmware version
+    aria::writeLE<uint32_t>(p + 34, 50); // unknown2
+    aria::writeLE<uint32_t>(p + 38, now);
+    aria::writeLE<uint32_t>(p + 42, count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // Slot 0 is taken now, slots 1..n-1 are older and ascending
+        uint32_t age = i == 0 ? 0 : (count - i) * 3600;
+        uint32_t userId = options.users[userDist(rng)];
+        uint32_t fat = userId ? fatDist(rng) : 0;
+        uint8_t *m = p + aria::REQUEST_PREAMBLE_SIZE + i * aria::MEASUREMENT_SIZE;
+        aria::writeLE<uint32_t>(m, scale.nextId++);
+        aria::writeLE<uint32_t>(m + 4, impedanceDist(rng));
+        aria::writeLE<uint32_t>(m + 8, weightDist(rng));
+        aria::writeLE<uint32_t>(m + 12, now - age);
+        aria::writeLE<uint32_t>(m + 16, userId);
+        aria::writeLE<uint32_t>(m + 20, fat);
+        aria::writeLE<uint32_t>(m + 24, userId ? 1000 : 0);
+        aria::writeLE<uint32_t>(m + 28, fat);
+    }
+
+    size_t bodyLength = body.size() - aria::CRC_SIZE;
+    aria::writeLE<uint16_t>(p + bodyLength, Crc16Xmodem::compute(p, bodyLength));
+    return body;
+}
+
+Outcome checkResponse(const uint8_t *data, size_t length)
+{
+    if (length < aria::responseSize(0))
+    {
+        return SHORT_RESPONSE;
+    }
+    uint16_t crc = aria::readLE<uint16_t>(data + length - aria::RESPONSE_FOOTER_SIZE);
+    if (Crc16Xmodem::compute(data, length - aria::RESPONSE_FOOTER_SIZE) != crc)
+    {
+        return BAD_CRC;
+    }
+
+    uint32_t users = aria::readLE<uint32_t>(data + 7);
+    if (users > 8 || length < aria::responseSize(users))
+    {
+        return SHORT_RESPONSE;
+    }
+    size_t updateOffset = aria::RESPONSE_HEADER_SIZE + users * aria::USER_RECORD_SIZE + 4;
+    uint32_t updateAvailable = aria::readLE<uint32_t>(data + updateOffset);
+    // An update message makes the body variable length; only the CRC applies
+    if (updateAvailable == 1)
+    {
+        return OK;
+    }
+    if (length != aria::responseSize(users) ||
+        aria::readLE<uint16_t>(data + length - 2) != aria::responseMessageSize(users))
+    {
+        return BAD_TRAILER;
+    }
+    return OK;
+}
+
+class Connection
+{
+public:
+    ~Connection()
+    {
+        if (mFd >= 0)
+        {
+            close(mFd);
+        }
+    }
+
+    bool open(const addrinfo *address, double timeout)
+    {
+        mFd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (mFd < 0)
+        {
+            return false;
+        }
+        timeval tv;
+        tv.tv_sec = (time_t)timeout;
+        tv.tv_usec = (suseconds_t)((timeout - tv.tv_sec) * 1e6);
+        setsockopt(mFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(mFd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        int one = 1;
+        setsockopt(mFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return connect(mFd, address->ai_addr, address->ai_addrlen) == 0;
+    }
+
+    bool sendAll(const std::string &head, const std::vector<uint8_t> &body)
+    {
+        // One segment for small uploads, like the scale does
+        std::string request = head;
+        request.append((const char *)body.data(), body.size());
+        size_t sent = 0;
+        while (sent < request.size())
+        {
+            ssize_t n = send(mFd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+            {
+                return false;
+            }
+            sent += (size_t)n;
+        }
+        return true;
+    }
+
+    // Reads until the server closes the connection or Content-Length is met
+    Outcome receive(std::string &response, std::string &body)
+    {
+        char buf[4096];
+        size_t headerEnd = std::string::npos;
+        long contentLength = -1;
+        bool chunked = false;
+        for (;;)
+        {
+            if (headerEnd != std::string::npos && contentLength >= 0 &&
+                response.size() >= headerEnd + 4 + (size_t)contentLength)
+            {
+                break;
+            }
+            ssize_t n = recv(mFd, buf, sizeof(buf), 0);
+            if (n < 0)
+            {
+                return RECV_FAILED;
+            }
+            if (n == 0)
+            {
+                break;
+            }
+            response.append(buf, (size_t)n);
+            if (headerEnd == std::string::npos && (headerEnd = response.find("\r\n\r\n")) != std::string::npos)
+            {
+                std::string head = response.substr(0, headerEnd);
+                std::transform(head.begin(), head.end(), head.begin(), ::tolower);
+                size_t pos = head.find("\r\ncontent-length:");
+                if (pos != std::string::npos)
+                {
+                    contentLength = strtol(head.c_str() + pos + 17, nullptr, 10);
+                }
+                chunked = head.find("\r\ntransfer-encoding: chunked") != std::string::npos;
+            }
+        }
+        if (headerEnd == std::string::npos || response.compare(0, 7, "HTTP/1.") != 0)
+        {
+            return BAD_HTTP;
+        }
+
+        body = response.substr(headerEnd + 4);
+        if (chunked)
+        {
+            std::string decoded;
+            size_t pos = 0;
+            for (;;)
+            {
+                size_t lineEnd = body.find("\r\n", pos);
+                if (lineEnd == std::string::npos)
+                {
+                    return BAD_HTTP;
+                }
+                size_t size = strtoul(body.c_str() + pos, nullptr, 16);
+                if (size == 0)
+                {
+                    break;
+                }
+                if (lineEnd + 2 + size > body.size())
+                {
+                    return BAD_HTTP;
+                }
+                decoded.append(body, lineEnd + 2, size);
+                pos = lineEnd + 2 + size + 2;
+            }
+            body.swap(decoded);
+        }
+        else if (contentLength >= 0 && body.size() > (size_t)contentLength)
+        {
+            body.resize((size_t)contentLength);
+        }
+        return atoi(response.c_str() + 9) == 200 ? OK : HTTP_STATUS;
+    }
+
+private:
+    int mFd = -1;
+};
+
+Outcome postUpload(const Options &options, const addrinfo *address, const std::vector<uint8_t> &upload)
+{
+    char head[256];
+    snprintf(head, sizeof(head),
+             "POST %s HTTP/1.1\r\n"
+             "Host: www.fitbit.com\r\n"
+             "Content-Type: application/x-www-form-urlencoded\r\n"
+             "Content-Length: %zu\r\n"
+             "Connection: close\r\n\r\n",
+             options.path.c_str(), upload.size());
+
+    Connection connection;
+    if (!connection.open(address, options.timeout))
+    {
+        return CONNECT_FAILED;
+    }
+    if (!connection.sendAll(head, upload))
+    {
+        return SEND_FAILED;
+    }
+    std::string response, body;
+    Outcome outcome = connection.receive(response, body);
+    if (outcome != OK)
+    {
+        return outcome;
+    }
+    return checkResponse((const uint8_t *)body.data(), body.size());
+}
+
+uint32_t percentile(const std::vector<uint32_t> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void printLatency(const char *label, std::vector<uint32_t> &samples)
+{
+    std::sort(samples.begin(), samples.end());
+    printf("%-9s p50 %8.2f  p90 %8.2f  p99 %8.2f  p99.9 %8.2f  max %8.2f ms\n", label,
+           percentile(samples, 0.50) / 1000.0, percentile(samples, 0.90) / 1000.0,
+           percentile(samples, 0.99) / 1000.0, percentile(samples, 0.999) / 1000.0,
+           samples.empty() ? 0.0 : samples.back() / 1000.0);
+}
+
+bool parseUrl(const std::string &url, Options &options)
+{
+    std::string rest = url;
+    if (rest.compare(0, 7, "http://") == 0)
+    {
+        rest = rest.substr(7);
+    }
+    size_t slash = rest.find('/');
+    if (slash != std::string::npos)
+    {
+        options.path = rest.substr(slash);
+        rest = rest.substr(0, slash);
+    }
+    size_t colon = rest.rfind(':');
+    if (colon != std::string::npos)
+    {
+        options.port = rest.substr(colon + 1);
+        rest = rest.substr(0, colon);
+    }
+    else
+    {
+        options.port = "80";
+    }
+    options.host = rest;
+    return !options.host.empty();
+}
+
+bool loadReplay(const char *path, Options &options)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return false;
+    }
+    options.replay.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [http://host:port/scale/upload]\n"
+            "  -r, --rate N           requests per second, 0 = as fast as possible (default 10)\n"
+            "  -d, --duration S       run time in seconds (default 10)\n"
+            "  -n, --requests N       total requests, overrides --duration\n"
+            "  -b, --burst N          release N requests at once per tick (default 1)\n"
+            "  -c, --concurrency N    connections in flight (default 8)\n"
+            "  -s, --scales N         simulated scales, distinct MAC and auth code (default 16)\n"
+            "  -m, --measurements A-B measurements per upload (default 0-17)\n"
+            "  -u, --users LIST       user ids to attribute measurements to, 0 = guest (default 0)\n"
+            "  -k, --skew S           per-scale clock error up to +/- S seconds (default 0)\n"
+            "  -t, --timeout S        socket timeout (default 5)\n"
+            "  -S, --seed N           random seed (default 1)\n"
+            "  -R, --replay FILE      send captured bodies instead, may be repeated\n"
+            "  -w, --write-body FILE  write one generated body to FILE and exit\n",
+            argv0);
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+    static const option longOptions[] = {
+        {"rate", required_argument, nullptr, 'r'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"requests", required_argument, nullptr, 'n'},
+        {"burst", required_argument, nullptr, 'b'},
+        {"concurrency", required_argument, nullptr, 'c'},
+        {"scales", required_argument, nullptr, 's'},
+        {"measurements", required_argument, nullptr, 'm'},
+        {"users", required_argument, nullptr, 'u'},
+        {"skew", required_argument, nullptr, 'k'},
+        {"timeout", required_argument, nullptr, 't'},
+        {"seed", required_argument, nullptr, 'S'},
+        {"replay", required_argument, nullptr, 'R'},
+        {"write-body", required_argument, nullptr, 'w'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "r:d:n:b:c:s:m:u:k:t:S:R:w:h", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            options.rate = atof(optarg);
+            break;
+        case 'd':
+            options.duration = atof(optarg);
+            break;
+        case 'n':
+            options.requests = strtoull(optarg, nullptr, 10);
+            break;
+        case 'b':
+            options.burst = std::max(1, atoi(optarg));
+            break;
+        case 'c':
+            options.concurrency = std::max(1, atoi(optarg));
+            break;
+        case 's':
+            options.scales = std::max(1, atoi(optarg));
+            break;
+        case 'm':
+        {
+            unsigned lo, hi;
+            int fields = sscanf(optarg, "%u-%u", &lo, &hi);
+            if (fields == 1)
+            {
+                hi = lo;
+            }
+            if (fields < 1 || lo > hi || hi > aria::MAX_MEASUREMENTS)
+            {
+                fprintf(stderr, "--measurements must be within 0-%u\n", (unsigned)aria::MAX_MEASUREMENTS);
+                return false;
+            }
+            options.minMeasurements = lo;
+            options.maxMeasurements = hi;
+            break;
+        }
+        case 'u':
+        {
+            options.users.clear();
+            for (char *token = strtok(optarg, ","); token; token = strtok(nullptr, ","))
+            {
+                options.users.push_back((uint32_t)strtoul(token, nullptr, 0));
+            }
+            if (options.users.empty())
+            {
+                options.users.push_back(0);
+            }
+            break;
+        }
+        case 'k':
+            options.maxSkew = abs(atoi(optarg));
+            break;
+        case 't':
+            options.timeout = atof(optarg);
+            break;
+        case 'S':
+            options.seed = (uint32_t)strtoul(optarg, nullptr, 10);
+            break;
+        case 'R':
+            if (!loadReplay(optarg, options))
+            {
+                return false;
+            }
+            break;
+        case 'w':
+            options.writeBody = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return false;
+        }
+    }
+    if (optind < argc && !parseUrl(argv[optind], options))
+    {
+        fprintf(stderr, "Bad url %s\n", argv[optind]);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 2;
+    }
+
+    std::mt19937 rng(options.seed);
+    std::vector<Scale> scales = makeScales(options, rng);
+
+    if (!options.writeBody.empty())
+    {
+        std::vector<uint8_t> body = buildUpload(options, scales[0], rng);
+        std::ofstream file(options.writeBody, std::ios::binary);
+        file.write((const char *)body.data(), body.size());
+        return file ? 0 : 1;
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *address = nullptr;
+    int error = getaddrinfo(options.host.c_str(), options.port.c_str(), &hints, &address);
+    if (error != 0)
+    {
+        fprintf(stderr, "%s:%s: %s\n", options.host.c_str(), options.port.c_str(), gai_strerror(error));
+        return 2;
+    }
+
+    uint64_t total = options.requests;
+    if (total == 0)
+    {
+        total = options.rate > 0 ? (uint64_t)(options.rate * options.duration) : UINT64_MAX;
+    }
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::duration_cast<Clock::duration>(
+                                             std::chrono::duration<double>(options.duration));
+    bool untilDeadline = options.requests == 0 && options.rate <= 0;
+
+    // Bodies are generated before the run so the generator is not measured
+    std::vector<std::vector<uint8_t>> bodies;
+    if (!options.replay.empty())
+    {
+        bodies = options.replay;
+    }
+    else
+    {
+        size_t pool = std::max<size_t>(scales.size() * 4, 256);
+        for (size_t i = 0; i < pool; i++)
+        {
+            bodies.push_back(buildUpload(options, scales[i % scales.size()], rng));
+        }
+    }
+
+    std::atomic<uint64_t> next{0};
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<bool> running{true};
+    std::vector<WorkerStats> stats(options.concurrency);
+    std::vector<std::thread> workers;
+
+    for (unsigned w = 0; w < options.concurrency; w++)
+    {
+        workers.emplace_back([&, w]() {
+            WorkerStats &mine = stats[w];
+            for (;;)
+            {
+                uint64_t k = next.fetch_add(1);
+                if (k >= total || !running)
+                {
+                    break;
+                }
+                Clock::time_point scheduled = Clock::now();
+                if (options.rate > 0)
+                {
+                    // Ticks of `burst` requests, evenly spaced at the target rate
+                    double at = (double)(k / options.burst) * options.burst / options.rate;
+                    scheduled = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(at));
+                    std::this_thread::sleep_until(scheduled);
+                }
+                if (untilDeadline && Clock::now() >= deadline)
+                {
+                    break;
+                }
+
+                const std::vector<uint8_t> &body = bodies[k % bodies.size()];
+                Clock::time_point sent = Clock::now();
+                Outcome outcome = postUpload(options, address, body);
+                Clock::time_point done = Clock::now();
+
+                mine.outcomes[outcome]++;
+                if (outcome != CONNECT_FAILED && outcome != SEND_FAILED)
+                {
+                    mine.bytesSent += body.size();
+                }
+                if (outcome == OK)
+                {
+                    mine.latencyUs.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(done - scheduled).count());
+                    mine.serviceUs.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(done - sent).count());
+                }
+                else
+                {
+                    failed++;
+                }
+                completed++;
+            }
+        });
+    }
+
+    // Progress once a second while the workers run
+    uint64_t lastCompleted = 0;
+    while (completed < total)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        uint64_t now = completed;
+        fprintf(stderr, "%8llu done  %6llu/s  %llu errors\n", (unsigned long long)now,
+                (unsigned long long)(now - lastCompleted), (unsigned long long)failed.load());
+        lastCompleted = now;
+        if (untilDeadline && Clock::now() >= deadline)
+        {
+            running = false;
+            break;
+        }
+        if (next >= total && completed + options.concurrency >= total)
+        {
+            // Only in-flight requests left; join below
+            break;
+        }
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    freeaddrinfo(address);
+
+    WorkerStats all;
+    for (WorkerStats &s : stats)
+    {
+        all.latencyUs.insert(all.latencyUs.end(), s.latencyUs.begin(), s.latencyUs.end());
+        all.serviceUs.insert(all.serviceUs.end(), s.serviceUs.begin(), s.serviceUs.end());
+        for (int i = 0; i < OUTCOME_COUNT; i++)
+        {
+            all.outcomes[i] += s.outcomes[i];
+        }
+        all.bytesSent += s.bytesSent;
+    }
+    uint64_t requests = 0;
+    for (uint64_t n : all.outcomes)
+    {
+        requests += n;
+    }
+
+    printf("target    %s:%s%s, %u scales, %s bodies\n", options.host.c_str(), options.port.c_str(),
+           options.path.c_str(), options.scales, options.replay.empty() ? "generated" : "replayed");
+    printf("requests  %llu in %.2f s, %.1f req/s sent, %.1f req/s ok, %.1f KiB/s sent\n",
+           (unsigned long long)requests, elapsed, requests / elapsed, all.outcomes[OK] / elapsed,
+           all.bytesSent / elapsed / 1024);
+    for (int i = 1; i < OUTCOME_COUNT; i++)
+    {
+        if (all.outcomes[i])
+        {
+            printf("error     %-20s %8llu  %6.2f%%\n", OUTCOME_NAMES[i], (unsigned long long)all.outcomes[i],
+                   100.0 * all.outcomes[i] / requests);
+        }
+    }
+    printLatency("latency", all.latencyUs);
+    printLatency("service", all.serviceUs);
+    return all.outcomes[OK] == requests ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+// Microbenchmark for parsing /scale/upload bodies (aria_protocol.h).
+//
+// Times UploadRequest::parse plus decoding every measurement, and the
+// stream parser fed in TCP-segment sized and in small chunks, for each
+// measurement count the scale can send. The CRC check dominates, so the
+// rate is also given in MB/s of envelope.
+
+#include <aria_protocol.h>
+
+#include <chrono>
+#include <initializer_list>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr int ITERATIONS = 1000000;
+
+std::vector<uint8_t> buildUpload(uint32_t count)
+{
+    std::vector<uint8_t> body(aria::REQUEST_PREAMBLE_SIZE + count * aria::MEASUREMENT_SIZE + aria::CRC_SIZE);
+    uint8_t *p = body.data();
+    aria::writeLE<uint32_t>(p, aria::PROTOCOL_VERSION);
+    aria::writeLE<uint32_t>(p + 42, count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t *m = p + aria::REQUEST_PREAMBLE_SIZE + i * aria::MEASUREMENT_SIZE;
+        aria::writeLE<uint32_t>(m + 8, 70000 + i);
+        aria::writeLE<uint32_t>(m + 12, 1790000000 - i * 3600);
+    }
+    size_t bodyLength = body.size() - aria::CRC_SIZE;
+    aria::writeLE<uint16_t>(p + bodyLength, Crc16Xmodem::compute(p, bodyLength));
+    return body;
+}
+
+template <typename F>
+double nsPerCall(F &&parse)
+{
+    volatile uint32_t sink = 0;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        sink = sink + parse();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ITERATIONS;
+}
+
+// Sum of the weights, so the decode cannot be optimised away
+uint32_t weights(const aria::UploadRequest &request)
+{
+    uint32_t sum = 0;
+    for (const aria::Measurement &m : request.measurements())
+    {
+        sum += m.weight_g;
+    }
+    return sum;
+}
+
+} // namespace
+
+int main()
+{
+    uint8_t buffer[aria::MAX_REQUEST_SIZE];
+    aria::UploadStreamParser parser(buffer, sizeof(buffer));
+    bool ok = true;
+
+    printf("%-6s %6s %12s %10s %14s %14s\n", "count", "bytes", "parse ns", "MB/s", "stream 1460 ns", "stream 64 ns");
+    for (uint32_t count : {0u, 1u, 4u, 8u, aria::MAX_MEASUREMENTS})
+    {
+        std::vector<uint8_t> body = buildUpload(count);
+        aria::UploadRequest request;
+        if (request.parse(body.data(), body.size()) != aria::ParseStatus::Ok || request.measurements().size() != count)
+        {
+            fprintf(stderr, "%u measurements: envelope does not parse\n", (unsigned)count);
+            ok = false;
+            continue;
+        }
+
+        double parse = nsPerCall([&]()
+                                 {
+                                     aria::UploadRequest r;
+                                     r.parse(body.data(), body.size());
+                                     return weights(r); });
+        auto streamed = [&](size_t chunk)
+        {
+            return nsPerCall([&]()
+                             {
+                                 parser.reset();
+                                 for (size_t offset = 0; offset < body.size(); offset += chunk)
+                                 {
+                                     parser.feed(body.data() + offset, body.size() - offset < chunk ? body.size() - offset : chunk);
+                                 }
+                                 aria::UploadRequest r;
+                                 parser.finish(r);
+                                 return weights(r); });
+        };
+        double segment = streamed(1460);
+        double small = streamed(64);
+        printf("%-6u %6u %12.1f %10.1f %14.1f %14.1f\n", (unsigned)count, (unsigned)body.size(), parse,
+               body.size() / parse * 1e3, segment, small);
+    }
+    return ok ? 0 : 1;
+}
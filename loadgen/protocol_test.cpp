@@ -0,0 +1,219 @@
+// Host tests for the Aria upload codec (aria_protocol.h).
+//
+// Valid envelopes, every truncation of one, measurement counts that do not
+// match the body, bad protocol versions and bad CRCs, and the stream parser
+// fed in chunks of every size. Exits non-zero on the first failure.
+
+#include <aria_protocol.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+
+int failures = 0;
+
+#define CHECK(condition)                                                  \
+    do                                                                    \
+    {                                                                     \
+        if (!(condition))                                                 \
+        {                                                                 \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                   \
+        }                                                                 \
+    } while (0)
+
+const uint8_t MAC[aria::MAC_SIZE] = {0x02, 0x48, 0x45, 0x00, 0x00, 0x01};
+
+std::vector<uint8_t> buildUpload(uint32_t count, uint32_t declared)
+{
+    std::vector<uint8_t> body(aria::REQUEST_PREAMBLE_SIZE + count * aria::MEASUREMENT_SIZE + aria::CRC_SIZE);
+    uint8_t *p = body.data();
+    aria::writeLE<uint32_t>(p, aria::PROTOCOL_VERSION);
+    aria::writeLE<uint32_t>(p + 4, 87);
+    memcpy(p + 8, MAC, aria::MAC_SIZE);
+    memset(p + 14, 0xA5, aria::AUTH_CODE_SIZE);
+    aria::writeLE<uint32_t>(p + 30, 39);
+    aria::writeLE<uint32_t>(p + 34, 50);
+    aria::writeLE<uint32_t>(p + 38, 1790000000);
+    aria::writeLE<uint32_t>(p + 42, declared);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t *m = p + aria::REQUEST_PREAMBLE_SIZE + i * aria::MEASUREMENT_SIZE;
+        aria::writeLE<uint32_t>(m, i + 1);
+        aria::writeLE<uint32_t>(m + 4, 500 + i);
+        aria::writeLE<uint32_t>(m + 8, 70000 + i);
+        aria::writeLE<uint32_t>(m + 12, 1790000000 - i * 3600);
+        aria::writeLE<uint32_t>(m + 16, i % 2 ? 0x1234 : 0);
+        aria::writeLE<uint32_t>(m + 20, 20000 + i);
+        aria::writeLE<uint32_t>(m + 24, 1000);
+        aria::writeLE<uint32_t>(m + 28, 20000 + i);
+    }
+    size_t bodyLength = body.size() - aria::CRC_SIZE;
+    aria::writeLE<uint16_t>(p + bodyLength, Crc16Xmodem::compute(p, bodyLength));
+    return body;
+}
+
+void testValid()
+{
+    for (uint32_t count = 0; count <= aria::MAX_MEASUREMENTS; count++)
+    {
+        std::vector<uint8_t> body = buildUpload(count, count);
+        aria::UploadRequest request;
+        CHECK(request.parse(body.data(), body.size()) == aria::ParseStatus::Ok);
+        const aria::UploadHeader &header = request.header();
+        CHECK(header.protocolVersion == aria::PROTOCOL_VERSION);
+        CHECK(header.batteryPercent == 87);
+        CHECK(memcmp(header.mac, MAC, aria::MAC_SIZE) == 0);
+        CHECK(header.firmwareVersion == 39);
+        CHECK(header.timestamp == 1790000000);
+        CHECK(request.measurements().size() == count);
+        CHECK(request.bodyLength() == body.size() - aria::CRC_SIZE);
+        uint32_t i = 0;
+        for (const aria::Measurement &m : request.measurements())
+        {
+            CHECK(m.id2 == i + 1);
+            CHECK(m.weight_g == 70000 + i);
+            CHECK(m.timestamp == 1790000000 - i * 3600);
+            CHECK(m.user_id == (i % 2 ? 0x1234u : 0u));
+            i++;
+        }
+        CHECK(i == count);
+    }
+
+    // Bytes after the CRC are ignored
+    std::vector<uint8_t> body = buildUpload(3, 3);
+    body.push_back(0xEE);
+    aria::UploadRequest request;
+    CHECK(request.parse(body.data(), body.size()) == aria::ParseStatus::Ok);
+    CHECK(request.measurements().size() == 3);
+}
+
+void testTruncated()
+{
+    std::vector<uint8_t> body = buildUpload(5, 5);
+    for (size_t length = 0; length < body.size(); length++)
+    {
+        aria::UploadRequest request;
+        CHECK(request.parse(body.data(), length) == aria::ParseStatus::Truncated);
+        // A failed parse exposes no measurements
+        CHECK(request.measurements().empty());
+    }
+}
+
+void testCountMismatch()
+{
+    // More measurements declared than the body holds
+    for (uint32_t declared = 3; declared <= aria::MAX_MEASUREMENTS; declared++)
+    {
+        std::vector<uint8_t> body = buildUpload(2, declared);
+        aria::UploadRequest request;
+        CHECK(request.parse(body.data(), body.size()) == aria::ParseStatus::Truncated);
+        CHECK(request.measurements().empty());
+    }
+
+    // More than the protocol allows, including counts that would wrap the size
+    for (uint32_t declared : {aria::MAX_MEASUREMENTS + 1, 1000u, 0x08000000u, 0xFFFFFFFFu})
+    {
+        std::vector<uint8_t> body = buildUpload(2, declared);
+        aria::UploadRequest request;
+        CHECK(request.parse(body.data(), body.size()) == aria::ParseStatus::TooManyMeasurements);
+        CHECK(request.measurements().empty());
+    }
+
+    // Fewer declared than sent: the extra records are not part of the envelope,
+    // so the CRC taken over all of them does not match
+    std::vector<uint8_t> body = buildUpload(4, 2);
+    aria::UploadRequest request;
+    CHECK(request.parse(body.data(), body.size()) == aria::ParseStatus::BadCrc);
+}
+
+void testBadProtocol()
+{
+    std::vector<uint8_t> body = buildUpload(1, 1);
+    aria::writeLE<uint32_t>(body.data(), 2);
+    aria::UploadRequest request;
+    CHECK(request.parse(body.data(), body.size()) == aria::ParseStatus::BadProtocol);
+}
+
+void testBadCrc()
+{
+    std::vector<uint8_t> body = buildUpload(3, 3);
+    // Any single flipped bit, in the body or in the CRC itself, is caught
+    for (size_t i = 0; i < body.size(); i++)
+    {
+        if (i < 4 || (i >= 42 && i < 46))
+        {
+            continue; // protocol and count fail their own checks first
+        }
+        for (int bit = 0; bit < 8; bit++)
+        {
+            body[i] ^= 1 << bit;
+            aria::UploadRequest request;
+            CHECK(request.parse(body.data(), body.size()) == aria::ParseStatus::BadCrc);
+            CHECK(request.measurements().empty());
+            body[i] ^= 1 << bit;
+        }
+    }
+}
+
+void testStreamParser()
+{
+    std::vector<uint8_t> body = buildUpload(aria::MAX_MEASUREMENTS, aria::MAX_MEASUREMENTS);
+    uint8_t buffer[aria::MAX_REQUEST_SIZE];
+    aria::UploadStreamParser parser(buffer, sizeof(buffer));
+    for (size_t chunk = 1; chunk <= body.size(); chunk++)
+    {
+        parser.reset();
+        size_t seen = 0;
+        for (size_t offset = 0; offset < body.size(); offset += chunk)
+        {
+            size_t length = body.size() - offset < chunk ? body.size() - offset : chunk;
+            parser.feed(body.data() + offset, length);
+            size_t complete = parser.completeMeasurements();
+            CHECK(complete >= seen);
+            CHECK(complete == (parser.size() < aria::REQUEST_PREAMBLE_SIZE
+                                   ? 0
+                                   : (parser.size() - aria::REQUEST_PREAMBLE_SIZE) / aria::MEASUREMENT_SIZE > aria::MAX_MEASUREMENTS
+                                         ? aria::MAX_MEASUREMENTS
+                                         : (parser.size() - aria::REQUEST_PREAMBLE_SIZE) / aria::MEASUREMENT_SIZE));
+            seen = complete;
+        }
+        aria::UploadRequest request;
+        CHECK(parser.finish(request) == aria::ParseStatus::Ok);
+        CHECK(!parser.overflowed());
+        CHECK(request.measurements().size() == aria::MAX_MEASUREMENTS);
+    }
+
+    // Bytes past the largest envelope are dropped, the envelope still parses
+    parser.reset();
+    parser.feed(body.data(), body.size());
+    uint8_t junk[16] = {};
+    parser.feed(junk, sizeof(junk));
+    aria::UploadRequest request;
+    CHECK(parser.overflowed());
+    CHECK(parser.size() == sizeof(buffer));
+    CHECK(parser.finish(request) == aria::ParseStatus::Ok);
+}
+
+} // namespace
+
+int main()
+{
+    testValid();
+    testTruncated();
+    testCountMismatch();
+    testBadProtocol();
+    testBadCrc();
+    testStreamParser();
+    if (failures)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("protocol_test: all checks passed\n");
+    return 0;
+}
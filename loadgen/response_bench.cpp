@@ -0,0 +1,137 @@
+// Microbenchmark for building the /scale/upload response envelope.
+//
+// Compares the single-user packing the firmware used to do on every upload,
+// a full build from the compiled user table, and a ResponseCache hit that
+// only patches the clock and user timestamps. Every patched response is
+// also checked against a full build of the same inputs.
+
+#include <aria_response.h>
+
+#include <chrono>
+#include <initializer_list>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+constexpr uint32_t BASE_TIME = 1790000000;
+constexpr int ITERATIONS = 1000000;
+
+template <typename T>
+void packLE(uint8_t *dest, T value)
+{
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+        dest[i] = (value >> (i * 8)) & 0xFF;
+    }
+}
+
+// handleScaleUpload before the user table: memset, repack, full CRC
+size_t legacyBuild(uint8_t *response, uint32_t now, uint32_t scaleTime, uint32_t weight)
+{
+    memset(response, 0, 104);
+    packLE(response, now);
+    response[5] = 0x32;
+    response[6] = 0x01;
+    packLE(response + 7, (uint32_t)1);
+    packLE(response + 11, (uint32_t)0x1234);
+    memcpy(response + 31, "You", 4);
+    packLE(response + 51, weight - 4000);
+    packLE(response + 55, weight + 4000);
+    packLE(response + 59, (uint32_t)18);
+    response[63] = 2;
+    packLE(response + 64, (uint32_t)1800);
+    packLE(response + 84, scaleTime - 1000);
+    packLE(response + 92, (uint32_t)3);
+    packLE(response + 100, Crc16Xmodem::compute(response, 100));
+    packLE(response + 102, (uint16_t)(0x19 + 0x4d));
+    return 104;
+}
+
+void fillTable(aria::UserTable &users, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        aria::UserProfile profile;
+        char text[64];
+        snprintf(text, sizeof(text), "%u,USER%u,1985-06-%02u,1750,%c", (unsigned)(0x1234 + i), (unsigned)i,
+                 (unsigned)(i + 1), i % 2 ? 'f' : 'm');
+        aria::parseUserProfile(text, profile);
+        users.add(profile);
+        users.setLastWeight(i, 60000 + i * 5000);
+    }
+    users.compile();
+}
+
+template <typename F>
+double nsPerCall(F &&build)
+{
+    volatile uint32_t sink = 0;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        // New clock values every time, as for real uploads
+        sink = sink + build(BASE_TIME + i, BASE_TIME - 7 + i);
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ITERATIONS;
+}
+
+} // namespace
+
+int main()
+{
+    static const uint8_t mac[aria::MAC_SIZE] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+    uint8_t buffer[aria::MAX_RESPONSE_SIZE];
+    uint8_t check[aria::MAX_RESPONSE_SIZE];
+    bool ok = true;
+
+    printf("%-6s %12s %12s %12s\n", "users", "legacy ns", "build ns", "cached ns");
+    for (size_t count : {(size_t)1, (size_t)2, (size_t)4, aria::MAX_USERS})
+    {
+        aria::UserTable users;
+        fillTable(users, count);
+        aria::ResponseCache cache(users);
+
+        double legacy = count == 1 ? nsPerCall([&](uint32_t now, uint32_t scaleTime)
+                                               { return legacyBuild(buffer, now, scaleTime, 60000); })
+                                   : 0;
+        double build = nsPerCall([&](uint32_t now, uint32_t scaleTime)
+                                 { return users.build(buffer, now, scaleTime); });
+        double cached = nsPerCall([&](uint32_t now, uint32_t scaleTime)
+                                  {
+                                      size_t length;
+                                      bool hit;
+                                      return cache.get(mac, now, scaleTime, length, hit)[length - 3]; });
+
+        // Spot check patched responses against full builds across a day change
+        for (uint32_t step = 0; step < 1000; step++)
+        {
+            uint32_t now = BASE_TIME + step * 97;
+            size_t length;
+            bool hit;
+            const uint8_t *patched = cache.get(mac, now, now - 12345, length, hit);
+            size_t expected = users.build(check, now, now - 12345);
+            if (length != expected || memcmp(patched, check, length) != 0)
+            {
+                fprintf(stderr, "%u users: patched response differs at step %u\n", (unsigned)count, (unsigned)step);
+                ok = false;
+                break;
+            }
+        }
+
+        if (count == 1)
+        {
+            printf("%-6u %12.1f %12.1f %12.1f\n", (unsigned)count, legacy, build, cached);
+        }
+        else
+        {
+            printf("%-6u %12s %12.1f %12.1f\n", (unsigned)count, "-", build, cached);
+        }
+    }
+    return ok ? 0 : 1;
+}